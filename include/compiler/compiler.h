@@ -14,9 +14,11 @@ typedef struct _symbol_
     int local;
     int depth;
     char *identifier;
+    int atom;
     int is_entity;   // a function or a class
     int class_bound; // declared as member (function or attribute) of a class
-    struct _symbol_ *next;
+    struct _symbol_ *next;    // symbol of the same atom in an outer scope, the one this shadows
+    struct _symbol_ *sibling; // symbol declared before this in the same scope
 } Symbol;
 
 typedef enum _scope_type_
@@ -36,7 +38,7 @@ typedef struct _symbol_stack_
 {
     int local;
     enum _scope_type_ type;
-    LZHTable *symbols;
+    struct _symbol_ *symbols; // last symbol declared in the scope
 } SymbolStack;
 
 typedef struct _compiler_
@@ -48,14 +50,23 @@ typedef struct _compiler_
 
     VM *vm;
 
-    DynArrPtr *stmts;
-
     DynArr *continues;
     DynArr *breaks;
 
+    // every identifier is interned once to an atom, natives being the
+    // first ones: the atom of a native is its index
+    LZHTable *atoms;     // identifier bytes to atom + 1
+    DynArrPtr *bindings; // innermost visible symbol of every atom, by atom
     DynArrPtr *natives;
 } Compiler;
 
+// Statements can be compiled one at a time between compiler_begin and
+// compiler_end. A statement only refers to names declared before it, so
+// each one can be released as soon as it is compiled
+void compiler_begin(VM *vm);
+void compiler_compile_stmt(Stmt *stmt);
+void compiler_end();
+
 void compiler_compile(VM *vm, DynArrPtr *stmts);
 
 #endif
\ No newline at end of file
@@ -24,9 +24,16 @@ void *memory_alloc(size_t bytes);
 void *memory_realloc(void *ptr, size_t bytes);
 void memory_dealloc(void *ptr);
 
+// while streaming, allocations between memory_ast_begin and memory_ast_end
+// belong to the current statement and are freed by memory_ast_release
+void memory_ast_begin();
+void memory_ast_end();
+void memory_ast_release();
+
 void memory_report();
 
 char *memory_clone_raw_str(char *str);
+char *memory_clone_raw_str_range(char *str, size_t length);
 void memory_destroy_raw_str(char *str);
 
 StaticStr *memory_create_static_str(char *str, size_t len);
@@ -46,10 +53,11 @@ void memory_destroy_lzstack(LZStack *stack);
 LZHTable *memory_create_lzhtable(size_t size);
 void memory_destroy_lzhtable(LZHTable *table);
 
-Token *memory_create_token(int line, char *lexeme, void *literal, size_t literal_size, TokenType type);
+Token *memory_create_token(int line, char *start, size_t length, TokenType type);
 void memory_destroy_token(Token *token);
 
-Token *memory_clone_token(Token *token);
+// NUL terminated lexeme of 'token', copied out of the source on first use
+char *memory_token_lexeme(Token *token);
 
 // ---> expressions
 AssignExpr *memory_create_assign_expr(Expr *left, Token *equals_token, Expr *right);
@@ -145,13 +153,13 @@ ExprStmt *memory_create_expr_stmt(Expr *expr);
 void memory_destroy_expr_stmt(ExprStmt *stmt);
 // <--- statements
 
-Scanner *memory_create_scanner(DynArr *tokens, StaticStr *source, LZHTable *keywords);
+Scanner *memory_create_scanner(DynArr *tokens, StaticStr *source);
 void memory_destroy_scanner(Scanner *scanner);
 
-Parser *memory_create_parser(DynArr *tokens, DynArrPtr *stmts);
+Parser *memory_create_parser(DynArr *tokens, Scanner *scanner, DynArrPtr *stmts);
 void memory_destroy_parser(Parser *parser);
 
-Symbol *memory_create_symbol(int global, int local, int depth, char *identifier, int is_entity, int class_bound);
+Symbol *memory_create_symbol(int global, int local, int depth, char *identifier, int atom, int is_entity, int class_bound);
 void memory_destroy_symbol(Symbol *symbol);
 
 Compiler *memory_create_compiler();
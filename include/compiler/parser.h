@@ -1,15 +1,28 @@
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
+#include "scanner.h"
+#include "stmt.h"
+
 #include <essentials/dynarr.h>
 
+// tokens kept while streaming: the previous, current and next one
+#define PARSER_WINDOW 4
+
 typedef struct _parser_
 {
     int current;
-    DynArr *tokens;
+    DynArr *tokens;                // every token of the source, NULL while streaming
+    Scanner *scanner;              // streaming mode: where tokens are pulled from
+    Token *window[PARSER_WINDOW];  // streaming mode: last tokens pulled, by index
+    int scanned;                   // streaming mode: tokens pulled so far
     DynArrPtr *stmts;
 } Parser;
 
 void parser_parse(Parser *parser);
+// streaming mode: parses the next top-level statement, NULL at end of source
+Stmt *parser_parse_stmt(Parser *parser);
+// streaming mode: frees the statement ast, keeping the tokens still ahead
+void parser_release_stmt(Parser *parser);
 
 #endif
\ No newline at end of file
@@ -2,21 +2,33 @@
 #define _SCANNER_H_
 
 #include "static_str.h"
+#include "token.h"
 
 #include <essentials/dynarr.h>
-#include <essentials/lzhtable.h>
 
 typedef struct _scanner_
 {
     int line;
     int start;
     int current;
-    DynArr *tokens;
+    DynArr *tokens; // NULL when tokens are pulled with scanner_next_token
     StaticStr *source;
-    LZHTable *keywords;
+    int pending;    // streaming mode: 'token' holds a token not yet pulled
+    Token token;
+    int chunked;     // parallel mode: the source is cut at a chunk end, so strings may stay open
+    int speculative; // parallel mode: the chunk start state is a guess, errors are only flagged
+    int failed;
+    int open_string; // start of a string left open at the chunk end, -1 if none
+    int open_line;
 } Scanner;
 
 void scanner_print_tokens(DynArr *tokens);
 int scanner_scan_tokens(Scanner *scanner);
+// same tokens as scanner_scan_tokens, but large sources are split at
+// newlines and the pieces are lexed by up to 'workers' threads
+int scanner_scan_tokens_parallel(Scanner *scanner, int workers);
+// scans just enough of the source to produce its next token,
+// an EOF token is returned for every call past the end
+Token scanner_next_token(Scanner *scanner);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@ typedef struct _static_str_
 {
     char *raw;
     size_t len;
+    char mapped; // raw is a read-only file mapping instead of an allocation
 } StaticStr;
 
 #endif
\ No newline at end of file
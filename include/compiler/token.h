@@ -87,9 +87,10 @@ typedef enum _token_type_
 typedef struct _token_
 {
     int line;
-    char *lexeme;
-    void *literal;
-    size_t literal_size;
+    char *start;   // lexeme slice into the source, not NUL terminated
+    size_t length; // bytes of the slice
+    char *lexeme;  // NUL terminated copy of the slice, see memory_token_lexeme
+    int atom;      // identifier interned by the compiler, -1 until then
     enum _token_type_ type;
 } Token;
 
@@ -10,21 +10,32 @@
 typedef struct _lzallocator_header_
 {
     char free;
-    size_t size;
+    char tag; // left to the user of an allocated block, 0 when handed out
+    size_t size; // bytes of the whole block, header included. Always a power of two
+    // free blocks only: neighbours in the free list of the block order
     struct _lzallocator_header_ *prev;
     struct _lzallocator_header_ *next;
 } LZAllocatorHeader;
 
+// an order is the log2 of a block size, blocks can't be smaller than the minimum order
+#define LZALLOCATOR_MIN_ORDER 6
+#define LZALLOCATOR_ORDERS 64
+
 typedef struct _lzallocator_
 {
     size_t bytes;
-    struct _lzallocator_header_ *blocks;
+    size_t free_bytes;
+    struct _lzallocator_header_ *blocks; // start of the area, its first block
+    size_t orders;                       // bit n set when free_lists[n] isn't empty
+    struct _lzallocator_header_ *free_lists[LZALLOCATOR_ORDERS];
 } LZAllocator;
 
 #define LZALLOCATOR_HEADER_SIZE (sizeof(struct _lzallocator_header_))
 #define LZALLOCATOR_CALC_BLOCK_SIZE(size) (size - LZALLOCATOR_HEADER_SIZE)
 
 // interface
+// manages 'area', owned by the caller, as one free block
+void lzallocator_init(void *area, size_t bytes, struct _lzallocator_ *allocator);
 struct _lzallocator_ *lzallocator_create(size_t bytes);
 void lzallocator_destroy(struct _lzallocator_ *allocator);
 
@@ -37,15 +48,22 @@ int lzallocator_validate_ptr(void *ptr, struct _lzallocator_ *allocator);
 struct _lzallocator_header_ *lzallocator_get_header(void *ptr);
 void *lzallocator_alloc_from_header(struct _lzallocator_header_ *header);
 
-void lzallocator_join_blocks(struct _lzallocator_ *allocator);
-struct _lzallocator_header_ *lzallocator_split_block(struct _lzallocator_header_ *header);
+// smallest order whose blocks hold 'bytes' of payload
+size_t lzallocator_order(size_t bytes);
+struct _lzallocator_header_ *lzallocator_buddy(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator);
 
-struct _lzallocator_header_ *lzallocator_best_fit(size_t bytes, struct _lzallocator_ *allocator);
-struct _lzallocator_header_ *lzallocator_find_by_split(size_t bytes, struct _lzallocator_header_ *header);
+void lzallocator_push_block(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator);
+void lzallocator_remove_block(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator);
+// halves a free block taken out of its list, the upper buddy goes to its free list
+struct _lzallocator_header_ *lzallocator_split_block(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator);
+// merges a block with its free buddies for as long as possible, returns the resulting block
+struct _lzallocator_header_ *lzallocator_join_blocks(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator);
+// grows an allocated block to 'order' in place, 0 when the buddies above it aren't free
+int lzallocator_grow_block(struct _lzallocator_header_ *header, size_t order, struct _lzallocator_ *allocator);
 
 void *lzallocator_alloc(size_t bytes, struct _lzallocator_ *allocator, struct _lzallocator_header_ **header_out);
 void *lzallocator_calloc(size_t bytes, struct _lzallocator_ *allocator, struct _lzallocator_header_ **header_out);
 void lzallocator_dealloc(void *ptr, struct _lzallocator_ *allocator);
 void *lzallocator_realloc(size_t bytes, void *ptr, struct _lzallocator_ *allocator, struct _lzallocator_header_ **header_out);
 
-#endif
\ No newline at end of file
+#endif
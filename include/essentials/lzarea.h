@@ -1,6 +1,7 @@
 #ifndef _LZPOOL_H_
 #define _LZPOOL_H_
 
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef struct _lzarea_allocator_
@@ -10,15 +11,26 @@ typedef struct _lzarea_allocator_
     void (*dealloc)(void *ptr);
 } LZAreaAllocator;
 
+// free slots are bits, found with two count trailing zeros:
+// one in the summary for the word, one in the word for the slot
+#define LZLINEAR_MAX_SLOTS 4096
+#define LZLINEAR_WORDS (LZLINEAR_MAX_SLOTS / 64)
+
 typedef struct _lzlinear_
 {
     size_t slot_size;
     size_t slot_count;
     size_t used_bytes;
+    uint64_t summary;                    // bit n set when free_slots[n] has a free slot
+    uint64_t free_slots[LZLINEAR_WORDS]; // bit set when its slot is free
     void *slots;
     struct _lzlinear_ *next;
+    struct _lzlinear_ *next_available;
 } LZLinear;
 
+// linears are found from a pointer by the pages of this size they span
+#define LZAREA_PAGE_SHIFT 16
+
 typedef struct _lzlinear_container_
 {
     size_t size;
@@ -30,6 +42,13 @@ typedef struct _lzlinear_container_
 
     struct _lzlinear_ *head;
     struct _lzlinear_ *tail;
+    struct _lzlinear_ *available; // linears with free slots
+
+    // open addressing table from page to linear, a page can be shared by two linears
+    size_t map_m;
+    size_t map_n;
+    uintptr_t *map_pages;
+    struct _lzlinear_ **map_linears;
 
     struct _lzlinear_container_ *next;
 
@@ -46,6 +65,14 @@ typedef struct _lzarea_
     struct _lzarea_allocator_ *allocator;
 } LZArea;
 
+typedef struct _lzarea_stats_
+{
+    size_t containers;
+    size_t linears;
+    size_t bytes;      // bytes of every slot
+    size_t used_bytes; // bytes of the slots in use
+} LZAreaStats;
+
 struct _lzlinear_container_ *lzlinear_container_create(size_t slot_size, struct _lzarea_allocator_ *allocator);
 void lzlinear_container_destroy(struct _lzlinear_container_ *linear);
 
@@ -64,5 +91,6 @@ int lzarea_add_container(size_t slot_size, struct _lzarea_ *area, struct _lzline
 
 void *lzarea_alloc(size_t bytes, size_t slot_count, struct _lzarea_ * area);
 void lzarea_dealloc(void *ptr, struct _lzarea_ * area);
+void lzarea_stats(struct _lzarea_ *area, struct _lzarea_stats_ *stats);
 
-#endif
\ No newline at end of file
+#endif
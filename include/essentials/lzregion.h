@@ -0,0 +1,47 @@
+// Bump pointer region allocator. Memory is handed out from chained chunks
+// and given back all at once when the region is destroyed
+
+#ifndef _LZREGION_H_
+#define _LZREGION_H_
+
+#include <stddef.h>
+
+typedef struct _lzregion_allocator_
+{
+    void *(*alloc)(size_t size);
+    void (*dealloc)(void *ptr);
+} LZRegionAllocator;
+
+typedef struct _lzregion_chunk_
+{
+    size_t size; // bytes available for allocations
+    size_t used; // bytes already bumped
+    struct _lzregion_chunk_ *prev;
+} LZRegionChunk;
+
+typedef struct _lzregion_
+{
+    size_t chunk_size;
+    size_t bytes;      // bytes of every chunk
+    size_t used_bytes; // bytes handed out, headers included
+
+    void *last; // newest allocation, the only one that can grow in place
+    struct _lzregion_chunk_ *chunks;
+
+    struct _lzregion_allocator_ *allocator;
+} LZRegion;
+
+#define LZREGION_ALIGNMENT (sizeof(size_t))
+
+struct _lzregion_ *lzregion_create(size_t chunk_size, struct _lzregion_allocator_ *allocator);
+void lzregion_destroy(struct _lzregion_ *region);
+// forgets every allocation, keeping only the first chunk for reuse
+void lzregion_reset(struct _lzregion_ *region);
+
+void *lzregion_alloc(size_t bytes, struct _lzregion_ *region);
+void *lzregion_calloc(size_t bytes, struct _lzregion_ *region);
+void *lzregion_realloc(size_t bytes, void *ptr, struct _lzregion_ *region);
+// only the newest allocation gives its bytes back, the rest wait for lzregion_destroy
+void lzregion_dealloc(void *ptr, struct _lzregion_ *region);
+
+#endif
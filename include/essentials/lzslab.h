@@ -0,0 +1,50 @@
+// Slab allocator. Slots of a single size are carved from pages and threaded
+// through an intrusive free list, so they carry no header of their own
+
+#ifndef _LZSLAB_H_
+#define _LZSLAB_H_
+
+#include <stddef.h>
+
+typedef struct _lzslab_allocator_
+{
+    void *(*alloc)(size_t size);
+    void (*dealloc)(void *ptr);
+} LZSlabAllocator;
+
+// lives at the start of every page, followed by its slots
+typedef struct _lzslab_page_
+{
+    size_t used;         // slots handed out
+    void *free;          // slots given back, each one holds the next
+    unsigned char *bump; // slots never handed out start here
+    unsigned char *end;
+    struct _lzslab_ *slab;
+    struct _lzslab_page_ *prev;
+    struct _lzslab_page_ *next;
+} LZSlabPage;
+
+typedef struct _lzslab_
+{
+    size_t slot_size;
+    size_t page_size;
+    size_t pages;      // count of pages
+    size_t used_slots; // slots handed out by every page
+
+    struct _lzslab_page_ *partial; // pages with room for one slot at least
+    struct _lzslab_page_ *full;
+
+    struct _lzslab_allocator_ *allocator;
+} LZSlab;
+
+#define LZSLAB_ALIGNMENT 16
+
+void lzslab_init(size_t slot_size, size_t page_size, struct _lzslab_allocator_ *allocator, struct _lzslab_ *slab);
+// gives back every page
+void lzslab_deinit(struct _lzslab_ *slab);
+
+void *lzslab_alloc(struct _lzslab_ *slab);
+// 'page' is the one holding 'ptr', found by the caller from where pages live
+void lzslab_dealloc(void *ptr, struct _lzslab_page_ *page);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include "vm.h"
+
+// Loads the shared object with the native code of every function of the
+// program, generating and building it with gcc when it is missing or was
+// built for different bytecode. Returns 0 if the interpreter must be used.
+int aot_load(char *source_path, VM *vm);
+void aot_unload();
+
+// Runs native code from the current frame ip. Returns 0 if nothing was executed.
+int aot_execute(VM *vm);
+
+#endif
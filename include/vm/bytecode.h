@@ -0,0 +1,19 @@
+#ifndef _BYTECODE_H_
+#define _BYTECODE_H_
+
+#include "vm.h"
+
+#include <stdint.h>
+
+// changes every time the compiler output or the file layout changes
+#define BYTECODE_VERSION 1
+
+uint64_t bytecode_hash(char *source, size_t length);
+
+// Fills 'vm' with the program cached next to 'source_path'. Returns 0,
+// leaving 'vm' untouched, if there is no valid cache for 'source_hash'.
+int bytecode_load(char *source_path, uint64_t source_hash, VM *vm);
+// Caches the program compiled in 'vm'. Returns 0 if it could not be written.
+int bytecode_save(char *source_path, uint64_t source_hash, VM *vm);
+
+#endif
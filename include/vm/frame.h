@@ -3,6 +3,7 @@
 
 #include "value.h"
 #include "primitive.h"
+#include "function.h"
 
 #include <essentials/dynarr.h>
 
@@ -11,6 +12,7 @@
 typedef struct _frame_
 {
     int ip;
+    Fn *fn;
     DynArr *chunks;
     Object *instance;
     char is_constructor;
@@ -11,6 +11,10 @@ typedef struct _fn_
     char *name;
     DynArrPtr *params;
     DynArr *chunks;
+    unsigned int hotness;   // calls plus loop back-edges, drives the jit. Stops at JIT_HOT_THRESHOLD
+    int locals;             // frame slots its chunks use, -1 until counted
+    struct _jit_code_ *jit; // native code, NULL while interpreted
+    void *aot;              // entry in the aot shared object, NULL if none
 } Fn;
 
 #endif
\ No newline at end of file
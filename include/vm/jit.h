@@ -0,0 +1,58 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "vm.h"
+
+#include <essentials/dynarr.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+// calls plus loop back-edges before a function gets compiled
+#define JIT_HOT_THRESHOLD 1000
+// back-edges to a loop header before its trace gets recorded
+#define JIT_TRACE_THRESHOLD 100
+// counter value of loop headers that failed to trace
+#define JIT_TRACE_BLACKLIST (INT32_MIN / 2)
+
+typedef enum _jit_mode_
+{
+    JIT_OFF_MODE,  // interpret everything
+    JIT_ON_MODE,   // compile functions once they get hot
+    JIT_FORCE_MODE // compile every function the first time it runs
+} JitMode;
+
+typedef struct _jit_code_
+{
+    char compiled;   // baseline compilation was attempted
+    uint8_t *native; // machine code, NULL if the chunks could not be compiled
+    size_t size;     // bytes mapped for native
+    void **entries;  // native address of each chunk the interpreter can resume at
+    size_t length;   // chunks of the function
+
+    int32_t *counters;           // back-edges taken to each chunk
+    struct _jit_trace_ **traces; // loop traces by header chunk
+} JitCode;
+
+// bytes following 'opcode' in the chunks, -1 if it is not a known one
+int jit_operands_length(uint8_t opcode);
+
+void jit_set_mode(JitMode mode);
+JitMode jit_get_mode();
+
+JitCode *jit_create_code(Fn *fn);
+void jit_compile(JitCode *code, DynArr *chunks, VM *vm);
+void jit_destroy_code(JitCode *code);
+
+// counts a back-edge taken by the interpreter, 'frame' ip is the loop header
+void jit_backedge(Frame *frame);
+
+// Runs native code from the current frame ip until it reaches an
+// instruction it does not handle. Returns 0 if nothing was executed.
+int jit_execute(VM *vm);
+
+#endif
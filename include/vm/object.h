@@ -54,7 +54,8 @@ typedef struct _instance_
 
 typedef struct _object_
 {
-    char marked;
+    char marked;     // of the last full collection that reached it, 0 while young
+    char remembered; // in the remembered set
     enum _object_type_ type;
     struct _object_ *next;
 
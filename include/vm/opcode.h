@@ -36,6 +36,19 @@ typedef enum _opcode_
     EQ_OPC, // equals
     NE_OPC, // not equals
 
+    // quickened (int-int forms rewritten in place at runtime)
+    ADD_II_OPC,
+    SUB_II_OPC,
+    MUL_II_OPC,
+    DIV_II_OPC,
+    MOD_II_OPC,
+    LT_II_OPC,
+    GT_II_OPC,
+    LE_II_OPC,
+    GE_II_OPC,
+    EQ_II_OPC,
+    NE_II_OPC,
+
     // logical
     OR_OPC,
     AND_OPC,
@@ -56,6 +69,7 @@ typedef enum _opcode_
     JMP_OPC, // unconditional jump
     JIT_OPC, // jump if true
     JIF_OPC, // jump if false
+    FORLOOP_OPC, // for loop step: increment, compare and jump
 
     CONCAT_OPC,  // join two strings
     STR_LEN_OPC, // length of a string
@@ -12,12 +12,35 @@
 #include <essentials/lzhtable.h>
 #include <essentials/lzallocator.h>
 
+#include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 
 #define VM_STACK_LENGTH 255
 #define VM_FRAME_LENGTH 255
+// the collector runs once the objects outgrow their live size after
+// the previous collection by this factor, but never below the minimum
+#define VM_GC_GROWTH 2.0
+#define VM_GC_MIN_BYTES ((size_t)1024 * 1024)
+// objects allocated since the previous collection are young, and get
+// collected on their own once they take this many bytes
+#define VM_GC_NURSERY_BYTES ((size_t)256 * 1024)
+// initial length of the worklist the collector marks with
+#define VM_GC_GRAY_LENGTH 256
+// initial length of the set of old objects holding young ones
+#define VM_GC_REMEMBERED_LENGTH 64
+// incremental collections do a unit of work, scanning a reference or
+// sweeping an object, for every this many bytes allocated meanwhile,
+// in steps run once at least VM_GC_STEP_BYTES got allocated
+#define VM_GC_UNIT_BYTES 8
+#define VM_GC_STEP_BYTES ((size_t)4 * 1024)
+// threads full collections mark and sweep on, when not tuned otherwise.
+// They live as long as the VM and sleep between collections. Unlinking the
+// dead objects stays on the VM thread, which keeps the order of the
+// survivors, only freeing them gets shared
+#define VM_GC_THREADS 1
+#define VM_GC_MAX_THREADS 64
 
 typedef enum _entity_info_type_
 {
@@ -46,6 +69,34 @@ typedef struct _entity_
     void *raw_symbol;
 } Entity;
 
+typedef enum _gc_phase_
+{
+    IDLE_GCPHASE,
+    MARK_GCPHASE,
+    SWEEP_GCPHASE
+} GCPhase;
+
+// references the collector has yet to mark: the items of an array,
+// or the attributes of an instance starting from its newest node,
+// or what is left of them when a step ran out of budget
+typedef struct _gray_
+{
+    size_t length; // items, 0 for attributes
+    void *references;
+} Gray;
+
+// pauses the collector took at safepoints, recorded only when asked for
+typedef struct _gc_pauses_
+{
+    char recording;
+    size_t steps; // of full collections run in steps, starting them included
+    size_t full;
+    size_t minor;
+    clock_t longest_step;
+    clock_t longest_full;
+    clock_t longest_minor;
+} GCPauses;
+
 typedef struct _vm_
 {
     char halt;
@@ -67,14 +118,42 @@ typedef struct _vm_
     LZStack *fn_def_stack;
     Klass *klass;
 
-    size_t size;
+    size_t size;         // bytes of the objects and what they own
+    Gray *gray;          // worklist of references left to mark
+    size_t gray_used;
+    size_t gray_count;
+    Object **remembered; // old objects written a young one since the last collection
+    size_t remembered_used;
+    size_t remembered_count;
+    size_t gc_threshold; // size the next collection runs at
+    size_t gc_min;
+    double gc_growth;
+    size_t gc_young_base; // size when the young objects started to be allocated
+    size_t gc_nursery;    // 0 when every collection is a full one
+    GCPhase gc_phase;     // of the full collection in progress
+    char gc_mark;         // 1 or 2, flipped by every full collection
+    Object *gc_sweep;     // last object the sweep in progress kept
+    size_t gc_live;       // bytes the sweep in progress kept
+    size_t gc_paced;      // size when the previous step ran
+    size_t gc_debt;       // units the previous step had no time for
+    clock_t gc_max_pause; // of a step, 0 when full collections run at once
+    size_t gc_threads;    // full collections run at once mark and sweep on, 1 keeps them on the VM thread
+    struct _gc_parallel_ *gc_parallel; // the collector threads, NULL if gc_threads is 1
+    GCPauses gc_pauses;
     Object *head_object;
     Object *tail_object;
+    Object *old_object; // newest object that survived a collection, young ones follow it
 } VM;
 
 VM *vm_create();
 void vm_destroy(VM *vm);
 
+void vm_gc_tune(double growth, size_t min_bytes, size_t nursery_bytes, size_t max_pause_us, size_t threads, VM *vm);
+// Records how long every collector pause takes, and prints the counts and
+// the longest ones of each kind to stderr
+void vm_gc_record_pauses(VM *vm);
+void vm_gc_report_pauses(VM *vm);
+
 size_t vm_block_length(VM *vm);
 void vm_print_stack(VM *vm);
 
@@ -2,8 +2,10 @@
 #define _VM_MEMORY_H_
 
 #include <essentials/dynarr.h>
+#include <essentials/lzarea.h>
 #include <essentials/lzallocator.h>
 #include <essentials/lzhtable.h>
+#include <essentials/lzslab.h>
 #include <essentials/lzstack.h>
 
 #include "function.h"
@@ -18,6 +20,14 @@ size_t vm_memory_used_space();
 void vm_memory_print_blocks();
 void vm_memory_report_space();
 
+// upper bound, in bytes, for the arenas mapped by the heap
+void vm_memory_set_limit(size_t bytes);
+size_t vm_memory_limit();
+// unmaps the arenas a collection left empty
+void vm_memory_release_arenas();
+// gives what the calling thread's magazines cache back to the shared heap
+void vm_memory_flush_thread();
+
 int vm_memory_init();
 void vm_memory_deinit();
 
@@ -56,4 +66,10 @@ void vm_memory_destroy_instance(Instance *instance);
 Object *vm_memory_create_object(ObjectType type, VM *vm);
 void vm_memory_destroy_object(Object *object);
 
+// values living outside the stack: globals and instance attributes
+Value *vm_memory_create_value();
+void vm_memory_destroy_value(Value *value);
+
+void vm_memory_records_stats(LZAreaStats *stats);
+
 #endif
\ No newline at end of file
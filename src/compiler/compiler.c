@@ -11,17 +11,16 @@ static Compiler *compiler = NULL;
 
 #define COMPILER_VM compiler->vm
 
-void _clear_lzhtable_(void *value)
-{
-    memory_destroy_symbol((Symbol *)value);
-}
-
 // private interface
 void compiler_error_at(Token *token, char *msg, ...);
 
+int compiler_intern(char *identifier, size_t length);
+int compiler_atom(Token *identifier_token);
+
+int compiler_new_local(SymbolStack *scope, Token *token);
 Symbol *compiler_declare_depth(int is_entity, int depth, Token *identifier_token);
 Symbol *compiler_declare(int is_entity, Token *identifier_token);
-Symbol *compiler_symbol_at(int depth, char *identifier);
+Symbol *compiler_symbol_at(int depth, Token *identifier_token);
 Symbol *compiler_exists(Token *identifier_token);
 Symbol *compiler_get(Token *identifier_token);
 
@@ -34,6 +33,11 @@ int compiler_scope_inside_klass();
 void compiler_scope_in(ScopeType type);
 void compiler_scope_out();
 
+int compiler_expr_writes(int atom, int global, Expr *expr);
+int compiler_stmts_write(int atom, int global, DynArrPtr *stmts);
+int compiler_stmt_writes(int atom, int global, Stmt *stmt);
+int compiler_is_loop_invariant(Expr *expr, Symbol *counter, DynArrPtr *stmts);
+
 void compiler_assign_expr(AssignExpr *expr);
 void compiler_is_expr(IsExpr *expr);
 void compiler_from_expr(FromExpr *expr);
@@ -79,30 +83,88 @@ void compiler_error_at(Token *token, char *msg, ...)
     va_end(args);
 }
 
-Symbol *compiler_declare_depth(int is_entity, int depth, Token *identifier_token)
+int compiler_intern(char *identifier, size_t length)
+{
+    void *value = lzhtable_get((uint8_t *)identifier, length, compiler->atoms);
+
+    if (value)
+        return (int)((intptr_t)value - 1);
+
+    DynArrPtr *bindings = compiler->bindings;
+    int atom = (int)bindings->used;
+
+    dynarr_ptr_insert(NULL, bindings);
+    lzhtable_put((uint8_t *)identifier, length, (void *)(intptr_t)(atom + 1), compiler->atoms, NULL);
+
+    return atom;
+}
+
+int compiler_atom(Token *identifier_token)
+{
+    // the key is the token slice, the source outlives the compiler
+    if (identifier_token->atom == -1)
+        identifier_token->atom = compiler_intern(identifier_token->start, identifier_token->length);
+
+    return identifier_token->atom;
+}
+
+// slots are operands of a byte and index the frame locals
+int compiler_new_local(SymbolStack *scope, Token *token)
 {
-    char *identifier = identifier_token->lexeme;
+    if (scope->local >= FRAME_VALUES_LENGTH)
+        compiler_error_at(token, "Too many locals. A function can hold at most %d.", FRAME_VALUES_LENGTH);
+
+    return scope->local++;
+}
 
+Symbol *compiler_declare_depth(int is_entity, int depth, Token *identifier_token)
+{
+    int atom = compiler_atom(identifier_token);
+    DynArrPtr *bindings = compiler->bindings;
     SymbolStack *scope = &compiler->scope_stack[depth];
-    LZHTable *symbols = scope->symbols;
 
-    size_t key_size = strlen(identifier);
+    // the chain of an atom goes from the innermost scope outwards,
+    // members are declared at the klass scope from deeper ones
+    Symbol *previous = NULL;
+    Symbol *shadowed = (Symbol *)DYNARR_PTR_GET(atom, bindings);
 
-    if (lzhtable_contains((uint8_t *)identifier, key_size, symbols, NULL))
-        compiler_error_at(identifier_token, "Already exists a symbol named as '%s'", identifier);
+    while (shadowed && shadowed->depth > depth)
+    {
+        previous = shadowed;
+        shadowed = shadowed->next;
+    }
+
+    if (shadowed && shadowed->depth == depth)
+        compiler_error_at(identifier_token, "Already exists a symbol named as '%s'", memory_token_lexeme(identifier_token));
 
     int is_global = depth == 0;
-    int local = is_entity ? ((int)compiler->natives->used + compiler->entity_counter++) : scope->local++;
+    int local = 0;
+
+    // globals are looked up by name
+    if (is_entity)
+        local = (int)compiler->natives->used + compiler->entity_counter++;
+    else if (is_global)
+        local = scope->local++;
+    else
+        local = compiler_new_local(scope, identifier_token);
 
     Symbol *symbol = memory_create_symbol(
         is_global,
         local,
         depth,
-        identifier,
+        memory_token_lexeme(identifier_token),
+        atom,
         is_entity,
         0);
 
-    lzhtable_put((uint8_t *)identifier, key_size, symbol, symbols, NULL);
+    symbol->next = shadowed;
+    symbol->sibling = scope->symbols;
+    scope->symbols = symbol;
+
+    if (previous)
+        previous->next = symbol;
+    else
+        dynarr_ptr_set(atom, symbol, bindings);
 
     return symbol;
 }
@@ -112,23 +174,20 @@ Symbol *compiler_declare(int is_entity, Token *identifier_token)
     return compiler_declare_depth(is_entity, compiler->depth, identifier_token);
 }
 
-Symbol *compiler_symbol_at(int depth, char *identifier)
+Symbol *compiler_symbol_at(int depth, Token *identifier_token)
 {
-    SymbolStack *scope = &compiler->scope_stack[depth];
-    return lzhtable_get((uint8_t *)identifier, strlen(identifier), scope->symbols);
+    Symbol *symbol = (Symbol *)DYNARR_PTR_GET(compiler_atom(identifier_token), compiler->bindings);
+
+    while (symbol && symbol->depth > depth)
+        symbol = symbol->next;
+
+    return symbol && symbol->depth == depth ? symbol : NULL;
 }
 
 Symbol *compiler_exists(Token *identifier_token)
 {
-    for (int i = compiler->depth; i >= 0; i--)
-    {
-        Symbol *symbol = compiler_symbol_at(i, identifier_token->lexeme);
-
-        if (symbol)
-            return symbol;
-    }
-
-    return NULL;
+    // symbols of closed scopes are unbound, so the head is the innermost one
+    return (Symbol *)DYNARR_PTR_GET(compiler_atom(identifier_token), compiler->bindings);
 }
 
 Symbol *compiler_get(Token *identifier_token)
@@ -136,7 +195,7 @@ Symbol *compiler_get(Token *identifier_token)
     Symbol *symbol = compiler_exists(identifier_token);
 
     if (!symbol)
-        compiler_error_at(identifier_token, "Do not exists a symbol named '%s'", identifier_token->lexeme);
+        compiler_error_at(identifier_token, "Do not exists a symbol named '%s'", memory_token_lexeme(identifier_token));
 
     return symbol;
 }
@@ -202,16 +261,261 @@ void compiler_scope_in(ScopeType type)
         scope->local = prev_scope->local;
 
     scope->type = type;
-
-    if (!scope->symbols)
-        scope->symbols = memory_create_lzhtable(17);
+    scope->symbols = NULL;
 }
 
 void compiler_scope_out()
 {
     SymbolStack *scope = &compiler->scope_stack[compiler->depth--];
+    DynArrPtr *bindings = compiler->bindings;
+    Symbol *symbol = scope->symbols;
+
+    while (symbol)
+    {
+        Symbol *sibling = symbol->sibling;
+        Symbol *current = (Symbol *)DYNARR_PTR_GET(symbol->atom, bindings);
+
+        if (current == symbol)
+            dynarr_ptr_set(symbol->atom, symbol->next, bindings);
+        else
+        {
+            while (current->next != symbol)
+                current = current->next;
+
+            current->next = symbol->next;
+        }
+
+        // only unbound: a statement may still use the symbols of a scope
+        // it closed, like the for counter. They go with the front-end region
+        symbol = sibling;
+    }
+
+    scope->symbols = NULL;
+}
+
+int compiler_expr_writes(int atom, int global, Expr *expr)
+{
+    if (!expr)
+        return 0;
+
+    switch (expr->type)
+    {
+    case ASSIGN_EXPR_TYPE:
+    {
+        AssignExpr *assign_expr = (AssignExpr *)expr->e;
+        Expr *left = assign_expr->left;
+
+        if (left->type == IDENTIFIER_EXPR_TYPE)
+        {
+            IdentifierExpr *identifier_expr = (IdentifierExpr *)left->e;
+
+            if (compiler_atom(identifier_expr->identifier_token) == atom)
+                return 1;
+        }
+
+        return compiler_expr_writes(atom, global, left) ||
+               compiler_expr_writes(atom, global, assign_expr->right);
+    }
+
+    case IS_EXPR_TYPE:
+        return compiler_expr_writes(atom, global, ((IsExpr *)expr->e)->left);
+
+    case FROM_EXPR_TYPE:
+        return compiler_expr_writes(atom, global, ((FromExpr *)expr->e)->left);
+
+    case ARR_EXPR_TYPE:
+    {
+        ArrExpr *arr_expr = (ArrExpr *)expr->e;
+        DynArrPtr *items = arr_expr->items;
+
+        for (size_t i = 0; i < items->used; i++)
+        {
+            if (compiler_expr_writes(atom, global, (Expr *)DYNARR_PTR_GET(i, items)))
+                return 1;
+        }
+
+        return compiler_expr_writes(atom, global, arr_expr->len_expr);
+    }
+
+    case LOGICAL_EXPR_TYPE:
+    case COMPARISON_EXPR_TYPE:
+    case BINARY_EXPR_TYPE:
+    {
+        // logical, comparison and binary expressions share the same layout
+        BinaryExpr *binary_expr = (BinaryExpr *)expr->e;
+
+        return compiler_expr_writes(atom, global, binary_expr->left) ||
+               compiler_expr_writes(atom, global, binary_expr->right);
+    }
+
+    case UNARY_EXPR_TYPE:
+        return compiler_expr_writes(atom, global, ((UnaryExpr *)expr->e)->right);
+
+    case ARR_ACCESS_EXPR_TYPE:
+    {
+        ArrAccessExpr *arr_access_expr = (ArrAccessExpr *)expr->e;
+
+        return compiler_expr_writes(atom, global, arr_access_expr->expr) ||
+               compiler_expr_writes(atom, global, arr_access_expr->index_expr);
+    }
+
+    case ACCESS_EXPR_TYPE:
+        return compiler_expr_writes(atom, global, ((AccessExpr *)expr->e)->left);
+
+    case CALL_EXPR_TYPE:
+    {
+        // globals can be modified by the callee
+        if (global)
+            return 1;
+
+        CallExpr *call_expr = (CallExpr *)expr->e;
+        DynArrPtr *args = call_expr->args;
+
+        for (size_t i = 0; i < args->used; i++)
+        {
+            if (compiler_expr_writes(atom, global, (Expr *)DYNARR_PTR_GET(i, args)))
+                return 1;
+        }
+
+        return compiler_expr_writes(atom, global, call_expr->left);
+    }
+
+    case GROUP_EXPR_TYPE:
+        return compiler_expr_writes(atom, global, ((GroupExpr *)expr->e)->e);
+
+    default:
+        return 0;
+    }
+}
+
+int compiler_stmts_write(int atom, int global, DynArrPtr *stmts)
+{
+    if (!stmts)
+        return 0;
+
+    for (size_t i = 0; i < stmts->used; i++)
+    {
+        if (compiler_stmt_writes(atom, global, (Stmt *)DYNARR_PTR_GET(i, stmts)))
+            return 1;
+    }
+
+    return 0;
+}
+
+int compiler_stmt_writes(int atom, int global, Stmt *stmt)
+{
+    switch (stmt->type)
+    {
+    case VAR_DECL_STMT_TYPE:
+    {
+        VarDeclStmt *var_decl_stmt = (VarDeclStmt *)stmt->s;
+
+        if (compiler_atom(var_decl_stmt->identifier) == atom)
+            return 1;
+
+        return compiler_expr_writes(atom, global, var_decl_stmt->initializer);
+    }
+
+    case BLOCK_STMT_TYPE:
+        return compiler_stmts_write(atom, global, ((BlockStmt *)stmt->s)->stmts);
+
+    case IF_STMT_TYPE:
+    {
+        IfStmt *if_stmt = (IfStmt *)stmt->s;
+        IfStmtBranch *if_branch = if_stmt->if_branch;
+        DynArrPtr *elif_branches = if_stmt->elif_branches;
+
+        if (compiler_expr_writes(atom, global, if_branch->condition) ||
+            compiler_stmts_write(atom, global, if_branch->stmts))
+            return 1;
+
+        for (size_t i = 0; elif_branches && i < elif_branches->used; i++)
+        {
+            IfStmtBranch *branch = (IfStmtBranch *)DYNARR_PTR_GET(i, elif_branches);
 
-    lzhtable_clear(_clear_lzhtable_, scope->symbols);
+            if (compiler_expr_writes(atom, global, branch->condition) ||
+                compiler_stmts_write(atom, global, branch->stmts))
+                return 1;
+        }
+
+        return compiler_stmts_write(atom, global, if_stmt->else_stmts);
+    }
+
+    case WHILE_STMT_TYPE:
+    {
+        WhileStmt *while_stmt = (WhileStmt *)stmt->s;
+
+        return compiler_expr_writes(atom, global, while_stmt->condition) ||
+               compiler_stmts_write(atom, global, while_stmt->stmts);
+    }
+
+    case FOR_STMT_TYPE:
+    {
+        ForStmt *for_stmt = (ForStmt *)stmt->s;
+
+        if (compiler_atom(for_stmt->identifier_token) == atom)
+            return 1;
+
+        return compiler_expr_writes(atom, global, for_stmt->left_expr) ||
+               compiler_expr_writes(atom, global, for_stmt->right_expr) ||
+               compiler_stmts_write(atom, global, for_stmt->stmts);
+    }
+
+    case PRINT_STMT_TYPE:
+        return compiler_expr_writes(atom, global, ((PrintStmt *)stmt->s)->expr);
+
+    case RETURN_STMT_TYPE:
+        return compiler_expr_writes(atom, global, ((ReturnStmt *)stmt->s)->value);
+
+    case EXPR_STMT_TYPE:
+        return compiler_expr_writes(atom, global, ((ExprStmt *)stmt->s)->expr);
+
+    default:
+        // continue, break, functions and classes declarations
+        // do not execute anything where they appear
+        return 0;
+    }
+}
+
+int compiler_is_loop_invariant(Expr *expr, Symbol *counter, DynArrPtr *stmts)
+{
+    switch (expr->type)
+    {
+    case NIL_EXPR_TYPE:
+    case BOOL_EXPR_TYPE:
+    case INT_EXPR_TYPE:
+        return 1;
+
+    case IDENTIFIER_EXPR_TYPE:
+    {
+        Token *identifier_token = ((IdentifierExpr *)expr->e)->identifier_token;
+        Symbol *symbol = compiler_exists(identifier_token);
+
+        if (!symbol || symbol == counter || symbol->is_entity || symbol->class_bound)
+            return 0;
+
+        return !compiler_stmts_write(symbol->atom, symbol->global, stmts);
+    }
+
+    case GROUP_EXPR_TYPE:
+        return compiler_is_loop_invariant(((GroupExpr *)expr->e)->e, counter, stmts);
+
+    case UNARY_EXPR_TYPE:
+        return compiler_is_loop_invariant(((UnaryExpr *)expr->e)->right, counter, stmts);
+
+    case BINARY_EXPR_TYPE:
+    {
+        BinaryExpr *binary_expr = (BinaryExpr *)expr->e;
+
+        return compiler_is_loop_invariant(binary_expr->left, counter, stmts) &&
+               compiler_is_loop_invariant(binary_expr->right, counter, stmts);
+    }
+
+    default:
+        // calls, accesses and allocations might have
+        // side effects or change between iterations
+        return 0;
+    }
 }
 
 void compiler_assign_expr(AssignExpr *expr)
@@ -223,7 +527,7 @@ void compiler_assign_expr(AssignExpr *expr)
     {
         AccessExpr *access_expr = (AccessExpr *)left->e;
         Token *identifier_token = access_expr->identifier_token;
-        char *identifier = identifier_token->lexeme;
+        char *identifier = memory_token_lexeme(identifier_token);
 
         compiler_expr(right);
         compiler_expr(access_expr->left);
@@ -246,8 +550,8 @@ void compiler_assign_expr(AssignExpr *expr)
         if (klass_scope == -1)
             compiler_error_at(this_expr->this_token, "Illegal assignment target. 'this' expressions can't be used outside classes scope.");
 
-        char *identifier = identifier_token->lexeme;
-        Symbol *symbol = compiler_symbol_at(klass_scope, identifier_token->lexeme);
+        char *identifier = memory_token_lexeme(identifier_token);
+        Symbol *symbol = compiler_symbol_at(klass_scope, identifier_token);
 
         if (!symbol)
             compiler_declare_depth(0, klass_scope, identifier_token)->class_bound = 1;
@@ -280,7 +584,7 @@ void compiler_assign_expr(AssignExpr *expr)
 
         IdentifierExpr *identifier_expr = (IdentifierExpr *)left->e;
         Token *identifier_token = identifier_expr->identifier_token;
-        char *identifier = identifier_token->lexeme;
+        char *identifier = memory_token_lexeme(identifier_token);
 
         Symbol *symbol = compiler_get(identifier_token);
 
@@ -360,7 +664,7 @@ void compiler_from_expr(FromExpr *expr)
     compiler_expr(expr->left);
 
     vm_write_chunk(FROM_OPC, COMPILER_VM);
-    vm_write_str_const(expr->klass_identifier_token->lexeme, COMPILER_VM);
+    vm_write_str_const(memory_token_lexeme(expr->klass_identifier_token), COMPILER_VM);
 }
 
 void compiler_arr_expr(ArrExpr *expr)
@@ -540,7 +844,7 @@ void compiler_access(AccessExpr *expr)
     compiler_expr(left);
 
     vm_write_chunk(GET_PROPERTY_OPC, COMPILER_VM);
-    vm_write_str_const(identifier->lexeme, COMPILER_VM);
+    vm_write_str_const(memory_token_lexeme(identifier), COMPILER_VM);
 }
 
 void compiler_call_expr(CallExpr *expr)
@@ -573,7 +877,7 @@ void compiler_this_expr(ThisExpr *expr)
 
     if (identifier_token)
     {
-        char *identifier = identifier_token->lexeme;
+        char *identifier = memory_token_lexeme(identifier_token);
 
         vm_write_chunk(GET_PROPERTY_OPC, COMPILER_VM);
         vm_write_str_const(identifier, COMPILER_VM);
@@ -606,21 +910,16 @@ void compiler_str_expr(LiteralExpr *expr)
 void compiler_identifier_expr(IdentifierExpr *expr)
 {
     Token *identifier_token = expr->identifier_token;
-    char *identifier = identifier_token->lexeme;
-
-    DynArrPtr *natives = compiler->natives;
+    char *identifier = memory_token_lexeme(identifier_token);
+    int atom = compiler_atom(identifier_token);
 
-    for (size_t i = 0; i < natives->used; i++)
+    // natives were interned first, their atoms are their indexes
+    if (atom < (int)compiler->natives->used)
     {
-        char *native = DYNARR_PTR_GET(i, natives);
-
-        if (strcmp(identifier, native) == 0)
-        {
-            vm_write_chunk(LOAD_OPC, COMPILER_VM);
-            vm_write_i32(i, COMPILER_VM);
+        vm_write_chunk(LOAD_OPC, COMPILER_VM);
+        vm_write_i32(atom, COMPILER_VM);
 
-            return;
-        }
+        return;
     }
 
     Symbol *symbol = compiler_get(identifier_token);
@@ -743,7 +1042,7 @@ void compiler_expr(Expr *expr)
 void compiler_var_decl_stmt(VarDeclStmt *stmt)
 {
     Token *identifier_token = stmt->identifier;
-    char *identifier = identifier_token->lexeme;
+    char *identifier = memory_token_lexeme(identifier_token);
     Expr *initializer = stmt->initializer;
 
     Symbol *symbol = compiler_declare(0, identifier_token);
@@ -930,7 +1229,7 @@ void compiler_break_stmt(BreakStmt *stmt)
 
     size_t len = vm_block_length(COMPILER_VM);
 
-    size_t *info = (size_t *)memory_alloc(sizeof(size_t) * 2);
+    size_t *info = (size_t *)memory_alloc(sizeof(size_t) * 3);
 
     info[0] = len;
     info[1] = jmp_index;
@@ -1026,69 +1325,73 @@ void compiler_for_stmt(ForStmt *stmt)
 
     Symbol *symbol = compiler_declare(0, identifier_token);
 
+    // hidden local which holds the loop bound
+    int bound_local = compiler_new_local(compiler_scope_current(), identifier_token);
+    int hoisted = compiler_is_loop_invariant(right_expr, symbol, stmts);
+
     compiler_expr(left_expr);
 
     vm_write_chunk(LSET_OPC, COMPILER_VM);
     vm_write_chunk(symbol->local, COMPILER_VM);
     vm_write_chunk(POP_OPC, COMPILER_VM);
 
-    vm_write_chunk(JMP_OPC, COMPILER_VM);
-    size_t jmp_index = vm_write_i32(0, COMPILER_VM);
-
-    size_t len_before_body = vm_block_length(COMPILER_VM);
-
-    for (size_t i = 0; i < stmts->used; i++)
-    {
-        Stmt *s = (Stmt *)DYNARR_PTR_GET(i, stmts);
-        compiler_stmt(s);
-    }
-
-    compiler_scope_out();
+    compiler_expr(right_expr);
 
-    size_t len_before_increment = vm_block_length(COMPILER_VM);
+    vm_write_chunk(LSET_OPC, COMPILER_VM);
+    vm_write_chunk((uint8_t)bound_local, COMPILER_VM);
+    vm_write_chunk(POP_OPC, COMPILER_VM);
 
-    //> increment/decrement section
+    //> entry check
     vm_write_chunk(LREAD_OPC, COMPILER_VM);
     vm_write_chunk(symbol->local, COMPILER_VM);
 
-    vm_write_chunk(ICONST_OPC, COMPILER_VM);
-    vm_write_i64_const(1, COMPILER_VM);
+    vm_write_chunk(LREAD_OPC, COMPILER_VM);
+    vm_write_chunk((uint8_t)bound_local, COMPILER_VM);
 
     if (up)
-        vm_write_chunk(ADD_OPC, COMPILER_VM);
+        vm_write_chunk(LT_OPC, COMPILER_VM);
     else
-        vm_write_chunk(SUB_OPC, COMPILER_VM);
+        vm_write_chunk(GE_OPC, COMPILER_VM);
 
-    vm_write_chunk(LSET_OPC, COMPILER_VM);
-    vm_write_chunk(symbol->local, COMPILER_VM);
-    vm_write_chunk(POP_OPC, COMPILER_VM);
-    //< increment/decrement section
+    vm_write_chunk(JIF_OPC, COMPILER_VM);
+    size_t jif_index = vm_write_i32(0, COMPILER_VM);
+    //< entry check
 
-    size_t len_after_body = vm_block_length(COMPILER_VM);
-    size_t body_len = len_after_body - len_before_body;
+    size_t len_before_body = vm_block_length(COMPILER_VM);
 
-    vm_update_i32(jmp_index, body_len, COMPILER_VM);
+    for (size_t i = 0; i < stmts->used; i++)
+    {
+        Stmt *s = (Stmt *)DYNARR_PTR_GET(i, stmts);
+        compiler_stmt(s);
+    }
 
-    size_t len_before_header = vm_block_length(COMPILER_VM);
+    compiler_scope_out();
 
-    vm_write_chunk(LREAD_OPC, COMPILER_VM);
-    vm_write_chunk(symbol->local, COMPILER_VM);
+    size_t len_before_increment = vm_block_length(COMPILER_VM);
 
-    compiler_expr(right_expr);
+    // The bound has side effects or might change inside the body,
+    // so it must be evaluated again before each check
+    if (!hoisted)
+    {
+        compiler_expr(right_expr);
 
-    if (up)
-        vm_write_chunk(LT_OPC, COMPILER_VM);
-    else
-        vm_write_chunk(GE_OPC, COMPILER_VM);
+        vm_write_chunk(LSET_OPC, COMPILER_VM);
+        vm_write_chunk((uint8_t)bound_local, COMPILER_VM);
+        vm_write_chunk(POP_OPC, COMPILER_VM);
+    }
 
-    size_t len_after_header = vm_block_length(COMPILER_VM);
-    size_t header_len = len_after_header - len_before_header;
+    size_t len_before_forloop = vm_block_length(COMPILER_VM);
 
-    vm_write_chunk(JIT_OPC, COMPILER_VM);
-    vm_write_i32(-(header_len + body_len), COMPILER_VM);
+    vm_write_chunk(FORLOOP_OPC, COMPILER_VM);
+    vm_write_chunk(symbol->local, COMPILER_VM);
+    vm_write_chunk((uint8_t)bound_local, COMPILER_VM);
+    vm_write_chunk((uint8_t)up, COMPILER_VM);
+    vm_write_i32(-(len_before_forloop - len_before_body), COMPILER_VM);
 
     size_t after_for_body = vm_block_length(COMPILER_VM);
 
+    vm_update_i32(jif_index, after_for_body - len_before_body, COMPILER_VM);
+
     DynArr *continues = compiler->continues;
 
     for (size_t i = 0; i < continues->used; i++)
@@ -1137,7 +1440,7 @@ void compiler_fn_stmt(FnStmt *stmt)
 
     compiler_scope_in(FN_SCOPE);
 
-    vm_fn_start(identifier_token->lexeme, COMPILER_VM);
+    vm_fn_start(memory_token_lexeme(identifier_token), COMPILER_VM);
 
     for (size_t i = 0; i < params->used; i++)
     {
@@ -1145,7 +1448,7 @@ void compiler_fn_stmt(FnStmt *stmt)
 
         compiler_declare(0, param_token);
 
-        vm_fn_add_param(param_token->lexeme, COMPILER_VM);
+        vm_fn_add_param(memory_token_lexeme(param_token), COMPILER_VM);
     }
 
     if (stmts->used == 0)
@@ -1185,7 +1488,7 @@ void compiler_klass_stmt(ClassStmt *stmt)
 
     compiler_scope_in(KLASS_SCOPE);
 
-    vm_klass_start(identifier_token->lexeme, COMPILER_VM);
+    vm_klass_start(memory_token_lexeme(identifier_token), COMPILER_VM);
 
     // Declaring, before hand, the class methods. This is done in
     // order to methods can call each other
@@ -1213,7 +1516,7 @@ void compiler_klass_stmt(ClassStmt *stmt)
             for (size_t param_index = 0; param_index < params->used; param_index++)
             {
                 Token *param_token = DYNARR_PTR_GET(param_index, params);
-                char *param = param_token->lexeme;
+                char *param = memory_token_lexeme(param_token);
 
                 compiler_declare(0, param_token);
 
@@ -1253,12 +1556,12 @@ void compiler_klass_stmt(ClassStmt *stmt)
 
         compiler_scope_in(FN_SCOPE);
 
-        vm_klass_fn_start(fn_identifier_token->lexeme, COMPILER_VM);
+        vm_klass_fn_start(memory_token_lexeme(fn_identifier_token), COMPILER_VM);
 
         for (size_t param_index = 0; param_index < fn_params->used; param_index++)
         {
             Token *param_identifier_token = (Token *)DYNARR_PTR_GET(param_index, fn_params);
-            char *param_identifier = param_identifier_token->lexeme;
+            char *param_identifier = memory_token_lexeme(param_identifier_token);
 
             compiler_declare(0, param_identifier_token);
 
@@ -1382,9 +1685,8 @@ void compiler_stmt(Stmt *stmt)
 }
 
 // public implementation
-void compiler_compile(VM *vm, DynArrPtr *stmts)
+void compiler_begin(VM *vm)
 {
-    LZHTable *symbols = memory_create_lzhtable(1669);
     DynArr *continues = memory_create_dynarr(sizeof(size_t) * 3);
     DynArr *breaks = memory_create_dynarr(sizeof(size_t) * 3);
     DynArrPtr *natives = memory_create_dynarr_ptr();
@@ -1397,15 +1699,16 @@ void compiler_compile(VM *vm, DynArrPtr *stmts)
 
     compiler->scope_stack[0].local = 0;
     compiler->scope_stack[0].type = GLOBAL_SCOPE;
-    compiler->scope_stack[0].symbols = memory_create_lzhtable(17);
+    compiler->scope_stack[0].symbols = NULL;
 
     compiler->vm = vm;
-    compiler->stmts = stmts;
     compiler->entity_counter = 0;
 
     compiler->continues = continues;
     compiler->breaks = breaks;
 
+    compiler->atoms = memory_create_lzhtable(1021);
+    compiler->bindings = memory_create_dynarr_ptr();
     compiler->natives = natives;
 
     //> vm natives functions
@@ -1440,6 +1743,12 @@ void compiler_compile(VM *vm, DynArrPtr *stmts)
     dynarr_ptr_insert((void *)memory_clone_raw_str("concat"), natives);
     //< language natives functions
 
+    for (size_t i = 0; i < natives->used; i++)
+    {
+        char *native = (char *)DYNARR_PTR_GET(i, natives);
+        compiler_intern(native, strlen(native));
+    }
+
     //> arr_len function
     vm_fn_start("arr_len", COMPILER_VM);
     vm_fn_add_param("arr", COMPILER_VM);
@@ -1505,16 +1814,31 @@ void compiler_compile(VM *vm, DynArrPtr *stmts)
     vm_fn_end(COMPILER_VM);
     //< concat function
 
+}
+
+void compiler_compile_stmt(Stmt *stmt)
+{
+    compiler_stmt(stmt);
+}
+
+void compiler_end()
+{
+    memory_destroy_dynarr(compiler->continues);
+    memory_destroy_dynarr(compiler->breaks);
+    memory_destroy_compiler(compiler);
+
+    compiler = NULL;
+}
+
+void compiler_compile(VM *vm, DynArrPtr *stmts)
+{
+    compiler_begin(vm);
+
     for (size_t i = 0; i < stmts->used; i++)
     {
         Stmt *stmt = DYNARR_PTR_GET(i, stmts);
         compiler_stmt(stmt);
     }
 
-    memory_destroy_lzhtable(symbols);
-    memory_destroy_dynarr(continues);
-    memory_destroy_dynarr(breaks);
-    memory_destroy_compiler(compiler);
-
-    compiler = NULL;
+    compiler_end();
 }
\ No newline at end of file
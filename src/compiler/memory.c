@@ -1,11 +1,23 @@
 #include "memory.h"
-#include <essentials/lzallocator.h>
+#include <essentials/lzregion.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the front-end only builds data that dies once the compiler is done,
+// so everything lives in a region released by memory_deinit. While
+// streaming, the ast of each statement lives in its own region instead
+#define REGION_CHUNK_SIZE (64 * 1024)
 
 static int initialized = 0;
-static LZAllocator *allocator = NULL;
+static LZRegion *region = NULL;
+static LZRegion *ast_region = NULL;
+static LZRegion *current_region = NULL;
 static DynArrAllocator dynarr_allocator = {0};
 static LZHTableAllocator lzhtable_allocator = {0};
 static LZStackAllocator lzstack_allocator = {0};
@@ -37,10 +49,18 @@ int memory_init()
     if (initialized)
         return 0;
 
-    allocator = lzallocator_create(lzallocator_mib(8));
+    region = lzregion_create(REGION_CHUNK_SIZE, NULL);
+    ast_region = lzregion_create(REGION_CHUNK_SIZE, NULL);
+
+    if (!region || !ast_region)
+    {
+        lzregion_destroy(region);
+        lzregion_destroy(ast_region);
 
-    if (!allocator)
         return 1;
+    }
+
+    current_region = region;
 
     initialized = 1;
 
@@ -63,7 +83,12 @@ void memory_deinit()
     if (!initialized)
         return;
 
-    lzallocator_destroy(allocator);
+    lzregion_destroy(region);
+    lzregion_destroy(ast_region);
+
+    region = NULL;
+    ast_region = NULL;
+    current_region = NULL;
 
     initialized = 0;
 }
@@ -72,7 +97,7 @@ void *memory_calloc(size_t bytes)
 {
     assert(initialized && "You must call memory_init");
 
-    void *ptr = lzallocator_calloc(bytes, allocator, NULL);
+    void *ptr = lzregion_calloc(bytes, current_region);
 
     if (!ptr)
         memory_deinit();
@@ -86,7 +111,7 @@ void *memory_alloc(size_t bytes)
 {
     assert(initialized && "You must call memory_init");
 
-    void *ptr = lzallocator_alloc(bytes, allocator, NULL);
+    void *ptr = lzregion_alloc(bytes, current_region);
 
     if (!ptr)
         memory_deinit();
@@ -100,7 +125,7 @@ void *memory_realloc(void *ptr, size_t bytes)
 {
     assert(initialized && "You must call memory_init");
 
-    void *new_ptr = lzallocator_realloc(bytes, ptr, allocator, NULL);
+    void *new_ptr = lzregion_realloc(bytes, ptr, current_region);
 
     if (!new_ptr)
         memory_deinit();
@@ -117,14 +142,28 @@ void memory_dealloc(void *ptr)
     if (!ptr)
         return;
 
-    lzallocator_dealloc(ptr, allocator);
+    lzregion_dealloc(ptr, current_region);
+}
+
+void memory_ast_begin()
+{
+    current_region = ast_region;
+}
+
+void memory_ast_end()
+{
+    current_region = region;
+}
+
+void memory_ast_release()
+{
+    lzregion_reset(ast_region);
 }
 
 void memory_report()
 {
-    size_t total = allocator->bytes;
-    size_t available = lzallocator_available_space(allocator);
-    size_t used = total - available;
+    size_t total = region->bytes + ast_region->bytes;
+    size_t used = region->used_bytes + ast_region->used_bytes;
 
     printf("%ld/%ld\n", used, total);
 }
@@ -141,6 +180,17 @@ char *memory_clone_raw_str(char *str)
     return new_str;
 }
 
+char *memory_clone_raw_str_range(char *str, size_t length)
+{
+    char *new_str = (char *)memory_alloc(length + 1);
+
+    memcpy(new_str, str, length);
+
+    new_str[length] = 0;
+
+    return new_str;
+}
+
 void memory_destroy_raw_str(char *str)
 {
     if (!str)
@@ -159,6 +209,7 @@ StaticStr *memory_create_static_str(char *str, size_t len)
 
     static_str->raw = raw;
     static_str->len = len;
+    static_str->mapped = 0;
 
     return static_str;
 }
@@ -168,7 +219,10 @@ void memory_destroy_static_str(StaticStr *str)
     if (!str)
         return;
 
-    memory_dealloc(str->raw);
+    if (str->mapped)
+        munmap(str->raw, str->len);
+    else
+        memory_dealloc(str->raw);
 
     str->len = 0;
     str->raw = NULL;
@@ -178,23 +232,37 @@ void memory_destroy_static_str(StaticStr *str)
 
 StaticStr *memory_read_source(char *path)
 {
-    FILE *source_stream = fopen(path, "r");
-    fseek(source_stream, 0, SEEK_END);
+    int fd = open(path, O_RDONLY);
+    struct stat info;
 
-    size_t len = ftell(source_stream);
-    char *source = (char *)memory_alloc(len + 1);
+    if (fd == -1 || fstat(fd, &info) == -1)
+    {
+        fprintf(stderr, "Could not open source file '%s'\n", path);
+        exit(1);
+    }
 
-    rewind(source_stream);
-    fread(source, 1, len, source_stream);
+    StaticStr *str = (StaticStr *)memory_alloc(sizeof(StaticStr));
 
-    source[len] = '\0';
+    str->len = (size_t)info.st_size;
+    str->raw = "";
+    str->mapped = 0;
 
-    fclose(source_stream);
+    // the source is never copied, tokens are slices into the mapping
+    if (str->len > 0)
+    {
+        void *raw = mmap(NULL, str->len, PROT_READ, MAP_PRIVATE, fd, 0);
 
-    StaticStr *str = (StaticStr *)memory_alloc(sizeof(StaticStr));
+        if (raw == MAP_FAILED)
+        {
+            fprintf(stderr, "Could not map source file '%s'\n", path);
+            exit(1);
+        }
 
-    str->len = len;
-    str->raw = source;
+        str->raw = (char *)raw;
+        str->mapped = 1;
+    }
+
+    close(fd);
 
     return str;
 }
@@ -242,14 +310,15 @@ void memory_destroy_lzhtable(LZHTable *table)
     lzhtable_destroy(table);
 }
 
-Token *memory_create_token(int line, char *lexeme, void *literal, size_t literal_size, TokenType type)
+Token *memory_create_token(int line, char *start, size_t length, TokenType type)
 {
     Token *token = (Token *)memory_alloc(sizeof(Token));
 
     token->line = line;
-    token->lexeme = lexeme;
-    token->literal = literal;
-    token->literal_size = literal_size;
+    token->start = start;
+    token->length = length;
+    token->lexeme = NULL;
+    token->atom = -1;
     token->type = type;
 
     return token;
@@ -260,36 +329,19 @@ void memory_destroy_token(Token *token)
     if (!token)
         return;
 
-    token->line = 0;
-    token->lexeme = NULL;
-    token->literal = NULL;
-    token->literal_size = 0;
-    token->type = 0;
+    memory_dealloc(token->lexeme);
+    memset(token, 0, sizeof(Token));
 
     memory_dealloc(token);
 }
 
-Token *memory_clone_token(Token *token)
+char *memory_token_lexeme(Token *token)
 {
-    void *literal = NULL;
-
-    if (token->type == STRING_TOKTYPE)
-        literal = token->literal ? memory_clone_raw_str((char *)token->literal) : NULL;
-    else
-        literal = token->literal ? memory_alloc(token->literal_size) : NULL;
-
-    Token *new_token = (Token *)memory_alloc(sizeof(Token));
-
-    if (literal)
-        memcpy(literal, token->literal, token->literal_size);
-
-    new_token->line = token->line;
-    new_token->lexeme = memory_clone_raw_str(token->lexeme);
-    new_token->literal = literal;
-    new_token->literal_size = token->literal_size;
-    new_token->type = token->type;
+    // only tokens the compiler asks for by name pay for a copy
+    if (!token->lexeme)
+        token->lexeme = memory_clone_raw_str_range(token->start, token->length);
 
-    return new_token;
+    return token->lexeme;
 }
 
 AssignExpr *memory_create_assign_expr(Expr *left, Token *equals_token, Expr *right)
@@ -340,7 +392,7 @@ void memory_destroy_is_expr(IsExpr *expr)
 
 FromExpr *memory_create_from_expr(Expr *left, Token *from_token, Token *klass_identifier_token)
 {
-    FromExpr *expr = (FromExpr *)memory_alloc(sizeof(FromExpr *));
+    FromExpr *expr = (FromExpr *)memory_alloc(sizeof(FromExpr));
 
     expr->left = left;
     expr->from_token = from_token;
@@ -920,7 +972,7 @@ void memory_destroy_expr_stmt(ExprStmt *stmt)
     memory_dealloc(stmt);
 }
 
-Scanner *memory_create_scanner(DynArr *tokens, StaticStr *source, LZHTable *keywords)
+Scanner *memory_create_scanner(DynArr *tokens, StaticStr *source)
 {
     Scanner *scanner = (Scanner *)memory_alloc(sizeof(Scanner));
 
@@ -929,7 +981,12 @@ Scanner *memory_create_scanner(DynArr *tokens, StaticStr *source, LZHTable *keyw
     scanner->current = 0;
     scanner->tokens = tokens;
     scanner->source = source;
-    scanner->keywords = keywords;
+    scanner->pending = 0;
+    scanner->chunked = 0;
+    scanner->speculative = 0;
+    scanner->failed = 0;
+    scanner->open_string = -1;
+    scanner->open_line = 0;
 
     return scanner;
 }
@@ -944,12 +1001,14 @@ void memory_destroy_scanner(Scanner *scanner)
     memory_dealloc(scanner);
 }
 
-Parser *memory_create_parser(DynArr *tokens, DynArrPtr *stmts)
+Parser *memory_create_parser(DynArr *tokens, Scanner *scanner, DynArrPtr *stmts)
 {
-    Parser *parser = (Parser *)memory_alloc(sizeof(Parser));
+    Parser *parser = (Parser *)memory_calloc(sizeof(Parser));
 
     parser->current = 0;
     parser->tokens = tokens;
+    parser->scanner = scanner;
+    parser->scanned = 0;
     parser->stmts = stmts;
 
     return parser;
@@ -965,7 +1024,7 @@ void memory_destroy_parser(Parser *parser)
     memory_dealloc(parser);
 }
 
-Symbol *memory_create_symbol(int global, int local, int depth, char *identifier, int is_entity, int class_bound)
+Symbol *memory_create_symbol(int global, int local, int depth, char *identifier, int atom, int is_entity, int class_bound)
 {
     Symbol *symbol = (Symbol *)memory_alloc(sizeof(Symbol));
 
@@ -973,9 +1032,11 @@ Symbol *memory_create_symbol(int global, int local, int depth, char *identifier,
     symbol->local = local;
     symbol->depth = depth;
     symbol->identifier = identifier;
+    symbol->atom = atom;
     symbol->is_entity = is_entity;
     symbol->class_bound = class_bound;
     symbol->next = NULL;
+    symbol->sibling = NULL;
 
     return symbol;
 }
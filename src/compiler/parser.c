@@ -8,6 +8,7 @@
 // private interface
 void parser_error_at(Token *token, char *msg, ...);
 
+Token *parser_token_at(Parser *parser, int index);
 int parser_is_at_end(Parser *parser);
 
 Token *parser_advance(Parser *parser);
@@ -20,24 +21,110 @@ int parser_check_next(Parser *parser, TokenType type);
 int parser_match(Parser *parser, size_t count, ...);
 Token *parser_consume(Parser *parser, TokenType type, char *err_msg, ...);
 
+int64_t parser_token_to_i64(Token *token);
+
+// binding power of expression operators, from loosest to tightest
+typedef enum _parser_precedence_
+{
+    NONE_PRECEDENCE,
+    ASSIGN_PRECEDENCE,     // =
+    ARR_PRECEDENCE,        // [a, b]: n
+    TYPE_PRECEDENCE,       // is from
+    BIT_OR_PRECEDENCE,     // |
+    BIT_XOR_PRECEDENCE,    // ^
+    BIT_AND_PRECEDENCE,    // &
+    BIT_NOT_PRECEDENCE,    // ~a
+    OR_PRECEDENCE,         // ||
+    AND_PRECEDENCE,        // &&
+    COMPARISON_PRECEDENCE, // < > <= >= == !=
+    SHIFT_PRECEDENCE,      // << >>
+    TERM_PRECEDENCE,       // + -
+    FACTOR_PRECEDENCE,     // * / %
+    UNARY_PRECEDENCE,      // -a !a
+    ACCESS_PRECEDENCE,     // a[i] a.b a()
+    PRIMARY_PRECEDENCE
+} ParserPrecedence;
+
+typedef enum _parser_assoc_
+{
+    LEFT_ASSOC,
+    RIGHT_ASSOC,
+    NONE_ASSOC // nothing of the same level may follow, as in 'a is int is int'
+} ParserAssoc;
+
+typedef struct _parser_rule_
+{
+    Expr *(*prefix)(Parser *parser, Token *token);
+    ParserPrecedence prefix_precedence; // loosest level the prefix can start an operand at
+    Expr *(*infix)(Parser *parser, Expr *left, Token *token);
+    ParserPrecedence infix_precedence;
+    ParserAssoc assoc;
+} ParserRule;
+
 Expr *parser_expr(Parser *parser);
-Expr *parser_assign_expr(Parser *parser);
-Expr *parser_arr_expr(Parser *parser);
-Expr *parser_type_expr(Parser *parser);
-Expr *parser_bit_or(Parser *parser);
-Expr *parser_bit_xor(Parser *parser);
-Expr *parser_bit_and(Parser *parser);
-Expr *parser_bit_not(Parser *parser);
-Expr *parser_or_expr(Parser *parser);
-Expr *parser_and_expr(Parser *parser);
-Expr *parser_comparison_expr(Parser *parser);
-Expr *parser_shift_expr(Parser *parser);
-Expr *parser_term_expr(Parser *parser);
-Expr *parser_factor_expr(Parser *parser);
-Expr *parser_unary_expr(Parser *parser);
-Expr *parser_access_expr(Parser *parser);
-Expr *parser_this_expr(Parser *parser);
-Expr *parser_literal_expr(Parser *parser);
+Expr *parser_expr_at(Parser *parser, ParserPrecedence precedence);
+Expr *parser_right_operand(Parser *parser, Token *operator_token);
+
+Expr *parser_assign_expr(Parser *parser, Expr *left, Token *equals_token);
+Expr *parser_is_expr(Parser *parser, Expr *left, Token *is_token);
+Expr *parser_from_expr(Parser *parser, Expr *left, Token *from_token);
+Expr *parser_logical_expr(Parser *parser, Expr *left, Token *operator_token);
+Expr *parser_comparison_expr(Parser *parser, Expr *left, Token *operator_token);
+Expr *parser_binary_expr(Parser *parser, Expr *left, Token *operator_token);
+Expr *parser_arr_access_expr(Parser *parser, Expr *left, Token *left_square_token);
+Expr *parser_access_expr(Parser *parser, Expr *left, Token *dot_token);
+Expr *parser_call_expr(Parser *parser, Expr *left, Token *left_parenthesis_token);
+
+Expr *parser_arr_expr(Parser *parser, Token *left_square_token);
+Expr *parser_unary_expr(Parser *parser, Token *operator_token);
+Expr *parser_this_expr(Parser *parser, Token *this_token);
+Expr *parser_group_expr(Parser *parser, Token *left_paren_token);
+Expr *parser_identifier_expr(Parser *parser, Token *identifier_token);
+Expr *parser_literal_expr(Parser *parser, Token *literal_token);
+
+// indexed by TokenType, tokens without an entry start and continue nothing
+static const ParserRule parser_rules[] = {
+    [EQUALS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_assign_expr, ASSIGN_PRECEDENCE, RIGHT_ASSOC},
+    [IS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_is_expr, TYPE_PRECEDENCE, NONE_ASSOC},
+    [FROM_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_from_expr, TYPE_PRECEDENCE, NONE_ASSOC},
+
+    [BITWISE_OR_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, BIT_OR_PRECEDENCE, LEFT_ASSOC},
+    [BITWISE_XOR_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, BIT_XOR_PRECEDENCE, LEFT_ASSOC},
+    [BITWISE_AND_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, BIT_AND_PRECEDENCE, LEFT_ASSOC},
+    [BITWISE_NOT_TOKTYPE] = {parser_unary_expr, BIT_NOT_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+
+    [OR_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_logical_expr, OR_PRECEDENCE, LEFT_ASSOC},
+    [AND_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_logical_expr, AND_PRECEDENCE, LEFT_ASSOC},
+
+    [LESS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_comparison_expr, COMPARISON_PRECEDENCE, LEFT_ASSOC},
+    [GREATER_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_comparison_expr, COMPARISON_PRECEDENCE, LEFT_ASSOC},
+    [LESS_EQUALS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_comparison_expr, COMPARISON_PRECEDENCE, LEFT_ASSOC},
+    [GREATER_EQUALS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_comparison_expr, COMPARISON_PRECEDENCE, LEFT_ASSOC},
+    [EQUALS_EQUALS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_comparison_expr, COMPARISON_PRECEDENCE, LEFT_ASSOC},
+    [NOT_EQUALS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_comparison_expr, COMPARISON_PRECEDENCE, LEFT_ASSOC},
+
+    [SHIFT_LEFT] = {NULL, NONE_PRECEDENCE, parser_binary_expr, SHIFT_PRECEDENCE, LEFT_ASSOC},
+    [SHIFT_RIGHT] = {NULL, NONE_PRECEDENCE, parser_binary_expr, SHIFT_PRECEDENCE, LEFT_ASSOC},
+
+    [PLUS_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, TERM_PRECEDENCE, LEFT_ASSOC},
+    [MINUS_TOKTYPE] = {parser_unary_expr, UNARY_PRECEDENCE, parser_binary_expr, TERM_PRECEDENCE, LEFT_ASSOC},
+    [ASTERISK_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, FACTOR_PRECEDENCE, LEFT_ASSOC},
+    [SLASH_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, FACTOR_PRECEDENCE, LEFT_ASSOC},
+    [PERCENT_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_binary_expr, FACTOR_PRECEDENCE, LEFT_ASSOC},
+    [EXCLAMATION_TOKTYPE] = {parser_unary_expr, UNARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+
+    [LEFT_SQUARE_TOKTYPE] = {parser_arr_expr, ARR_PRECEDENCE, parser_arr_access_expr, ACCESS_PRECEDENCE, LEFT_ASSOC},
+    [DOT_TOKTYPE] = {NULL, NONE_PRECEDENCE, parser_access_expr, ACCESS_PRECEDENCE, LEFT_ASSOC},
+    [LEFT_PARENTHESIS_TOKTYPE] = {parser_group_expr, PRIMARY_PRECEDENCE, parser_call_expr, ACCESS_PRECEDENCE, LEFT_ASSOC},
+
+    [THIS_TOKTYPE] = {parser_this_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+    [IDENTIFIER_TOKTYPE] = {parser_identifier_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+    [NIL_TOKTYPE] = {parser_literal_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+    [TRUE_TOKTYPE] = {parser_literal_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+    [FALSE_TOKTYPE] = {parser_literal_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+    [INTEGER_TOKTYPE] = {parser_literal_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+    [STRING_TOKTYPE] = {parser_literal_expr, PRIMARY_PRECEDENCE, NULL, NONE_PRECEDENCE, LEFT_ASSOC},
+};
 
 Stmt *parser_stmt(Parser *parser);
 Stmt *parser_var_decl_stmt(Parser *parser);
@@ -65,35 +152,51 @@ void parser_error_at(Token *token, char *msg, ...)
     va_end(args);
 }
 
-int parser_is_at_end(Parser *parser)
+Token *parser_token_at(Parser *parser, int index)
 {
-    size_t current = (size_t)parser->current;
-    Token *token = (Token *)dynarr_get(current, parser->tokens);
+    if (parser->tokens)
+        return (Token *)dynarr_get((size_t)index, parser->tokens);
+
+    while (parser->scanned <= index)
+    {
+        Token *token = (Token *)memory_alloc(sizeof(Token));
+
+        *token = scanner_next_token(parser->scanner);
+        parser->window[parser->scanned++ % PARSER_WINDOW] = token;
+    }
 
+    assert(index >= parser->scanned - PARSER_WINDOW && "Token out of parser window");
+
+    return parser->window[index % PARSER_WINDOW];
+}
+
+int parser_is_at_end(Parser *parser)
+{
+    Token *token = parser_token_at(parser, parser->current);
     return token->type == EOF_TOKTYPE;
 }
 
 Token *parser_advance(Parser *parser)
 {
-    return (Token *)dynarr_get((size_t)parser->current++, parser->tokens);
+    return parser_token_at(parser, parser->current++);
 }
 
 Token *parser_peek(Parser *parser)
 {
-    return (Token *)dynarr_get((size_t)parser->current, parser->tokens);
+    return parser_token_at(parser, parser->current);
 }
 
 Token *parser_peek_next(Parser *parser)
 {
-    if ((size_t)parser->current + 1 >= parser->tokens->used)
+    if (parser->tokens && (size_t)parser->current + 1 >= parser->tokens->used)
         return NULL;
 
-    return (Token *)dynarr_get(parser->current + 1, parser->tokens);
+    return parser_token_at(parser, parser->current + 1);
 }
 
 Token *parser_previous(Parser *parser)
 {
-    return (Token *)dynarr_get(parser->current - 1, parser->tokens);
+    return parser_token_at(parser, parser->current - 1);
 }
 
 int parser_check(Parser *parser, TokenType type)
@@ -156,412 +259,265 @@ Token *parser_consume(Parser *parser, TokenType type, char *err_msg, ...)
     return NULL;
 }
 
-Expr *parser_expr(Parser *parser)
+int64_t parser_token_to_i64(Token *token)
 {
-    return parser_assign_expr(parser);
-}
+    int64_t value = 0;
 
-Expr *parser_assign_expr(Parser *parser)
-{
-    Expr *left = parser_arr_expr(parser);
-
-    if (parser_match(parser, 1, EQUALS_TOKTYPE))
+    for (size_t i = 0; i < token->length; i++)
     {
-        Token *equals_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_assign_expr(parser);
-
-        AssignExpr *expr = memory_create_assign_expr(left, equals_token, right);
-
-        return memory_create_expr(expr, ASSIGN_EXPR_TYPE);
+        value *= 10;
+        value += token->start[i] - 48;
     }
 
-    return left;
+    return value;
 }
 
-Expr *parser_is_expr(Expr *left, Token *is_token, Parser *parser)
+Expr *parser_expr(Parser *parser)
 {
-    if (parser_match(parser, 7,
-                     NIL_TOKTYPE,
-                     BOOL_TOKTYPE,
-                     INT_TOKTYPE,
-                     STR_TOKTYPE,
-                     ARR_TOKTYPE,
-                     PROC_TOKTYPE,
-                     CLASS_TOKTYPE,
-                     INSTANCE_TOKTYPE))
-    {
-        Token *type_token = memory_clone_token(parser_previous(parser));
-
-        IsExpr *expr = memory_create_is_expr(
-            left,
-            memory_clone_token(is_token),
-            type_token);
-
-        return memory_create_expr(expr, IS_EXPR_TYPE);
-    }
-
-    parser_error_at(parser_peek(parser), "Expect 'nil', 'bool', 'int', 'str', 'klass' or 'instance', but got something else.");
-
-    return NULL;
+    return parser_expr_at(parser, ASSIGN_PRECEDENCE);
 }
 
-Expr *parser_from_expr(Expr *left, Token *from_token, Parser *parser)
+Expr *parser_expr_at(Parser *parser, ParserPrecedence precedence)
 {
-    Token *klass_name_token = parser_consume(
-        parser,
-        IDENTIFIER_TOKTYPE,
-        "Expect klass identifier at right side of from expression.");
+    Token *token = parser_advance(parser);
+    const ParserRule *rule = &parser_rules[token->type];
 
-    FromExpr *expr = memory_create_from_expr(
-        left,
-        memory_clone_token(from_token),
-        memory_clone_token(klass_name_token));
+    if (!rule->prefix || rule->prefix_precedence < precedence)
+        parser_error_at(token, "Expected something, but got '%.*s'", (int)token->length, token->start);
 
-    return memory_create_expr(expr, FROM_EXPR_TYPE);
-}
+    Expr *left = rule->prefix(parser, token);
+    // operators binding at 'limit' or tighter were taken by the prefix operand,
+    // or may not follow it at all, like anything but '=' after an array
+    ParserPrecedence limit = rule->prefix_precedence;
 
-Expr *parser_arr_expr(Parser *parser)
-{
-    if (parser_match(parser, 1, LEFT_SQUARE_TOKTYPE))
+    for (;;)
     {
-        Token *left_square_token = memory_clone_token(parser_previous(parser));
-        DynArrPtr *items = memory_create_dynarr_ptr();
-        Expr *len_expr = NULL;
+        token = parser_peek(parser);
+        rule = &parser_rules[token->type];
 
-        if (!parser_check(parser, RIGHT_SQUARE_TOKTYPE))
-        {
-            do
-            {
-                dynarr_ptr_insert(parser_expr(parser), items);
-            } while (parser_match(parser, 1, COMMA_TOKTYPE));
-        }
-
-        parser_consume(parser, RIGHT_SQUARE_TOKTYPE, "Expect ']' at end or array creation expression.");
-
-        if (parser_match(parser, 1, COLON_TOKTYPE))
-            len_expr = parser_expr(parser);
+        if (!rule->infix || rule->infix_precedence < precedence || rule->infix_precedence >= limit)
+            return left;
 
-        ArrExpr *expr = memory_create_arr_expr(left_square_token, items, len_expr);
+        parser->current++;
+        left = rule->infix(parser, left, token);
 
-        return memory_create_expr(expr, ARR_EXPR_TYPE);
+        // a right operand may stop early at its own limit, what it left
+        // behind must not be taken by this loop either
+        if (rule->assoc != LEFT_ASSOC)
+            limit = rule->infix_precedence;
     }
-
-    return parser_type_expr(parser);
 }
 
-Expr *parser_type_expr(Parser *parser)
+Expr *parser_right_operand(Parser *parser, Token *operator_token)
 {
-    Expr *left = parser_bit_or(parser);
+    const ParserRule *rule = &parser_rules[operator_token->type];
 
-    if (parser_match(parser, 2, IS_TOKTYPE, FROM_TOKTYPE))
-    {
-        Token *previous_token = parser_previous(parser);
-
-        if (previous_token->type == IS_TOKTYPE)
-            return parser_is_expr(left, previous_token, parser);
-        else
-            return parser_from_expr(left, previous_token, parser);
-    }
+    if (rule->assoc == RIGHT_ASSOC)
+        return parser_expr_at(parser, rule->infix_precedence);
 
-    return left;
+    return parser_expr_at(parser, rule->infix_precedence + 1);
 }
 
-Expr *parser_bit_or(Parser *parser)
+Expr *parser_assign_expr(Parser *parser, Expr *left, Token *equals_token)
 {
-    Expr *left = parser_bit_xor(parser);
-
-    while (parser_match(parser, 1, BITWISE_OR_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_bit_xor(parser);
+    Expr *right = parser_right_operand(parser, equals_token);
 
-        BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
+    AssignExpr *expr = memory_create_assign_expr(left, equals_token, right);
 
-        left = memory_create_expr(expr, BINARY_EXPR_TYPE);
-    }
-
-    return left;
+    return memory_create_expr(expr, ASSIGN_EXPR_TYPE);
 }
 
-Expr *parser_bit_xor(Parser *parser)
+Expr *parser_is_expr(Parser *parser, Expr *left, Token *is_token)
 {
-    Expr *left = parser_bit_and(parser);
+    Token *type_token = parser_peek(parser);
 
-    while (parser_match(parser, 1, BITWISE_XOR_TOKTYPE))
+    switch (type_token->type)
+    {
+    case NIL_TOKTYPE:
+    case BOOL_TOKTYPE:
+    case INT_TOKTYPE:
+    case STR_TOKTYPE:
+    case ARR_TOKTYPE:
+    case PROC_TOKTYPE:
+    case CLASS_TOKTYPE:
+    case INSTANCE_TOKTYPE:
     {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_bit_and(parser);
+        parser->current++;
 
-        BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
+        IsExpr *expr = memory_create_is_expr(
+            left,
+            is_token,
+            type_token);
 
-        left = memory_create_expr(expr, BINARY_EXPR_TYPE);
+        return memory_create_expr(expr, IS_EXPR_TYPE);
     }
 
-    return left;
-}
-
-Expr *parser_bit_and(Parser *parser)
-{
-    Expr *left = parser_bit_not(parser);
-
-    while (parser_match(parser, 1, BITWISE_AND_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_bit_not(parser);
-
-        BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
-
-        left = memory_create_expr(expr, BINARY_EXPR_TYPE);
+    default:
+        parser_error_at(type_token, "Expect 'nil', 'bool', 'int', 'str', 'klass' or 'instance', but got something else.");
     }
 
-    return left;
+    return NULL;
 }
 
-Expr *parser_bit_not(Parser *parser)
+Expr *parser_from_expr(Parser *parser, Expr *left, Token *from_token)
 {
-    if (parser_match(parser, 1, BITWISE_NOT_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_bit_not(parser);
-
-        UnaryExpr *expr = memory_create_unary_expr(operator_token, right);
+    Token *klass_name_token = parser_consume(
+        parser,
+        IDENTIFIER_TOKTYPE,
+        "Expect klass identifier at right side of from expression.");
 
-        return memory_create_expr(expr, UNARY_EXPR_TYPE);
-    }
+    FromExpr *expr = memory_create_from_expr(
+        left,
+        from_token,
+        klass_name_token);
 
-    return parser_or_expr(parser);
+    return memory_create_expr(expr, FROM_EXPR_TYPE);
 }
 
-Expr *parser_or_expr(Parser *parser)
+Expr *parser_logical_expr(Parser *parser, Expr *left, Token *operator_token)
 {
-    Expr *left = parser_and_expr(parser);
-
-    while (parser_match(parser, 1, OR_TOKTYPE))
-    {
-        Token *operator= memory_clone_token(parser_previous(parser));
-        Expr *right = parser_and_expr(parser);
+    Expr *right = parser_right_operand(parser, operator_token);
 
-        LogicalExpr *expr = memory_create_logical_expr(left, operator, right);
-
-        left = memory_create_expr(expr, LOGICAL_EXPR_TYPE);
-    }
+    LogicalExpr *expr = memory_create_logical_expr(left, operator_token, right);
 
-    return left;
+    return memory_create_expr(expr, LOGICAL_EXPR_TYPE);
 }
 
-Expr *parser_and_expr(Parser *parser)
+Expr *parser_comparison_expr(Parser *parser, Expr *left, Token *operator_token)
 {
-    Expr *left = parser_comparison_expr(parser);
+    Expr *right = parser_right_operand(parser, operator_token);
 
-    while (parser_match(parser, 1, AND_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_comparison_expr(parser);
-
-        LogicalExpr *expr = memory_create_logical_expr(left, operator_token, right);
+    ComparisonExpr *expr = memory_create_comparison_expr(left, operator_token, right);
 
-        left = memory_create_expr(expr, LOGICAL_EXPR_TYPE);
-    }
-
-    return left;
+    return memory_create_expr(expr, COMPARISON_EXPR_TYPE);
 }
 
-Expr *parser_comparison_expr(Parser *parser)
+Expr *parser_binary_expr(Parser *parser, Expr *left, Token *operator_token)
 {
-    Expr *left = parser_shift_expr(parser);
-
-    while (parser_match(parser, 6,
-                        LESS_TOKTYPE,
-                        GREATER_TOKTYPE,
-                        LESS_EQUALS_TOKTYPE,
-                        GREATER_EQUALS_TOKTYPE,
-                        EQUALS_EQUALS_TOKTYPE,
-                        NOT_EQUALS_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_shift_expr(parser);
-
-        ComparisonExpr *expr = memory_create_comparison_expr(left, operator_token, right);
+    Expr *right = parser_right_operand(parser, operator_token);
 
-        left = memory_create_expr(expr, COMPARISON_EXPR_TYPE);
-    }
+    BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
 
-    return left;
+    return memory_create_expr(expr, BINARY_EXPR_TYPE);
 }
 
-Expr *parser_shift_expr(Parser *parser)
+Expr *parser_arr_access_expr(Parser *parser, Expr *left, Token *left_square_token)
 {
-    Expr *left = parser_term_expr(parser);
-
-    while (parser_match(parser, 2, SHIFT_LEFT, SHIFT_RIGHT))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_term_expr(parser);
+    Expr *index_expr = parser_expr_at(parser, TERM_PRECEDENCE);
+    ArrAccessExpr *expr = memory_create_arr_access_expr(left, left_square_token, index_expr);
 
-        BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
+    parser_consume(parser, RIGHT_SQUARE_TOKTYPE, "Expect ']' at end of array access expression.");
 
-        left = memory_create_expr(expr, BINARY_EXPR_TYPE);
-    }
-
-    return left;
+    return memory_create_expr(expr, ARR_ACCESS_EXPR_TYPE);
 }
 
-Expr *parser_term_expr(Parser *parser)
+Expr *parser_access_expr(Parser *parser, Expr *left, Token *dot_token)
 {
-    Expr *left = parser_factor_expr(parser);
-
-    while (parser_match(parser, 2, PLUS_TOKTYPE, MINUS_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_factor_expr(parser);
-
-        BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
+    Token *identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after '.'.");
 
-        left = memory_create_expr(expr, BINARY_EXPR_TYPE);
-    }
+    AccessExpr *expr = memory_create_access_expr(left, dot_token, identifier);
 
-    return left;
+    return memory_create_expr(expr, ACCESS_EXPR_TYPE);
 }
 
-Expr *parser_factor_expr(Parser *parser)
+Expr *parser_call_expr(Parser *parser, Expr *left, Token *left_parenthesis_token)
 {
-    Expr *left = parser_unary_expr(parser);
+    DynArrPtr *args = memory_create_dynarr_ptr();
 
-    while (parser_match(parser, 3, ASTERISK_TOKTYPE, SLASH_TOKTYPE, PERCENT_TOKTYPE))
+    if (!parser_check(parser, RIGHT_PARENTHESIS_TOKTYPE))
     {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_unary_expr(parser);
-
-        BinaryExpr *expr = memory_create_binary_expr(left, operator_token, right);
-
-        left = memory_create_expr(expr, BINARY_EXPR_TYPE);
+        do
+        {
+            Expr *expr = parser_expr(parser);
+            dynarr_ptr_insert((void *)expr, args);
+        } while (parser_match(parser, 1, COMMA_TOKTYPE));
     }
 
-    return left;
-}
-
-Expr *parser_unary_expr(Parser *parser)
-{
-    if (parser_match(parser, 2, MINUS_TOKTYPE, EXCLAMATION_TOKTYPE))
-    {
-        Token *operator_token = memory_clone_token(parser_previous(parser));
-        Expr *right = parser_unary_expr(parser);
-
-        UnaryExpr *expr = memory_create_unary_expr(operator_token, right);
+    parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of call expression argument list.");
 
-        return memory_create_expr(expr, UNARY_EXPR_TYPE);
-    }
+    CallExpr *expr = memory_create_call_expr(left, left_parenthesis_token, args);
 
-    return parser_access_expr(parser);
+    return memory_create_expr(expr, CALL_EXPR_TYPE);
 }
 
-Expr *parser_access_expr(Parser *parser)
+Expr *parser_arr_expr(Parser *parser, Token *left_square_token)
 {
-    Expr *left = parser_this_expr(parser);
+    DynArrPtr *items = memory_create_dynarr_ptr();
+    Expr *len_expr = NULL;
 
-    while (parser_match(parser, 3,
-                        LEFT_SQUARE_TOKTYPE,
-                        DOT_TOKTYPE,
-                        LEFT_PARENTHESIS_TOKTYPE))
+    if (!parser_check(parser, RIGHT_SQUARE_TOKTYPE))
     {
-        Token *previous = parser_previous(parser);
-
-        switch (previous->type)
-        {
-        case LEFT_SQUARE_TOKTYPE:
+        do
         {
-            do
-            {
-                Expr *index_expr = parser_term_expr(parser);
-                Token *left_square_index = memory_clone_token(previous);
-                ArrAccessExpr *expr = memory_create_arr_access_expr(left, left_square_index, index_expr);
-
-                left = memory_create_expr(expr, ARR_ACCESS_EXPR_TYPE);
+            dynarr_ptr_insert(parser_expr(parser), items);
+        } while (parser_match(parser, 1, COMMA_TOKTYPE));
+    }
 
-                parser_consume(parser, RIGHT_SQUARE_TOKTYPE, "Expect ']' at end of array access expression.");
+    parser_consume(parser, RIGHT_SQUARE_TOKTYPE, "Expect ']' at end or array creation expression.");
 
-            } while (parser_match(parser, 1, LEFT_SQUARE_TOKTYPE));
+    if (parser_match(parser, 1, COLON_TOKTYPE))
+        len_expr = parser_expr(parser);
 
-            break;
-        }
+    ArrExpr *expr = memory_create_arr_expr(left_square_token, items, len_expr);
 
-        case DOT_TOKTYPE:
-        {
-            Token *dot_token = memory_clone_token(previous);
-            Token *raw_identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after '.'.");
-            Token *identifier = memory_clone_token(raw_identifier);
+    return memory_create_expr(expr, ARR_EXPR_TYPE);
+}
 
-            AccessExpr *expr = memory_create_access_expr(left, dot_token, identifier);
+Expr *parser_unary_expr(Parser *parser, Token *operator_token)
+{
+    // the operand binds as tight as the operator itself, so '~' takes a
+    // whole '||' chain while '-' and '!' only take an access
+    Expr *right = parser_expr_at(parser, parser_rules[operator_token->type].prefix_precedence);
 
-            left = memory_create_expr(expr, ACCESS_EXPR_TYPE);
+    UnaryExpr *expr = memory_create_unary_expr(operator_token, right);
 
-            break;
-        }
+    return memory_create_expr(expr, UNARY_EXPR_TYPE);
+}
 
-        case LEFT_PARENTHESIS_TOKTYPE:
-        {
-            Token *left_parenthesis_token = memory_clone_token(previous);
-            DynArrPtr *args = memory_create_dynarr_ptr();
+Expr *parser_this_expr(Parser *parser, Token *this_token)
+{
+    Token *identifier_token = NULL;
 
-            if (!parser_check(parser, RIGHT_PARENTHESIS_TOKTYPE))
-            {
-                do
-                {
-                    Expr *expr = parser_expr(parser);
-                    dynarr_ptr_insert((void *)expr, args);
-                } while (parser_match(parser, 1, COMMA_TOKTYPE));
-            }
+    if (parser_match(parser, 1, DOT_TOKTYPE))
+        identifier_token = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after '.'");
 
-            parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of call expression argument list.");
+    ThisExpr *expr = memory_create_this_expr(this_token, identifier_token);
 
-            CallExpr *expr = memory_create_call_expr(left, left_parenthesis_token, args);
+    return memory_create_expr(expr, THIS_EXPR_TYPE);
+}
 
-            left = memory_create_expr(expr, CALL_EXPR_TYPE);
+Expr *parser_group_expr(Parser *parser, Token *left_paren_token)
+{
+    Expr *e = parser_expr(parser);
 
-            break;
-        }
+    parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of group expression.");
 
-        default:
-            assert(0 && "Illegal TokenType value");
-        }
-    }
+    GroupExpr *expr = memory_create_group_expr(left_paren_token, e);
 
-    return left;
+    return memory_create_expr(expr, GROUP_EXPR_TYPE);
 }
 
-Expr *parser_this_expr(Parser *parser)
+Expr *parser_identifier_expr(Parser *parser, Token *identifier_token)
 {
-    if (parser_match(parser, 1, THIS_TOKTYPE))
-    {
-        Token *raw_this_token = parser_previous(parser);
-        Token *this_token = memory_clone_token(raw_this_token);
-        Token *identifier_token = NULL;
-
-        if (parser_match(parser, 1, DOT_TOKTYPE))
-            identifier_token = memory_clone_token(parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after '.'"));
-
-        ThisExpr *expr = memory_create_this_expr(this_token, identifier_token);
+    IdentifierExpr *expr = memory_create_identifier_expr(identifier_token);
 
-        return memory_create_expr(expr, THIS_EXPR_TYPE);
-    }
-
-    return parser_literal_expr(parser);
+    return memory_create_expr(expr, IDENTIFIER_EXPR_TYPE);
 }
 
-Expr *parser_literal_expr(Parser *parser)
+Expr *parser_literal_expr(Parser *parser, Token *literal_token)
 {
-    if (parser_match(parser, 1, NIL_TOKTYPE))
+    switch (literal_token->type)
+    {
+    case NIL_TOKTYPE:
     {
-        Token *literal_token = memory_clone_token(parser_previous(parser));
-
         LiteralExpr *expr = memory_create_literal_expr(NULL, 0, literal_token);
 
         return memory_create_expr(expr, NIL_EXPR_TYPE);
     }
 
-    if (parser_match(parser, 2, TRUE_TOKTYPE, FALSE_TOKTYPE))
+    case TRUE_TOKTYPE:
+    case FALSE_TOKTYPE:
     {
-        Token *literal_token = memory_clone_token(parser_previous(parser));
         int8_t *literal = (int8_t *)memory_alloc(sizeof(int8_t));
 
         *literal = literal_token->type == TRUE_TOKTYPE ? 1 : 0;
@@ -571,53 +527,32 @@ Expr *parser_literal_expr(Parser *parser)
         return memory_create_expr(expr, BOOL_EXPR_TYPE);
     }
 
-    if (parser_match(parser, 1, INTEGER_TOKTYPE))
+    case INTEGER_TOKTYPE:
     {
-        Token *literal_token = memory_clone_token(parser_previous(parser));
         int64_t *literal = (int64_t *)memory_alloc(sizeof(int64_t));
 
-        *literal = *(int64_t *)literal_token->literal;
+        *literal = parser_token_to_i64(literal_token);
 
-        LiteralExpr *expr = memory_create_literal_expr(literal, literal_token->literal_size, literal_token);
+        LiteralExpr *expr = memory_create_literal_expr(literal, sizeof(int64_t), literal_token);
 
         return memory_create_expr(expr, INT_EXPR_TYPE);
     }
 
-    if (parser_match(parser, 1, STRING_TOKTYPE))
+    case STRING_TOKTYPE:
     {
-        Token *raw_literal_token = parser_previous(parser);
-        Token *literal_token = memory_clone_token(raw_literal_token);
-        char *literal = memory_clone_raw_str((char *)literal_token->literal);
+        // the slice still holds the surrounding quotes
+        size_t len = literal_token->length - 2;
+        char *literal = memory_clone_raw_str_range(literal_token->start + 1, len);
 
-        LiteralExpr *expr = memory_create_literal_expr(literal, literal_token->literal_size, literal_token);
+        LiteralExpr *expr = memory_create_literal_expr(literal, len, literal_token);
 
         return memory_create_expr(expr, STR_EXPR_TYPE);
     }
 
-    if (parser_match(parser, 1, IDENTIFIER_TOKTYPE))
-    {
-        Token *identifier_token = memory_clone_token(parser_previous(parser));
-        IdentifierExpr *expr = memory_create_identifier_expr(identifier_token);
-
-        return memory_create_expr(expr, IDENTIFIER_EXPR_TYPE);
-    }
-
-    if (parser_match(parser, 1, LEFT_PARENTHESIS_TOKTYPE))
-    {
-        Token *left_paren_token = memory_clone_token(parser_previous(parser));
-        Expr *e = parser_expr(parser);
-
-        parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of group expression.");
-
-        GroupExpr *expr = memory_create_group_expr(left_paren_token, e);
-
-        return memory_create_expr(expr, GROUP_EXPR_TYPE);
+    default:
+        assert(0 && "Illegal TokenType value");
     }
 
-    Token *token = parser_peek(parser);
-
-    parser_error_at(parser_peek(parser), "Expected something, but got '%s'", token->lexeme);
-
     return NULL;
 }
 
@@ -666,8 +601,7 @@ Stmt *parser_stmt(Parser *parser)
 
 Stmt *parser_var_decl_stmt(Parser *parser)
 {
-    Token *raw_identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after 'cl' keyword");
-    Token *identifier = memory_clone_token(raw_identifier);
+    Token *identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after 'cl' keyword");
     Expr *initializer = NULL;
 
     if (parser_match(parser, 1, EQUALS_TOKTYPE))
@@ -699,7 +633,7 @@ IfStmtBranch *parser_if_branch(Parser *parser)
 {
     parser_consume(parser, LEFT_PARENTHESIS_TOKTYPE, "Expect '(' at start of branch condition.");
 
-    Expr *condition = parser_type_expr(parser);
+    Expr *condition = parser_expr_at(parser, TYPE_PRECEDENCE);
 
     parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of branch condition.");
     parser_consume(parser, LEFT_BRACKET_TOKTYPE, "Expect '{' at start of branch body.");
@@ -736,7 +670,7 @@ Stmt *parser_if_stmt(Parser *parser)
 
 Stmt *parser_continue_stmt(Parser *parser)
 {
-    Token *continue_token = memory_clone_token(parser_previous(parser));
+    Token *continue_token = parser_previous(parser);
 
     parser_consume(parser, SEMICOLON_TOKTYPE, "Expect ';' at end of continue statement.");
 
@@ -747,7 +681,7 @@ Stmt *parser_continue_stmt(Parser *parser)
 
 Stmt *parser_break_stmt(Parser *parser)
 {
-    Token *break_token = memory_clone_token(parser_previous(parser));
+    Token *break_token = parser_previous(parser);
 
     parser_consume(parser, SEMICOLON_TOKTYPE, "Expect ';' at end of break statement.");
 
@@ -763,7 +697,7 @@ Stmt *parser_while_stmt(Parser *parser)
 
     parser_consume(parser, LEFT_PARENTHESIS_TOKTYPE, "Expect '(' after 'while' keyword.");
 
-    condition = parser_type_expr(parser);
+    condition = parser_expr_at(parser, TYPE_PRECEDENCE);
 
     parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of while statement condition.");
     parser_consume(parser, LEFT_BRACKET_TOKTYPE, "Expect '{' at start of while body.");
@@ -781,8 +715,7 @@ DynArrPtr *fn_params(Parser *parser)
 
     do
     {
-        Token *raw_param_token = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier as parameter.");
-        Token *param_token = memory_clone_token(raw_param_token);
+        Token *param_token = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier as parameter.");
 
         dynarr_ptr_insert((void *)param_token, params);
     } while (parser_match(parser, 1, COMMA_TOKTYPE));
@@ -801,18 +734,16 @@ Stmt *parser_for_stmt(Parser *parser)
     parser_consume(parser, LEFT_PARENTHESIS_TOKTYPE, "Expect '(' at start of for header.");
 
     identifier_token = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier.");
-    identifier_token = memory_clone_token(identifier_token);
-
     parser_consume(parser, IN_TOKTYPE, "Expect 'in' keyword after identifier.");
-    left_expr = parser_term_expr(parser);
+    left_expr = parser_expr_at(parser, TERM_PRECEDENCE);
 
     if (parser_match(parser, 2, DOWN_TOKTYPE, UP_TOKTYPE))
-        operator_token = memory_clone_token(parser_previous(parser));
+        operator_token = parser_previous(parser);
 
     if (!operator_token)
         parser_error_at(parser_peek(parser), "Expect 'down' or 'up', but got something else.");
 
-    right_expr = parser_term_expr(parser);
+    right_expr = parser_expr_at(parser, TERM_PRECEDENCE);
     parser_consume(parser, RIGHT_PARENTHESIS_TOKTYPE, "Expect ')' at end of for header.");
 
     parser_consume(parser, LEFT_BRACKET_TOKTYPE, "Expect '{' at start of for body.");
@@ -825,8 +756,7 @@ Stmt *parser_for_stmt(Parser *parser)
 
 Stmt *parser_fn_stmt(Parser *parser)
 {
-    Token *raw_identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after 'proc' keyword.");
-    Token *identifier = memory_clone_token(raw_identifier);
+    Token *identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect identifier after 'proc' keyword.");
     DynArrPtr *params = memory_create_dynarr_ptr();
     DynArrPtr *stmts = NULL;
 
@@ -864,8 +794,7 @@ FnStmt *class_constructor(Parser *parser, Token *init_token)
 
 Stmt *parser_class_stmt(Parser *parser)
 {
-    Token *raw_identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect class name after 'class' keyword.");
-    Token *identifier = memory_clone_token(raw_identifier);
+    Token *identifier = parser_consume(parser, IDENTIFIER_TOKTYPE, "Expect class name after 'class' keyword.");
     DynArrPtr *attributes = memory_create_dynarr_ptr();
     FnStmt *constructor = NULL;
     DynArrPtr *methods = memory_create_dynarr_ptr();
@@ -881,7 +810,7 @@ Stmt *parser_class_stmt(Parser *parser)
             if (previous_token->type == INIT_TOKTYPE)
             {
                 if (constructor)
-                    parser_error_at(raw_identifier, "Classes can't have more than one constructor.");
+                    parser_error_at(identifier, "Classes can't have more than one constructor.");
 
                 constructor = class_constructor(parser, previous_token);
 
@@ -901,7 +830,7 @@ Stmt *parser_class_stmt(Parser *parser)
 
 Stmt *parser_print_stmt(Parser *parser)
 {
-    Token *print_token = memory_clone_token(parser_previous(parser));
+    Token *print_token = parser_previous(parser);
     Expr *expr = parser_expr(parser);
     PrintStmt *stmt = memory_create_print_stmt(expr, print_token);
 
@@ -913,7 +842,7 @@ Stmt *parser_print_stmt(Parser *parser)
 Stmt *parser_return_stmt(Parser *parser)
 {
     Expr *value = NULL;
-    Token *return_token = memory_clone_token(parser_previous(parser));
+    Token *return_token = parser_previous(parser);
 
     if (!parser_check(parser, SEMICOLON_TOKTYPE))
         value = parser_expr(parser);
@@ -931,7 +860,7 @@ Stmt *parser_expr_stmt(Parser *parser)
 
     Token *token = parser_peek(parser);
 
-    parser_consume(parser, SEMICOLON_TOKTYPE, "Expect ';' at end of expression statement, but got '%s'.", token->lexeme);
+    parser_consume(parser, SEMICOLON_TOKTYPE, "Expect ';' at end of expression statement, but got '%.*s'.", (int)token->length, token->start);
 
     ExprStmt *stmt = memory_create_expr_stmt(expr);
 
@@ -943,4 +872,33 @@ void parser_parse(Parser *parser)
 {
     while (!parser_is_at_end(parser))
         dynarr_ptr_insert(parser_stmt(parser), parser->stmts);
+}
+
+Stmt *parser_parse_stmt(Parser *parser)
+{
+    if (parser_is_at_end(parser))
+        return NULL;
+
+    return parser_stmt(parser);
+}
+
+void parser_release_stmt(Parser *parser)
+{
+    Token ahead[PARSER_WINDOW];
+    int from = parser->current;
+    int to = parser->scanned;
+
+    // tokens already pulled for the next statement live in the ast region too
+    for (int i = from; i < to; i++)
+        ahead[i - from] = *parser_token_at(parser, i);
+
+    memory_ast_release();
+
+    for (int i = from; i < to; i++)
+    {
+        Token *token = (Token *)memory_alloc(sizeof(Token));
+
+        *token = ahead[i - from];
+        parser->window[i % PARSER_WINDOW] = token;
+    }
 }
\ No newline at end of file
@@ -5,11 +5,47 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCANNER_SIMD
+#endif
+
+typedef enum _scanner_simd_level_
+{
+    SCALAR_SIMD_LEVEL,
+    SSE2_SIMD_LEVEL,
+    AVX2_SIMD_LEVEL
+} ScannerSimdLevel;
+
+static ScannerSimdLevel simd_level = SCALAR_SIMD_LEVEL;
+
+// below this many bytes per worker, threads cost more than they save
+#define SCANNER_MIN_CHUNK 262144
+#define SCANNER_MAX_WORKERS 16
+
+typedef struct _scanner_chunk_
+{
+    size_t from;
+    size_t to;
+    int lines;      // newlines between 'from' and 'to'
+    StaticStr view; // the source cut at 'to'
+    Scanner scanner;
+    pthread_t thread;
+} ScannerChunk;
 
 void scanner_error_at(Scanner *scanner, char *msg, ...);
-void scanner_add_keyword(char *keyword, TokenType type, LZHTable *table);
-void scanner_clear_keywords(LZHTable *table);
+
+void scanner_detect_simd();
+size_t scanner_skip_blanks(char *raw, size_t from, size_t to, int *lines);
+size_t scanner_skip_identifier(char *raw, size_t from, size_t to);
+size_t scanner_find_char(char c, char *raw, size_t from, size_t to, int *lines);
+
+int scanner_is_keyword(char *keyword, char *lexeme, size_t len);
+TokenType scanner_keyword_type(char *lexeme, size_t len);
 
 int scanner_is_at_end(Scanner *scanner);
 int scanner_is_digit(char c);
@@ -20,13 +56,8 @@ char scanner_advance(Scanner *scanner);
 char scanner_peek(Scanner *scanner);
 int scanner_match(char c, Scanner *scanner);
 
-char *scanner_lexeme_range(int from, int to, Scanner *scanner);
-char *scanner_lexeme(Scanner *scanner);
-void scanner_add_token_literal(void *literal, size_t literal_size, TokenType type, Scanner *scanner);
 void scanner_add_token(TokenType type, Scanner *scanner);
 
-int64_t scanner_lexeme_to_i64(char *lexeme, Scanner *scanner);
-
 void scanner_comment(Scanner *scanner);
 void scanner_number(Scanner *scanner);
 void scanner_string(Scanner *scanner);
@@ -34,6 +65,9 @@ void scanner_identifier(Scanner *scanner);
 
 void scanner_scan_token(Scanner *scanner);
 
+void *scanner_chunk_worker(void *arg);
+void scanner_scan_range(Scanner *scanner, ScannerChunk *chunk, size_t from, int line);
+
 // private implementation
 void scanner_error_at(Scanner *scanner, char *msg, ...)
 {
@@ -45,25 +79,359 @@ void scanner_error_at(Scanner *scanner, char *msg, ...)
     va_end(args);
 }
 
-void scanner_add_keyword(char *keyword, TokenType type, LZHTable *table)
+//> simd
+// Runs of blanks, identifier characters and string or comment bodies are
+// classified 16 (SSE2) or 32 (AVX2) bytes at a time. Every kernel stops at
+// the first byte outside its class and leaves the tail to the scalar loop
+#ifdef SCANNER_SIMD
+static size_t skip_blanks_sse2(char *raw, size_t from, size_t to, int *lines)
 {
-    TokenType *mem_type = (TokenType *)memory_alloc(sizeof(TokenType));
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    __m128i newline = _mm_set1_epi8('\n');
 
-    *mem_type = type;
+    while (from + 16 <= to)
+    {
+        __m128i bytes = _mm_loadu_si128((__m128i *)(raw + from));
+        __m128i newlines = _mm_cmpeq_epi8(bytes, newline);
+        __m128i blanks = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)), newlines);
 
-    lzhtable_put((uint8_t *)keyword, strlen(keyword), mem_type, table, NULL);
+        uint32_t others = ~(uint32_t)_mm_movemask_epi8(blanks) & 0xFFFF;
+        uint32_t newline_mask = (uint32_t)_mm_movemask_epi8(newlines);
+        size_t skip = others ? (size_t)__builtin_ctz(others) : 16;
+
+        *lines += __builtin_popcount(newline_mask & ((1u << skip) - 1));
+        from += skip;
+
+        if (others)
+            return from;
+    }
+
+    return from;
+}
+
+static size_t skip_identifier_sse2(char *raw, size_t from, size_t to)
+{
+    __m128i lower_case = _mm_set1_epi8(0x20);
+    __m128i before_a = _mm_set1_epi8('a' - 1);
+    __m128i after_z = _mm_set1_epi8('z' + 1);
+    __m128i before_0 = _mm_set1_epi8('0' - 1);
+    __m128i after_9 = _mm_set1_epi8('9' + 1);
+    __m128i underscore = _mm_set1_epi8('_');
+
+    while (from + 16 <= to)
+    {
+        __m128i bytes = _mm_loadu_si128((__m128i *)(raw + from));
+        // bytes above 0x7f are negative, so the signed compares reject them
+        __m128i folded = _mm_or_si128(bytes, lower_case);
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, before_a), _mm_cmpgt_epi8(after_z, folded));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(bytes, before_0), _mm_cmpgt_epi8(after_9, bytes));
+        __m128i word = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(bytes, underscore));
+
+        uint32_t others = ~(uint32_t)_mm_movemask_epi8(word) & 0xFFFF;
+
+        if (others)
+            return from + (size_t)__builtin_ctz(others);
+
+        from += 16;
+    }
+
+    return from;
 }
 
-void scanner_clear_keywords(LZHTable *table)
+static size_t find_char_sse2(char c, char *raw, size_t from, size_t to, int *lines)
 {
-    LZHTableNode *node = table->nodes;
+    __m128i target = _mm_set1_epi8(c);
+    __m128i newline = _mm_set1_epi8('\n');
 
-    while (node)
+    while (from + 16 <= to)
     {
-        LZHTableNode *before = node->previous_table_node;
-        memory_dealloc(node->value);
-        node = before;
+        __m128i bytes = _mm_loadu_si128((__m128i *)(raw + from));
+
+        uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, target));
+        size_t skip = found ? (size_t)__builtin_ctz(found) : 16;
+
+        if (lines)
+        {
+            uint32_t newline_mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+            *lines += __builtin_popcount(newline_mask & ((1u << skip) - 1));
+        }
+
+        from += skip;
+
+        if (found)
+            return from;
     }
+
+    return from;
+}
+
+__attribute__((target("avx2"))) static size_t skip_blanks_avx2(char *raw, size_t from, size_t to, int *lines)
+{
+    __m256i space = _mm256_set1_epi8(' ');
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i newline = _mm256_set1_epi8('\n');
+
+    while (from + 32 <= to)
+    {
+        __m256i bytes = _mm256_loadu_si256((__m256i *)(raw + from));
+        __m256i newlines = _mm256_cmpeq_epi8(bytes, newline);
+        __m256i blanks = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), _mm256_cmpeq_epi8(bytes, tab)), newlines);
+
+        uint32_t others = ~(uint32_t)_mm256_movemask_epi8(blanks);
+        uint32_t newline_mask = (uint32_t)_mm256_movemask_epi8(newlines);
+        size_t skip = others ? (size_t)__builtin_ctz(others) : 32;
+
+        *lines += __builtin_popcount(skip == 32 ? newline_mask : newline_mask & ((1u << skip) - 1));
+        from += skip;
+
+        if (others)
+            return from;
+    }
+
+    return skip_blanks_sse2(raw, from, to, lines);
+}
+
+__attribute__((target("avx2"))) static size_t skip_identifier_avx2(char *raw, size_t from, size_t to)
+{
+    __m256i lower_case = _mm256_set1_epi8(0x20);
+    __m256i before_a = _mm256_set1_epi8('a' - 1);
+    __m256i after_z = _mm256_set1_epi8('z' + 1);
+    __m256i before_0 = _mm256_set1_epi8('0' - 1);
+    __m256i after_9 = _mm256_set1_epi8('9' + 1);
+    __m256i underscore = _mm256_set1_epi8('_');
+
+    while (from + 32 <= to)
+    {
+        __m256i bytes = _mm256_loadu_si256((__m256i *)(raw + from));
+        __m256i folded = _mm256_or_si256(bytes, lower_case);
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(folded, before_a), _mm256_cmpgt_epi8(after_z, folded));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, before_0), _mm256_cmpgt_epi8(after_9, bytes));
+        __m256i word = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(bytes, underscore));
+
+        uint32_t others = ~(uint32_t)_mm256_movemask_epi8(word);
+
+        if (others)
+            return from + (size_t)__builtin_ctz(others);
+
+        from += 32;
+    }
+
+    return skip_identifier_sse2(raw, from, to);
+}
+
+__attribute__((target("avx2"))) static size_t find_char_avx2(char c, char *raw, size_t from, size_t to, int *lines)
+{
+    __m256i target = _mm256_set1_epi8(c);
+    __m256i newline = _mm256_set1_epi8('\n');
+
+    while (from + 32 <= to)
+    {
+        __m256i bytes = _mm256_loadu_si256((__m256i *)(raw + from));
+
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, target));
+        size_t skip = found ? (size_t)__builtin_ctz(found) : 32;
+
+        if (lines)
+        {
+            uint32_t newline_mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline));
+            *lines += __builtin_popcount(skip == 32 ? newline_mask : newline_mask & ((1u << skip) - 1));
+        }
+
+        from += skip;
+
+        if (found)
+            return from;
+    }
+
+    return find_char_sse2(c, raw, from, to, lines);
+}
+#endif
+
+void scanner_detect_simd()
+{
+#ifdef SCANNER_SIMD
+    static char detected = 0;
+
+    if (detected)
+        return;
+
+    detected = 1;
+
+    __builtin_cpu_init();
+    simd_level = __builtin_cpu_supports("avx2") ? AVX2_SIMD_LEVEL : SSE2_SIMD_LEVEL;
+#endif
+}
+
+size_t scanner_skip_blanks(char *raw, size_t from, size_t to, int *lines)
+{
+#ifdef SCANNER_SIMD
+    if (simd_level == AVX2_SIMD_LEVEL)
+        from = skip_blanks_avx2(raw, from, to, lines);
+    else if (simd_level == SSE2_SIMD_LEVEL)
+        from = skip_blanks_sse2(raw, from, to, lines);
+#endif
+
+    for (; from < to; from++)
+    {
+        char c = raw[from];
+
+        if (c == '\n')
+            (*lines)++;
+        else if (c != ' ' && c != '\t')
+            break;
+    }
+
+    return from;
+}
+
+size_t scanner_skip_identifier(char *raw, size_t from, size_t to)
+{
+#ifdef SCANNER_SIMD
+    if (simd_level == AVX2_SIMD_LEVEL)
+        from = skip_identifier_avx2(raw, from, to);
+    else if (simd_level == SSE2_SIMD_LEVEL)
+        from = skip_identifier_sse2(raw, from, to);
+#endif
+
+    while (from < to && scanner_is_alpha_numeric(raw[from]))
+        from++;
+
+    return from;
+}
+
+// index of the first 'c' at or after 'from', counting the newlines skipped
+// into 'lines' unless it is NULL. Returns 'to' if there is none
+size_t scanner_find_char(char c, char *raw, size_t from, size_t to, int *lines)
+{
+#ifdef SCANNER_SIMD
+    if (simd_level == AVX2_SIMD_LEVEL)
+        from = find_char_avx2(c, raw, from, to, lines);
+    else if (simd_level == SSE2_SIMD_LEVEL)
+        from = find_char_sse2(c, raw, from, to, lines);
+#endif
+
+    for (; from < to && raw[from] != c; from++)
+        if (lines && raw[from] == '\n')
+            (*lines)++;
+
+    return from;
+}
+//< simd
+
+int scanner_is_keyword(char *keyword, char *lexeme, size_t len)
+{
+    return strlen(keyword) == len && memcmp(keyword, lexeme, len) == 0;
+}
+
+// Keywords are narrowed down by their first character, then each candidate
+// is checked by scanner_is_keyword, whose length test rejects most of them
+// before any memory is compared. Nothing gets hashed or copied
+TokenType scanner_keyword_type(char *lexeme, size_t len)
+{
+    switch (lexeme[0])
+    {
+    case 'a':
+        if (scanner_is_keyword("arr", lexeme, len))
+            return ARR_TOKTYPE;
+        break;
+
+    case 'b':
+        if (scanner_is_keyword("bool", lexeme, len))
+            return BOOL_TOKTYPE;
+        if (scanner_is_keyword("break", lexeme, len))
+            return BREAK_TOKTYPE;
+        break;
+
+    case 'c':
+        if (scanner_is_keyword("cl", lexeme, len))
+            return CL_TOKTYPE;
+        if (scanner_is_keyword("continue", lexeme, len))
+            return CONTINUE_TOKTYPE;
+        break;
+
+    case 'd':
+        if (scanner_is_keyword("down", lexeme, len))
+            return DOWN_TOKTYPE;
+        break;
+
+    case 'e':
+        if (scanner_is_keyword("elif", lexeme, len))
+            return ELIF_TOKTYPE;
+        if (scanner_is_keyword("else", lexeme, len))
+            return ELSE_TOKTYPE;
+        break;
+
+    case 'f':
+        if (scanner_is_keyword("for", lexeme, len))
+            return FOR_TOKTYPE;
+        if (scanner_is_keyword("from", lexeme, len))
+            return FROM_TOKTYPE;
+        if (scanner_is_keyword("false", lexeme, len))
+            return FALSE_TOKTYPE;
+        break;
+
+    case 'i':
+        if (scanner_is_keyword("if", lexeme, len))
+            return IF_TOKTYPE;
+        if (scanner_is_keyword("in", lexeme, len))
+            return IN_TOKTYPE;
+        if (scanner_is_keyword("is", lexeme, len))
+            return IS_TOKTYPE;
+        if (scanner_is_keyword("int", lexeme, len))
+            return INT_TOKTYPE;
+        if (scanner_is_keyword("init", lexeme, len))
+            return INIT_TOKTYPE;
+        if (scanner_is_keyword("instance", lexeme, len))
+            return INSTANCE_TOKTYPE;
+        break;
+
+    case 'k':
+        if (scanner_is_keyword("klass", lexeme, len))
+            return CLASS_TOKTYPE;
+        break;
+
+    case 'n':
+        if (scanner_is_keyword("nil", lexeme, len))
+            return NIL_TOKTYPE;
+        break;
+
+    case 'p':
+        if (scanner_is_keyword("proc", lexeme, len))
+            return PROC_TOKTYPE;
+        if (scanner_is_keyword("print", lexeme, len))
+            return PRINT_TOKTYPE;
+        break;
+
+    case 'r':
+        if (scanner_is_keyword("ret", lexeme, len))
+            return RETURN_TOKTYPE;
+        break;
+
+    case 's':
+        if (scanner_is_keyword("str", lexeme, len))
+            return STR_TOKTYPE;
+        break;
+
+    case 't':
+        if (scanner_is_keyword("true", lexeme, len))
+            return TRUE_TOKTYPE;
+        if (scanner_is_keyword("this", lexeme, len))
+            return THIS_TOKTYPE;
+        break;
+
+    case 'u':
+        if (scanner_is_keyword("up", lexeme, len))
+            return UP_TOKTYPE;
+        break;
+
+    case 'w':
+        if (scanner_is_keyword("while", lexeme, len))
+            return WHILE_TOKTYPE;
+        break;
+    }
+
+    return IDENTIFIER_TOKTYPE;
 }
 
 int scanner_is_at_end(Scanner *scanner)
@@ -114,64 +482,32 @@ int scanner_match(char c, Scanner *scanner)
     return 1;
 }
 
-char *scanner_lexeme_range(int from, int to, Scanner *scanner)
-{
-    char *raw_source = scanner->source->raw;
-
-    size_t len = to - from;
-    char *lexeme = (char *)memory_alloc(len + 1);
-
-    memcpy(lexeme, raw_source + from, len);
-    lexeme[len] = 0;
-
-    return lexeme;
-}
-
-char *scanner_lexeme(Scanner *scanner)
-{
-    return scanner_lexeme_range(scanner->start, scanner->current, scanner);
-}
-
-void scanner_add_token_literal(void *literal, size_t literal_size, TokenType type, Scanner *scanner)
+void scanner_add_token(TokenType type, Scanner *scanner)
 {
-    char *lexeme = scanner_lexeme(scanner);
-
     Token token = {0};
 
     token.line = scanner->line;
-    token.lexeme = lexeme;
-    token.literal = literal;
-    token.literal_size = literal_size;
+    token.start = scanner->source->raw + scanner->start;
+    token.length = (size_t)(scanner->current - scanner->start);
+    token.lexeme = NULL;
+    token.atom = -1;
     token.type = type;
 
-    dynarr_insert((void *)&token, scanner->tokens);
-}
-
-void scanner_add_token(TokenType type, Scanner *scanner)
-{
-    scanner_add_token_literal(NULL, 0, type, scanner);
-}
-
-int64_t scanner_lexeme_to_i64(char *lexeme, Scanner *scanner)
-{
-    int64_t value = 0;
-    size_t len = strlen(lexeme);
-
-    for (size_t i = 0; i < len; i++)
+    if (!scanner->tokens)
     {
-        char c = lexeme[i];
+        scanner->token = token;
+        scanner->pending = 1;
 
-        value *= 10;
-        value += c - 48;
+        return;
     }
 
-    return value;
+    dynarr_insert((void *)&token, scanner->tokens);
 }
 
 void scanner_comment(Scanner *scanner)
 {
-    while (!scanner_is_at_end(scanner) && scanner_peek(scanner) != '\n')
-        scanner_advance(scanner);
+    StaticStr *source = scanner->source;
+    scanner->current = (int)scanner_find_char('\n', source->raw, (size_t)scanner->current, source->len, NULL);
 }
 
 void scanner_number(Scanner *scanner)
@@ -179,55 +515,47 @@ void scanner_number(Scanner *scanner)
     while (!scanner_is_at_end(scanner) && scanner_is_digit(scanner_peek(scanner)))
         scanner_advance(scanner);
 
-    char *lexeme = scanner_lexeme(scanner);
-
-    size_t value_size = sizeof(int64_t);
-    int64_t *value = (int64_t *)memory_alloc(value_size);
-
-    *value = scanner_lexeme_to_i64(lexeme, scanner);
-
-    memory_destroy_raw_str(lexeme);
-
-    scanner_add_token_literal((void *)value, value_size, INTEGER_TOKTYPE, scanner);
+    // the value is decoded by the parser straight from the slice
+    scanner_add_token(INTEGER_TOKTYPE, scanner);
 }
 
 void scanner_string(Scanner *scanner)
 {
     int line = scanner->line;
+    StaticStr *source = scanner->source;
 
-    while (!scanner_is_at_end(scanner) && scanner_peek(scanner) != '"')
-        if (scanner_advance(scanner) == '\n')
-            line++;
+    scanner->current = (int)scanner_find_char('"', source->raw, (size_t)scanner->current, source->len, &line);
 
     if (scanner_peek(scanner) != '"')
+    {
+        // the string may close in the next chunk, the merge step decides
+        if (scanner->chunked)
+        {
+            scanner->open_string = scanner->start;
+            scanner->open_line = scanner->line;
+
+            return;
+        }
+
         scanner_error_at(scanner, "Unterminated string. Expect '\"' at end of string");
+    }
 
     scanner_advance(scanner);
 
-    char *literal = scanner_lexeme_range(scanner->start + 1, scanner->current - 1, scanner);
-    size_t len = strlen(literal);
-
-    scanner_add_token_literal((void *)literal, len, STRING_TOKTYPE, scanner);
+    scanner_add_token(STRING_TOKTYPE, scanner);
 
     scanner->line = line;
 }
 
 void scanner_identifier(Scanner *scanner)
 {
-    while (!scanner_is_at_end(scanner) && scanner_is_alpha_numeric(scanner_peek(scanner)))
-        scanner_advance(scanner);
+    StaticStr *source = scanner->source;
+    scanner->current = (int)scanner_skip_identifier(source->raw, (size_t)scanner->current, source->len);
 
-    char *lexeme = scanner_lexeme(scanner);
-    size_t len = strlen(lexeme);
+    char *lexeme = scanner->source->raw + scanner->start;
+    size_t len = (size_t)(scanner->current - scanner->start);
 
-    TokenType *type = lzhtable_get((uint8_t *)lexeme, len, scanner->keywords);
-
-    if (type)
-        scanner_add_token(*type, scanner);
-    else
-        scanner_add_token(IDENTIFIER_TOKTYPE, scanner);
-
-    memory_destroy_raw_str(lexeme);
+    scanner_add_token(scanner_keyword_type(lexeme, len), scanner);
 }
 
 void scanner_scan_token(Scanner *scanner)
@@ -356,10 +684,12 @@ void scanner_scan_token(Scanner *scanner)
 
     case '\n':
         scanner->line++;
+        scanner->current = (int)scanner_skip_blanks(scanner->source->raw, (size_t)scanner->current, scanner->source->len, &scanner->line);
         break;
 
     case ' ':
     case '\t':
+        scanner->current = (int)scanner_skip_blanks(scanner->source->raw, (size_t)scanner->current, scanner->source->len, &scanner->line);
         break;
 
     default:
@@ -369,6 +699,8 @@ void scanner_scan_token(Scanner *scanner)
             scanner_string(scanner);
         else if (scanner_is_alpha_numeric(c))
             scanner_identifier(scanner);
+        else if (scanner->speculative)
+            scanner->failed = 1;
         else
             scanner_error_at(scanner, "Unknown token '%c'", c);
 
@@ -376,50 +708,64 @@ void scanner_scan_token(Scanner *scanner)
     }
 }
 
+void *scanner_chunk_worker(void *arg)
+{
+    ScannerChunk *chunk = (ScannerChunk *)arg;
+    Scanner *scanner = &chunk->scanner;
+
+    while (!scanner_is_at_end(scanner) && !scanner->failed)
+    {
+        scanner_scan_token(scanner);
+        scanner->start = scanner->current;
+    }
+
+    char *c = chunk->view.raw + chunk->from;
+    char *end = chunk->view.raw + chunk->to;
+
+    while ((c = memchr(c, '\n', (size_t)(end - c))))
+    {
+        chunk->lines++;
+        c++;
+    }
+
+    return NULL;
+}
+
+// lexes 'chunk' again from 'from', now that the state at that point is known
+void scanner_scan_range(Scanner *scanner, ScannerChunk *chunk, size_t from, int line)
+{
+    StaticStr *source = scanner->source;
+
+    scanner->source = &chunk->view;
+    scanner->start = (int)from;
+    scanner->current = (int)from;
+    scanner->line = line;
+    scanner->chunked = 1;
+    scanner->open_string = -1;
+
+    while (!scanner_is_at_end(scanner))
+    {
+        scanner_scan_token(scanner);
+        scanner->start = scanner->current;
+    }
+
+    scanner->source = source;
+    scanner->chunked = 0;
+}
+
 // public implementation
 void scanner_print_tokens(DynArr *tokens)
 {
     for (size_t i = 0; i < tokens->used; i++)
     {
         Token *token = (Token *)dynarr_get(i, tokens);
-        printf("token %32.32s\tat line %7d\n", token->lexeme, token->line + 1);
+        printf("token %32.*s\tat line %7d\n", (int)token->length, token->start, token->line + 1);
     }
 }
 
 int scanner_scan_tokens(Scanner *scanner)
 {
-    LZHTable *keywords = scanner->keywords;
-
-    scanner_add_keyword("nil", NIL_TOKTYPE, keywords);
-    scanner_add_keyword("true", TRUE_TOKTYPE, keywords);
-    scanner_add_keyword("false", FALSE_TOKTYPE, keywords);
-    scanner_add_keyword("cl", CL_TOKTYPE, keywords);
-    scanner_add_keyword("if", IF_TOKTYPE, keywords);
-    scanner_add_keyword("elif", ELIF_TOKTYPE, keywords);
-    scanner_add_keyword("else", ELSE_TOKTYPE, keywords);
-    scanner_add_keyword("while", WHILE_TOKTYPE, keywords);
-    scanner_add_keyword("for", FOR_TOKTYPE, keywords);
-    scanner_add_keyword("break", BREAK_TOKTYPE, keywords);
-    scanner_add_keyword("continue", CONTINUE_TOKTYPE, keywords);
-    scanner_add_keyword("print", PRINT_TOKTYPE, keywords);
-    scanner_add_keyword("proc", PROC_TOKTYPE, keywords);
-    scanner_add_keyword("ret", RETURN_TOKTYPE, keywords);
-
-    scanner_add_keyword("in", IN_TOKTYPE, keywords);
-    scanner_add_keyword("up", UP_TOKTYPE, keywords);
-    scanner_add_keyword("down", DOWN_TOKTYPE, keywords);
-
-    scanner_add_keyword("is", IS_TOKTYPE, keywords);
-    scanner_add_keyword("from", FROM_TOKTYPE, keywords);
-    scanner_add_keyword("bool", BOOL_TOKTYPE, keywords);
-    scanner_add_keyword("int", INT_TOKTYPE, keywords);
-    scanner_add_keyword("str", STR_TOKTYPE, keywords);
-    scanner_add_keyword("arr", ARR_TOKTYPE, keywords);
-    scanner_add_keyword("instance", INSTANCE_TOKTYPE, keywords);
-
-    scanner_add_keyword("klass", CLASS_TOKTYPE, keywords);
-    scanner_add_keyword("init", INIT_TOKTYPE, keywords);
-    scanner_add_keyword("this", THIS_TOKTYPE, keywords);
+    scanner_detect_simd();
 
     while (!scanner_is_at_end(scanner))
     {
@@ -429,7 +775,152 @@ int scanner_scan_tokens(Scanner *scanner)
 
     scanner_add_token(EOF_TOKTYPE, scanner);
 
-    scanner_clear_keywords(keywords);
+    return 0;
+}
+
+int scanner_scan_tokens_parallel(Scanner *scanner, int workers)
+{
+    StaticStr *source = scanner->source;
+    size_t len = source->len;
+    size_t count = len / SCANNER_MIN_CHUNK;
+
+    if (workers > SCANNER_MAX_WORKERS)
+        workers = SCANNER_MAX_WORKERS;
+
+    if (count > (size_t)workers)
+        count = (size_t)workers;
+
+    if (count < 2 || !scanner->tokens || scanner->current != 0)
+        return scanner_scan_tokens(scanner);
+
+    // simd_level is shared by the workers, settle it before they start
+    scanner_detect_simd();
+
+    ScannerChunk *chunks = (ScannerChunk *)memory_calloc(sizeof(ScannerChunk) * count);
+    size_t from = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ScannerChunk *chunk = &chunks[i];
+        size_t to = i + 1 == count ? len : len / count * (i + 1);
+
+        if (to < from)
+            to = from;
+
+        // chunks end right after a newline, so only strings can cross them
+        if (to < len && i + 1 < count)
+        {
+            char *newline = memchr(source->raw + to, '\n', len - to);
+            to = newline ? (size_t)(newline - source->raw) + 1 : len;
+        }
+
+        chunk->from = from;
+        chunk->to = to;
+        chunk->view = *source;
+        chunk->view.len = to;
+
+        // worker tokens live on the C heap, the front-end region is not thread safe
+        chunk->scanner.line = 0;
+        chunk->scanner.start = (int)from;
+        chunk->scanner.current = (int)from;
+        chunk->scanner.tokens = dynarr_create(sizeof(Token), NULL);
+        chunk->scanner.source = &chunk->view;
+        chunk->scanner.chunked = 1;
+        chunk->scanner.speculative = 1;
+        chunk->scanner.open_string = -1;
+
+        assert(chunk->scanner.tokens && "failed to create chunk tokens");
+
+        from = to;
+    }
+
+    // the first chunk is lexed by the calling thread
+    for (size_t i = 1; i < count; i++)
+    {
+        if (pthread_create(&chunks[i].thread, NULL, scanner_chunk_worker, &chunks[i]))
+            assert(0 && "failed to start scanner worker");
+    }
+
+    scanner_chunk_worker(&chunks[0]);
+
+    for (size_t i = 1; i < count; i++)
+        pthread_join(chunks[i].thread, NULL);
+
+    // stitch: a chunk lexed from the right start state keeps its tokens,
+    // only moving them to absolute lines. A chunk entered inside a string,
+    // or holding an error, is lexed again from where the sequential scan would be
+    int line = scanner->line;
+    int open_string = -1;
+    int open_line = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ScannerChunk *chunk = &chunks[i];
+        DynArr *tokens = chunk->scanner.tokens;
+
+        if (open_string == -1 && !chunk->scanner.failed)
+        {
+            for (size_t o = 0; o < tokens->used; o++)
+            {
+                Token token = *(Token *)dynarr_get(o, tokens);
+                token.line += line;
+
+                dynarr_insert((void *)&token, scanner->tokens);
+            }
+
+            if (chunk->scanner.open_string != -1)
+            {
+                open_string = chunk->scanner.open_string;
+                open_line = line + chunk->scanner.open_line;
+            }
+        }
+        else
+        {
+            if (open_string == -1)
+                scanner_scan_range(scanner, chunk, chunk->from, line);
+            else
+                scanner_scan_range(scanner, chunk, (size_t)open_string, open_line);
+
+            open_string = scanner->open_string;
+            open_line = scanner->open_line;
+        }
+
+        line += chunk->lines;
+
+        dynarr_destroy(tokens);
+    }
+
+    memory_dealloc(chunks);
+
+    if (open_string != -1)
+    {
+        scanner->line = open_line;
+        scanner_error_at(scanner, "Unterminated string. Expect '\"' at end of string");
+    }
+
+    scanner->start = (int)len;
+    scanner->current = (int)len;
+    scanner->line = line;
+
+    scanner_add_token(EOF_TOKTYPE, scanner);
 
     return 0;
+}
+
+Token scanner_next_token(Scanner *scanner)
+{
+    scanner_detect_simd();
+
+    scanner->pending = 0;
+
+    while (!scanner->pending && !scanner_is_at_end(scanner))
+    {
+        scanner_scan_token(scanner);
+        scanner->start = scanner->current;
+    }
+
+    if (!scanner->pending)
+        scanner_add_token(EOF_TOKTYPE, scanner);
+
+    return scanner->token;
 }
\ No newline at end of file
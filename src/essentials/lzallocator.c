@@ -1,28 +1,45 @@
 #include "lzallocator.h"
 
+#include <sys/mman.h>
+
+#define BLOCK_AT(allocator, offset) ((struct _lzallocator_header_ *)(((unsigned char *)(allocator)->blocks) + (offset)))
+#define BLOCK_OFFSET(allocator, header) ((size_t)(((unsigned char *)(header)) - ((unsigned char *)(allocator)->blocks)))
+#define BLOCK_ORDER(size) ((size_t)__builtin_ctzll(size))
+
 // implementation
+void lzallocator_init(void *area, size_t bytes, struct _lzallocator_ *allocator)
+{
+    assert(lzallocator_is_power_of_two(bytes) && "Illegal bytes value. Not power of two");
+    assert(bytes >= ((size_t)1 << LZALLOCATOR_MIN_ORDER) && "Illegal bytes value. Smaller than the minimum block");
+
+    memset(allocator, 0, sizeof(struct _lzallocator_));
+
+    allocator->bytes = bytes;
+    allocator->blocks = (struct _lzallocator_header_ *)area;
+
+    allocator->blocks->size = bytes;
+    lzallocator_push_block(allocator->blocks, allocator);
+}
+
 struct _lzallocator_ *lzallocator_create(size_t bytes)
 {
     assert(lzallocator_is_power_of_two(bytes) && "Illegal bytes value. Not power of two");
 
-    void *area = malloc(bytes);
+    // mapped on its own, so destroying the allocator gives the pages back to the OS
+    void *area = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     struct _lzallocator_ *allocator = (struct _lzallocator_ *)malloc(sizeof(struct _lzallocator_));
 
-    if (!area || !allocator)
+    if (area == MAP_FAILED || !allocator)
     {
-        free(area);
+        if (area != MAP_FAILED)
+            munmap(area, bytes);
+
         free(allocator);
 
         return NULL;
     }
 
-    allocator->bytes = bytes;
-    allocator->blocks = (struct _lzallocator_header_ *)area;
-
-    allocator->blocks->free = 1;
-    allocator->blocks->size = bytes;
-    allocator->blocks->prev = NULL;
-    allocator->blocks->next = NULL;
+    lzallocator_init(area, bytes, allocator);
 
     return allocator;
 }
@@ -32,7 +49,7 @@ void lzallocator_destroy(struct _lzallocator_ *allocator)
     if (!allocator)
         return;
 
-    free(allocator->blocks);
+    munmap(allocator->blocks, allocator->bytes);
     free(allocator);
 }
 
@@ -61,27 +78,14 @@ int lzallocator_is_power_of_two(size_t value)
 
 size_t lzallocator_available_space(struct _lzallocator_ *allocator)
 {
-    size_t space = 0;
-    struct _lzallocator_header_ *current = allocator->blocks;
-
-    while (current)
-    {
-        struct _lzallocator_header_ *next = current->next;
-
-        if (current->free)
-            space += current->size;
-
-        current = next;
-    }
-
-    return space;
+    return allocator->free_bytes;
 }
 
 int lzallocator_validate_ptr(void *ptr, struct _lzallocator_ *allocator)
 {
     unsigned char *block_ptr = (unsigned char *)ptr;
 
-    return (block_ptr < (unsigned char *)allocator->blocks) || (block_ptr > (((unsigned char *)allocator->blocks) + allocator->bytes));
+    return (block_ptr < (unsigned char *)allocator->blocks) || (block_ptr >= (((unsigned char *)allocator->blocks) + allocator->bytes));
 }
 
 struct _lzallocator_header_ *lzallocator_get_header(void *ptr)
@@ -95,157 +99,148 @@ void *lzallocator_alloc_from_header(struct _lzallocator_header_ *header)
     assert(header->free && "header is not free");
 
     header->free = 0;
+    header->tag = 0;
 
     return (void *)(((unsigned char *)header) + LZALLOCATOR_HEADER_SIZE);
 }
 
-void lzallocator_join_blocks(struct _lzallocator_ *allocator)
+size_t lzallocator_order(size_t bytes)
 {
-    struct _lzallocator_header_ *current = allocator->blocks;
-
-    while (current)
-    {
-        struct _lzallocator_header_ *next = current->next;
+    size_t size = bytes + LZALLOCATOR_HEADER_SIZE;
 
-        if (next && current->free && next->free && lzallocator_is_power_of_two(current->size + next->size))
-        {
-            if (next->next)
-                next->next->prev = current;
+    if (size <= ((size_t)1 << LZALLOCATOR_MIN_ORDER))
+        return LZALLOCATOR_MIN_ORDER;
 
-            current->next = next->next;
-            current->size += next->size;
+    // log2 of the next power of two
+    return 64 - (size_t)__builtin_clzll(size - 1);
+}
 
-            continue;
-        }
+struct _lzallocator_header_ *lzallocator_buddy(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator)
+{
+    if (header->size >= allocator->bytes)
+        return NULL;
 
-        current = next;
-    }
+    // blocks sit at multiples of their size from the area start,
+    // so buddies only differ in the bit of that size
+    return BLOCK_AT(allocator, BLOCK_OFFSET(allocator, header) ^ header->size);
 }
 
-struct _lzallocator_header_ *lzallocator_split_block(struct _lzallocator_header_ *header)
+void lzallocator_push_block(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator)
 {
-    size_t header_size = sizeof(struct _lzallocator_header_);
+    size_t order = BLOCK_ORDER(header->size);
+    struct _lzallocator_header_ *head = allocator->free_lists[order];
 
-    // A block size can be less or equals to the header side.
-    // Blocks need to have enough space for headers, which contains
-    // information of that block: free, previous o next.
-    if (header->size / 2 <= header_size)
-        return NULL;
+    header->free = 1;
+    header->prev = NULL;
+    header->next = head;
 
-    header->size /= 2;
+    if (head)
+        head->prev = header;
 
-    unsigned char *area = (unsigned char *)header;
-    unsigned char *new_area = area + header->size;
+    allocator->free_lists[order] = header;
+    allocator->orders |= (size_t)1 << order;
+    allocator->free_bytes += header->size;
+}
 
-    struct _lzallocator_header_ *next = (struct _lzallocator_header_ *)new_area;
+void lzallocator_remove_block(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator)
+{
+    size_t order = BLOCK_ORDER(header->size);
 
-    next->free = 1;
-    next->size = header->size;
-    next->prev = header;
-    next->next = header->next;
+    if (header->prev)
+        header->prev->next = header->next;
+    else
+        allocator->free_lists[order] = header->next;
 
     if (header->next)
-        header->next->prev = next;
+        header->next->prev = header->prev;
 
-    header->next = next;
+    if (!allocator->free_lists[order])
+        allocator->orders &= ~((size_t)1 << order);
 
-    return next;
+    allocator->free_bytes -= header->size;
+
+    header->prev = NULL;
+    header->next = NULL;
 }
 
-struct _lzallocator_header_ *lzallocator_best_fit(size_t bytes, struct _lzallocator_ *allocator)
+struct _lzallocator_header_ *lzallocator_split_block(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator)
 {
-    size_t last_size = 0;
-    struct _lzallocator_header_ *header = NULL;
-    struct _lzallocator_header_ *current = allocator->blocks;
+    header->size /= 2;
 
-    while (current)
-    {
-        struct _lzallocator_header_ *next = current->next;
+    struct _lzallocator_header_ *buddy = (struct _lzallocator_header_ *)(((unsigned char *)header) + header->size);
 
-        if (current->free)
-        {
-            size_t current_size = LZALLOCATOR_CALC_BLOCK_SIZE(current->size);
+    buddy->size = header->size;
+    lzallocator_push_block(buddy, allocator);
 
-            if (bytes == current_size)
-                return current;
+    return buddy;
+}
 
-            if (current_size > bytes && (current_size < last_size || last_size == 0))
-            {
-                header = current;
-                last_size = current_size;
+struct _lzallocator_header_ *lzallocator_join_blocks(struct _lzallocator_header_ *header, struct _lzallocator_ *allocator)
+{
+    struct _lzallocator_header_ *buddy = NULL;
+
+    // the buddy can only be merged while it is whole and free,
+    // a split buddy has a smaller size in its first header
+    while ((buddy = lzallocator_buddy(header, allocator)) && buddy->free && buddy->size == header->size)
+    {
+        lzallocator_remove_block(buddy, allocator);
 
-                continue;
-            }
-        }
+        if (buddy < header)
+            header = buddy;
 
-        current = next;
+        header->size *= 2;
     }
 
     return header;
 }
 
-struct _lzallocator_header_ *lzallocator_find_by_split(size_t bytes, struct _lzallocator_header_ *header)
+int lzallocator_grow_block(struct _lzallocator_header_ *header, size_t order, struct _lzallocator_ *allocator)
 {
-    assert(header && "header is NULL");
-
-    size_t block_size = LZALLOCATOR_CALC_BLOCK_SIZE(header->size);
+    size_t offset = BLOCK_OFFSET(allocator, header);
 
-    if (!header->free)
-        return NULL;
-    if (bytes > block_size)
-        return NULL;
+    // the block must be the lower buddy at every level it grows through,
+    // and each upper buddy must be free and whole
+    for (size_t size = header->size; BLOCK_ORDER(size) < order; size *= 2)
+    {
+        struct _lzallocator_header_ *buddy = BLOCK_AT(allocator, offset + size);
 
-    if (bytes == block_size)
-        return header;
-    if (LZALLOCATOR_CALC_BLOCK_SIZE(header->size / 2) < bytes)
-        return header;
+        if ((offset & size) || offset + size >= allocator->bytes || !buddy->free || buddy->size != size)
+            return 0;
+    }
 
-    do
+    while (BLOCK_ORDER(header->size) < order)
     {
-        lzallocator_split_block(header);
-    } while (LZALLOCATOR_CALC_BLOCK_SIZE(header->size / 2) >= bytes);
+        lzallocator_remove_block(BLOCK_AT(allocator, offset + header->size), allocator);
+        header->size *= 2;
+    }
 
-    return header;
+    return 1;
 }
 
 void *lzallocator_alloc(size_t bytes, struct _lzallocator_ *allocator, struct _lzallocator_header_ **header_out)
 {
-    // If the first block was splitted, we need to check for every block to find the best for the request size
-    if (allocator->blocks->next)
-    {
-        struct _lzallocator_header_ *header = lzallocator_best_fit(bytes, allocator);
-
-        if (!header)
-            return NULL;
+    size_t order = lzallocator_order(bytes);
 
-        // If the found block size is bigger enough to contains the requested size twice, then we
-        // split the block to give the best block size possible
-        if (header->size / 2 >= bytes)
-            header = lzallocator_find_by_split(bytes, header);
-
-        if (header_out)
-            *header_out = header;
-
-        void *ptr = lzallocator_alloc_from_header(header);
+    if (order >= LZALLOCATOR_ORDERS)
+        return NULL;
 
-        lzallocator_join_blocks(allocator);
+    // smallest order with a free block, at or above the one needed
+    size_t available = allocator->orders & ~(((size_t)1 << order) - 1);
 
-        return ptr;
-    }
+    if (!available)
+        return NULL;
 
-    struct _lzallocator_header_ *header = lzallocator_find_by_split(bytes, allocator->blocks);
+    struct _lzallocator_header_ *header = allocator->free_lists[BLOCK_ORDER(available)];
 
-    if (!header)
-        return NULL;
+    lzallocator_remove_block(header, allocator);
 
-    void *ptr = lzallocator_alloc_from_header(header);
+    while (BLOCK_ORDER(header->size) > order)
+        lzallocator_split_block(header, allocator);
 
     if (header_out)
         *header_out = header;
 
-    lzallocator_join_blocks(allocator);
-
-    return ptr;
+    return lzallocator_alloc_from_header(header);
 }
 
 void *lzallocator_calloc(size_t bytes, struct _lzallocator_ *allocator, struct _lzallocator_header_ **header_out)
@@ -266,17 +261,31 @@ void *lzallocator_realloc(size_t bytes, void *ptr, struct _lzallocator_ *allocat
     if (lzallocator_validate_ptr(ptr, allocator))
         return NULL;
 
-    void *new_ptr = lzallocator_alloc(bytes, allocator, header_out);
+    struct _lzallocator_header_ *old_header = lzallocator_get_header(ptr);
+    size_t old_bytes = LZALLOCATOR_CALC_BLOCK_SIZE(old_header->size);
+    size_t order = lzallocator_order(bytes);
 
-    if (new_ptr)
+    if (order >= LZALLOCATOR_ORDERS)
+        return NULL;
+
+    // shrinks by giving the upper halves back, grows by taking in the free buddies above
+    while (BLOCK_ORDER(old_header->size) > order)
+        lzallocator_split_block(old_header, allocator);
+
+    if (BLOCK_ORDER(old_header->size) == order || lzallocator_grow_block(old_header, order, allocator))
     {
-        struct _lzallocator_header_ *old_header = lzallocator_get_header(ptr);
-        struct _lzallocator_header_ *new_header = lzallocator_get_header(new_ptr);
+        if (header_out)
+            *header_out = old_header;
 
-        size_t min = old_header->size < new_header->size ? old_header->size : new_header->size;
+        return ptr;
+    }
 
-        memcpy(new_ptr, ptr, min);
+    // the payload is all that moves
+    void *new_ptr = lzallocator_alloc(bytes, allocator, header_out);
 
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, old_bytes);
         lzallocator_dealloc(ptr, allocator);
     }
 
@@ -290,7 +299,9 @@ void lzallocator_dealloc(void *ptr, struct _lzallocator_ *allocator)
 
     struct _lzallocator_header_ *header = lzallocator_get_header(ptr);
 
-    header->free = 1;
+    assert(!header->free && "block already free");
 
-    lzallocator_join_blocks(allocator);
-}
\ No newline at end of file
+    header = lzallocator_join_blocks(header, allocator);
+
+    lzallocator_push_block(header, allocator);
+}
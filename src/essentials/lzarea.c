@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <assert.h>
 
+#define PAGE_OF(ptr) (((uintptr_t)(ptr)) >> LZAREA_PAGE_SHIFT)
+#define MAP_SLOT(page, container) ((size_t)(((page) * 11400714819323198485ULL) >> 32) & ((container)->map_m - 1))
+
 // private interface
 static void *_alloc_(size_t size, struct _lzarea_allocator_ *allocator);
 static void *_realloc_(void *ptr, size_t size, struct _lzarea_allocator_ *allocator);
@@ -18,11 +21,14 @@ int lzlinear_is_slot(void *ptr, struct _lzlinear_ *linear);
 #define LZLINEAR_AVAILABLE_SPACE(linear) (linear->slot_size * linear->slot_count - linear->used_bytes)
 
 void *lzlinear_alloc(struct _lzlinear_ *linear);
-void lzlinear_dealloc(void *ptr, struct _lzlinear_ *linear);
+int lzlinear_dealloc(void *ptr, struct _lzlinear_ *linear);
+
+static int _map_grow_(struct _lzlinear_container_ *container);
+static int _map_put_(struct _lzlinear_ *linear, struct _lzlinear_container_ *container);
+static struct _lzlinear_ *_map_get_(void *ptr, struct _lzlinear_container_ *container);
+static void _release_slot_(void *ptr, struct _lzlinear_ *linear, struct _lzlinear_container_ *container);
 
-static void *_get_header_(size_t position, struct _lzlinear_ *linear_slots);
 static struct _lzlinear_container_ *_has_container_slot_size_(size_t slot_size, struct _lzarea_ *area);
-static struct _lzlinear_container_ *_has_container_slot_(void *ptr, struct _lzarea_ *area);
 
 // private implementation
 void *_alloc_(size_t size, struct _lzarea_allocator_ *allocator)
@@ -51,8 +57,10 @@ void _dealloc_(void *ptr, struct _lzarea_allocator_ *allocator)
 
 struct _lzlinear_ *lzlinear_create(size_t slot_size, size_t slot_count, struct _lzarea_allocator_ *allocator)
 {
-    size_t size = (slot_size + 1) * slot_count;
-    void *slots = _alloc_(size, allocator);
+    if (slot_count > LZLINEAR_MAX_SLOTS)
+        slot_count = LZLINEAR_MAX_SLOTS;
+
+    void *slots = _alloc_(slot_size * slot_count, allocator);
     struct _lzlinear_ *linear = (struct _lzlinear_ *)_alloc_(sizeof(struct _lzlinear_), allocator);
 
     if (!slots || !linear)
@@ -63,13 +71,23 @@ struct _lzlinear_ *lzlinear_create(size_t slot_size, size_t slot_count, struct _
         return NULL;
     }
 
-    memset(slots, 0, size);
+    memset(linear, 0, sizeof(struct _lzlinear_));
+
+    // every slot starts free
+    for (size_t i = 0; i < slot_count; i += 64)
+    {
+        size_t left = slot_count - i;
+
+        linear->free_slots[i / 64] = left >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << left) - 1);
+        linear->summary |= (uint64_t)1 << (i / 64);
+    }
 
     linear->slot_size = slot_size;
     linear->slot_count = slot_count;
     linear->used_bytes = 0;
     linear->slots = slots;
     linear->next = NULL;
+    linear->next_available = NULL;
 
     return linear;
 }
@@ -90,82 +108,171 @@ void lzlinear_print_slots(size_t from, struct _lzlinear_ *linear)
 {
     for (size_t i = 0; i < linear->slot_count; i++)
     {
-        char *header = _get_header_(i, linear);
-        printf("%ld: %s, %ld\n", from + i, *header == 0 ? "free" : "used", linear->slot_size);
+        int free = (linear->free_slots[i / 64] >> (i % 64)) & 1;
+        printf("%ld: %s, %ld\n", from + i, free ? "free" : "used", linear->slot_size);
     }
 }
 
 int lzlinear_is_slot(void *ptr, struct _lzlinear_ *linear)
 {
-    return ptr >= linear->slots && ptr <= _get_header_(linear->slot_count - 1, linear) + linear->slot_size;
+    unsigned char *slots = (unsigned char *)linear->slots;
+
+    return (unsigned char *)ptr >= slots && (unsigned char *)ptr < slots + linear->slot_size * linear->slot_count;
 }
 
 void *lzlinear_alloc(struct _lzlinear_ *linear)
 {
-    // 0 = not used
-    // 1 = used
+    if (!linear->summary)
+        return NULL;
 
-    for (size_t i = 0; i < linear->slot_count; i++)
-    {
-        char *header = _get_header_(i, linear);
+    size_t word = (size_t)__builtin_ctzll(linear->summary);
+    size_t bit = (size_t)__builtin_ctzll(linear->free_slots[word]);
 
-        if (*header == 0)
-        {
-            *header = 1;
+    linear->free_slots[word] &= ~((uint64_t)1 << bit);
 
-            linear->used_bytes += linear->slot_size;
+    if (!linear->free_slots[word])
+        linear->summary &= ~((uint64_t)1 << word);
 
-            return header + 1;
-        }
-    }
+    linear->used_bytes += linear->slot_size;
 
-    return NULL;
+    return (unsigned char *)linear->slots + (word * 64 + bit) * linear->slot_size;
 }
 
-void lzlinear_dealloc(void *ptr, struct _lzlinear_ *linear)
+int lzlinear_dealloc(void *ptr, struct _lzlinear_ *linear)
 {
     if (!ptr)
-        return;
+        return 0;
 
     if (!lzlinear_is_slot(ptr, linear))
-        return;
+        return 0;
 
-    char *header = ((char *)ptr) - 1;
+    size_t offset = (size_t)((unsigned char *)ptr - (unsigned char *)linear->slots);
 
-    if (*header == 0)
-        return;
+    if (offset % linear->slot_size)
+        return 0;
 
-    *header = 0;
+    size_t index = offset / linear->slot_size;
+    size_t word = index / 64;
+    uint64_t mask = (uint64_t)1 << (index % 64);
+
+    if (linear->free_slots[word] & mask)
+        return 0;
+
+    linear->free_slots[word] |= mask;
+    linear->summary |= (uint64_t)1 << word;
 
     linear->used_bytes -= linear->slot_size;
+
+    return 1;
+}
+
+int _map_grow_(struct _lzlinear_container_ *container)
+{
+    size_t old_m = container->map_m;
+    uintptr_t *old_pages = container->map_pages;
+    struct _lzlinear_ **old_linears = container->map_linears;
+
+    size_t m = old_m == 0 ? 16 : old_m * 2;
+    uintptr_t *pages = (uintptr_t *)_alloc_(sizeof(uintptr_t) * m, container->allocator);
+    struct _lzlinear_ **linears = (struct _lzlinear_ **)_alloc_(sizeof(struct _lzlinear_ *) * m, container->allocator);
+
+    if (!pages || !linears)
+    {
+        _dealloc_(pages, container->allocator);
+        _dealloc_(linears, container->allocator);
+
+        return 1;
+    }
+
+    memset(linears, 0, sizeof(struct _lzlinear_ *) * m);
+
+    container->map_m = m;
+    container->map_pages = pages;
+    container->map_linears = linears;
+
+    for (size_t i = 0; i < old_m; i++)
+    {
+        if (!old_linears[i])
+            continue;
+
+        size_t slot = MAP_SLOT(old_pages[i], container);
+
+        while (linears[slot])
+            slot = (slot + 1) & (m - 1);
+
+        pages[slot] = old_pages[i];
+        linears[slot] = old_linears[i];
+    }
+
+    _dealloc_(old_pages, container->allocator);
+    _dealloc_(old_linears, container->allocator);
+
+    return 0;
 }
 
-void *_get_header_(size_t position, struct _lzlinear_ *linear)
+int _map_put_(struct _lzlinear_ *linear, struct _lzlinear_container_ *container)
 {
-    size_t skip_size = linear->slot_size + 1;
-    char *slots = (char *)linear->slots;
+    uintptr_t first = PAGE_OF(linear->slots);
+    uintptr_t last = PAGE_OF((unsigned char *)linear->slots + linear->slot_size * linear->slot_count - 1);
+
+    for (uintptr_t page = first; page <= last; page++)
+    {
+        // kept at most half full, so probes stay short
+        if ((container->map_n + 1) * 2 > container->map_m && _map_grow_(container))
+            return 1;
+
+        size_t slot = MAP_SLOT(page, container);
 
-    return (void *)(slots + skip_size * position);
+        while (container->map_linears[slot])
+            slot = (slot + 1) & (container->map_m - 1);
+
+        container->map_pages[slot] = page;
+        container->map_linears[slot] = linear;
+        container->map_n++;
+    }
+
+    return 0;
 }
 
-struct _lzlinear_container_ *_has_container_slot_size_(size_t slot_size, struct _lzarea_ *area)
+struct _lzlinear_ *_map_get_(void *ptr, struct _lzlinear_container_ *container)
 {
-    struct _lzlinear_container_ *container = area->head;
+    if (container->map_m == 0)
+        return NULL;
 
-    while (container)
+    uintptr_t page = PAGE_OF(ptr);
+    size_t slot = MAP_SLOT(page, container);
+
+    while (container->map_linears[slot])
     {
-        struct _lzlinear_container_ *next = container->next;
+        struct _lzlinear_ *linear = container->map_linears[slot];
 
-        if (container->slot_size == slot_size)
-            return container;
+        if (container->map_pages[slot] == page && lzlinear_is_slot(ptr, linear))
+            return linear;
 
-        container = next;
+        slot = (slot + 1) & (container->map_m - 1);
     }
 
     return NULL;
 }
 
-static struct _lzlinear_container_ *_has_container_slot_(void *ptr, struct _lzarea_ *area)
+void _release_slot_(void *ptr, struct _lzlinear_ *linear, struct _lzlinear_container_ *container)
+{
+    int was_full = !linear->summary;
+
+    if (!lzlinear_dealloc(ptr, linear))
+        return;
+
+    // back to the stack of linears with free slots
+    if (was_full)
+    {
+        linear->next_available = container->available;
+        container->available = linear;
+    }
+
+    container->used_bytes -= container->slot_size;
+}
+
+struct _lzlinear_container_ *_has_container_slot_size_(size_t slot_size, struct _lzarea_ *area)
 {
     struct _lzlinear_container_ *container = area->head;
 
@@ -173,7 +280,7 @@ static struct _lzlinear_container_ *_has_container_slot_(void *ptr, struct _lzar
     {
         struct _lzlinear_container_ *next = container->next;
 
-        if (lzlinear_container_is_slot(ptr, container))
+        if (container->slot_size == slot_size)
             return container;
 
         container = next;
@@ -188,24 +295,11 @@ struct _lzlinear_container_ *lzlinear_container_create(size_t slot_size, struct
     struct _lzlinear_container_ *container = (struct _lzlinear_container_ *)_alloc_(sizeof(struct _lzlinear_container_), allocator);
 
     if (!container)
-    {
-        _dealloc_(container, allocator);
-
         return NULL;
-    }
 
-    container->size = 0;
+    memset(container, 0, sizeof(struct _lzlinear_container_));
 
     container->slot_size = slot_size;
-
-    container->bytes = 0;
-    container->used_bytes = 0;
-
-    container->head = NULL;
-    container->tail = NULL;
-
-    container->next = NULL;
-
     container->allocator = allocator;
 
     return container;
@@ -228,6 +322,9 @@ void lzlinear_container_destroy(struct _lzlinear_container_ *container)
         slots = next;
     }
 
+    _dealloc_(container->map_pages, allocator);
+    _dealloc_(container->map_linears, allocator);
+
     memset(container, 0, sizeof(struct _lzlinear_container_));
 
     _dealloc_(container, allocator);
@@ -252,19 +349,7 @@ void lzlinear_container_print_slots(struct _lzlinear_container_ *container)
 
 int lzlinear_container_is_slot(void *ptr, struct _lzlinear_container_ *container)
 {
-    struct _lzlinear_ *linear = container->head;
-
-    while (linear)
-    {
-        struct _lzlinear_ *next = linear->next;
-
-        if (lzlinear_is_slot(ptr, linear))
-            return 1;
-
-        linear = next;
-    }
-
-    return 0;
+    return _map_get_(ptr, container) != NULL;
 }
 
 int lzlinear_container_add_linear(size_t slot_count, struct _lzlinear_container_ *container)
@@ -275,6 +360,12 @@ int lzlinear_container_add_linear(size_t slot_count, struct _lzlinear_container_
     if (!linear)
         return 1;
 
+    if (_map_put_(linear, container))
+    {
+        lzlinear_destroy(linear, allocator);
+        return 1;
+    }
+
     if (container->size == 0)
         container->head = linear;
     else
@@ -283,46 +374,40 @@ int lzlinear_container_add_linear(size_t slot_count, struct _lzlinear_container_
     container->size++;
     container->tail = linear;
 
-    container->bytes += container->slot_size * slot_count;
+    linear->next_available = container->available;
+    container->available = linear;
+
+    container->bytes += container->slot_size * linear->slot_count;
 
     return 0;
 }
 
 void *lzlinear_container_alloc(size_t slot_count, struct _lzlinear_container_ *container)
 {
-    if (LZLINEAR_CONTAINER_AVAILABLE(container) == 0)
+    if (!container->available)
     {
         if (slot_count == 0)
             return NULL;
 
         if (lzlinear_container_add_linear(slot_count, container))
             return NULL;
-
-        struct _lzlinear_ *tail = container->tail;
-
-        container->used_bytes += container->slot_size;
-
-        return lzlinear_alloc(tail);
     }
 
-    struct _lzlinear_ *linear = container->head;
+    struct _lzlinear_ *linear = container->available;
+    void *ptr = lzlinear_alloc(linear);
 
-    while (linear)
-    {
-        struct _lzlinear_ *next = linear->next;
-        size_t available = LZLINEAR_AVAILABLE_SPACE(linear);
+    assert(ptr && "available linear without free slots");
 
-        if (available > 0)
-        {
-            container->used_bytes += container->slot_size;
-
-            return lzlinear_alloc(linear);
-        }
-
-        linear = next;
+    // full linears leave the stack until one of their slots is freed
+    if (!linear->summary)
+    {
+        container->available = linear->next_available;
+        linear->next_available = NULL;
     }
 
-    return NULL;
+    container->used_bytes += container->slot_size;
+
+    return ptr;
 }
 
 void lzlinear_container_dealloc(void *ptr, struct _lzlinear_container_ *container)
@@ -330,23 +415,10 @@ void lzlinear_container_dealloc(void *ptr, struct _lzlinear_container_ *containe
     if (!ptr)
         return;
 
-    struct _lzlinear_ *linear = container->head;
-
-    while (linear)
-    {
-        struct _lzlinear_ *next = linear->next;
-
-        if (lzlinear_is_slot(ptr, linear))
-        {
-            container->used_bytes -= linear->slot_size;
-
-            lzlinear_dealloc(ptr, linear);
-
-            return;
-        }
+    struct _lzlinear_ *linear = _map_get_(ptr, container);
 
-        linear = next;
-    }
+    if (linear)
+        _release_slot_(ptr, linear, container);
 }
 
 struct _lzarea_ *lzarea_create(struct _lzarea_allocator_ *allocator)
@@ -431,10 +503,31 @@ void *lzarea_alloc(size_t bytes, size_t slot_count, struct _lzarea_ *area)
 
 void lzarea_dealloc(void *ptr, struct _lzarea_ *area)
 {
-    struct _lzlinear_container_ *container = _has_container_slot_(ptr, area);
-
-    if(!container)
+    if (!ptr)
         return;
 
-    lzlinear_container_dealloc(ptr, container);
-}
\ No newline at end of file
+    // one lookup per slot size
+    for (struct _lzlinear_container_ *container = area->head; container; container = container->next)
+    {
+        struct _lzlinear_ *linear = _map_get_(ptr, container);
+
+        if (linear)
+        {
+            _release_slot_(ptr, linear, container);
+            return;
+        }
+    }
+}
+
+void lzarea_stats(struct _lzarea_ *area, struct _lzarea_stats_ *stats)
+{
+    memset(stats, 0, sizeof(struct _lzarea_stats_));
+
+    for (struct _lzlinear_container_ *container = area->head; container; container = container->next)
+    {
+        stats->containers++;
+        stats->linears += container->size;
+        stats->bytes += container->bytes;
+        stats->used_bytes += container->used_bytes;
+    }
+}
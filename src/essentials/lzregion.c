@@ -0,0 +1,200 @@
+#include "lzregion.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// every allocation is preceded by its aligned size, needed by realloc
+#define HEADER_SIZE (sizeof(size_t))
+#define ALIGN(size) (((size) + (LZREGION_ALIGNMENT - 1)) & ~(LZREGION_ALIGNMENT - 1))
+#define CHUNK_DATA(chunk) ((char *)(chunk) + sizeof(struct _lzregion_chunk_))
+#define PTR_SIZE(ptr) (*(size_t *)((char *)(ptr) - HEADER_SIZE))
+
+// private interface
+static void *_alloc_(size_t size, struct _lzregion_allocator_ *allocator);
+static void _dealloc_(void *ptr, struct _lzregion_allocator_ *allocator);
+
+static struct _lzregion_chunk_ *_add_chunk_(size_t bytes, struct _lzregion_ *region);
+
+// private implementation
+void *_alloc_(size_t size, struct _lzregion_allocator_ *allocator)
+{
+    return allocator ? allocator->alloc(size) : malloc(size);
+}
+
+void _dealloc_(void *ptr, struct _lzregion_allocator_ *allocator)
+{
+    if (!ptr)
+        return;
+
+    if (allocator)
+    {
+        allocator->dealloc(ptr);
+        return;
+    }
+
+    free(ptr);
+}
+
+struct _lzregion_chunk_ *_add_chunk_(size_t bytes, struct _lzregion_ *region)
+{
+    size_t size = bytes > region->chunk_size ? bytes : region->chunk_size;
+    struct _lzregion_chunk_ *chunk = (struct _lzregion_chunk_ *)_alloc_(sizeof(struct _lzregion_chunk_) + size, region->allocator);
+
+    if (!chunk)
+        return NULL;
+
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->prev = region->chunks;
+
+    region->bytes += size;
+    region->chunks = chunk;
+
+    return chunk;
+}
+
+// public implementation
+struct _lzregion_ *lzregion_create(size_t chunk_size, struct _lzregion_allocator_ *allocator)
+{
+    struct _lzregion_ *region = (struct _lzregion_ *)_alloc_(sizeof(struct _lzregion_), allocator);
+
+    if (!region)
+        return NULL;
+
+    region->chunk_size = ALIGN(chunk_size);
+    region->bytes = 0;
+    region->used_bytes = 0;
+
+    region->last = NULL;
+    region->chunks = NULL;
+
+    region->allocator = allocator;
+
+    return region;
+}
+
+void lzregion_destroy(struct _lzregion_ *region)
+{
+    if (!region)
+        return;
+
+    struct _lzregion_chunk_ *chunk = region->chunks;
+    struct _lzregion_allocator_ *allocator = region->allocator;
+
+    while (chunk)
+    {
+        struct _lzregion_chunk_ *prev = chunk->prev;
+
+        _dealloc_(chunk, allocator);
+
+        chunk = prev;
+    }
+
+    memset(region, 0, sizeof(struct _lzregion_));
+
+    _dealloc_(region, allocator);
+}
+
+void lzregion_reset(struct _lzregion_ *region)
+{
+    struct _lzregion_chunk_ *chunk = region->chunks;
+
+    if (!chunk)
+        return;
+
+    while (chunk->prev)
+    {
+        struct _lzregion_chunk_ *prev = chunk->prev;
+
+        region->bytes -= chunk->size;
+        _dealloc_(chunk, region->allocator);
+
+        chunk = prev;
+    }
+
+    chunk->used = 0;
+
+    region->used_bytes = 0;
+    region->last = NULL;
+    region->chunks = chunk;
+}
+
+void *lzregion_alloc(size_t bytes, struct _lzregion_ *region)
+{
+    size_t size = ALIGN(bytes);
+    size_t total = HEADER_SIZE + size;
+    struct _lzregion_chunk_ *chunk = region->chunks;
+
+    if (!chunk || chunk->size - chunk->used < total)
+        chunk = _add_chunk_(total, region);
+
+    if (!chunk)
+        return NULL;
+
+    char *header = CHUNK_DATA(chunk) + chunk->used;
+
+    *(size_t *)header = size;
+
+    chunk->used += total;
+    region->used_bytes += total;
+    region->last = header + HEADER_SIZE;
+
+    return region->last;
+}
+
+void *lzregion_calloc(size_t bytes, struct _lzregion_ *region)
+{
+    void *ptr = lzregion_alloc(bytes, region);
+
+    if (ptr)
+        memset(ptr, 0, bytes);
+
+    return ptr;
+}
+
+void *lzregion_realloc(size_t bytes, void *ptr, struct _lzregion_ *region)
+{
+    if (!ptr)
+        return lzregion_alloc(bytes, region);
+
+    size_t old_size = PTR_SIZE(ptr);
+    size_t new_size = ALIGN(bytes);
+
+    if (new_size <= old_size)
+        return ptr;
+
+    struct _lzregion_chunk_ *chunk = region->chunks;
+    size_t grow = new_size - old_size;
+
+    // the newest allocation sits at the bump pointer, so it can grow in place
+    if (ptr == region->last && chunk->size - chunk->used >= grow)
+    {
+        PTR_SIZE(ptr) = new_size;
+
+        chunk->used += grow;
+        region->used_bytes += grow;
+
+        return ptr;
+    }
+
+    void *new_ptr = lzregion_alloc(bytes, region);
+
+    if (!new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size);
+
+    return new_ptr;
+}
+
+void lzregion_dealloc(void *ptr, struct _lzregion_ *region)
+{
+    if (!ptr || ptr != region->last)
+        return;
+
+    size_t total = HEADER_SIZE + PTR_SIZE(ptr);
+
+    region->chunks->used -= total;
+    region->used_bytes -= total;
+    region->last = NULL;
+}
@@ -0,0 +1,150 @@
+#include "lzslab.h"
+
+#include <assert.h>
+
+#define ALIGN(size) (((size) + (LZSLAB_ALIGNMENT - 1)) & ~((size_t)LZSLAB_ALIGNMENT - 1))
+
+// private interface
+static void _unlink_(struct _lzslab_page_ *page, struct _lzslab_page_ **list);
+static void _link_(struct _lzslab_page_ *page, struct _lzslab_page_ **list);
+static struct _lzslab_page_ *_add_page_(struct _lzslab_ *slab);
+static void _remove_page_(struct _lzslab_page_ *page, struct _lzslab_page_ **list, struct _lzslab_ *slab);
+
+// private implementation
+void _unlink_(struct _lzslab_page_ *page, struct _lzslab_page_ **list)
+{
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        *list = page->next;
+
+    if (page->next)
+        page->next->prev = page->prev;
+
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+void _link_(struct _lzslab_page_ *page, struct _lzslab_page_ **list)
+{
+    page->prev = NULL;
+    page->next = *list;
+
+    if (*list)
+        (*list)->prev = page;
+
+    *list = page;
+}
+
+struct _lzslab_page_ *_add_page_(struct _lzslab_ *slab)
+{
+    struct _lzslab_page_ *page = (struct _lzslab_page_ *)slab->allocator->alloc(slab->page_size);
+
+    if (!page)
+        return NULL;
+
+    // slots are threaded lazily, the bump pointer hands out the ones never used
+    page->used = 0;
+    page->free = NULL;
+    page->bump = (unsigned char *)page + ALIGN(sizeof(struct _lzslab_page_));
+    page->end = (unsigned char *)page + slab->page_size;
+    page->slab = slab;
+
+    _link_(page, &slab->partial);
+    slab->pages++;
+
+    return page;
+}
+
+void _remove_page_(struct _lzslab_page_ *page, struct _lzslab_page_ **list, struct _lzslab_ *slab)
+{
+    _unlink_(page, list);
+    slab->pages--;
+
+    slab->allocator->dealloc(page);
+}
+
+// public implementation
+void lzslab_init(size_t slot_size, size_t page_size, struct _lzslab_allocator_ *allocator, struct _lzslab_ *slab)
+{
+    slot_size = ALIGN(slot_size < sizeof(void *) ? sizeof(void *) : slot_size);
+
+    assert(page_size >= ALIGN(sizeof(struct _lzslab_page_)) + slot_size && "Illegal page size. No room for a slot");
+
+    slab->slot_size = slot_size;
+    slab->page_size = page_size;
+    slab->pages = 0;
+    slab->used_slots = 0;
+
+    slab->partial = NULL;
+    slab->full = NULL;
+
+    slab->allocator = allocator;
+}
+
+void lzslab_deinit(struct _lzslab_ *slab)
+{
+    while (slab->partial)
+        _remove_page_(slab->partial, &slab->partial, slab);
+
+    while (slab->full)
+        _remove_page_(slab->full, &slab->full, slab);
+
+    slab->used_slots = 0;
+}
+
+void *lzslab_alloc(struct _lzslab_ *slab)
+{
+    struct _lzslab_page_ *page = slab->partial;
+
+    if (!page && !(page = _add_page_(slab)))
+        return NULL;
+
+    void *ptr = page->free;
+
+    if (ptr)
+        page->free = *(void **)ptr;
+    else
+    {
+        ptr = page->bump;
+        page->bump += slab->slot_size;
+    }
+
+    page->used++;
+    slab->used_slots++;
+
+    if (!page->free && page->bump + slab->slot_size > page->end)
+    {
+        _unlink_(page, &slab->partial);
+        _link_(page, &slab->full);
+    }
+
+    return ptr;
+}
+
+void lzslab_dealloc(void *ptr, struct _lzslab_page_ *page)
+{
+    if (!ptr)
+        return;
+
+    struct _lzslab_ *slab = page->slab;
+
+    assert(page->used > 0 && "page has no slots in use");
+
+    // a full page has neither free slots nor room to bump
+    if (!page->free && page->bump + slab->slot_size > page->end)
+    {
+        _unlink_(page, &slab->full);
+        _link_(page, &slab->partial);
+    }
+
+    *(void **)ptr = page->free;
+    page->free = ptr;
+
+    page->used--;
+    slab->used_slots--;
+
+    // empty pages go back, except the last one with room, kept for the next allocations
+    if (page->used == 0 && (page->prev || page->next))
+        _remove_page_(page, &slab->partial, slab);
+}
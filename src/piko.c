@@ -7,64 +7,283 @@
 #include "vm/vm_memory.h"
 #include "vm/vm.h"
 #include "vm/dummper.h"
+#include "vm/jit.h"
+#include "vm/aot.h"
+#include "vm/bytecode.h"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-void clear_tokens(DynArr *tokens)
+// scans, parses and compiles 'source' into 'vm', destroying 'source'
+void compile_source(StaticStr *source, VM *vm)
 {
-    for (size_t i = 0; i < tokens->used; i++)
+    // scanner phase
+    DynArr *tokens = memory_create_dynarr(sizeof(Token));
+    Scanner *scanner = memory_create_scanner(tokens, source);
+
+    scanner_scan_tokens_parallel(scanner, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    memory_destroy_scanner(scanner);
+
+    // parser phase
+    DynArrPtr *stmts = memory_create_dynarr_ptr();
+    Parser *parser = memory_create_parser(tokens, NULL, stmts);
+
+    parser_parse(parser);
+
+    memory_destroy_parser(parser);
+
+    // compiler phase
+    compiler_compile(vm, stmts);
+
+    // tokens are slices of 'source', so it must outlive the compiler phase.
+    // Tokens and the ast are released with the front-end region
+    memory_destroy_static_str(source);
+}
+
+// like compile_source, but each top-level statement is compiled and
+// released right after it is parsed, so the whole ast never exists at once
+void stream_source(StaticStr *source, VM *vm)
+{
+    Scanner *scanner = memory_create_scanner(NULL, source);
+    Parser *parser = memory_create_parser(NULL, scanner, NULL);
+
+    compiler_begin(vm);
+    memory_ast_begin();
+
+    Stmt *stmt = NULL;
+
+    while ((stmt = parser_parse_stmt(parser)))
     {
-        Token *token = (Token *)dynarr_get(i, tokens);
+        memory_ast_end();
+        compiler_compile_stmt(stmt);
+        memory_ast_begin();
 
-        memory_dealloc(token->lexeme);
-        memory_dealloc(token->literal);
+        parser_release_stmt(parser);
     }
+
+    memory_ast_end();
+    compiler_end();
+
+    memory_destroy_parser(parser);
+    memory_destroy_scanner(scanner);
+    memory_destroy_static_str(source);
+}
+
+// parses a heap size given in MiB, 0 when it isn't a valid one
+static size_t parse_heap_size(const char *str)
+{
+    char *end = NULL;
+    unsigned long long mib = strtoull(str, &end, 10);
+
+    if (end == str || *end || mib == 0 || mib > SIZE_MAX / (1024 * 1024))
+        return 0;
+
+    return (size_t)mib * 1024 * 1024;
+}
+
+// parses a collector growth factor, 0 when it isn't greater than 1
+static double parse_gc_growth(const char *str)
+{
+    char *end = NULL;
+    double growth = strtod(str, &end);
+
+    if (end == str || *end || !(growth > 1.0) || growth > 1000.0)
+        return 0;
+
+    return growth;
+}
+
+// parses a size given in KiB, 0 when it isn't a valid one
+static size_t parse_gc_min_heap(const char *str)
+{
+    char *end = NULL;
+    unsigned long long kib = strtoull(str, &end, 10);
+
+    if (end == str || *end || kib == 0 || kib > SIZE_MAX / 1024)
+        return 0;
+
+    return (size_t)kib * 1024;
+}
+
+// parses a nursery size given in KiB, where 0 turns minor collections off.
+// Returns 0 when it isn't a valid one
+static int parse_gc_nursery(const char *str, size_t *out_bytes)
+{
+    char *end = NULL;
+    unsigned long long kib = strtoull(str, &end, 10);
+
+    if (end == str || *end || kib > SIZE_MAX / 1024)
+        return 0;
+
+    *out_bytes = (size_t)kib * 1024;
+
+    return 1;
+}
+
+// parses a pause given in microseconds, 0 when it isn't a valid one
+static size_t parse_gc_max_pause(const char *str)
+{
+    char *end = NULL;
+    unsigned long long us = strtoull(str, &end, 10);
+
+    if (end == str || *end || us == 0 || us > SIZE_MAX)
+        return 0;
+
+    return (size_t)us;
+}
+
+// parses a count of collector threads, 0 when it isn't a valid one
+static size_t parse_gc_threads(const char *str)
+{
+    char *end = NULL;
+    unsigned long long threads = strtoull(str, &end, 10);
+
+    if (end == str || *end || threads == 0 || threads > VM_GC_MAX_THREADS)
+        return 0;
+
+    return (size_t)threads;
 }
 
 int main(int argc, char const *argv[])
 {
-    if (argc != 2)
+    char *source_path = NULL;
+    JitMode jit_mode = JIT_ON_MODE;
+    char aot_mode = 0;
+    char cache_mode = 1;
+    char stream_mode = 1;
+    size_t heap_limit = 0;
+    char *heap_env = getenv("PIKO_MAX_HEAP");
+
+    if (heap_env && !(heap_limit = parse_heap_size(heap_env)))
+        fprintf(stderr, "Ignoring PIKO_MAX_HEAP, expected a size in MiB\n");
+
+    // collections run once the heap outgrows what survived the last one by PIKO_GC_GROWTH,
+    // and never below PIKO_GC_MIN_HEAP. Minor ones run every PIKO_GC_NURSERY allocated.
+    // With PIKO_GC_MAX_PAUSE full collections run in steps that pause that long at most,
+    // otherwise they mark and sweep on PIKO_GC_THREADS threads. PIKO_GC_STATS reports
+    // the collector pauses on exit
+    double gc_growth = VM_GC_GROWTH;
+    size_t gc_min = VM_GC_MIN_BYTES;
+    size_t gc_nursery = VM_GC_NURSERY_BYTES;
+    size_t gc_max_pause = 0;
+    size_t gc_threads = VM_GC_THREADS;
+    char *growth_env = getenv("PIKO_GC_GROWTH");
+    char *min_env = getenv("PIKO_GC_MIN_HEAP");
+    char *nursery_env = getenv("PIKO_GC_NURSERY");
+    char *pause_env = getenv("PIKO_GC_MAX_PAUSE");
+    char *threads_env = getenv("PIKO_GC_THREADS");
+    char *stats_env = getenv("PIKO_GC_STATS");
+
+    if (growth_env && !(gc_growth = parse_gc_growth(growth_env)))
+    {
+        fprintf(stderr, "Ignoring PIKO_GC_GROWTH, expected a factor greater than 1\n");
+        gc_growth = VM_GC_GROWTH;
+    }
+
+    if (min_env && !(gc_min = parse_gc_min_heap(min_env)))
+    {
+        fprintf(stderr, "Ignoring PIKO_GC_MIN_HEAP, expected a size in KiB\n");
+        gc_min = VM_GC_MIN_BYTES;
+    }
+
+    if (nursery_env && !parse_gc_nursery(nursery_env, &gc_nursery))
+        fprintf(stderr, "Ignoring PIKO_GC_NURSERY, expected a size in KiB\n");
+
+    if (pause_env && !(gc_max_pause = parse_gc_max_pause(pause_env)))
+        fprintf(stderr, "Ignoring PIKO_GC_MAX_PAUSE, expected microseconds\n");
+
+    if (threads_env && !(gc_threads = parse_gc_threads(threads_env)))
+    {
+        fprintf(stderr, "Ignoring PIKO_GC_THREADS, expected a count from 1 to %d\n", VM_GC_MAX_THREADS);
+        gc_threads = VM_GC_THREADS;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-jit") == 0)
+            jit_mode = JIT_OFF_MODE;
+        else if (strcmp(argv[i], "--jit-all") == 0)
+            jit_mode = JIT_FORCE_MODE;
+        else if (strcmp(argv[i], "--aot") == 0)
+            aot_mode = 1;
+        else if (strcmp(argv[i], "--no-cache") == 0)
+            cache_mode = 0;
+        else if (strcmp(argv[i], "--no-stream") == 0)
+            stream_mode = 0;
+        else if (strncmp(argv[i], "--max-heap=", 11) == 0)
+        {
+            if (!(heap_limit = parse_heap_size(argv[i] + 11)))
+            {
+                fprintf(stderr, "Illegal --max-heap value, expected a size in MiB\n");
+                exit(1);
+            }
+        }
+        else
+            source_path = (char *)argv[i];
+    }
+
+    if (!source_path)
     {
         fprintf(stderr, "No input source file\n");
         exit(1);
     }
 
+    jit_set_mode(jit_mode);
     memory_init();
 
-    // scanner phase
-    StaticStr *source = memory_read_source((char *)argv[1]);
-    DynArr *tokens = memory_create_dynarr(sizeof(Token));
-    LZHTable *keywords = memory_create_lzhtable(23);
-    Scanner *scanner = memory_create_scanner(tokens, source, keywords);
+    if (heap_limit)
+        vm_memory_set_limit(heap_limit);
 
-    scanner_scan_tokens(scanner);
+    // the whole limit gets reserved up front, which can be more than there is room for
+    if (vm_memory_init())
+    {
+        fprintf(stderr, "Cannot reserve a %zu MiB heap\n", vm_memory_limit() / (1024 * 1024));
+        exit(1);
+    }
 
-    memory_destroy_static_str(source);
-    memory_destroy_lzhtable(keywords);
-    memory_destroy_scanner(scanner);
+    StaticStr *source = memory_read_source(source_path);
+    uint64_t source_hash = bytecode_hash(source->raw, source->len);
+    VM *vm = vm_create();
 
-    // parser phase
-    DynArrPtr *stmts = memory_create_dynarr_ptr();
-    Parser *parser = memory_create_parser(tokens, stmts);
+    vm_gc_tune(gc_growth, gc_min, gc_nursery, gc_max_pause, gc_threads, vm);
 
-    parser_parse(parser);
+    if (stats_env)
+        vm_gc_record_pauses(vm);
 
-    clear_tokens(tokens);
-    memory_destroy_dynarr(tokens);
-    memory_destroy_parser(parser);
+    // the bytecode cache skips scanning, parsing and compiling
+    if (cache_mode && bytecode_load(source_path, source_hash, vm))
+        memory_destroy_static_str(source);
+    else
+    {
+        if (stream_mode)
+            stream_source(source, vm);
+        else
+            compile_source(source, vm);
 
-    //> compiler phase
-    vm_memory_init();
-    VM *vm = vm_create();
+        if (cache_mode)
+            bytecode_save(source_path, source_hash, vm);
+    }
+
+    // nothing allocated by the front-end is needed to execute
+    memory_deinit();
+
+    if (aot_mode && !aot_load(source_path, vm))
+        fprintf(stderr, "Failed to load aot code, falling back to the interpreter\n");
 
-    compiler_compile(vm, stmts);
     // dumpper_execute(vm);
     int return_code = vm_execute(vm);
     // vm_print_stack(vm);
 
+    if (stats_env)
+        vm_gc_report_pauses(vm);
+
     vm_destroy(vm);
+    aot_unload();
     vm_memory_deinit();
-    memory_deinit();
 
     return return_code;
 }
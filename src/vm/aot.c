@@ -0,0 +1,556 @@
+#define _DEFAULT_SOURCE
+
+#include "aot.h"
+#include "vm_memory.h"
+
+#include <dlfcn.h>
+#include <spawn.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// Ahead of time compilation.
+//
+// Every function of the program becomes a C function where each
+// instruction is a direct call to its interpreter helper, jumps are
+// gotos and the current frame ip is the only state kept in sync. Calls
+// and returns go back to the interpreter loop so it can switch frames,
+// which then enters the native code of the next function at its ip.
+
+typedef int (*AotEnter)(VM *vm, int *ip);
+
+typedef struct _aot_
+{
+    void *handle;
+} Aot;
+
+static Aot aot = {0};
+
+// changes every time the generated code changes shape
+#define AOT_VERSION 1
+#define AOT_PATH_LENGTH (PATH_MAX + 16)
+
+// private interface
+uint8_t aot_chunk(size_t index, DynArr *chunks);
+int32_t aot_chunk_i32(size_t index, DynArr *chunks);
+const char *aot_helper(uint8_t opcode, int *out_operands);
+
+void aot_add_fn(Fn *fn, DynArrPtr *fns);
+void aot_collect_fns(VM *vm, DynArrPtr *fns);
+uint64_t aot_hash(DynArrPtr *fns);
+
+int aot_temp(char *path, char *out_temp);
+int aot_emit_fn(FILE *file, size_t index, Fn *fn);
+int aot_generate(char *c_path, uint64_t hash, DynArrPtr *fns);
+int aot_build(char *c_path, char *so_path);
+void *aot_open(char *so_path, uint64_t hash);
+int aot_bind(void *handle, DynArrPtr *fns);
+
+// private implementation
+uint8_t aot_chunk(size_t index, DynArr *chunks)
+{
+    return *(uint8_t *)dynarr_get(index, chunks);
+}
+
+int32_t aot_chunk_i32(size_t index, DynArr *chunks)
+{
+    uint8_t bytes[4];
+
+    for (size_t i = 0; i < 4; i++)
+        bytes[i] = aot_chunk(index + i, chunks);
+
+    // shifting into the sign bit of an int32_t is undefined
+    return (int32_t)(((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[0]));
+}
+
+// Interpreter helper executing 'opcode' once its operands are next to be
+// read. Returns NULL for instructions the interpreter must run itself.
+const char *aot_helper(uint8_t opcode, int *out_operands)
+{
+    *out_operands = 0;
+
+    switch (opcode)
+    {
+    case NIL_OPC:
+        return "vm_execute_nil(vm)";
+    case ARR_LEN_OPC:
+        return "vm_execute_array_length(vm)";
+    case ARR_ITM_OPC:
+        return "vm_execute_get_array_item(vm)";
+    case ARR_SITM_OPC:
+        return "vm_execute_set_array_item(vm)";
+
+    case ADD_OPC:
+    case ADD_II_OPC:
+        return "vm_execute_arithmetic(1, vm)";
+    case SUB_OPC:
+    case SUB_II_OPC:
+        return "vm_execute_arithmetic(2, vm)";
+    case MUL_OPC:
+    case MUL_II_OPC:
+        return "vm_execute_arithmetic(3, vm)";
+    case DIV_OPC:
+    case DIV_II_OPC:
+        return "vm_execute_arithmetic(4, vm)";
+    case MOD_OPC:
+    case MOD_II_OPC:
+        return "vm_execute_arithmetic(5, vm)";
+
+    case LT_OPC:
+    case LT_II_OPC:
+        return "vm_execute_comparison(1, vm)";
+    case GT_OPC:
+    case GT_II_OPC:
+        return "vm_execute_comparison(2, vm)";
+    case LE_OPC:
+    case LE_II_OPC:
+        return "vm_execute_comparison(3, vm)";
+    case GE_OPC:
+    case GE_II_OPC:
+        return "vm_execute_comparison(4, vm)";
+    case EQ_OPC:
+    case EQ_II_OPC:
+        return "vm_execute_comparison(5, vm)";
+    case NE_OPC:
+    case NE_II_OPC:
+        return "vm_execute_comparison(6, vm)";
+
+    case OR_OPC:
+        return "vm_execute_logical(1, vm)";
+    case AND_OPC:
+        return "vm_execute_logical(2, vm)";
+    case NOT_OPC:
+        return "vm_execute_negation(1, vm)";
+    case NNOT_OPC:
+        return "vm_execute_negation(2, vm)";
+    case SLEFT_OPC:
+        return "vm_execute_shift(1, vm)";
+    case SRIGHT_OPC:
+        return "vm_execute_shift(2, vm)";
+    case BOR_OPC:
+        return "vm_execute_bitwise(1, vm)";
+    case BXOR_OPC:
+        return "vm_execute_bitwise(2, vm)";
+    case BAND_OPC:
+        return "vm_execute_bitwise(3, vm)";
+    case BNOT_OPC:
+        return "vm_execute_bitwise(4, vm)";
+
+    case CONCAT_OPC:
+        return "vm_execute_concat(vm)";
+    case STR_LEN_OPC:
+        return "vm_execute_length_str(vm)";
+    case STR_ITM_OPC:
+        return "vm_execute_str_itm(vm)";
+    case THIS_OPC:
+        return "vm_execute_this(vm)";
+    case PRT_OPC:
+        return "vm_execute_print(vm)";
+    case POP_OPC:
+        return "vm_execute_pop(vm)";
+    case GBG_OPC:
+        return "vm_execute_garbage(vm)";
+    case RET_OPC:
+        return "vm_execute_return(vm)";
+    }
+
+    *out_operands = 1;
+
+    switch (opcode)
+    {
+    case BCONST_OPC:
+        return "vm_execute_bool(vm)";
+    case ARR_OPC:
+        return "vm_execute_array(vm)";
+    case LREAD_OPC:
+        return "vm_execute_get_local(vm)";
+    case LSET_OPC:
+        return "vm_execute_set_local(vm)";
+    case IS_OPC:
+        return "vm_execute_is(vm)";
+    case CALL_OPC:
+        return "vm_execute_call(vm)";
+    }
+
+    *out_operands = 4;
+
+    switch (opcode)
+    {
+    case ICONST_OPC:
+        return "vm_execute_int(vm)";
+    case SCONST_OPC:
+        return "vm_execute_string(vm)";
+    case GWRITE_OPC:
+        return "vm_execute_set_global(vm)";
+    case GREAD_OPC:
+        return "vm_execute_get_global(vm)";
+    case LOAD_OPC:
+        return "vm_execute_load_entity(vm)";
+    case JMP_OPC:
+        return "vm_execute_jmp(vm)";
+    case JIT_OPC:
+        return "vm_execute_argjmp(1, vm)";
+    case JIF_OPC:
+        return "vm_execute_argjmp(2, vm)";
+    case CLASS_OPC:
+        return "vm_execute_class(vm)";
+    case SET_PROPERTY_OPC:
+        return "vm_execute_set_property(vm)";
+    case GET_PROPERTY_OPC:
+        return "vm_execute_get_property(vm)";
+    case FROM_OPC:
+        return "vm_execute_from(vm)";
+    }
+
+    if (opcode == FORLOOP_OPC)
+    {
+        *out_operands = 7;
+        return "vm_execute_forloop(vm)";
+    }
+
+    *out_operands = 0;
+
+    return NULL;
+}
+
+void aot_add_fn(Fn *fn, DynArrPtr *fns)
+{
+    if (!fn)
+        return;
+
+    for (size_t i = 0; i < fns->used; i++)
+    {
+        if (DYNARR_PTR_GET(i, fns) == fn)
+            return;
+    }
+
+    dynarr_ptr_insert(fn, fns);
+}
+
+// main first, then every function and method in definition order
+void aot_collect_fns(VM *vm, DynArrPtr *fns)
+{
+    aot_add_fn(vm->frames[0].fn, fns);
+
+    for (size_t i = 0; i < vm->entities->used; i++)
+    {
+        Entity *entity = (Entity *)dynarr_get(i, vm->entities);
+
+        if (entity->type == FUNCTION_SYMTYPE)
+            aot_add_fn((Fn *)entity->raw_symbol, fns);
+
+        if (entity->type == CLASS_SYMTYPE)
+        {
+            Klass *klass = (Klass *)entity->raw_symbol;
+
+            aot_add_fn(klass->constructor, fns);
+
+            for (LZHTableNode *node = klass->methods->nodes; node; node = node->previous_table_node)
+                aot_add_fn((Fn *)node->value, fns);
+        }
+    }
+}
+
+// FNV-1a of the bytecode the shared object was generated from
+uint64_t aot_hash(DynArrPtr *fns)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    hash = (hash ^ AOT_VERSION) * 1099511628211ULL;
+    hash = (hash ^ fns->used) * 1099511628211ULL;
+
+    for (size_t i = 0; i < fns->used; i++)
+    {
+        DynArr *chunks = ((Fn *)DYNARR_PTR_GET(i, fns))->chunks;
+
+        hash = (hash ^ chunks->used) * 1099511628211ULL;
+
+        for (size_t pc = 0; pc < chunks->used; pc++)
+            hash = (hash ^ aot_chunk(pc, chunks)) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Creates an empty file next to 'path' for what gets renamed to it once
+// complete, so concurrent runs never see each other's half written files.
+// Returns its descriptor, or -1
+int aot_temp(char *path, char *out_temp)
+{
+    if (snprintf(out_temp, AOT_PATH_LENGTH, "%s.XXXXXX", path) >= AOT_PATH_LENGTH)
+        return -1;
+
+    int fd = mkstemp(out_temp);
+
+    if (fd == -1)
+        return -1;
+
+    // mkstemp leaves it readable by its owner only, not what other files get
+    mode_t mask = umask(0);
+    umask(mask);
+
+    if (fchmod(fd, 0644 & ~mask) != 0)
+    {
+        close(fd);
+        unlink(out_temp);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+// Returns 0 if the chunks hold an unknown or truncated instruction
+int aot_emit_fn(FILE *file, size_t index, Fn *fn)
+{
+    DynArr *chunks = fn->chunks;
+    size_t length = chunks->used;
+    int operands = 0;
+
+    fprintf(file, "\nint piko_aot_fn_%zu(VM *vm, int *ip)\n{\n", index);
+    fprintf(file, "    // %s\n", fn->name);
+    fprintf(file, "    switch (*ip)\n    {\n");
+
+    for (size_t pc = 0; pc < length; pc += 1 + operands)
+    {
+        uint8_t opcode = aot_chunk(pc, chunks);
+
+        if (!aot_helper(opcode, &operands) && opcode != HLT_OPC)
+            return 0;
+
+        if (pc + 1 + operands > length)
+            return 0;
+
+        if (opcode != HLT_OPC)
+            fprintf(file, "    case %zu: goto L%zu;\n", pc, pc);
+    }
+
+    fprintf(file, "    default: return 0;\n    }\n");
+
+    for (size_t pc = 0; pc < length; pc += 1 + operands)
+    {
+        uint8_t opcode = aot_chunk(pc, chunks);
+        const char *helper = aot_helper(opcode, &operands);
+        size_t end = pc + 1 + operands;
+
+        fprintf(file, "L%zu:\n", pc);
+
+        if (opcode == HLT_OPC)
+        {
+            fprintf(file, "    *ip = %zu;\n    return 1;\n", pc);
+            continue;
+        }
+
+        fprintf(file, "    *ip = %zu;\n    %s;\n", pc + 1, helper);
+
+        if (opcode == CALL_OPC || opcode == RET_OPC)
+        {
+            // the interpreter loop switches frames
+            fprintf(file, "    return 1;\n");
+            continue;
+        }
+
+        if (opcode == JMP_OPC || opcode == JIT_OPC || opcode == JIF_OPC || opcode == FORLOOP_OPC)
+        {
+            int32_t value = aot_chunk_i32(end - 4, chunks);
+            int64_t target = end + value;
+
+            if (value < 0 && opcode != JIF_OPC)
+                target = pc + value;
+
+            if (value == 0 || target == (int64_t)end)
+                continue;
+
+            if (target < 0 || target > (int64_t)length)
+                fprintf(file, "    if (*ip != %zu) return 1;\n", end);
+            else
+                fprintf(file, "    if (*ip == %zu) goto L%zu;\n", (size_t)target, (size_t)target);
+        }
+    }
+
+    fprintf(file, "L%zu:\n    return 1;\n}\n", length);
+
+    return 1;
+}
+
+int aot_generate(char *c_path, uint64_t hash, DynArrPtr *fns)
+{
+    char temp_path[AOT_PATH_LENGTH];
+    int fd = aot_temp(c_path, temp_path);
+
+    if (fd == -1)
+        return 0;
+
+    FILE *file = fdopen(fd, "w");
+
+    if (!file)
+    {
+        close(fd);
+        unlink(temp_path);
+        return 0;
+    }
+
+    fprintf(file, "// generated by piko --aot, do not edit\n\n");
+    fprintf(file, "typedef struct _vm_ VM;\n\n");
+
+    const char *helpers[] = {
+        "nil", "bool", "int", "string", "array", "array_length", "get_array_item",
+        "set_array_item", "concat", "length_str", "str_itm", "class", "get_property",
+        "set_property", "is", "from", "this", "jmp", "forloop", "get_local",
+        "set_local", "set_global", "get_global", "load_entity", "print", "pop",
+        "call", "garbage", "return"};
+    const char *typed_helpers[] = {"arithmetic", "comparison", "argjmp", "logical", "negation", "shift", "bitwise"};
+
+    for (size_t i = 0; i < sizeof(helpers) / sizeof(helpers[0]); i++)
+        fprintf(file, "void vm_execute_%s(VM *vm);\n", helpers[i]);
+
+    for (size_t i = 0; i < sizeof(typed_helpers) / sizeof(typed_helpers[0]); i++)
+        fprintf(file, "void vm_execute_%s(int type, VM *vm);\n", typed_helpers[i]);
+
+    fprintf(file, "\nconst unsigned long long piko_aot_hash = 0x%016llxULL;\n", (unsigned long long)hash);
+
+    int emitted = 1;
+
+    for (size_t i = 0; i < fns->used && emitted; i++)
+        emitted = aot_emit_fn(file, i, (Fn *)DYNARR_PTR_GET(i, fns));
+
+    if (fclose(file) != 0 || !emitted || rename(temp_path, c_path) != 0)
+    {
+        unlink(temp_path);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Runs gcc without a shell, paths are passed as they are
+int aot_build(char *c_path, char *so_path)
+{
+    char temp_path[AOT_PATH_LENGTH];
+    int fd = aot_temp(so_path, temp_path);
+
+    if (fd == -1)
+        return 0;
+
+    close(fd);
+
+    char *argv[] = {"gcc", "-O2", "-shared", "-fPIC", "-o", temp_path, c_path, NULL};
+    pid_t pid;
+    int status = 0;
+    int built = posix_spawnp(&pid, "gcc", NULL, NULL, argv, environ) == 0 &&
+                waitpid(pid, &status, 0) == pid &&
+                WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    if (!built || rename(temp_path, so_path) != 0)
+    {
+        unlink(temp_path);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Returns NULL unless 'so_path' exists and was built for 'hash'
+void *aot_open(char *so_path, uint64_t hash)
+{
+    void *handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle)
+        return NULL;
+
+    unsigned long long *built_hash = (unsigned long long *)dlsym(handle, "piko_aot_hash");
+
+    if (!built_hash || *built_hash != hash)
+    {
+        dlclose(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+int aot_bind(void *handle, DynArrPtr *fns)
+{
+    char symbol[64];
+
+    for (size_t i = 0; i < fns->used; i++)
+    {
+        snprintf(symbol, sizeof(symbol), "piko_aot_fn_%zu", i);
+
+        if (!dlsym(handle, symbol))
+            return 0;
+    }
+
+    for (size_t i = 0; i < fns->used; i++)
+    {
+        snprintf(symbol, sizeof(symbol), "piko_aot_fn_%zu", i);
+        ((Fn *)DYNARR_PTR_GET(i, fns))->aot = dlsym(handle, symbol);
+    }
+
+    return 1;
+}
+
+// public implementation
+int aot_load(char *source_path, VM *vm)
+{
+    char full_path[PATH_MAX];
+
+    if (aot.handle || !realpath(source_path, full_path))
+        return 0;
+
+    char c_path[AOT_PATH_LENGTH];
+    char so_path[AOT_PATH_LENGTH];
+
+    snprintf(c_path, sizeof(c_path), "%s.aot.c", full_path);
+    snprintf(so_path, sizeof(so_path), "%s.aot.so", full_path);
+
+    DynArrPtr *fns = vm_memory_create_dynarr_ptr();
+
+    aot_collect_fns(vm, fns);
+
+    uint64_t hash = aot_hash(fns);
+    void *handle = aot_open(so_path, hash);
+
+    // missing or stale, build it again
+    if (!handle && aot_generate(c_path, hash, fns) && aot_build(c_path, so_path))
+        handle = aot_open(so_path, hash);
+
+    if (handle && !aot_bind(handle, fns))
+    {
+        dlclose(handle);
+        handle = NULL;
+    }
+
+    vm_memory_destroy_dynarr_ptr(fns);
+
+    aot.handle = handle;
+
+    return handle != NULL;
+}
+
+void aot_unload()
+{
+    if (!aot.handle)
+        return;
+
+    dlclose(aot.handle);
+    aot.handle = NULL;
+}
+
+int aot_execute(VM *vm)
+{
+    if (!aot.handle)
+        return 0;
+
+    Frame *frame = &vm->frames[vm->frame_ptr];
+    Fn *fn = frame->fn;
+
+    if (!fn || !fn->aot)
+        return 0;
+
+    return ((AotEnter)fn->aot)(vm, &frame->ip);
+}
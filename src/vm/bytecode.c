@@ -0,0 +1,519 @@
+#define _DEFAULT_SOURCE
+
+#include "bytecode.h"
+#include "vm_memory.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Cache file layout, integers in host byte order:
+//
+//  header:   "PIKO" version:u32 source_hash:u64
+//  iconsts:  count:u32 (value:i64)*
+//  strings:  count:u32 (str)*
+//  entities: count:u32 (type:u8 entity)*
+//  main:     chunks
+//
+//  str:      length:u32 bytes
+//  chunks:   length:u32 bytes
+//  fn:       name:str params:(count:u32 (str)*) chunks
+//  native:   name:str, must match the native the vm already has at that index
+//  function: fn
+//  klass:    name:str has_constructor:u8 (fn)? methods:(count:u32 (fn)*)
+
+#define BYTECODE_MAGIC "PIKO"
+#define BYTECODE_PATH_SUFFIX ".pkc"
+
+typedef struct _bytecode_reader_
+{
+    uint8_t *bytes;
+    size_t length;
+    size_t offset;
+    char failed;
+    char apply; // fill the vm, otherwise the file only gets validated
+} BytecodeReader;
+
+// private interface
+char *bytecode_cache_path(char *source_path);
+
+int bytecode_write_u32(uint32_t value, FILE *file);
+int bytecode_write_str(char *value, FILE *file);
+int bytecode_write_chunks(DynArr *chunks, FILE *file);
+int bytecode_write_fn(Fn *fn, FILE *file);
+int bytecode_write_klass(Klass *klass, FILE *file);
+int bytecode_write_program(uint64_t source_hash, VM *vm, FILE *file);
+
+uint8_t *bytecode_read(size_t length, BytecodeReader *reader);
+uint8_t bytecode_read_u8(BytecodeReader *reader);
+uint32_t bytecode_read_u32(BytecodeReader *reader);
+char *bytecode_read_str(size_t *out_length, BytecodeReader *reader);
+char *bytecode_clone_str(BytecodeReader *reader);
+void bytecode_read_chunks(DynArr *chunks, BytecodeReader *reader);
+Fn *bytecode_read_fn(BytecodeReader *reader);
+Klass *bytecode_read_klass(BytecodeReader *reader);
+int bytecode_read_program(uint64_t source_hash, VM *vm, BytecodeReader *reader);
+
+// private implementation
+char *bytecode_cache_path(char *source_path)
+{
+    size_t length = strlen(source_path);
+    size_t suffix_length = strlen(BYTECODE_PATH_SUFFIX);
+    char *path = (char *)vm_memory_alloc(length + suffix_length + 1);
+
+    memcpy(path, source_path, length);
+    memcpy(path + length, BYTECODE_PATH_SUFFIX, suffix_length + 1);
+
+    return path;
+}
+
+int bytecode_write_u32(uint32_t value, FILE *file)
+{
+    return fwrite(&value, sizeof(uint32_t), 1, file) == 1;
+}
+
+int bytecode_write_str(char *value, FILE *file)
+{
+    uint32_t length = (uint32_t)strlen(value);
+
+    return bytecode_write_u32(length, file) &&
+           fwrite(value, 1, length, file) == length;
+}
+
+int bytecode_write_chunks(DynArr *chunks, FILE *file)
+{
+    if (!bytecode_write_u32((uint32_t)chunks->used, file))
+        return 0;
+
+    // dynarr pads its items, chunks are written one by one
+    for (size_t i = 0; i < chunks->used; i++)
+    {
+        if (fputc(*(uint8_t *)dynarr_get(i, chunks), file) == EOF)
+            return 0;
+    }
+
+    return 1;
+}
+
+int bytecode_write_fn(Fn *fn, FILE *file)
+{
+    DynArrPtr *params = fn->params;
+
+    if (!bytecode_write_str(fn->name, file) || !bytecode_write_u32((uint32_t)params->used, file))
+        return 0;
+
+    for (size_t i = 0; i < params->used; i++)
+    {
+        if (!bytecode_write_str((char *)DYNARR_PTR_GET(i, params), file))
+            return 0;
+    }
+
+    return bytecode_write_chunks(fn->chunks, file);
+}
+
+int bytecode_write_klass(Klass *klass, FILE *file)
+{
+    if (!bytecode_write_str(klass->name, file))
+        return 0;
+
+    if (fputc(klass->constructor != NULL, file) == EOF)
+        return 0;
+
+    if (klass->constructor && !bytecode_write_fn(klass->constructor, file))
+        return 0;
+
+    LZHTableNode *oldest = klass->methods->nodes;
+    uint32_t count = 0;
+
+    for (LZHTableNode *node = klass->methods->nodes; node; node = node->previous_table_node)
+    {
+        oldest = node;
+        count++;
+    }
+
+    if (!bytecode_write_u32(count, file))
+        return 0;
+
+    // oldest first so loading puts them back in the same order
+    for (LZHTableNode *node = oldest; node; node = node->next_table_node)
+    {
+        if (!bytecode_write_fn((Fn *)node->value, file))
+            return 0;
+    }
+
+    return 1;
+}
+
+int bytecode_write_program(uint64_t source_hash, VM *vm, FILE *file)
+{
+    uint32_t version = BYTECODE_VERSION;
+
+    if (fwrite(BYTECODE_MAGIC, 1, 4, file) != 4 ||
+        !bytecode_write_u32(version, file) ||
+        fwrite(&source_hash, sizeof(uint64_t), 1, file) != 1)
+        return 0;
+
+    if (!bytecode_write_u32((uint32_t)vm->iconsts->used, file))
+        return 0;
+
+    for (size_t i = 0; i < vm->iconsts->used; i++)
+    {
+        if (fwrite(dynarr_get(i, vm->iconsts), sizeof(int64_t), 1, file) != 1)
+            return 0;
+    }
+
+    if (!bytecode_write_u32((uint32_t)vm->strings->used, file))
+        return 0;
+
+    for (size_t i = 0; i < vm->strings->used; i++)
+    {
+        if (!bytecode_write_str((char *)DYNARR_PTR_GET(i, vm->strings), file))
+            return 0;
+    }
+
+    if (!bytecode_write_u32((uint32_t)vm->entities->used, file))
+        return 0;
+
+    for (size_t i = 0; i < vm->entities->used; i++)
+    {
+        Entity *entity = (Entity *)dynarr_get(i, vm->entities);
+        int written = 0;
+
+        if (fputc(entity->type, file) == EOF)
+            return 0;
+
+        switch (entity->type)
+        {
+        case NATIVE_SYMTYPE:
+            written = bytecode_write_str(((NativeFn *)entity->raw_symbol)->name, file);
+            break;
+
+        case FUNCTION_SYMTYPE:
+            written = bytecode_write_fn((Fn *)entity->raw_symbol, file);
+            break;
+
+        case CLASS_SYMTYPE:
+            written = bytecode_write_klass((Klass *)entity->raw_symbol, file);
+            break;
+
+        default:
+            assert(0 && "Illegal entity type");
+        }
+
+        if (!written)
+            return 0;
+    }
+
+    return bytecode_write_chunks(vm->frames[0].fn->chunks, file);
+}
+
+// Returns NULL once the reader runs past the end of the file
+uint8_t *bytecode_read(size_t length, BytecodeReader *reader)
+{
+    if (reader->failed || length > reader->length - reader->offset)
+    {
+        reader->failed = 1;
+        return NULL;
+    }
+
+    uint8_t *bytes = reader->bytes + reader->offset;
+    reader->offset += length;
+
+    return bytes;
+}
+
+uint8_t bytecode_read_u8(BytecodeReader *reader)
+{
+    uint8_t *bytes = bytecode_read(1, reader);
+    return bytes ? *bytes : 0;
+}
+
+uint32_t bytecode_read_u32(BytecodeReader *reader)
+{
+    uint32_t value = 0;
+    uint8_t *bytes = bytecode_read(sizeof(uint32_t), reader);
+
+    if (bytes)
+        memcpy(&value, bytes, sizeof(uint32_t));
+
+    return value;
+}
+
+// points into the mapped file, not terminated
+char *bytecode_read_str(size_t *out_length, BytecodeReader *reader)
+{
+    uint32_t length = bytecode_read_u32(reader);
+    char *str = (char *)bytecode_read(length, reader);
+
+    *out_length = str ? length : 0;
+
+    return str;
+}
+
+// NULL unless the reader is applying the file
+char *bytecode_clone_str(BytecodeReader *reader)
+{
+    size_t length = 0;
+    char *str = bytecode_read_str(&length, reader);
+
+    if (!str || !reader->apply)
+        return NULL;
+
+    char *clone = (char *)vm_memory_alloc(length + 1);
+
+    memcpy(clone, str, length);
+    clone[length] = 0;
+
+    return clone;
+}
+
+void bytecode_read_chunks(DynArr *chunks, BytecodeReader *reader)
+{
+    uint32_t length = bytecode_read_u32(reader);
+    uint8_t *bytes = bytecode_read(length, reader);
+
+    if (!bytes || !reader->apply)
+        return;
+
+    for (size_t i = 0; i < length; i++)
+        dynarr_insert(&bytes[i], chunks);
+}
+
+Fn *bytecode_read_fn(BytecodeReader *reader)
+{
+    char *name = bytecode_clone_str(reader);
+    Fn *fn = name ? vm_memory_create_fn(name) : NULL;
+
+    if (name)
+        vm_memory_dealloc(name);
+
+    uint32_t params = bytecode_read_u32(reader);
+
+    for (uint32_t i = 0; i < params && !reader->failed; i++)
+    {
+        char *param = bytecode_clone_str(reader);
+
+        if (fn && param)
+            dynarr_ptr_insert(param, fn->params);
+    }
+
+    bytecode_read_chunks(fn ? fn->chunks : NULL, reader);
+
+    return fn;
+}
+
+Klass *bytecode_read_klass(BytecodeReader *reader)
+{
+    char *name = bytecode_clone_str(reader);
+    Klass *klass = name ? vm_memory_create_klass(name) : NULL;
+
+    if (name)
+        vm_memory_dealloc(name);
+
+    if (bytecode_read_u8(reader))
+    {
+        Fn *constructor = bytecode_read_fn(reader);
+
+        if (klass)
+            klass->constructor = constructor;
+    }
+
+    uint32_t methods = bytecode_read_u32(reader);
+
+    for (uint32_t i = 0; i < methods && !reader->failed; i++)
+    {
+        Fn *fn = bytecode_read_fn(reader);
+
+        if (klass && fn)
+            lzhtable_put((uint8_t *)fn->name, strlen(fn->name), (void *)fn, klass->methods, NULL);
+    }
+
+    return klass;
+}
+
+// Only validates the file unless the reader is applying it to 'vm'
+int bytecode_read_program(uint64_t source_hash, VM *vm, BytecodeReader *reader)
+{
+    uint8_t *magic = bytecode_read(4, reader);
+    uint32_t version = bytecode_read_u32(reader);
+    uint8_t *hash = bytecode_read(sizeof(uint64_t), reader);
+
+    if (!magic || !hash ||
+        memcmp(magic, BYTECODE_MAGIC, 4) != 0 ||
+        version != BYTECODE_VERSION ||
+        memcmp(hash, &source_hash, sizeof(uint64_t)) != 0)
+        return 0;
+
+    uint32_t iconsts = bytecode_read_u32(reader);
+
+    for (uint32_t i = 0; i < iconsts && !reader->failed; i++)
+    {
+        uint8_t *bytes = bytecode_read(sizeof(int64_t), reader);
+        int64_t value = 0;
+
+        if (bytes && reader->apply)
+        {
+            memcpy(&value, bytes, sizeof(int64_t));
+            dynarr_insert(&value, vm->iconsts);
+        }
+    }
+
+    uint32_t strings = bytecode_read_u32(reader);
+
+    for (uint32_t i = 0; i < strings && !reader->failed; i++)
+    {
+        char *str = bytecode_clone_str(reader);
+
+        if (str)
+            dynarr_ptr_insert(str, vm->strings);
+    }
+
+    // the vm starts with its natives, indexes of the rest come after them
+    size_t natives = vm->entities->used;
+    uint32_t entities = bytecode_read_u32(reader);
+
+    for (uint32_t i = 0; i < entities && !reader->failed; i++)
+    {
+        uint8_t type = bytecode_read_u8(reader);
+        Entity entity = {0};
+
+        entity.type = (EntityType)type;
+
+        if ((type == NATIVE_SYMTYPE) != (i < natives))
+            return 0;
+
+        switch (type)
+        {
+        case NATIVE_SYMTYPE:
+        {
+            size_t length = 0;
+            char *name = bytecode_read_str(&length, reader);
+            NativeFn *native_fn = (NativeFn *)((Entity *)dynarr_get(i, vm->entities))->raw_symbol;
+
+            if (!name || strlen(native_fn->name) != length || memcmp(native_fn->name, name, length) != 0)
+                return 0;
+
+            continue;
+        }
+
+        case FUNCTION_SYMTYPE:
+            entity.raw_symbol = bytecode_read_fn(reader);
+            break;
+
+        case CLASS_SYMTYPE:
+            entity.raw_symbol = bytecode_read_klass(reader);
+            break;
+
+        default:
+            return 0;
+        }
+
+        if (reader->apply)
+            dynarr_insert(&entity, vm->entities);
+    }
+
+    bytecode_read_chunks(vm->frames[0].fn->chunks, reader);
+
+    return !reader->failed && reader->offset == reader->length;
+}
+
+// public implementation
+uint64_t bytecode_hash(char *source, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)source[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+int bytecode_load(char *source_path, uint64_t source_hash, VM *vm)
+{
+    char *path = bytecode_cache_path(source_path);
+    int fd = open(path, O_RDONLY);
+
+    vm_memory_dealloc(path);
+
+    if (fd == -1)
+        return 0;
+
+    struct stat info;
+
+    if (fstat(fd, &info) == -1 || info.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t length = (size_t)info.st_size;
+    void *bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (bytes == MAP_FAILED)
+        return 0;
+
+    BytecodeReader reader = {(uint8_t *)bytes, length, 0, 0, 0};
+    int loaded = bytecode_read_program(source_hash, vm, &reader);
+
+    // the file is valid, now fill the vm
+    if (loaded)
+    {
+        reader.offset = 0;
+        reader.apply = 1;
+
+        loaded = bytecode_read_program(source_hash, vm, &reader);
+    }
+
+    munmap(bytes, length);
+
+    return loaded;
+}
+
+int bytecode_save(char *source_path, uint64_t source_hash, VM *vm)
+{
+    char *path = bytecode_cache_path(source_path);
+    size_t length = strlen(path);
+    char *tmp_path = (char *)vm_memory_alloc(length + 8);
+
+    // unique per run, so concurrent runs never write to the same file
+    memcpy(tmp_path, path, length);
+    memcpy(tmp_path + length, ".XXXXXX", 8);
+
+    int fd = mkstemp(tmp_path);
+    FILE *file = NULL;
+    int saved = 0;
+
+    if (fd != -1)
+    {
+        // mkstemp leaves it readable by its owner only, a cache is as readable as any file
+        mode_t mask = umask(0);
+        umask(mask);
+
+        if (fchmod(fd, 0644 & ~mask) == 0)
+            file = fdopen(fd, "wb");
+    }
+
+    if (file)
+    {
+        saved = bytecode_write_program(source_hash, vm, file);
+        saved = fclose(file) == 0 && saved;
+
+        // readers never see a half written cache
+        if (saved)
+            saved = rename(tmp_path, path) == 0;
+    }
+    else if (fd != -1)
+        close(fd);
+
+    if (!saved && fd != -1)
+        unlink(tmp_path);
+
+    vm_memory_dealloc(tmp_path);
+    vm_memory_dealloc(path);
+
+    return saved;
+}
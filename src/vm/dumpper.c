@@ -67,7 +67,8 @@ void dumpper_scope_down()
 
 int32_t dumpper_compose_i32(uint8_t *bytes)
 {
-    return ((int32_t)bytes[3] << 24) | ((int32_t)bytes[2] << 16) | ((int32_t)bytes[1] << 8) | ((int32_t)bytes[0]);
+    // shifting into the sign bit of an int32_t is undefined
+    return (int32_t)(((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[0]));
 }
 
 int32_t dumpper_read_i32()
@@ -309,6 +310,83 @@ void dumpper_execute_raw_instruction(uint8_t instruction)
         break;
     }
 
+    case ADD_II_OPC:
+    {
+        printf("ADD_II\n");
+
+        break;
+    }
+
+    case SUB_II_OPC:
+    {
+        printf("SUB_II\n");
+
+        break;
+    }
+
+    case MUL_II_OPC:
+    {
+        printf("MUL_II\n");
+
+        break;
+    }
+
+    case DIV_II_OPC:
+    {
+        printf("DIV_II\n");
+
+        break;
+    }
+
+    case MOD_II_OPC:
+    {
+        printf("MOD_II\n");
+
+        break;
+    }
+
+    case LT_II_OPC:
+    {
+        printf("LT_II\n");
+
+        break;
+    }
+
+    case GT_II_OPC:
+    {
+        printf("GT_II\n");
+
+        break;
+    }
+
+    case LE_II_OPC:
+    {
+        printf("LE_II\n");
+
+        break;
+    }
+
+    case GE_II_OPC:
+    {
+        printf("GE_II\n");
+
+        break;
+    }
+
+    case EQ_II_OPC:
+    {
+        printf("EQ_II\n");
+
+        break;
+    }
+
+    case NE_II_OPC:
+    {
+        printf("NE_II\n");
+
+        break;
+    }
+
     // logical
     case OR_OPC:
     {
@@ -410,6 +488,18 @@ void dumpper_execute_raw_instruction(uint8_t instruction)
         break;
     }
 
+    case FORLOOP_OPC:
+    {
+        uint8_t counter_index = dumpper_advance();
+        uint8_t bound_index = dumpper_advance();
+        uint8_t up = dumpper_advance();
+        int32_t value = dumpper_read_i32();
+
+        printf("FORLOOP %d %d %s %d\n", counter_index, bound_index, up ? "up" : "down", value);
+
+        break;
+    }
+
     case CONCAT_OPC:
     {
         printf("CONCAT\n");
@@ -0,0 +1,2915 @@
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "vm_memory.h"
+
+#include <assert.h>
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Baseline template jit for x86-64 (System V).
+//
+// Every instruction of a function becomes a fixed piece of machine code.
+// Int operations, locals and jumps run inline; when a guard fails the
+// template sets the frame ip and calls the interpreter for that single
+// instruction. Calls, returns and halts leave native code so the
+// interpreter can switch frames, the caller resumes in native code
+// once the callee returns.
+//
+// Registers while in native code:
+//  rbx: VM *
+//  r12: Frame *
+//  r13: vm->stack
+//  r14: frame->locals
+
+// Loop traces.
+//
+// Once a loop header gets hot the interpreter records the instructions
+// of one iteration together with the types it sees. The record becomes
+// a linear SSA trace where every jump turns into a guard, constants are
+// folded, locals written in the iteration are forwarded to later reads
+// and the type checks of the values the loop reads are hoisted to the
+// trace entry. Guards that fail leave through a side exit that pushes the
+// pending values to the vm stack and sets the frame ip, so the
+// interpreter continues as if it had run the iteration itself.
+//
+// Arrays the loop reads from locals or globals must keep their identity,
+// so they are loaded once at the entry together with their length. An
+// array indexed by the counter of the for loop being traced gets its
+// bounds checked once at the entry for the whole range of the counter,
+// other indexes are checked on every access.
+
+// interpreter entry used by the templates slow paths
+void vm_execute_instruction(VM *vm);
+
+// used by traces that assign array items
+Object *vm_create_object(ObjectType type, VM *vm);
+void vm_gc_write_barrier(Object *container, Object *previous, Object *object, VM *vm);
+int vm_gc_pending(VM *vm);
+
+typedef void (*JitEnter)(VM *vm, Frame *frame, void *target);
+typedef int (*JitTraceEnter)(VM *vm, Frame *frame);
+
+// instructions recorded for a single trace
+#define JIT_TRACE_LENGTH 256
+
+typedef struct _jit_record_
+{
+    size_t pc;
+    uint8_t opcode;
+    size_t end;    // offset of the next instruction
+    size_t target; // jump target, SIZE_MAX if not a jump
+    int64_t value; // constant, local index or operation type
+    Value *global; // global read or written
+    int ptype;     // observed type of the value read
+    char taken;    // the recorded execution took the jump
+} JitRecord;
+
+typedef struct _jit_recorder_
+{
+    char active;
+    int frame_ptr;
+    JitCode *code;
+    size_t header;
+    int length;
+    JitRecord records[JIT_TRACE_LENGTH];
+} JitRecorder;
+
+typedef struct _jit_trace_
+{
+    uint8_t *native;
+    size_t size;
+    int failures; // entries refused because of types changed since recording
+} JitTrace;
+
+typedef struct _jit_
+{
+    JitMode mode;
+    JitRecorder recorder;
+} Jit;
+
+static Jit jit = {JIT_ON_MODE, {0}};
+
+#ifdef JIT_SUPPORTED
+
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RBX 3
+#define JIT_RSP 4
+#define JIT_RSI 6
+#define JIT_RDI 7
+#define JIT_R8 8
+#define JIT_R12 12
+#define JIT_R13 13
+#define JIT_R14 14
+
+#define JIT_CC_AE 0x3
+#define JIT_CC_E 0x4
+#define JIT_CC_NE 0x5
+#define JIT_CC_L 0xC
+#define JIT_CC_GE 0xD
+#define JIT_CC_LE 0xE
+#define JIT_CC_G 0xF
+
+// machine code bytes reserved for each chunk of bytecode
+#define JIT_CHUNK_BYTES 256
+#define JIT_EXTRA_BYTES 256
+#define JIT_SLOW_SITES 16
+
+// fixup target used to reach the epilogue
+#define JIT_EXIT_TARGET SIZE_MAX
+
+// trace limits
+#define JIT_TRACE_IR (JIT_TRACE_LENGTH * 4)
+#define JIT_TRACE_STACK 32
+#define JIT_TRACE_GLOBALS 32
+#define JIT_TRACE_FAILURES 16
+
+// ptype of refs holding an array instead of a primitive
+#define JIT_ARRAY_PTYPE (INT_VTYPE + 1)
+
+#define JIT_SP_OFFSET ((int32_t)offsetof(VM, stack_ptr))
+#define JIT_STACK_OFFSET ((int32_t)offsetof(VM, stack))
+#define JIT_IP_OFFSET ((int32_t)offsetof(Frame, ip))
+#define JIT_LOCALS_OFFSET ((int32_t)offsetof(Frame, locals))
+
+#define JIT_VALUE_SIZE ((int32_t)sizeof(Value))
+// slots get addressed as stack_ptr * 3 * 8
+_Static_assert(sizeof(Value) == 24, "The jit addresses stack slots as 24 bytes");
+#define JIT_TYPE_OFFSET ((int32_t)offsetof(Value, type))
+#define JIT_PTYPE_OFFSET ((int32_t)(offsetof(Value, entity) + offsetof(Primitive, type)))
+#define JIT_I64_OFFSET ((int32_t)(offsetof(Value, entity) + offsetof(Primitive, i64)))
+#define JIT_OBJECT_OFFSET ((int32_t)offsetof(Value, entity))
+
+#define JIT_OTYPE_OFFSET ((int32_t)offsetof(Object, type))
+#define JIT_LENGTH_OFFSET ((int32_t)offsetof(Object, value.array.length))
+#define JIT_ITEMS_OFFSET ((int32_t)offsetof(Object, value.array.items))
+#define JIT_BOX_PTYPE_OFFSET ((int32_t)offsetof(Object, value.primitive.type))
+#define JIT_BOX_I64_OFFSET ((int32_t)offsetof(Object, value.primitive.i64))
+
+// stack slots relative to rcx = stack_ptr * 3
+#define JIT_SLOT_NEW 0
+#define JIT_SLOT_TOP (-JIT_VALUE_SIZE)
+#define JIT_SLOT_SECOND (-2 * JIT_VALUE_SIZE)
+
+// states of each bytecode offset
+#define JIT_NO_START 0
+#define JIT_START 1      // instruction the interpreter can enter at
+#define JIT_EXIT_START 2 // instruction always executed by the interpreter
+
+typedef struct _jit_fixup_
+{
+    size_t site;   // offset of a rel32 in the native code
+    size_t target; // bytecode offset it jumps to
+} JitFixup;
+
+typedef struct _jit_compiler_
+{
+    VM *vm;
+    uint8_t *bytes;
+    size_t length;
+
+    uint8_t *code;
+    size_t used;
+    size_t size;
+
+    uint8_t *starts;
+    size_t *labels;
+    size_t exit_label;
+    DynArr *fixups;
+
+    size_t pc;         // instruction being compiled
+    int32_t *counters; // back-edge counters of the function
+
+    int slow_count;
+    size_t slow_sites[JIT_SLOW_SITES];
+} JitCompiler;
+
+typedef enum _jit_ir_type_
+{
+    JIT_IR_CONST,
+    JIT_IR_LOCAL,
+    JIT_IR_GLOBAL,
+    JIT_IR_ARITHMETIC, // value: operation type as in vm_execute_arithmetic
+    JIT_IR_COMPARISON, // value: operation type as in vm_execute_comparison
+    JIT_IR_STORE_LOCAL,
+    JIT_IR_STORE_GLOBAL,
+    JIT_IR_GUARD,         // exits unless 'a' equals value
+    JIT_IR_GUARD_NONZERO, // exits if 'a' is zero
+    JIT_IR_GUARD_INDEX,   // exits unless 'b' is an index of the array 'a'
+    JIT_IR_GUARD_RANGE,   // a hoisted GUARD_INDEX, refuses the entry unless the counter range fits
+    JIT_IR_ARRAY_LENGTH,  // length of the array 'a'
+    JIT_IR_ARRAY_ITEM,    // 'a'['b'], exits unless the item holds a primitive of ptype
+    JIT_IR_SET_ITEM,      // 'a'['b'] = 'c', exits instead once the collector waits for a safepoint
+} JitIrType;
+
+typedef struct _jit_ir_
+{
+    JitIrType type;
+    int a;
+    int b;
+    int c;
+    int64_t value;
+    Value *global;
+    int ptype;    // type of the produced value
+    int snapshot; // guards: state restored by the side exit
+    char hoisted; // computed once at the trace entry
+} JitIr;
+
+typedef struct _jit_snapshot_
+{
+    size_t ip;
+    int depth;
+    int stack[JIT_TRACE_STACK];
+} JitSnapshot;
+
+typedef struct _jit_trace_global_
+{
+    Value *value;
+    int ref;   // last value read or written in the iteration
+    int guard; // type checked at the trace entry, -1 if none
+    int store; // type written by the trace, -1 if none
+} JitTraceGlobal;
+
+typedef struct _jit_trace_builder_
+{
+    int ir_length;
+    JitIr ir[JIT_TRACE_IR];
+
+    int snapshots_length;
+    JitSnapshot snapshots[JIT_TRACE_LENGTH];
+
+    int stack_ptr;
+    int max_depth;
+    int stack[JIT_TRACE_STACK];
+
+    int local_refs[FRAME_VALUES_LENGTH];
+    int local_guards[FRAME_VALUES_LENGTH];
+    int local_stores[FRAME_VALUES_LENGTH];
+
+    int globals_length;
+    JitTraceGlobal globals[JIT_TRACE_GLOBALS];
+
+    int64_t forloop; // FORLOOP value of the loop traced, -1 for other loops
+} JitTraceBuilder;
+
+// private interface
+int64_t jit_jump_target(uint8_t opcode, size_t pc, size_t end, int32_t value);
+int32_t jit_read_i32(JitCompiler *compiler, size_t pc);
+int jit_is_target(JitCompiler *compiler, size_t target);
+
+void jit_emit(JitCompiler *compiler, uint8_t byte);
+void jit_emit_bytes(JitCompiler *compiler, size_t length, const uint8_t *bytes);
+void jit_emit_i32(JitCompiler *compiler, int32_t value);
+void jit_emit_i64(JitCompiler *compiler, int64_t value);
+void jit_emit_mem(JitCompiler *compiler, int wide, uint8_t opcode, int reg, int base, int index, int32_t disp);
+void jit_emit_mov_imm64(JitCompiler *compiler, int reg, int64_t value);
+void jit_patch_rel32(JitCompiler *compiler, size_t site, size_t to);
+
+void jit_emit_jcc_slow(JitCompiler *compiler, uint8_t cc);
+size_t jit_emit_jcc_forward(JitCompiler *compiler, uint8_t cc);
+void jit_emit_fixup(JitCompiler *compiler, size_t target);
+void jit_emit_backedge(JitCompiler *compiler, size_t target);
+void jit_emit_jcc_target(JitCompiler *compiler, uint8_t cc, size_t target);
+void jit_emit_jmp_target(JitCompiler *compiler, size_t target);
+size_t jit_emit_jmp_forward(JitCompiler *compiler);
+
+void jit_emit_load_sp(JitCompiler *compiler);
+void jit_emit_guard_pop(JitCompiler *compiler, int count);
+void jit_emit_guard_push(JitCompiler *compiler);
+void jit_emit_guard_slot(JitCompiler *compiler, int32_t slot, int type, int ptype);
+void jit_emit_guard_local(JitCompiler *compiler, uint8_t index, int ptype);
+void jit_emit_sp_add(JitCompiler *compiler, int8_t value);
+void jit_emit_copy(JitCompiler *compiler, int from_base, int from_index, int32_t from, int to_base, int to_index, int32_t to);
+
+void jit_emit_slow(JitCompiler *compiler, size_t pc, size_t target);
+void jit_emit_exit(JitCompiler *compiler, size_t pc);
+
+void jit_compile_push(JitCompiler *compiler, int type, int ptype, int64_t value);
+void jit_compile_arithmetic(JitCompiler *compiler, size_t pc, int type);
+void jit_compile_comparison(JitCompiler *compiler, size_t pc, int type);
+void jit_compile_argjmp(JitCompiler *compiler, size_t pc, int type, size_t target);
+void jit_compile_forloop(JitCompiler *compiler, size_t pc, size_t target);
+void jit_compile_instruction(JitCompiler *compiler, size_t pc);
+
+int jit_scan(JitCompiler *compiler);
+void jit_compile_native(JitCompiler *compiler);
+
+//> trace
+uint8_t jit_chunk(size_t index, DynArr *chunks);
+int32_t jit_chunk_i32(size_t index, DynArr *chunks);
+int jit_is_primitive(Value *value, int *out_ptype);
+int jit_is_array(Value *value, int *out_ptype);
+int jit_is_operand(Value *value, Primitive **out_primitive);
+int jit_are_top_ints(VM *vm);
+
+void jit_record_start(JitCode *code, size_t header, VM *vm);
+void jit_record_abort();
+int jit_record_instruction(JitRecord *record, VM *vm, Frame *frame);
+void jit_record(VM *vm, Frame *frame);
+
+int jit_ir_emit(JitTraceBuilder *builder, JitIr *ir);
+int jit_ir_const(JitTraceBuilder *builder, int ptype, int64_t value);
+int jit_ir_push(JitTraceBuilder *builder, int ref);
+int jit_ir_pop(JitTraceBuilder *builder);
+int jit_ir_snapshot(JitTraceBuilder *builder, size_t ip);
+int jit_ir_guard(JitTraceBuilder *builder, int ref, int expected, size_t ip);
+int jit_ir_local(JitTraceBuilder *builder, uint8_t index, int ptype);
+int jit_ir_store_local(JitTraceBuilder *builder, uint8_t index, int ref);
+JitTraceGlobal *jit_ir_find_global(JitTraceBuilder *builder, Value *value);
+int jit_ir_global(JitTraceBuilder *builder, Value *value, int ptype);
+int jit_ir_store_global(JitTraceBuilder *builder, Value *value, int ref);
+int jit_ir_arithmetic(JitTraceBuilder *builder, int type, int a, int b, size_t pc);
+int jit_ir_comparison(JitTraceBuilder *builder, int type, int a, int b);
+int jit_ir_array_length(JitTraceBuilder *builder, int array);
+int jit_ir_guard_index(JitTraceBuilder *builder, int array, int index, int snapshot);
+int jit_ir_array_item(JitTraceBuilder *builder, int array, int index, int ptype, size_t pc);
+int jit_ir_set_item(JitTraceBuilder *builder, int array, int index, int value, JitRecord *record);
+void jit_hoist_bounds(JitTraceBuilder *builder);
+int jit_build_trace(JitTraceBuilder *builder, JitRecorder *recorder);
+
+void jit_trace_load(JitCompiler *compiler, JitTraceBuilder *builder, int reg, int ref);
+void jit_trace_store(JitCompiler *compiler, int reg, int ref);
+void jit_trace_write_value(JitCompiler *compiler, JitTraceBuilder *builder, int base, int index, int32_t disp, int ref);
+void jit_trace_guard_value(JitCompiler *compiler, int base, int32_t disp, int ptype, DynArr *fail_sites);
+void jit_trace_guard_range(JitCompiler *compiler, JitTraceBuilder *builder, JitIr *ir, DynArr *fail_sites);
+int jit_trace_set_item(VM *vm, Object *array, int64_t index, int64_t ptype, int64_t value);
+void jit_trace_compile_ir(JitCompiler *compiler, JitTraceBuilder *builder, int ref, DynArr *exits, DynArr *fail_sites);
+void jit_trace_compile_exit(JitCompiler *compiler, JitTraceBuilder *builder, JitSnapshot *snapshot, DynArr *done_sites);
+JitTrace *jit_compile_trace(JitTraceBuilder *builder);
+void jit_destroy_trace(JitTrace *trace);
+int jit_run_trace(JitCode *code, size_t header, VM *vm, Frame *frame);
+//< trace
+
+// private implementation
+// same targets vm_jmp computes: backward jumps are relative to the
+// instruction start (except JIF) and forward jumps to its end
+int64_t jit_jump_target(uint8_t opcode, size_t pc, size_t end, int32_t value)
+{
+    if (value < 0 && opcode != JIF_OPC)
+        return (int64_t)pc + value;
+
+    return (int64_t)end + value;
+}
+
+int32_t jit_read_i32(JitCompiler *compiler, size_t pc)
+{
+    uint8_t *bytes = &compiler->bytes[pc];
+    // shifting into the sign bit of an int32_t is undefined
+    return (int32_t)(((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[0]));
+}
+
+int jit_is_target(JitCompiler *compiler, size_t target)
+{
+    return target == compiler->length || (target < compiler->length && compiler->starts[target] != JIT_NO_START);
+}
+
+void jit_emit(JitCompiler *compiler, uint8_t byte)
+{
+    assert(compiler->used < compiler->size && "Native code buffer overflow");
+    compiler->code[compiler->used++] = byte;
+}
+
+void jit_emit_bytes(JitCompiler *compiler, size_t length, const uint8_t *bytes)
+{
+    for (size_t i = 0; i < length; i++)
+        jit_emit(compiler, bytes[i]);
+}
+
+void jit_emit_i32(JitCompiler *compiler, int32_t value)
+{
+    for (size_t i = 0; i < 4; i++)
+        jit_emit(compiler, (uint8_t)((uint32_t)value >> (i * 8)));
+}
+
+void jit_emit_i64(JitCompiler *compiler, int64_t value)
+{
+    for (size_t i = 0; i < 8; i++)
+        jit_emit(compiler, (uint8_t)((uint64_t)value >> (i * 8)));
+}
+
+// Emits 'opcode' with a [base + index * 8 + disp32] operand,
+// index is -1 when not used. 'reg' is a register or an opcode extension.
+void jit_emit_mem(JitCompiler *compiler, int wide, uint8_t opcode, int reg, int base, int index, int32_t disp)
+{
+    uint8_t rex = 0x40;
+
+    if (wide)
+        rex |= 0x08;
+    if (reg & 8)
+        rex |= 0x04;
+    if (index >= 0 && (index & 8))
+        rex |= 0x02;
+    if (base & 8)
+        rex |= 0x01;
+
+    if (rex != 0x40)
+        jit_emit(compiler, rex);
+
+    jit_emit(compiler, opcode);
+
+    if (index >= 0)
+    {
+        jit_emit(compiler, 0x80 | ((reg & 7) << 3) | 4);
+        jit_emit(compiler, 0xC0 | ((index & 7) << 3) | (base & 7));
+    }
+    else if ((base & 7) == 4)
+    {
+        jit_emit(compiler, 0x80 | ((reg & 7) << 3) | 4);
+        jit_emit(compiler, 0x24);
+    }
+    else
+        jit_emit(compiler, 0x80 | ((reg & 7) << 3) | (base & 7));
+
+    jit_emit_i32(compiler, disp);
+}
+
+void jit_emit_mov_imm64(JitCompiler *compiler, int reg, int64_t value)
+{
+    jit_emit(compiler, (reg & 8) ? 0x49 : 0x48);
+    jit_emit(compiler, 0xB8 | (reg & 7));
+    jit_emit_i64(compiler, value);
+}
+
+void jit_patch_rel32(JitCompiler *compiler, size_t site, size_t to)
+{
+    int32_t rel = (int32_t)((int64_t)to - (int64_t)(site + 4));
+    memcpy(&compiler->code[site], &rel, sizeof(int32_t));
+}
+
+void jit_emit_jcc_slow(JitCompiler *compiler, uint8_t cc)
+{
+    assert(compiler->slow_count < JIT_SLOW_SITES && "Too many guards");
+
+    jit_emit(compiler, 0x0F);
+    jit_emit(compiler, 0x80 | cc);
+
+    compiler->slow_sites[compiler->slow_count++] = compiler->used;
+
+    jit_emit_i32(compiler, 0);
+}
+
+size_t jit_emit_jcc_forward(JitCompiler *compiler, uint8_t cc)
+{
+    jit_emit(compiler, 0x0F);
+    jit_emit(compiler, 0x80 | cc);
+
+    size_t site = compiler->used;
+    jit_emit_i32(compiler, 0);
+
+    return site;
+}
+
+// rel32 resolved to the native code of 'target' once everything is emitted
+void jit_emit_fixup(JitCompiler *compiler, size_t target)
+{
+    JitFixup fixup = {compiler->used, target};
+    dynarr_insert(&fixup, compiler->fixups);
+
+    jit_emit_i32(compiler, 0);
+}
+
+// Counts the back-edge. Once the loop header is hot native code leaves
+// there so jit_execute records or runs the loop trace.
+void jit_emit_backedge(JitCompiler *compiler, size_t target)
+{
+    jit_emit_mov_imm64(compiler, JIT_RAX, (int64_t)(uintptr_t)&compiler->counters[target]);
+
+    // add dword [rax], 1
+    jit_emit_mem(compiler, 0, 0x83, 0, JIT_RAX, -1, 0);
+    jit_emit(compiler, 1);
+
+    // cmp dword [rax], threshold
+    jit_emit_mem(compiler, 0, 0x81, 7, JIT_RAX, -1, 0);
+    jit_emit_i32(compiler, JIT_TRACE_THRESHOLD);
+
+    jit_emit(compiler, 0x0F);
+    jit_emit(compiler, 0x80 | JIT_CC_L);
+    jit_emit_fixup(compiler, target);
+
+    jit_emit_exit(compiler, target);
+}
+
+void jit_emit_jcc_target(JitCompiler *compiler, uint8_t cc, size_t target)
+{
+    if (target != JIT_EXIT_TARGET && target <= compiler->pc)
+    {
+        // skip the back-edge when the condition does not hold
+        size_t skip = jit_emit_jcc_forward(compiler, cc ^ 1);
+        jit_emit_backedge(compiler, target);
+        jit_patch_rel32(compiler, skip, compiler->used);
+
+        return;
+    }
+
+    jit_emit(compiler, 0x0F);
+    jit_emit(compiler, 0x80 | cc);
+    jit_emit_fixup(compiler, target);
+}
+
+void jit_emit_jmp_target(JitCompiler *compiler, size_t target)
+{
+    if (target != JIT_EXIT_TARGET && target <= compiler->pc)
+    {
+        jit_emit_backedge(compiler, target);
+        return;
+    }
+
+    jit_emit(compiler, 0xE9);
+    jit_emit_fixup(compiler, target);
+}
+
+size_t jit_emit_jmp_forward(JitCompiler *compiler)
+{
+    jit_emit(compiler, 0xE9);
+
+    size_t site = compiler->used;
+    jit_emit_i32(compiler, 0);
+
+    return site;
+}
+
+// movsxd rax, [rbx + stack_ptr]
+void jit_emit_load_sp(JitCompiler *compiler)
+{
+    jit_emit_mem(compiler, 1, 0x63, JIT_RAX, JIT_RBX, -1, JIT_SP_OFFSET);
+}
+
+// leaves rcx = stack_ptr * 3 once 'count' values are known to be in the stack
+void jit_emit_guard_pop(JitCompiler *compiler, int count)
+{
+    const uint8_t lea_rcx[] = {0x48, 0x8D, 0x0C, 0x40}; // lea rcx, [rax + rax * 2]
+
+    jit_emit_load_sp(compiler);
+
+    jit_emit(compiler, 0x3D); // cmp eax, imm32
+    jit_emit_i32(compiler, count);
+    jit_emit_jcc_slow(compiler, JIT_CC_L);
+
+    jit_emit_bytes(compiler, sizeof(lea_rcx), lea_rcx);
+}
+
+// leaves rcx = stack_ptr * 3 once there is room for one more value
+void jit_emit_guard_push(JitCompiler *compiler)
+{
+    const uint8_t lea_rcx[] = {0x48, 0x8D, 0x0C, 0x40};
+
+    jit_emit_load_sp(compiler);
+
+    jit_emit(compiler, 0x3D);
+    jit_emit_i32(compiler, VM_STACK_LENGTH - 1);
+    jit_emit_jcc_slow(compiler, JIT_CC_GE);
+
+    jit_emit_bytes(compiler, sizeof(lea_rcx), lea_rcx);
+}
+
+void jit_emit_guard_slot(JitCompiler *compiler, int32_t slot, int type, int ptype)
+{
+    // cmp dword [r13 + rcx * 8 + slot], imm32
+    jit_emit_mem(compiler, 0, 0x81, 7, JIT_R13, JIT_RCX, slot + JIT_TYPE_OFFSET);
+    jit_emit_i32(compiler, type);
+    jit_emit_jcc_slow(compiler, JIT_CC_NE);
+
+    jit_emit_mem(compiler, 0, 0x81, 7, JIT_R13, JIT_RCX, slot + JIT_PTYPE_OFFSET);
+    jit_emit_i32(compiler, ptype);
+    jit_emit_jcc_slow(compiler, JIT_CC_NE);
+}
+
+void jit_emit_guard_local(JitCompiler *compiler, uint8_t index, int ptype)
+{
+    int32_t local = index * JIT_VALUE_SIZE;
+
+    jit_emit_mem(compiler, 0, 0x81, 7, JIT_R14, -1, local + JIT_TYPE_OFFSET);
+    jit_emit_i32(compiler, VALUE_HTYPE);
+    jit_emit_jcc_slow(compiler, JIT_CC_NE);
+
+    jit_emit_mem(compiler, 0, 0x81, 7, JIT_R14, -1, local + JIT_PTYPE_OFFSET);
+    jit_emit_i32(compiler, ptype);
+    jit_emit_jcc_slow(compiler, JIT_CC_NE);
+}
+
+// add dword [rbx + stack_ptr], imm8
+void jit_emit_sp_add(JitCompiler *compiler, int8_t value)
+{
+    jit_emit_mem(compiler, 0, 0x83, 0, JIT_RBX, -1, JIT_SP_OFFSET);
+    jit_emit(compiler, (uint8_t)value);
+}
+
+// copies a whole value through rdx
+void jit_emit_copy(JitCompiler *compiler, int from_base, int from_index, int32_t from, int to_base, int to_index, int32_t to)
+{
+    for (int32_t i = 0; i < JIT_VALUE_SIZE; i += 8)
+    {
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RDX, from_base, from_index, from + i);
+        jit_emit_mem(compiler, 1, 0x89, JIT_RDX, to_base, to_index, to + i);
+    }
+}
+
+// Slow path: the interpreter executes the instruction at 'pc'. Jumps
+// pass their 'target' so native code follows the interpreter decision.
+void jit_emit_slow(JitCompiler *compiler, size_t pc, size_t target)
+{
+    const uint8_t call_interpreter[] = {
+        0x48, 0x89, 0xDF, // mov rdi, rbx
+        0x48, 0xB8        // mov rax, imm64
+    };
+    const uint8_t call_rax[] = {0xFF, 0xD0};
+
+    for (int i = 0; i < compiler->slow_count; i++)
+        jit_patch_rel32(compiler, compiler->slow_sites[i], compiler->used);
+
+    compiler->slow_count = 0;
+
+    // mov dword [r12 + ip], pc
+    jit_emit_mem(compiler, 0, 0xC7, 0, JIT_R12, -1, JIT_IP_OFFSET);
+    jit_emit_i32(compiler, (int32_t)pc);
+
+    jit_emit_bytes(compiler, sizeof(call_interpreter), call_interpreter);
+    jit_emit_i64(compiler, (int64_t)(uintptr_t)vm_execute_instruction);
+    jit_emit_bytes(compiler, sizeof(call_rax), call_rax);
+
+    if (target != JIT_EXIT_TARGET)
+    {
+        // cmp dword [r12 + ip], target
+        jit_emit_mem(compiler, 0, 0x81, 7, JIT_R12, -1, JIT_IP_OFFSET);
+        jit_emit_i32(compiler, (int32_t)target);
+        jit_emit_jcc_target(compiler, JIT_CC_E, target);
+    }
+}
+
+// leaves native code, the interpreter continues at 'pc'
+void jit_emit_exit(JitCompiler *compiler, size_t pc)
+{
+    jit_emit_mem(compiler, 0, 0xC7, 0, JIT_R12, -1, JIT_IP_OFFSET);
+    jit_emit_i32(compiler, (int32_t)pc);
+    jit_emit_jmp_target(compiler, JIT_EXIT_TARGET);
+}
+
+void jit_compile_push(JitCompiler *compiler, int type, int ptype, int64_t value)
+{
+    jit_emit_guard_push(compiler);
+
+    // qword stores write the padding and the upper half of entity.object too,
+    // so the slot ends up as zeroed as vm_stack_push_* leave it
+    jit_emit_mem(compiler, 1, 0xC7, 0, JIT_R13, JIT_RCX, JIT_SLOT_NEW + JIT_TYPE_OFFSET);
+    jit_emit_i32(compiler, type);
+
+    jit_emit_mem(compiler, 1, 0xC7, 0, JIT_R13, JIT_RCX, JIT_SLOT_NEW + JIT_PTYPE_OFFSET);
+    jit_emit_i32(compiler, ptype);
+
+    if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+        jit_emit_mem(compiler, 1, 0xC7, 0, JIT_R13, JIT_RCX, JIT_SLOT_NEW + JIT_I64_OFFSET);
+        jit_emit_i32(compiler, (int32_t)value);
+    }
+    else
+    {
+        const uint8_t mov_rdx[] = {0x48, 0xBA}; // mov rdx, imm64
+
+        jit_emit_bytes(compiler, sizeof(mov_rdx), mov_rdx);
+        jit_emit_i64(compiler, value);
+        jit_emit_mem(compiler, 1, 0x89, JIT_RDX, JIT_R13, JIT_RCX, JIT_SLOT_NEW + JIT_I64_OFFSET);
+    }
+
+    jit_emit_sp_add(compiler, 1);
+}
+
+void jit_compile_arithmetic(JitCompiler *compiler, size_t pc, int type)
+{
+    const uint8_t add[] = {0x4C, 0x01, 0xC0};        // add rax, r8
+    const uint8_t sub[] = {0x4C, 0x29, 0xC0};        // sub rax, r8
+    const uint8_t mul[] = {0x49, 0x0F, 0xAF, 0xC0};  // imul rax, r8
+    const uint8_t test_r8[] = {0x4D, 0x85, 0xC0};    // test r8, r8
+    const uint8_t div[] = {0x48, 0x99, 0x49, 0xF7, 0xF8}; // cqo, idiv r8
+    const uint8_t mov_rdx[] = {0x48, 0x89, 0xD0};    // mov rax, rdx
+
+    jit_emit_guard_pop(compiler, 2);
+    jit_emit_guard_slot(compiler, JIT_SLOT_SECOND, VALUE_HTYPE, INT_VTYPE);
+    jit_emit_guard_slot(compiler, JIT_SLOT_TOP, VALUE_HTYPE, INT_VTYPE);
+
+    jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_R13, JIT_RCX, JIT_SLOT_SECOND + JIT_I64_OFFSET);
+    jit_emit_mem(compiler, 1, 0x8B, JIT_R8, JIT_R13, JIT_RCX, JIT_SLOT_TOP + JIT_I64_OFFSET);
+
+    switch (type)
+    {
+    case 1:
+        jit_emit_bytes(compiler, sizeof(add), add);
+        break;
+
+    case 2:
+        jit_emit_bytes(compiler, sizeof(sub), sub);
+        break;
+
+    case 3:
+        jit_emit_bytes(compiler, sizeof(mul), mul);
+        break;
+
+    case 4:
+    case 5:
+        // division by zero is reported by the interpreter
+        jit_emit_bytes(compiler, sizeof(test_r8), test_r8);
+        jit_emit_jcc_slow(compiler, JIT_CC_E);
+        jit_emit_bytes(compiler, sizeof(div), div);
+
+        if (type == 5)
+            jit_emit_bytes(compiler, sizeof(mov_rdx), mov_rdx);
+
+        break;
+
+    default:
+        assert(0 && "Illegal arithmetic operation type value");
+    }
+
+    // result stays in the left operand slot
+    jit_emit_mem(compiler, 1, 0x89, JIT_RAX, JIT_R13, JIT_RCX, JIT_SLOT_SECOND + JIT_I64_OFFSET);
+    jit_emit_sp_add(compiler, -1);
+
+    size_t next = jit_emit_jmp_forward(compiler);
+    jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+    jit_patch_rel32(compiler, next, compiler->used);
+}
+
+void jit_compile_comparison(JitCompiler *compiler, size_t pc, int type)
+{
+    const uint8_t cmp[] = {0x4C, 0x39, 0xC0};         // cmp rax, r8
+    const uint8_t movzx[] = {0x0F, 0xB6, 0xC0};       // movzx eax, al
+    const uint8_t setcc[] = {0x9C, 0x9F, 0x9E, 0x9D, 0x94, 0x95};
+
+    assert(type >= 1 && type <= 6 && "Illegal comparison operation type value");
+
+    jit_emit_guard_pop(compiler, 2);
+    jit_emit_guard_slot(compiler, JIT_SLOT_SECOND, VALUE_HTYPE, INT_VTYPE);
+    jit_emit_guard_slot(compiler, JIT_SLOT_TOP, VALUE_HTYPE, INT_VTYPE);
+
+    jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_R13, JIT_RCX, JIT_SLOT_SECOND + JIT_I64_OFFSET);
+    jit_emit_mem(compiler, 1, 0x8B, JIT_R8, JIT_R13, JIT_RCX, JIT_SLOT_TOP + JIT_I64_OFFSET);
+
+    jit_emit_bytes(compiler, sizeof(cmp), cmp);
+
+    // setcc al
+    jit_emit(compiler, 0x0F);
+    jit_emit(compiler, setcc[type - 1]);
+    jit_emit(compiler, 0xC0);
+
+    jit_emit_bytes(compiler, sizeof(movzx), movzx);
+
+    jit_emit_mem(compiler, 0, 0xC7, 0, JIT_R13, JIT_RCX, JIT_SLOT_SECOND + JIT_PTYPE_OFFSET);
+    jit_emit_i32(compiler, BOOL_VTYPE);
+    jit_emit_mem(compiler, 1, 0x89, JIT_RAX, JIT_R13, JIT_RCX, JIT_SLOT_SECOND + JIT_I64_OFFSET);
+    jit_emit_sp_add(compiler, -1);
+
+    size_t next = jit_emit_jmp_forward(compiler);
+    jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+    jit_patch_rel32(compiler, next, compiler->used);
+}
+
+// type 1: jump if true, type 2: jump if false
+void jit_compile_argjmp(JitCompiler *compiler, size_t pc, int type, size_t target)
+{
+    const uint8_t cmp_rdx_1[] = {0x48, 0x83, 0xFA, 0x01}; // cmp rdx, 1
+    const uint8_t test_rdx[] = {0x48, 0x85, 0xD2};        // test rdx, rdx
+
+    jit_emit_guard_pop(compiler, 1);
+    jit_emit_guard_slot(compiler, JIT_SLOT_TOP, VALUE_HTYPE, BOOL_VTYPE);
+
+    jit_emit_mem(compiler, 1, 0x8B, JIT_RDX, JIT_R13, JIT_RCX, JIT_SLOT_TOP + JIT_I64_OFFSET);
+    jit_emit_sp_add(compiler, -1);
+
+    if (type == 1)
+        jit_emit_bytes(compiler, sizeof(cmp_rdx_1), cmp_rdx_1);
+    else
+        jit_emit_bytes(compiler, sizeof(test_rdx), test_rdx);
+
+    jit_emit_jcc_target(compiler, JIT_CC_E, target);
+
+    size_t next = jit_emit_jmp_forward(compiler);
+    jit_emit_slow(compiler, pc, target);
+    jit_patch_rel32(compiler, next, compiler->used);
+}
+
+void jit_compile_forloop(JitCompiler *compiler, size_t pc, size_t target)
+{
+    uint8_t counter = compiler->bytes[pc + 1];
+    uint8_t bound = compiler->bytes[pc + 2];
+    uint8_t up = compiler->bytes[pc + 3];
+
+    const uint8_t inc_rax[] = {0x48, 0x83, 0xC0, 0x01}; // add rax, 1
+    const uint8_t dec_rax[] = {0x48, 0x83, 0xE8, 0x01}; // sub rax, 1
+
+    jit_emit_guard_local(compiler, counter, INT_VTYPE);
+    jit_emit_guard_local(compiler, bound, INT_VTYPE);
+
+    jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_R14, -1, counter * JIT_VALUE_SIZE + JIT_I64_OFFSET);
+
+    if (up)
+        jit_emit_bytes(compiler, sizeof(inc_rax), inc_rax);
+    else
+        jit_emit_bytes(compiler, sizeof(dec_rax), dec_rax);
+
+    jit_emit_mem(compiler, 1, 0x89, JIT_RAX, JIT_R14, -1, counter * JIT_VALUE_SIZE + JIT_I64_OFFSET);
+
+    // cmp rax, [r14 + bound]
+    jit_emit_mem(compiler, 1, 0x3B, JIT_RAX, JIT_R14, -1, bound * JIT_VALUE_SIZE + JIT_I64_OFFSET);
+    jit_emit_jcc_target(compiler, up ? JIT_CC_L : JIT_CC_GE, target);
+
+    size_t next = jit_emit_jmp_forward(compiler);
+    jit_emit_slow(compiler, pc, target);
+    jit_patch_rel32(compiler, next, compiler->used);
+}
+
+void jit_compile_instruction(JitCompiler *compiler, size_t pc)
+{
+    uint8_t opcode = compiler->bytes[pc];
+    size_t end = pc + 1 + jit_operands_length(opcode);
+
+    switch (opcode)
+    {
+    case NIL_OPC:
+        jit_compile_push(compiler, NIL_HTYPE, 0, 0);
+        break;
+
+    case BCONST_OPC:
+        jit_compile_push(compiler, VALUE_HTYPE, BOOL_VTYPE, compiler->bytes[pc + 1]);
+        break;
+
+    case ICONST_OPC:
+    {
+        int32_t index = jit_read_i32(compiler, pc + 1);
+
+        if (index < 0 || (size_t)index >= compiler->vm->iconsts->used)
+        {
+            jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+            return;
+        }
+
+        int64_t value = *(int64_t *)dynarr_get((size_t)index, compiler->vm->iconsts);
+        jit_compile_push(compiler, VALUE_HTYPE, INT_VTYPE, value);
+
+        break;
+    }
+
+    case LREAD_OPC:
+    {
+        uint8_t index = compiler->bytes[pc + 1];
+
+        if (index >= FRAME_VALUES_LENGTH)
+        {
+            jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+            return;
+        }
+
+        jit_emit_guard_push(compiler);
+        jit_emit_copy(compiler, JIT_R14, -1, index * JIT_VALUE_SIZE, JIT_R13, JIT_RCX, JIT_SLOT_NEW);
+        jit_emit_sp_add(compiler, 1);
+
+        break;
+    }
+
+    case LSET_OPC:
+    {
+        uint8_t index = compiler->bytes[pc + 1];
+
+        if (index >= FRAME_VALUES_LENGTH)
+        {
+            jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+            return;
+        }
+
+        jit_emit_guard_pop(compiler, 1);
+        jit_emit_copy(compiler, JIT_R13, JIT_RCX, JIT_SLOT_TOP, JIT_R14, -1, index * JIT_VALUE_SIZE);
+
+        break;
+    }
+
+    case POP_OPC:
+        jit_emit_guard_pop(compiler, 1);
+        jit_emit_sp_add(compiler, -1);
+        break;
+
+    case ADD_OPC:
+    case ADD_II_OPC:
+        jit_compile_arithmetic(compiler, pc, 1);
+        return;
+
+    case SUB_OPC:
+    case SUB_II_OPC:
+        jit_compile_arithmetic(compiler, pc, 2);
+        return;
+
+    case MUL_OPC:
+    case MUL_II_OPC:
+        jit_compile_arithmetic(compiler, pc, 3);
+        return;
+
+    case DIV_OPC:
+    case DIV_II_OPC:
+        jit_compile_arithmetic(compiler, pc, 4);
+        return;
+
+    case MOD_OPC:
+    case MOD_II_OPC:
+        jit_compile_arithmetic(compiler, pc, 5);
+        return;
+
+    case LT_OPC:
+    case LT_II_OPC:
+        jit_compile_comparison(compiler, pc, 1);
+        return;
+
+    case GT_OPC:
+    case GT_II_OPC:
+        jit_compile_comparison(compiler, pc, 2);
+        return;
+
+    case LE_OPC:
+    case LE_II_OPC:
+        jit_compile_comparison(compiler, pc, 3);
+        return;
+
+    case GE_OPC:
+    case GE_II_OPC:
+        jit_compile_comparison(compiler, pc, 4);
+        return;
+
+    case EQ_OPC:
+    case EQ_II_OPC:
+        jit_compile_comparison(compiler, pc, 5);
+        return;
+
+    case NE_OPC:
+    case NE_II_OPC:
+        jit_compile_comparison(compiler, pc, 6);
+        return;
+
+    case JMP_OPC:
+    case JIT_OPC:
+    case JIF_OPC:
+    case FORLOOP_OPC:
+    {
+        int32_t value = jit_read_i32(compiler, end - 4);
+        int64_t target = jit_jump_target(opcode, pc, end, value);
+
+        if (target < 0 || !jit_is_target(compiler, (size_t)target))
+        {
+            jit_emit_exit(compiler, pc);
+            return;
+        }
+
+        if (opcode == JMP_OPC)
+        {
+            if (value != 0)
+                jit_emit_jmp_target(compiler, (size_t)target);
+        }
+        else if (opcode == FORLOOP_OPC)
+            jit_compile_forloop(compiler, pc, (size_t)target);
+        else
+            jit_compile_argjmp(compiler, pc, opcode == JIT_OPC ? 1 : 2, (size_t)target);
+
+        return;
+    }
+
+    case CALL_OPC:
+    case RET_OPC:
+    case HLT_OPC:
+        jit_emit_exit(compiler, pc);
+        return;
+
+    default:
+        jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+        return;
+    }
+
+    // fast paths above fall back to the interpreter when a guard fails
+    if (compiler->slow_count > 0)
+    {
+        size_t next = jit_emit_jmp_forward(compiler);
+        jit_emit_slow(compiler, pc, JIT_EXIT_TARGET);
+        jit_patch_rel32(compiler, next, compiler->used);
+    }
+}
+
+// marks where each instruction starts, fails on unknown or truncated instructions
+int jit_scan(JitCompiler *compiler)
+{
+    size_t pc = 0;
+
+    while (pc < compiler->length)
+    {
+        uint8_t opcode = compiler->bytes[pc];
+        int operands = jit_operands_length(opcode);
+
+        if (operands < 0 || pc + 1 + operands > compiler->length)
+            return 0;
+
+        if (opcode == CALL_OPC || opcode == RET_OPC || opcode == HLT_OPC)
+            compiler->starts[pc] = JIT_EXIT_START;
+        else
+            compiler->starts[pc] = JIT_START;
+
+        pc += 1 + operands;
+    }
+
+    return 1;
+}
+
+void jit_compile_native(JitCompiler *compiler)
+{
+    const uint8_t prologue[] = {
+        0x53,             // push rbx
+        0x41, 0x54,       // push r12
+        0x41, 0x55,       // push r13
+        0x41, 0x56,       // push r14
+        0x41, 0x57,       // push r15 (keeps the stack 16 bytes aligned)
+        0x48, 0x89, 0xFB, // mov rbx, rdi
+        0x49, 0x89, 0xF4  // mov r12, rsi
+    };
+    const uint8_t jmp_rdx[] = {0xFF, 0xE2};
+    const uint8_t epilogue[] = {
+        0x41, 0x5F, // pop r15
+        0x41, 0x5E, // pop r14
+        0x41, 0x5D, // pop r13
+        0x41, 0x5C, // pop r12
+        0x5B,       // pop rbx
+        0xC3        // ret
+    };
+
+    jit_emit_bytes(compiler, sizeof(prologue), prologue);
+    jit_emit_mem(compiler, 1, 0x8D, JIT_R13, JIT_RBX, -1, JIT_STACK_OFFSET);  // lea r13, [rbx + stack]
+    jit_emit_mem(compiler, 1, 0x8D, JIT_R14, JIT_R12, -1, JIT_LOCALS_OFFSET); // lea r14, [r12 + locals]
+    jit_emit_bytes(compiler, sizeof(jmp_rdx), jmp_rdx);
+
+    for (size_t pc = 0; pc < compiler->length; pc++)
+    {
+        if (compiler->starts[pc] == JIT_NO_START)
+            continue;
+
+        compiler->pc = pc;
+        compiler->labels[pc] = compiler->used;
+        jit_compile_instruction(compiler, pc);
+    }
+
+    // falling off the end of the chunks
+    compiler->labels[compiler->length] = compiler->used;
+
+    jit_emit_mem(compiler, 0, 0xC7, 0, JIT_R12, -1, JIT_IP_OFFSET);
+    jit_emit_i32(compiler, (int32_t)compiler->length);
+
+    compiler->exit_label = compiler->used;
+    jit_emit_bytes(compiler, sizeof(epilogue), epilogue);
+
+    for (size_t i = 0; i < compiler->fixups->used; i++)
+    {
+        JitFixup *fixup = (JitFixup *)dynarr_get(i, compiler->fixups);
+
+        if (fixup->target == JIT_EXIT_TARGET)
+            jit_patch_rel32(compiler, fixup->site, compiler->exit_label);
+        else
+            jit_patch_rel32(compiler, fixup->site, compiler->labels[fixup->target]);
+    }
+}
+
+//> trace
+uint8_t jit_chunk(size_t index, DynArr *chunks)
+{
+    return *(uint8_t *)dynarr_get(index, chunks);
+}
+
+int32_t jit_chunk_i32(size_t index, DynArr *chunks)
+{
+    uint8_t bytes[4];
+
+    for (size_t i = 0; i < 4; i++)
+        bytes[i] = jit_chunk(index + i, chunks);
+
+    // shifting into the sign bit of an int32_t is undefined
+    return (int32_t)(((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[0]));
+}
+
+int jit_is_primitive(Value *value, int *out_ptype)
+{
+    if (value->type != VALUE_HTYPE)
+        return 0;
+
+    if (out_ptype)
+        *out_ptype = value->entity.primitive.type;
+
+    return 1;
+}
+
+int jit_is_array(Value *value, int *out_ptype)
+{
+    if (value->type != OBJECT_HTYPE || value->entity.object->type != ARR_OTYPE)
+        return 0;
+
+    if (out_ptype)
+        *out_ptype = JIT_ARRAY_PTYPE;
+
+    return 1;
+}
+
+// like jit_is_primitive, but also takes the boxes ARR_ITM pushes
+int jit_is_operand(Value *value, Primitive **out_primitive)
+{
+    Primitive *primitive = NULL;
+
+    if (value->type == VALUE_HTYPE)
+        primitive = &value->entity.primitive;
+    else if (value->type == OBJECT_HTYPE && value->entity.object->type == VALUE_OTYPE)
+        primitive = &value->entity.object->value.primitive;
+    else
+        return 0;
+
+    if (out_primitive)
+        *out_primitive = primitive;
+
+    return 1;
+}
+
+int jit_are_top_ints(VM *vm)
+{
+    if (vm->stack_ptr < 2)
+        return 0;
+
+    Primitive *left = NULL;
+    Primitive *right = NULL;
+
+    return jit_is_operand(&vm->stack[vm->stack_ptr - 2], &left) &&
+           jit_is_operand(&vm->stack[vm->stack_ptr - 1], &right) &&
+           left->type == INT_VTYPE &&
+           right->type == INT_VTYPE;
+}
+
+void jit_record_start(JitCode *code, size_t header, VM *vm)
+{
+    JitRecorder *recorder = &jit.recorder;
+
+    recorder->active = 1;
+    recorder->frame_ptr = vm->frame_ptr;
+    recorder->code = code;
+    recorder->header = header;
+    recorder->length = 0;
+}
+
+void jit_record_abort()
+{
+    JitRecorder *recorder = &jit.recorder;
+
+    recorder->active = 0;
+    recorder->code->counters[recorder->header] = JIT_TRACE_BLACKLIST;
+}
+
+// Fills 'record' with the instruction at the frame ip and what it sees.
+// Returns 0 for instructions traces do not handle.
+int jit_record_instruction(JitRecord *record, VM *vm, Frame *frame)
+{
+    DynArr *chunks = frame->chunks;
+    size_t pc = (size_t)frame->ip;
+
+    uint8_t opcode = jit_chunk(pc, chunks);
+    int operands = jit_operands_length(opcode);
+
+    if (operands < 0 || pc + 1 + operands > chunks->used)
+        return 0;
+
+    record->pc = pc;
+    record->opcode = opcode;
+    record->end = pc + 1 + operands;
+    record->target = JIT_EXIT_TARGET;
+    record->value = 0;
+    record->global = NULL;
+    record->ptype = INT_VTYPE;
+    record->taken = 0;
+
+    switch (opcode)
+    {
+    case BCONST_OPC:
+        record->value = jit_chunk(pc + 1, chunks);
+        record->ptype = BOOL_VTYPE;
+        return 1;
+
+    case ICONST_OPC:
+    {
+        int32_t index = jit_chunk_i32(pc + 1, chunks);
+
+        if (index < 0 || (size_t)index >= vm->iconsts->used)
+            return 0;
+
+        record->value = *(int64_t *)dynarr_get((size_t)index, vm->iconsts);
+
+        return 1;
+    }
+
+    case LREAD_OPC:
+    case LSET_OPC:
+    {
+        uint8_t index = jit_chunk(pc + 1, chunks);
+
+        if (index >= FRAME_VALUES_LENGTH)
+            return 0;
+
+        record->value = index;
+
+        if (opcode == LSET_OPC)
+            return 1;
+
+        return jit_is_primitive(&frame->locals[index], &record->ptype) ||
+               jit_is_array(&frame->locals[index], &record->ptype);
+    }
+
+    case GREAD_OPC:
+    case GWRITE_OPC:
+    {
+        int32_t index = jit_chunk_i32(pc + 1, chunks);
+
+        if (index < 0 || (size_t)index >= vm->strings->used)
+            return 0;
+
+        // globals never move once created, the trace keeps their address
+        char *identifier = (char *)DYNARR_PTR_GET((size_t)index, vm->strings);
+        record->global = (Value *)lzhtable_get((uint8_t *)identifier, strlen(identifier), vm->globals);
+
+        if (!record->global)
+            return 0;
+
+        if (opcode == GWRITE_OPC)
+            return 1;
+
+        return jit_is_primitive(record->global, &record->ptype) ||
+               jit_is_array(record->global, &record->ptype);
+    }
+
+    case POP_OPC:
+        return 1;
+
+    case ARR_LEN_OPC:
+        return vm->stack_ptr > 0 && jit_is_array(&vm->stack[vm->stack_ptr - 1], NULL);
+
+    case ARR_ITM_OPC:
+    case ARR_SITM_OPC:
+    {
+        // nil items and out of bounds indexes are left to the interpreter
+        int operands = opcode == ARR_ITM_OPC ? 2 : 3;
+
+        if (vm->stack_ptr < operands)
+            return 0;
+
+        Value *array = &vm->stack[vm->stack_ptr - 2];
+        Primitive *index = NULL;
+
+        if (!jit_is_array(array, NULL) ||
+            !jit_is_operand(&vm->stack[vm->stack_ptr - 1], &index) ||
+            index->type != INT_VTYPE ||
+            index->i64 < 0 ||
+            (size_t)index->i64 >= array->entity.object->value.array.length)
+            return 0;
+
+        Primitive *item = NULL;
+
+        if (opcode == ARR_SITM_OPC)
+            return jit_is_operand(&vm->stack[vm->stack_ptr - 3], &item);
+
+        Object *object = array->entity.object->value.array.items[index->i64];
+
+        if (!object || object->type != VALUE_OTYPE)
+            return 0;
+
+        record->ptype = object->value.primitive.type;
+
+        return 1;
+    }
+
+    case ADD_OPC:
+    case SUB_OPC:
+    case MUL_OPC:
+    case DIV_OPC:
+    case MOD_OPC:
+        record->value = opcode - ADD_OPC + 1;
+        return jit_are_top_ints(vm);
+
+    case ADD_II_OPC:
+    case SUB_II_OPC:
+    case MUL_II_OPC:
+    case DIV_II_OPC:
+    case MOD_II_OPC:
+        record->value = opcode - ADD_II_OPC + 1;
+        return jit_are_top_ints(vm);
+
+    case LT_OPC:
+    case GT_OPC:
+    case LE_OPC:
+    case GE_OPC:
+    case EQ_OPC:
+    case NE_OPC:
+        record->value = opcode - LT_OPC + 1;
+        return jit_are_top_ints(vm);
+
+    case LT_II_OPC:
+    case GT_II_OPC:
+    case LE_II_OPC:
+    case GE_II_OPC:
+    case EQ_II_OPC:
+    case NE_II_OPC:
+        record->value = opcode - LT_II_OPC + 1;
+        return jit_are_top_ints(vm);
+
+    case JMP_OPC:
+    case JIT_OPC:
+    case JIF_OPC:
+    case FORLOOP_OPC:
+    {
+        int64_t target = jit_jump_target(opcode, pc, record->end, jit_chunk_i32(record->end - 4, chunks));
+
+        if (target < 0 || (size_t)target > chunks->used)
+            return 0;
+
+        record->target = (size_t)target;
+
+        if (opcode == JIT_OPC || opcode == JIF_OPC)
+        {
+            Primitive *condition = NULL;
+            return vm->stack_ptr > 0 && jit_is_operand(&vm->stack[vm->stack_ptr - 1], &condition) && condition->type == BOOL_VTYPE;
+        }
+
+        if (opcode == FORLOOP_OPC)
+        {
+            uint8_t counter = jit_chunk(pc + 1, chunks);
+            uint8_t bound = jit_chunk(pc + 2, chunks);
+            uint8_t up = jit_chunk(pc + 3, chunks);
+
+            int counter_ptype = 0;
+            int bound_ptype = 0;
+
+            record->value = counter | (bound << 8) | (up << 16);
+
+            return counter < FRAME_VALUES_LENGTH &&
+                   bound < FRAME_VALUES_LENGTH &&
+                   jit_is_primitive(&frame->locals[counter], &counter_ptype) &&
+                   jit_is_primitive(&frame->locals[bound], &bound_ptype) &&
+                   counter_ptype == INT_VTYPE &&
+                   bound_ptype == INT_VTYPE;
+        }
+
+        return 1;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+// called before the interpreter executes each instruction while recording
+void jit_record(VM *vm, Frame *frame)
+{
+    JitRecorder *recorder = &jit.recorder;
+
+    if (vm->frame_ptr != recorder->frame_ptr || frame->fn->jit != recorder->code)
+    {
+        jit_record_abort();
+        return;
+    }
+
+    size_t ip = (size_t)frame->ip;
+
+    // the previous jump is done, note which way it went
+    if (recorder->length > 0)
+    {
+        JitRecord *last = &recorder->records[recorder->length - 1];
+
+        if (last->target != JIT_EXIT_TARGET)
+            last->taken = ip == last->target;
+    }
+
+    if (ip == recorder->header && recorder->length > 0)
+    {
+        JitCode *code = recorder->code;
+        JitTraceBuilder *builder = (JitTraceBuilder *)vm_memory_alloc(sizeof(JitTraceBuilder));
+        JitTrace *trace = NULL;
+
+        recorder->active = 0;
+
+        if (jit_build_trace(builder, recorder))
+            trace = jit_compile_trace(builder);
+
+        vm_memory_dealloc(builder);
+
+        if (trace)
+            code->traces[recorder->header] = trace;
+        else
+            code->counters[recorder->header] = JIT_TRACE_BLACKLIST;
+
+        return;
+    }
+
+    if (recorder->length == JIT_TRACE_LENGTH ||
+        !jit_record_instruction(&recorder->records[recorder->length], vm, frame))
+    {
+        jit_record_abort();
+        return;
+    }
+
+    recorder->length++;
+}
+
+int jit_ir_emit(JitTraceBuilder *builder, JitIr *ir)
+{
+    if (builder->ir_length == JIT_TRACE_IR)
+        return -1;
+
+    builder->ir[builder->ir_length] = *ir;
+
+    return builder->ir_length++;
+}
+
+int jit_ir_const(JitTraceBuilder *builder, int ptype, int64_t value)
+{
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_CONST;
+    ir.value = value;
+    ir.ptype = ptype;
+
+    return jit_ir_emit(builder, &ir);
+}
+
+int jit_ir_push(JitTraceBuilder *builder, int ref)
+{
+    if (ref < 0 || builder->stack_ptr == JIT_TRACE_STACK)
+        return 0;
+
+    builder->stack[builder->stack_ptr++] = ref;
+
+    if (builder->stack_ptr > builder->max_depth)
+        builder->max_depth = builder->stack_ptr;
+
+    return 1;
+}
+
+int jit_ir_pop(JitTraceBuilder *builder)
+{
+    // values pushed before the trace entry are not known
+    if (builder->stack_ptr == 0)
+        return -1;
+
+    return builder->stack[--builder->stack_ptr];
+}
+
+// state the interpreter needs to continue at 'ip'
+int jit_ir_snapshot(JitTraceBuilder *builder, size_t ip)
+{
+    if (builder->snapshots_length == JIT_TRACE_LENGTH)
+        return -1;
+
+    JitSnapshot *snapshot = &builder->snapshots[builder->snapshots_length];
+
+    snapshot->ip = ip;
+    snapshot->depth = builder->stack_ptr;
+    memcpy(snapshot->stack, builder->stack, sizeof(int) * builder->stack_ptr);
+
+    return builder->snapshots_length++;
+}
+
+// Returns 0 if the guard always fails
+int jit_ir_guard(JitTraceBuilder *builder, int ref, int expected, size_t ip)
+{
+    JitIr *value = &builder->ir[ref];
+
+    if (value->type == JIT_IR_CONST)
+        return (value->value != 0) == expected;
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_GUARD;
+    ir.a = ref;
+    ir.value = expected;
+    ir.snapshot = jit_ir_snapshot(builder, ip);
+
+    return ir.snapshot >= 0 && jit_ir_emit(builder, &ir) >= 0;
+}
+
+int jit_ir_local(JitTraceBuilder *builder, uint8_t index, int ptype)
+{
+    // written earlier in the iteration
+    if (builder->local_refs[index] >= 0)
+        return builder->local_refs[index];
+
+    // read before any write: its type is checked once at the trace entry
+    builder->local_guards[index] = ptype;
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_LOCAL;
+    ir.value = index;
+    ir.ptype = ptype;
+    // arrays are never stored by traces, it stays the same array
+    ir.hoisted = ptype == JIT_ARRAY_PTYPE;
+
+    int ref = jit_ir_emit(builder, &ir);
+    builder->local_refs[index] = ref;
+
+    return ref;
+}
+
+int jit_ir_store_local(JitTraceBuilder *builder, uint8_t index, int ref)
+{
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_STORE_LOCAL;
+    ir.a = ref;
+    ir.value = index;
+    ir.ptype = builder->ir[ref].ptype;
+
+    if (ir.ptype == JIT_ARRAY_PTYPE)
+        return 0;
+
+    // the next iteration must read the type checked at the entry
+    if (builder->local_stores[index] >= 0 && builder->local_stores[index] != ir.ptype)
+        return 0;
+
+    builder->local_refs[index] = ref;
+    builder->local_stores[index] = ir.ptype;
+
+    return jit_ir_emit(builder, &ir) >= 0;
+}
+
+JitTraceGlobal *jit_ir_find_global(JitTraceBuilder *builder, Value *value)
+{
+    for (int i = 0; i < builder->globals_length; i++)
+    {
+        if (builder->globals[i].value == value)
+            return &builder->globals[i];
+    }
+
+    if (builder->globals_length == JIT_TRACE_GLOBALS)
+        return NULL;
+
+    JitTraceGlobal *global = &builder->globals[builder->globals_length++];
+
+    global->value = value;
+    global->ref = -1;
+    global->guard = -1;
+    global->store = -1;
+
+    return global;
+}
+
+int jit_ir_global(JitTraceBuilder *builder, Value *value, int ptype)
+{
+    JitTraceGlobal *global = jit_ir_find_global(builder, value);
+
+    if (!global)
+        return -1;
+
+    if (global->ref >= 0)
+        return global->ref;
+
+    global->guard = ptype;
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_GLOBAL;
+    ir.global = value;
+    ir.ptype = ptype;
+    ir.hoisted = ptype == JIT_ARRAY_PTYPE;
+
+    global->ref = jit_ir_emit(builder, &ir);
+
+    return global->ref;
+}
+
+int jit_ir_store_global(JitTraceBuilder *builder, Value *value, int ref)
+{
+    JitTraceGlobal *global = jit_ir_find_global(builder, value);
+
+    if (!global)
+        return 0;
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_STORE_GLOBAL;
+    ir.a = ref;
+    ir.global = value;
+    ir.ptype = builder->ir[ref].ptype;
+
+    if (ir.ptype == JIT_ARRAY_PTYPE)
+        return 0;
+
+    if (global->store >= 0 && global->store != ir.ptype)
+        return 0;
+
+    global->ref = ref;
+    global->store = ir.ptype;
+
+    return jit_ir_emit(builder, &ir) >= 0;
+}
+
+int jit_ir_arithmetic(JitTraceBuilder *builder, int type, int a, int b, size_t pc)
+{
+    if (a < 0 || b < 0)
+        return -1;
+
+    JitIr *left = &builder->ir[a];
+    JitIr *right = &builder->ir[b];
+
+    if (left->ptype != INT_VTYPE || right->ptype != INT_VTYPE)
+        return -1;
+
+    if (type >= 4 && right->type == JIT_IR_CONST && right->value == 0)
+        return -1;
+
+    if (left->type == JIT_IR_CONST && right->type == JIT_IR_CONST)
+    {
+        int64_t l = left->value;
+        int64_t r = right->value;
+
+        switch (type)
+        {
+        case 1:
+            return jit_ir_const(builder, INT_VTYPE, l + r);
+        case 2:
+            return jit_ir_const(builder, INT_VTYPE, l - r);
+        case 3:
+            return jit_ir_const(builder, INT_VTYPE, l * r);
+        case 4:
+            return jit_ir_const(builder, INT_VTYPE, l / r);
+        default:
+            return jit_ir_const(builder, INT_VTYPE, l % r);
+        }
+    }
+
+    if (type >= 4 && right->type != JIT_IR_CONST)
+    {
+        // division by zero is reported by the interpreter, which
+        // needs both operands back in the stack
+        JitIr guard = {0};
+
+        guard.type = JIT_IR_GUARD_NONZERO;
+        guard.a = b;
+
+        if (!jit_ir_push(builder, a) || !jit_ir_push(builder, b))
+            return -1;
+
+        guard.snapshot = jit_ir_snapshot(builder, pc);
+
+        builder->stack_ptr -= 2;
+
+        if (guard.snapshot < 0 || jit_ir_emit(builder, &guard) < 0)
+            return -1;
+    }
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_ARITHMETIC;
+    ir.a = a;
+    ir.b = b;
+    ir.value = type;
+    ir.ptype = INT_VTYPE;
+
+    return jit_ir_emit(builder, &ir);
+}
+
+int jit_ir_comparison(JitTraceBuilder *builder, int type, int a, int b)
+{
+    if (a < 0 || b < 0)
+        return -1;
+
+    JitIr *left = &builder->ir[a];
+    JitIr *right = &builder->ir[b];
+
+    if (left->ptype != INT_VTYPE || right->ptype != INT_VTYPE)
+        return -1;
+
+    if (left->type == JIT_IR_CONST && right->type == JIT_IR_CONST)
+    {
+        int64_t l = left->value;
+        int64_t r = right->value;
+        int64_t results[] = {l < r, l > r, l <= r, l >= r, l == r, l != r};
+
+        return jit_ir_const(builder, BOOL_VTYPE, results[type - 1]);
+    }
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_COMPARISON;
+    ir.a = a;
+    ir.b = b;
+    ir.value = type;
+    ir.ptype = BOOL_VTYPE;
+
+    return jit_ir_emit(builder, &ir);
+}
+
+int jit_ir_array_length(JitTraceBuilder *builder, int array)
+{
+    if (array < 0 || builder->ir[array].ptype != JIT_ARRAY_PTYPE)
+        return -1;
+
+    // arrays never change their length
+    for (int ref = 0; ref < builder->ir_length; ref++)
+    {
+        JitIr *ir = &builder->ir[ref];
+
+        if (ir->type == JIT_IR_ARRAY_LENGTH && ir->a == array)
+            return ref;
+    }
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_ARRAY_LENGTH;
+    ir.a = array;
+    ir.ptype = INT_VTYPE;
+    ir.hoisted = 1;
+
+    return jit_ir_emit(builder, &ir);
+}
+
+int jit_ir_guard_index(JitTraceBuilder *builder, int array, int index, int snapshot)
+{
+    // already checked earlier in the iteration
+    for (int ref = 0; ref < builder->ir_length; ref++)
+    {
+        JitIr *ir = &builder->ir[ref];
+
+        if (ir->type == JIT_IR_GUARD_INDEX && ir->a == array && ir->b == index)
+            return 1;
+    }
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_GUARD_INDEX;
+    ir.a = array;
+    ir.b = index;
+    ir.snapshot = snapshot;
+
+    return snapshot >= 0 && jit_ir_emit(builder, &ir) >= 0;
+}
+
+int jit_ir_array_item(JitTraceBuilder *builder, int array, int index, int ptype, size_t pc)
+{
+    if (builder->ir[array].ptype != JIT_ARRAY_PTYPE || builder->ir[index].ptype != INT_VTYPE)
+        return -1;
+
+    // bad indexes and items other than primitives are handled by
+    // the interpreter, which needs both operands back in the stack
+    if (!jit_ir_push(builder, array) || !jit_ir_push(builder, index))
+        return -1;
+
+    int snapshot = jit_ir_snapshot(builder, pc);
+
+    builder->stack_ptr -= 2;
+
+    if (!jit_ir_guard_index(builder, array, index, snapshot))
+        return -1;
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_ARRAY_ITEM;
+    ir.a = array;
+    ir.b = index;
+    ir.ptype = ptype;
+    ir.snapshot = snapshot;
+
+    return jit_ir_emit(builder, &ir);
+}
+
+// 'value' stays in the stack, as ARR_SITM leaves it
+int jit_ir_set_item(JitTraceBuilder *builder, int array, int index, int value, JitRecord *record)
+{
+    if (builder->ir[array].ptype != JIT_ARRAY_PTYPE ||
+        builder->ir[index].ptype != INT_VTYPE ||
+        builder->ir[value].ptype == JIT_ARRAY_PTYPE)
+        return 0;
+
+    if (!jit_ir_push(builder, array) || !jit_ir_push(builder, index))
+        return 0;
+
+    int snapshot = jit_ir_snapshot(builder, record->pc);
+
+    builder->stack_ptr -= 2;
+
+    if (!jit_ir_guard_index(builder, array, index, snapshot))
+        return 0;
+
+    JitIr ir = {0};
+
+    ir.type = JIT_IR_SET_ITEM;
+    ir.a = array;
+    ir.b = index;
+    ir.c = value;
+    ir.ptype = BOOL_VTYPE;
+
+    JitIr guard = {0};
+
+    guard.type = JIT_IR_GUARD;
+    guard.a = jit_ir_emit(builder, &ir);
+    guard.value = 1;
+    guard.snapshot = snapshot;
+
+    // the interpreter reaches the safepoint before assigning it
+    return guard.a >= 0 && jit_ir_emit(builder, &guard) >= 0;
+}
+
+// Counters of the traced for loop read at the iteration start only take
+// the values from the one at the entry up to the bound. When the counter
+// is written by the FORLOOP alone and the bound not at all, index guards
+// on such reads become one range check at the trace entry.
+void jit_hoist_bounds(JitTraceBuilder *builder)
+{
+    if (builder->forloop < 0)
+        return;
+
+    uint8_t counter = (uint8_t)builder->forloop;
+    uint8_t bound = (uint8_t)(builder->forloop >> 8);
+    int stores = 0;
+
+    for (int ref = 0; ref < builder->ir_length; ref++)
+    {
+        JitIr *ir = &builder->ir[ref];
+
+        if (ir->type != JIT_IR_STORE_LOCAL)
+            continue;
+
+        if (ir->value == bound)
+            return;
+
+        if (ir->value == counter)
+            stores++;
+    }
+
+    if (stores != 1)
+        return;
+
+    for (int ref = 0; ref < builder->ir_length; ref++)
+    {
+        JitIr *ir = &builder->ir[ref];
+
+        if (ir->type != JIT_IR_GUARD_INDEX)
+            continue;
+
+        JitIr *index = &builder->ir[ir->b];
+
+        if (index->type != JIT_IR_LOCAL || index->value != counter)
+            continue;
+
+        ir->type = JIT_IR_GUARD_RANGE;
+        ir->value = builder->forloop;
+        ir->hoisted = 1;
+    }
+}
+
+// Turns the recorded iteration into ir. Returns 0 if it can not be traced.
+int jit_build_trace(JitTraceBuilder *builder, JitRecorder *recorder)
+{
+    builder->ir_length = 0;
+    builder->snapshots_length = 0;
+    builder->stack_ptr = 0;
+    builder->max_depth = 0;
+    builder->globals_length = 0;
+    builder->forloop = -1;
+
+    for (size_t i = 0; i < FRAME_VALUES_LENGTH; i++)
+    {
+        builder->local_refs[i] = -1;
+        builder->local_guards[i] = -1;
+        builder->local_stores[i] = -1;
+    }
+
+    for (int i = 0; i < recorder->length; i++)
+    {
+        JitRecord *record = &recorder->records[i];
+
+        switch (record->opcode)
+        {
+        case BCONST_OPC:
+        case ICONST_OPC:
+            if (!jit_ir_push(builder, jit_ir_const(builder, record->ptype, record->value)))
+                return 0;
+            break;
+
+        case LREAD_OPC:
+            if (!jit_ir_push(builder, jit_ir_local(builder, (uint8_t)record->value, record->ptype)))
+                return 0;
+            break;
+
+        case LSET_OPC:
+        {
+            if (builder->stack_ptr == 0)
+                return 0;
+
+            int ref = builder->stack[builder->stack_ptr - 1];
+
+            if (!jit_ir_store_local(builder, (uint8_t)record->value, ref))
+                return 0;
+
+            break;
+        }
+
+        case GREAD_OPC:
+            if (!jit_ir_push(builder, jit_ir_global(builder, record->global, record->ptype)))
+                return 0;
+            break;
+
+        case GWRITE_OPC:
+        {
+            if (builder->stack_ptr == 0)
+                return 0;
+
+            int ref = builder->stack[builder->stack_ptr - 1];
+
+            if (!jit_ir_store_global(builder, record->global, ref))
+                return 0;
+
+            break;
+        }
+
+        case POP_OPC:
+            if (jit_ir_pop(builder) < 0)
+                return 0;
+            break;
+
+        case ARR_LEN_OPC:
+            if (!jit_ir_push(builder, jit_ir_array_length(builder, jit_ir_pop(builder))))
+                return 0;
+            break;
+
+        case ARR_ITM_OPC:
+        {
+            int index = jit_ir_pop(builder);
+            int array = jit_ir_pop(builder);
+
+            if (array < 0 || index < 0)
+                return 0;
+
+            if (!jit_ir_push(builder, jit_ir_array_item(builder, array, index, record->ptype, record->pc)))
+                return 0;
+
+            break;
+        }
+
+        case ARR_SITM_OPC:
+        {
+            int index = jit_ir_pop(builder);
+            int array = jit_ir_pop(builder);
+
+            if (array < 0 || index < 0 || builder->stack_ptr == 0)
+                return 0;
+
+            if (!jit_ir_set_item(builder, array, index, builder->stack[builder->stack_ptr - 1], record))
+                return 0;
+
+            break;
+        }
+
+        case ADD_OPC:
+        case SUB_OPC:
+        case MUL_OPC:
+        case DIV_OPC:
+        case MOD_OPC:
+        case ADD_II_OPC:
+        case SUB_II_OPC:
+        case MUL_II_OPC:
+        case DIV_II_OPC:
+        case MOD_II_OPC:
+        {
+            int b = jit_ir_pop(builder);
+            int a = jit_ir_pop(builder);
+
+            if (a < 0 || b < 0)
+                return 0;
+
+            if (!jit_ir_push(builder, jit_ir_arithmetic(builder, (int)record->value, a, b, record->pc)))
+                return 0;
+
+            break;
+        }
+
+        case LT_OPC:
+        case GT_OPC:
+        case LE_OPC:
+        case GE_OPC:
+        case EQ_OPC:
+        case NE_OPC:
+        case LT_II_OPC:
+        case GT_II_OPC:
+        case LE_II_OPC:
+        case GE_II_OPC:
+        case EQ_II_OPC:
+        case NE_II_OPC:
+        {
+            int b = jit_ir_pop(builder);
+            int a = jit_ir_pop(builder);
+
+            if (a < 0 || b < 0)
+                return 0;
+
+            if (!jit_ir_push(builder, jit_ir_comparison(builder, (int)record->value, a, b)))
+                return 0;
+
+            break;
+        }
+
+        case JMP_OPC:
+            // the trace already follows it
+            break;
+
+        case JIT_OPC:
+        case JIF_OPC:
+        case FORLOOP_OPC:
+        {
+            int ref = -1;
+
+            if (record->opcode == FORLOOP_OPC)
+            {
+                uint8_t counter = (uint8_t)record->value;
+                uint8_t bound = (uint8_t)(record->value >> 8);
+                int up = (int)(record->value >> 16);
+
+                int one = jit_ir_const(builder, INT_VTYPE, 1);
+                int next = jit_ir_arithmetic(builder, up ? 1 : 2, jit_ir_local(builder, counter, INT_VTYPE), one, record->pc);
+
+                if (one < 0 || next < 0 || !jit_ir_store_local(builder, counter, next))
+                    return 0;
+
+                ref = jit_ir_comparison(builder, up ? 1 : 4, next, jit_ir_local(builder, bound, INT_VTYPE));
+
+                // the back-edge of the loop being traced
+                if (i == recorder->length - 1 && record->target == recorder->header && record->taken)
+                    builder->forloop = record->value;
+            }
+            else
+                ref = jit_ir_pop(builder);
+
+            if (ref < 0 || builder->ir[ref].ptype != BOOL_VTYPE)
+                return 0;
+
+            if (record->target == record->end)
+                break;
+
+            // JIT and FORLOOP jump when true, JIF when false
+            int expected = (record->opcode != JIF_OPC) == record->taken;
+            size_t exit = record->taken ? record->end : record->target;
+
+            if (!jit_ir_guard(builder, ref, expected, exit))
+                return 0;
+
+            break;
+        }
+
+        default:
+            return 0;
+        }
+    }
+
+    if (builder->stack_ptr != 0)
+        return 0;
+
+    // values read before being written keep the type checked at the entry
+    for (size_t i = 0; i < FRAME_VALUES_LENGTH; i++)
+    {
+        if (builder->local_guards[i] >= 0 && builder->local_stores[i] >= 0 && builder->local_guards[i] != builder->local_stores[i])
+            return 0;
+    }
+
+    for (int i = 0; i < builder->globals_length; i++)
+    {
+        JitTraceGlobal *global = &builder->globals[i];
+
+        if (global->guard >= 0 && global->store >= 0 && global->guard != global->store)
+            return 0;
+    }
+
+    jit_hoist_bounds(builder);
+
+    return 1;
+}
+
+// leaves the value of 'ref' in 'reg'
+void jit_trace_load(JitCompiler *compiler, JitTraceBuilder *builder, int reg, int ref)
+{
+    JitIr *ir = &builder->ir[ref];
+
+    if (ir->type == JIT_IR_CONST)
+        jit_emit_mov_imm64(compiler, reg, ir->value);
+    else
+        jit_emit_mem(compiler, 1, 0x8B, reg, JIT_RSP, -1, ref * 8);
+}
+
+// every ref lives in its own slot of the native stack frame
+void jit_trace_store(JitCompiler *compiler, int reg, int ref)
+{
+    jit_emit_mem(compiler, 1, 0x89, reg, JIT_RSP, -1, ref * 8);
+}
+
+// boxes 'ref' into the value at [base + index * 8 + disp]
+void jit_trace_write_value(JitCompiler *compiler, JitTraceBuilder *builder, int base, int index, int32_t disp, int ref)
+{
+    jit_trace_load(compiler, builder, JIT_RAX, ref);
+
+    if (builder->ir[ref].ptype == JIT_ARRAY_PTYPE)
+    {
+        jit_emit_mem(compiler, 1, 0xC7, 0, base, index, disp + JIT_TYPE_OFFSET);
+        jit_emit_i32(compiler, OBJECT_HTYPE);
+
+        jit_emit_mem(compiler, 1, 0x89, JIT_RAX, base, index, disp + JIT_OBJECT_OFFSET);
+
+        return;
+    }
+
+    jit_emit_mem(compiler, 1, 0xC7, 0, base, index, disp + JIT_TYPE_OFFSET);
+    jit_emit_i32(compiler, VALUE_HTYPE);
+
+    jit_emit_mem(compiler, 1, 0xC7, 0, base, index, disp + JIT_PTYPE_OFFSET);
+    jit_emit_i32(compiler, builder->ir[ref].ptype);
+
+    jit_emit_mem(compiler, 1, 0x89, JIT_RAX, base, index, disp + JIT_I64_OFFSET);
+}
+
+void jit_trace_guard_value(JitCompiler *compiler, int base, int32_t disp, int ptype, DynArr *fail_sites)
+{
+    size_t site = 0;
+
+    if (ptype == JIT_ARRAY_PTYPE)
+    {
+        jit_emit_mem(compiler, 0, 0x81, 7, base, -1, disp + JIT_TYPE_OFFSET);
+        jit_emit_i32(compiler, OBJECT_HTYPE);
+        site = jit_emit_jcc_forward(compiler, JIT_CC_NE);
+        dynarr_insert(&site, fail_sites);
+
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RCX, base, -1, disp + JIT_OBJECT_OFFSET);
+
+        jit_emit_mem(compiler, 0, 0x81, 7, JIT_RCX, -1, JIT_OTYPE_OFFSET);
+        jit_emit_i32(compiler, ARR_OTYPE);
+        site = jit_emit_jcc_forward(compiler, JIT_CC_NE);
+        dynarr_insert(&site, fail_sites);
+
+        return;
+    }
+
+    jit_emit_mem(compiler, 0, 0x81, 7, base, -1, disp + JIT_TYPE_OFFSET);
+    jit_emit_i32(compiler, VALUE_HTYPE);
+    site = jit_emit_jcc_forward(compiler, JIT_CC_NE);
+    dynarr_insert(&site, fail_sites);
+
+    jit_emit_mem(compiler, 0, 0x81, 7, base, -1, disp + JIT_PTYPE_OFFSET);
+    jit_emit_i32(compiler, ptype);
+    site = jit_emit_jcc_forward(compiler, JIT_CC_NE);
+    dynarr_insert(&site, fail_sites);
+}
+
+// Refuses the entry unless every value the counter takes is an index of
+// the array: up loops go from the entry value to bound - 1, down loops
+// from the entry value to bound. The entry guards checked both are ints.
+void jit_trace_guard_range(JitCompiler *compiler, JitTraceBuilder *builder, JitIr *ir, DynArr *fail_sites)
+{
+    const uint8_t test_rax[] = {0x48, 0x85, 0xC0}; // test rax, rax
+    const uint8_t test_r8[] = {0x4D, 0x85, 0xC0};  // test r8, r8
+    const uint8_t cmp[] = {0x4C, 0x39, 0xC0};      // cmp rax, r8
+
+    uint8_t counter = (uint8_t)ir->value;
+    uint8_t bound = (uint8_t)(ir->value >> 8);
+    int up = (int)(ir->value >> 16);
+
+    size_t sites[3];
+
+    jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_R14, -1, (int32_t)counter * JIT_VALUE_SIZE + JIT_I64_OFFSET);
+    jit_emit_mem(compiler, 1, 0x8B, JIT_R8, JIT_R14, -1, (int32_t)bound * JIT_VALUE_SIZE + JIT_I64_OFFSET);
+    jit_trace_load(compiler, builder, JIT_RCX, ir->a);
+
+    if (up)
+    {
+        // 0 <= counter < bound <= length
+        jit_emit_bytes(compiler, sizeof(test_rax), test_rax);
+        sites[0] = jit_emit_jcc_forward(compiler, JIT_CC_L);
+
+        jit_emit_bytes(compiler, sizeof(cmp), cmp);
+        sites[1] = jit_emit_jcc_forward(compiler, JIT_CC_GE);
+
+        // cmp r8, [rcx + length]
+        jit_emit_mem(compiler, 1, 0x3B, JIT_R8, JIT_RCX, -1, JIT_LENGTH_OFFSET);
+        sites[2] = jit_emit_jcc_forward(compiler, JIT_CC_G);
+    }
+    else
+    {
+        // 0 <= bound <= counter < length
+        jit_emit_bytes(compiler, sizeof(test_r8), test_r8);
+        sites[0] = jit_emit_jcc_forward(compiler, JIT_CC_L);
+
+        jit_emit_bytes(compiler, sizeof(cmp), cmp);
+        sites[1] = jit_emit_jcc_forward(compiler, JIT_CC_L);
+
+        // cmp rax, [rcx + length]
+        jit_emit_mem(compiler, 1, 0x3B, JIT_RAX, JIT_RCX, -1, JIT_LENGTH_OFFSET);
+        sites[2] = jit_emit_jcc_forward(compiler, JIT_CC_GE);
+    }
+
+    for (size_t i = 0; i < 3; i++)
+        dynarr_insert(&sites[i], fail_sites);
+}
+
+// ARR_SITM of a primitive, boxed like the interpreter does. Traces never
+// reach a safepoint, so once the collector waits for one it returns 0
+// and leaves the assignment to the interpreter.
+int jit_trace_set_item(VM *vm, Object *array, int64_t index, int64_t ptype, int64_t value)
+{
+    if (vm_gc_pending(vm))
+        return 0;
+
+    Object *box = vm_create_object(VALUE_OTYPE, vm);
+
+    box->value.primitive.type = (ValueType)ptype;
+    box->value.primitive.i64 = value;
+
+    Object **item = &array->value.array.items[index];
+
+    vm_gc_write_barrier(array, *item, box, vm);
+    *item = box;
+
+    return 1;
+}
+
+void jit_trace_compile_ir(JitCompiler *compiler, JitTraceBuilder *builder, int ref, DynArr *exits, DynArr *fail_sites)
+{
+    const uint8_t add[] = {0x4C, 0x01, 0xC0};             // add rax, r8
+    const uint8_t sub[] = {0x4C, 0x29, 0xC0};             // sub rax, r8
+    const uint8_t mul[] = {0x49, 0x0F, 0xAF, 0xC0};       // imul rax, r8
+    const uint8_t div[] = {0x48, 0x99, 0x49, 0xF7, 0xF8}; // cqo, idiv r8
+    const uint8_t mov_rdx[] = {0x48, 0x89, 0xD0};         // mov rax, rdx
+    const uint8_t cmp[] = {0x4C, 0x39, 0xC0};             // cmp rax, r8
+    const uint8_t movzx[] = {0x0F, 0xB6, 0xC0};           // movzx eax, al
+    const uint8_t test_rax[] = {0x48, 0x85, 0xC0};        // test rax, rax
+    const uint8_t setcc[] = {0x9C, 0x9F, 0x9E, 0x9D, 0x94, 0x95};
+    const uint8_t mov_rdi[] = {0x48, 0x89, 0xDF};         // mov rdi, rbx
+    const uint8_t call_rax[] = {0xFF, 0xD0};              // call rax
+    const uint8_t mov_eax[] = {0x89, 0xC0};               // mov eax, eax
+
+    JitIr *ir = &builder->ir[ref];
+    JitFixup exit = {0, (size_t)ir->snapshot};
+
+    switch (ir->type)
+    {
+    case JIT_IR_CONST:
+        // loaded as an immediate by its users
+        break;
+
+    case JIT_IR_LOCAL:
+    {
+        int32_t offset = ir->ptype == JIT_ARRAY_PTYPE ? JIT_OBJECT_OFFSET : JIT_I64_OFFSET;
+
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_R14, -1, (int32_t)ir->value * JIT_VALUE_SIZE + offset);
+        jit_trace_store(compiler, JIT_RAX, ref);
+
+        break;
+    }
+
+    case JIT_IR_GLOBAL:
+    {
+        int32_t offset = ir->ptype == JIT_ARRAY_PTYPE ? JIT_OBJECT_OFFSET : JIT_I64_OFFSET;
+
+        jit_emit_mov_imm64(compiler, JIT_RAX, (int64_t)(uintptr_t)ir->global);
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_RAX, -1, offset);
+        jit_trace_store(compiler, JIT_RAX, ref);
+
+        break;
+    }
+
+    case JIT_IR_ARITHMETIC:
+        jit_trace_load(compiler, builder, JIT_RAX, ir->a);
+        jit_trace_load(compiler, builder, JIT_R8, ir->b);
+
+        switch (ir->value)
+        {
+        case 1:
+            jit_emit_bytes(compiler, sizeof(add), add);
+            break;
+
+        case 2:
+            jit_emit_bytes(compiler, sizeof(sub), sub);
+            break;
+
+        case 3:
+            jit_emit_bytes(compiler, sizeof(mul), mul);
+            break;
+
+        case 4:
+        case 5:
+            jit_emit_bytes(compiler, sizeof(div), div);
+
+            if (ir->value == 5)
+                jit_emit_bytes(compiler, sizeof(mov_rdx), mov_rdx);
+
+            break;
+
+        default:
+            assert(0 && "Illegal arithmetic operation type value");
+        }
+
+        jit_trace_store(compiler, JIT_RAX, ref);
+
+        break;
+
+    case JIT_IR_COMPARISON:
+        jit_trace_load(compiler, builder, JIT_RAX, ir->a);
+        jit_trace_load(compiler, builder, JIT_R8, ir->b);
+
+        jit_emit_bytes(compiler, sizeof(cmp), cmp);
+
+        // setcc al
+        jit_emit(compiler, 0x0F);
+        jit_emit(compiler, setcc[ir->value - 1]);
+        jit_emit(compiler, 0xC0);
+
+        jit_emit_bytes(compiler, sizeof(movzx), movzx);
+        jit_trace_store(compiler, JIT_RAX, ref);
+
+        break;
+
+    case JIT_IR_STORE_LOCAL:
+        jit_trace_write_value(compiler, builder, JIT_R14, -1, (int32_t)ir->value * JIT_VALUE_SIZE, ir->a);
+        break;
+
+    case JIT_IR_STORE_GLOBAL:
+        jit_emit_mov_imm64(compiler, JIT_RCX, (int64_t)(uintptr_t)ir->global);
+        jit_trace_write_value(compiler, builder, JIT_RCX, -1, 0, ir->a);
+        break;
+
+    case JIT_IR_GUARD:
+    case JIT_IR_GUARD_NONZERO:
+    {
+        uint8_t cc = JIT_CC_E;
+
+        if (ir->type == JIT_IR_GUARD && !ir->value)
+            cc = JIT_CC_NE;
+
+        jit_trace_load(compiler, builder, JIT_RAX, ir->a);
+        jit_emit_bytes(compiler, sizeof(test_rax), test_rax);
+
+        exit.site = jit_emit_jcc_forward(compiler, cc);
+        dynarr_insert(&exit, exits);
+
+        break;
+    }
+
+    case JIT_IR_GUARD_INDEX:
+        jit_trace_load(compiler, builder, JIT_RAX, ir->a);
+        jit_trace_load(compiler, builder, JIT_R8, ir->b);
+
+        // cmp r8, [rax + length], negative indexes compare above it
+        jit_emit_mem(compiler, 1, 0x3B, JIT_R8, JIT_RAX, -1, JIT_LENGTH_OFFSET);
+
+        exit.site = jit_emit_jcc_forward(compiler, JIT_CC_AE);
+        dynarr_insert(&exit, exits);
+
+        break;
+
+    case JIT_IR_GUARD_RANGE:
+        jit_trace_guard_range(compiler, builder, ir, fail_sites);
+        break;
+
+    case JIT_IR_ARRAY_LENGTH:
+        jit_trace_load(compiler, builder, JIT_RAX, ir->a);
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_RAX, -1, JIT_LENGTH_OFFSET);
+        jit_trace_store(compiler, JIT_RAX, ref);
+        break;
+
+    case JIT_IR_ARRAY_ITEM:
+        jit_trace_load(compiler, builder, JIT_RAX, ir->a);
+        jit_trace_load(compiler, builder, JIT_R8, ir->b);
+
+        // mov rax, [rax + items], mov rax, [rax + r8 * 8]
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_RAX, -1, JIT_ITEMS_OFFSET);
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_RAX, JIT_R8, 0);
+
+        // nil items
+        jit_emit_bytes(compiler, sizeof(test_rax), test_rax);
+        exit.site = jit_emit_jcc_forward(compiler, JIT_CC_E);
+        dynarr_insert(&exit, exits);
+
+        jit_emit_mem(compiler, 0, 0x81, 7, JIT_RAX, -1, JIT_OTYPE_OFFSET);
+        jit_emit_i32(compiler, VALUE_OTYPE);
+        exit.site = jit_emit_jcc_forward(compiler, JIT_CC_NE);
+        dynarr_insert(&exit, exits);
+
+        jit_emit_mem(compiler, 0, 0x81, 7, JIT_RAX, -1, JIT_BOX_PTYPE_OFFSET);
+        jit_emit_i32(compiler, ir->ptype);
+        exit.site = jit_emit_jcc_forward(compiler, JIT_CC_NE);
+        dynarr_insert(&exit, exits);
+
+        jit_emit_mem(compiler, 1, 0x8B, JIT_RAX, JIT_RAX, -1, JIT_BOX_I64_OFFSET);
+        jit_trace_store(compiler, JIT_RAX, ref);
+
+        break;
+
+    case JIT_IR_SET_ITEM:
+        // jit_trace_set_item(vm, array, index, ptype, value)
+        jit_emit_bytes(compiler, sizeof(mov_rdi), mov_rdi);
+        jit_trace_load(compiler, builder, JIT_RSI, ir->a);
+        jit_trace_load(compiler, builder, JIT_RDX, ir->b);
+        jit_emit_mov_imm64(compiler, JIT_RCX, builder->ir[ir->c].ptype);
+        jit_trace_load(compiler, builder, JIT_R8, ir->c);
+
+        jit_emit_mov_imm64(compiler, JIT_RAX, (int64_t)(uintptr_t)jit_trace_set_item);
+        jit_emit_bytes(compiler, sizeof(call_rax), call_rax);
+
+        jit_emit_bytes(compiler, sizeof(mov_eax), mov_eax);
+        jit_trace_store(compiler, JIT_RAX, ref);
+
+        break;
+
+    default:
+        assert(0 && "Illegal trace ir type");
+    }
+}
+
+// pushes the pending values to the vm stack and leaves at the snapshot ip
+void jit_trace_compile_exit(JitCompiler *compiler, JitTraceBuilder *builder, JitSnapshot *snapshot, DynArr *done_sites)
+{
+    const uint8_t lea_rcx[] = {0x48, 0x8D, 0x0C, 0x49}; // lea rcx, [rcx + rcx * 2]
+    const uint8_t mov_eax_1[] = {0xB8, 0x01, 0x00, 0x00, 0x00};
+
+    if (snapshot->depth > 0)
+    {
+        // movsxd rcx, [rbx + stack_ptr]
+        jit_emit_mem(compiler, 1, 0x63, JIT_RCX, JIT_RBX, -1, JIT_SP_OFFSET);
+        jit_emit_bytes(compiler, sizeof(lea_rcx), lea_rcx);
+
+        for (int i = 0; i < snapshot->depth; i++)
+            jit_trace_write_value(compiler, builder, JIT_R13, JIT_RCX, i * JIT_VALUE_SIZE, snapshot->stack[i]);
+
+        jit_emit_sp_add(compiler, (int8_t)snapshot->depth);
+    }
+
+    jit_emit_mem(compiler, 0, 0xC7, 0, JIT_R12, -1, JIT_IP_OFFSET);
+    jit_emit_i32(compiler, (int32_t)snapshot->ip);
+
+    jit_emit_bytes(compiler, sizeof(mov_eax_1), mov_eax_1);
+
+    size_t site = jit_emit_jmp_forward(compiler);
+    dynarr_insert(&site, done_sites);
+}
+
+JitTrace *jit_compile_trace(JitTraceBuilder *builder)
+{
+    const uint8_t prologue[] = {
+        0x53,             // push rbx
+        0x41, 0x54,       // push r12
+        0x41, 0x55,       // push r13
+        0x41, 0x56,       // push r14
+        0x41, 0x57,       // push r15
+        0x48, 0x89, 0xFB, // mov rbx, rdi
+        0x49, 0x89, 0xF4  // mov r12, rsi
+    };
+    const uint8_t sub_rsp[] = {0x48, 0x81, 0xEC}; // sub rsp, imm32
+    const uint8_t add_rsp[] = {0x48, 0x81, 0xC4}; // add rsp, imm32
+    const uint8_t xor_eax[] = {0x31, 0xC0};
+    const uint8_t epilogue[] = {
+        0x41, 0x5F, // pop r15
+        0x41, 0x5E, // pop r14
+        0x41, 0x5D, // pop r13
+        0x41, 0x5C, // pop r12
+        0x5B,       // pop rbx
+        0xC3        // ret
+    };
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (size_t)builder->ir_length * 96 + FRAME_VALUES_LENGTH * 48 + JIT_TRACE_GLOBALS * 48 + JIT_EXTRA_BYTES;
+
+    for (int i = 0; i < builder->snapshots_length; i++)
+        size += 64 + (size_t)builder->snapshots[i].depth * 48;
+
+    size = (size + page - 1) / page * page;
+
+    void *native = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (native == MAP_FAILED)
+        return NULL;
+
+    JitCompiler compiler = {0};
+
+    compiler.code = (uint8_t *)native;
+    compiler.size = size;
+
+    DynArr *fail_sites = vm_memory_create_dynarr(sizeof(size_t));
+    DynArr *done_sites = vm_memory_create_dynarr(sizeof(size_t));
+    DynArr *exits = vm_memory_create_dynarr(sizeof(JitFixup));
+
+    // keeps rsp 16 bytes aligned
+    int32_t frame = (builder->ir_length * 8 + 15) / 16 * 16;
+
+    jit_emit_bytes(&compiler, sizeof(prologue), prologue);
+    jit_emit_mem(&compiler, 1, 0x8D, JIT_R13, JIT_RBX, -1, JIT_STACK_OFFSET);
+    jit_emit_mem(&compiler, 1, 0x8D, JIT_R14, JIT_R12, -1, JIT_LOCALS_OFFSET);
+    jit_emit_bytes(&compiler, sizeof(sub_rsp), sub_rsp);
+    jit_emit_i32(&compiler, frame);
+
+    // the types the trace was recorded with, checked once per entry
+    for (size_t i = 0; i < FRAME_VALUES_LENGTH; i++)
+    {
+        if (builder->local_guards[i] >= 0)
+            jit_trace_guard_value(&compiler, JIT_R14, (int32_t)i * JIT_VALUE_SIZE, builder->local_guards[i], fail_sites);
+    }
+
+    for (int i = 0; i < builder->globals_length; i++)
+    {
+        JitTraceGlobal *global = &builder->globals[i];
+
+        if (global->guard < 0)
+            continue;
+
+        jit_emit_mov_imm64(&compiler, JIT_RAX, (int64_t)(uintptr_t)global->value);
+        jit_trace_guard_value(&compiler, JIT_RAX, 0, global->guard, fail_sites);
+    }
+
+    // room for the values a side exit pushes
+    jit_emit_load_sp(&compiler);
+    jit_emit(&compiler, 0x3D); // cmp eax, imm32
+    jit_emit_i32(&compiler, VM_STACK_LENGTH - 1 - builder->max_depth);
+
+    size_t site = jit_emit_jcc_forward(&compiler, JIT_CC_G);
+    dynarr_insert(&site, fail_sites);
+
+    // arrays, their lengths and bound checks of the whole loop
+    for (int ref = 0; ref < builder->ir_length; ref++)
+    {
+        if (builder->ir[ref].hoisted)
+            jit_trace_compile_ir(&compiler, builder, ref, exits, fail_sites);
+    }
+
+    size_t loop_start = compiler.used;
+
+    for (int ref = 0; ref < builder->ir_length; ref++)
+    {
+        if (!builder->ir[ref].hoisted)
+            jit_trace_compile_ir(&compiler, builder, ref, exits, fail_sites);
+    }
+
+    jit_emit(&compiler, 0xE9);
+    jit_emit_i32(&compiler, (int32_t)((int64_t)loop_start - (int64_t)(compiler.used + 4)));
+
+    for (size_t i = 0; i < exits->used; i++)
+    {
+        JitFixup *exit = (JitFixup *)dynarr_get(i, exits);
+
+        jit_patch_rel32(&compiler, exit->site, compiler.used);
+        jit_trace_compile_exit(&compiler, builder, &builder->snapshots[exit->target], done_sites);
+    }
+
+    // entry refused, nothing was executed
+    for (size_t i = 0; i < fail_sites->used; i++)
+        jit_patch_rel32(&compiler, *(size_t *)dynarr_get(i, fail_sites), compiler.used);
+
+    jit_emit_bytes(&compiler, sizeof(xor_eax), xor_eax);
+
+    for (size_t i = 0; i < done_sites->used; i++)
+        jit_patch_rel32(&compiler, *(size_t *)dynarr_get(i, done_sites), compiler.used);
+
+    jit_emit_bytes(&compiler, sizeof(add_rsp), add_rsp);
+    jit_emit_i32(&compiler, frame);
+    jit_emit_bytes(&compiler, sizeof(epilogue), epilogue);
+
+    vm_memory_destroy_dynarr(fail_sites);
+    vm_memory_destroy_dynarr(done_sites);
+    vm_memory_destroy_dynarr(exits);
+
+    size_t used = (compiler.used + page - 1) / page * page;
+
+    if (used < size)
+        munmap((uint8_t *)native + used, size - used);
+
+    if (mprotect(native, used, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(native, used);
+        return NULL;
+    }
+
+    JitTrace *trace = (JitTrace *)vm_memory_alloc(sizeof(JitTrace));
+
+    trace->native = (uint8_t *)native;
+    trace->size = used;
+    trace->failures = 0;
+
+    return trace;
+}
+
+void jit_destroy_trace(JitTrace *trace)
+{
+    if (!trace)
+        return;
+
+    munmap(trace->native, trace->size);
+    vm_memory_dealloc(trace);
+}
+
+// Returns 0 if the trace refused to run because the types changed
+int jit_run_trace(JitCode *code, size_t header, VM *vm, Frame *frame)
+{
+    JitTrace *trace = code->traces[header];
+
+    if (((JitTraceEnter)trace->native)(vm, frame))
+        return 1;
+
+    if (++trace->failures >= JIT_TRACE_FAILURES)
+    {
+        jit_destroy_trace(trace);
+
+        code->traces[header] = NULL;
+        code->counters[header] = JIT_TRACE_BLACKLIST;
+    }
+
+    return 0;
+}
+//< trace
+
+#endif
+
+// public implementation
+int jit_operands_length(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case NIL_OPC:
+    case ARR_LEN_OPC:
+    case ARR_ITM_OPC:
+    case ARR_SITM_OPC:
+    case ADD_OPC:
+    case SUB_OPC:
+    case MUL_OPC:
+    case DIV_OPC:
+    case MOD_OPC:
+    case LT_OPC:
+    case GT_OPC:
+    case LE_OPC:
+    case GE_OPC:
+    case EQ_OPC:
+    case NE_OPC:
+    case ADD_II_OPC:
+    case SUB_II_OPC:
+    case MUL_II_OPC:
+    case DIV_II_OPC:
+    case MOD_II_OPC:
+    case LT_II_OPC:
+    case GT_II_OPC:
+    case LE_II_OPC:
+    case GE_II_OPC:
+    case EQ_II_OPC:
+    case NE_II_OPC:
+    case OR_OPC:
+    case AND_OPC:
+    case NOT_OPC:
+    case NNOT_OPC:
+    case SLEFT_OPC:
+    case SRIGHT_OPC:
+    case BOR_OPC:
+    case BXOR_OPC:
+    case BAND_OPC:
+    case BNOT_OPC:
+    case CONCAT_OPC:
+    case STR_LEN_OPC:
+    case STR_ITM_OPC:
+    case THIS_OPC:
+    case PRT_OPC:
+    case POP_OPC:
+    case GBG_OPC:
+    case RET_OPC:
+    case HLT_OPC:
+        return 0;
+
+    case BCONST_OPC:
+    case ARR_OPC:
+    case LREAD_OPC:
+    case LSET_OPC:
+    case IS_OPC:
+    case CALL_OPC:
+        return 1;
+
+    case ICONST_OPC:
+    case SCONST_OPC:
+    case GWRITE_OPC:
+    case GREAD_OPC:
+    case LOAD_OPC:
+    case JMP_OPC:
+    case JIT_OPC:
+    case JIF_OPC:
+    case CLASS_OPC:
+    case SET_PROPERTY_OPC:
+    case GET_PROPERTY_OPC:
+    case FROM_OPC:
+        return 4;
+
+    case FORLOOP_OPC:
+        return 7;
+
+    default:
+        return -1;
+    }
+}
+
+void jit_set_mode(JitMode mode)
+{
+    jit.mode = mode;
+}
+
+JitMode jit_get_mode()
+{
+    return jit.mode;
+}
+
+JitCode *jit_create_code(Fn *fn)
+{
+    JitCode *code = (JitCode *)vm_memory_alloc(sizeof(JitCode));
+    size_t length = fn->chunks->used;
+
+    code->compiled = 0;
+    code->native = NULL;
+    code->size = 0;
+    code->entries = NULL;
+    code->length = length;
+
+    // one more for loops whose header is the end of the chunks
+    code->counters = (int32_t *)vm_memory_calloc(sizeof(int32_t) * (length + 1));
+    code->traces = (JitTrace **)vm_memory_calloc(sizeof(JitTrace *) * (length + 1));
+
+    return code;
+}
+
+void jit_compile(JitCode *code, DynArr *chunks, VM *vm)
+{
+    code->compiled = 1;
+
+#ifdef JIT_SUPPORTED
+    size_t length = chunks->used;
+
+    if (length == 0 || length != code->length)
+        return;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = length * JIT_CHUNK_BYTES + JIT_EXTRA_BYTES;
+
+    size = (size + page - 1) / page * page;
+
+    void *native = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (native == MAP_FAILED)
+        return;
+
+    JitCompiler compiler = {0};
+
+    compiler.vm = vm;
+    compiler.bytes = (uint8_t *)vm_memory_alloc(length);
+    compiler.length = length;
+    compiler.code = (uint8_t *)native;
+    compiler.size = size;
+    compiler.starts = (uint8_t *)vm_memory_calloc(length);
+    compiler.labels = (size_t *)vm_memory_calloc(sizeof(size_t) * (length + 1));
+    compiler.fixups = vm_memory_create_dynarr(sizeof(JitFixup));
+    compiler.counters = code->counters;
+
+    // dynarr pads its items, work on a packed copy of the chunks
+    for (size_t i = 0; i < length; i++)
+        compiler.bytes[i] = *(uint8_t *)dynarr_get(i, chunks);
+
+    if (jit_scan(&compiler))
+    {
+        jit_compile_native(&compiler);
+
+        // give back the pages the code did not use
+        size_t used = (compiler.used + page - 1) / page * page;
+
+        if (used < size)
+            munmap((uint8_t *)native + used, size - used);
+
+        if (mprotect(native, used, PROT_READ | PROT_EXEC) == 0)
+        {
+            code->native = (uint8_t *)native;
+            code->size = used;
+            code->entries = (void **)vm_memory_calloc(sizeof(void *) * length);
+
+            for (size_t pc = 0; pc < length; pc++)
+            {
+                if (compiler.starts[pc] == JIT_START)
+                    code->entries[pc] = code->native + compiler.labels[pc];
+            }
+        }
+        else
+            munmap(native, used);
+    }
+    else
+        munmap(native, size);
+
+    vm_memory_dealloc(compiler.bytes);
+    vm_memory_dealloc(compiler.starts);
+    vm_memory_dealloc(compiler.labels);
+    vm_memory_destroy_dynarr(compiler.fixups);
+#endif
+}
+
+void jit_destroy_code(JitCode *code)
+{
+    if (!code)
+        return;
+
+    if (jit.recorder.active && jit.recorder.code == code)
+        jit.recorder.active = 0;
+
+#ifdef JIT_SUPPORTED
+    if (code->native)
+        munmap(code->native, code->size);
+
+    for (size_t i = 0; i <= code->length; i++)
+        jit_destroy_trace(code->traces[i]);
+#endif
+
+    if (code->entries)
+        vm_memory_dealloc(code->entries);
+
+    vm_memory_dealloc(code->counters);
+    vm_memory_dealloc(code->traces);
+
+    code->native = NULL;
+    code->entries = NULL;
+    code->counters = NULL;
+    code->traces = NULL;
+
+    vm_memory_dealloc(code);
+}
+
+void jit_backedge(Frame *frame)
+{
+    Fn *fn = frame->fn;
+
+    // long loops would overflow it, only reaching the threshold matters
+    if (fn->hotness < JIT_HOT_THRESHOLD)
+        fn->hotness++;
+
+    if (jit.mode == JIT_OFF_MODE)
+        return;
+
+    if (!fn->jit)
+        fn->jit = jit_create_code(fn);
+
+    JitCode *code = fn->jit;
+    size_t header = (size_t)frame->ip;
+
+    // blacklisted headers stay far below the threshold
+    if (header <= code->length && code->counters[header] < JIT_TRACE_THRESHOLD)
+        code->counters[header]++;
+}
+
+int jit_execute(VM *vm)
+{
+    if (jit.mode == JIT_OFF_MODE)
+        return 0;
+
+    Frame *frame = &vm->frames[vm->frame_ptr];
+    Fn *fn = frame->fn;
+
+#ifdef JIT_SUPPORTED
+    if (jit.recorder.active)
+    {
+        jit_record(vm, frame);
+
+        // a finished recording runs its trace right away
+        if (jit.recorder.active)
+            return 0;
+    }
+#endif
+
+    if ((!fn->jit || !fn->jit->compiled) &&
+        (jit.mode == JIT_FORCE_MODE || fn->hotness >= JIT_HOT_THRESHOLD))
+    {
+        if (!fn->jit)
+            fn->jit = jit_create_code(fn);
+
+        jit_compile(fn->jit, fn->chunks, vm);
+    }
+
+    JitCode *code = fn->jit;
+    size_t ip = (size_t)frame->ip;
+
+    if (!code || ip >= code->length)
+        return 0;
+
+#ifdef JIT_SUPPORTED
+    if (code->traces[ip])
+    {
+        if (jit_run_trace(code, ip, vm, frame))
+            return 1;
+    }
+    else if (code->counters[ip] >= JIT_TRACE_THRESHOLD)
+    {
+        jit_record_start(code, ip, vm);
+        jit_record(vm, frame);
+
+        return 0;
+    }
+#endif
+
+    if (!code->native || !code->entries[ip])
+        return 0;
+
+    ((JitEnter)code->native)(vm, frame, code->entries[ip]);
+
+    return 1;
+}
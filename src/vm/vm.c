@@ -2,10 +2,14 @@
 
 #include "vm.h"
 #include "vm_memory.h"
+#include "jit.h"
+#include "aot.h"
 
 #include <time.h>
+#include <sched.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
 
 #define VM_VALIDATE_OPCODES
 
@@ -76,19 +80,100 @@ void vm_garbage_instance(Object *object);
 void vm_garbage_object(Object *object);
 void vm_garbage_objects(VM *vm);
 
-int vm_gc_sweep_object(Object *object);
-void vm_gc_sweep_objects(VM *vm);
-
-int vm_gc_mark_object_array(Object *object);
-int vm_gc_mark_instance(Object *object);
-int vm_gc_mark_object(Object *object);
-int vm_gc_mark_frame_values(Value *values);
+size_t vm_object_size(Object *object);
+
+// objects hold the mark of the last collection that reached them, 0 while young.
+// Parallel markers race for it, so it is read and written atomically
+#define VM_GC_MARKED(object, vm) (__atomic_load_n(&(object)->marked, __ATOMIC_RELAXED) == (vm)->gc_mark)
+// items ahead of the one being marked whose headers get prefetched
+#define VM_GC_PREFETCH_DISTANCE 8
+// units a step does between looking at the clock
+#define VM_GC_CLOCK_UNITS 256
+// references a parallel marker scans before leaving the rest of an entry to be stolen
+#define VM_GC_SPLIT_UNITS 1024
+// dead objects a parallel sweeper frees at a time
+#define VM_GC_SEGMENT_OBJECTS 4096
+#define VM_GC_SEGMENTS_LENGTH 64
+
+typedef struct _gc_worker_
+{
+    pthread_t thread;
+    pthread_mutex_t lock; // others steal from the bottom of its worklist
+    Gray *gray;
+    size_t bottom;
+    size_t used;
+    size_t count;
+    size_t marked;
+    struct _gc_parallel_ *parallel;
+} GCWorker;
+
+// threads of the VM marking and sweeping full collections, started with it
+typedef struct _gc_parallel_
+{
+    VM *vm;
+    void *(*fn)(void *);
+    pthread_mutex_t gate;    // workers sleep on it between collections
+    pthread_cond_t opened;   // a job got posted or the workers must stop
+    pthread_cond_t finished; // the last worker done with the job
+    size_t job;              // jobs posted, every worker runs each one once
+    size_t pending;          // workers still running the job
+    char stop;
+    size_t length; // workers, the VM thread included
+    size_t idle;   // workers that found nothing to mark
+    GCWorker *workers;
+    Object **segments; // dead objects, chained through their next
+    size_t segments_used;
+    size_t segments_count;
+    size_t segment_length; // of the last segment
+    size_t next_segment;   // the next one a sweeper takes
+} GCParallel;
+
+// set while the thread works for a parallel collection
+static __thread GCWorker *gc_worker = NULL;
+
+int vm_gc_sweep_object(Object *object, VM *vm);
+int vm_gc_sweep_objects(size_t *budget, VM *vm);
+
+int vm_gc_mark_array_items(Gray *gray, size_t *budget, VM *vm);
+int vm_gc_mark_attributes(Gray *gray, size_t *budget, VM *vm);
+void vm_gc_push_gray(size_t length, void *references, VM *vm);
+int vm_gc_push_references(Object *object, VM *vm);
+int vm_gc_mark_object(Object *object, VM *vm);
+int vm_gc_mark_entry(Gray *gray, size_t *budget, VM *vm);
+int vm_gc_mark_gray(size_t *budget, VM *vm);
+int vm_gc_mark_frame_values(Value *values, size_t length, VM *vm);
 int vm_gc_mark_frames(VM *vm);
 int vm_gc_mark_stack(VM *vm);
 int vm_gc_mark_globals(VM *vm);
-void vm_gc_mark_objects(VM *vm);
+int vm_gc_mark_remembered(VM *vm);
+int vm_gc_mark_roots(VM *vm);
+
+void vm_gc_remember(Object *object, VM *vm);
+void vm_gc_write_barrier(Object *container, Object *previous, Object *object, VM *vm);
+void vm_gc_forget(VM *vm);
+void vm_gc_minor(VM *vm);
+void vm_gc_start(VM *vm);
+void vm_gc_end(VM *vm);
+void vm_gc_work(size_t budget, VM *vm);
+int vm_gc_step(VM *vm);
+
+void vm_gc_worker_push(size_t length, void *references, GCWorker *worker);
+int vm_gc_worker_pop(GCWorker *worker, Gray *out_gray);
+int vm_gc_worker_steal(GCWorker *worker, Gray *out_gray);
+int vm_gc_workers_have_gray(GCParallel *parallel);
+void *vm_gc_mark_worker(void *data);
+void vm_gc_defer_garbage(Object *object, GCParallel *parallel);
+void *vm_gc_sweep_worker(void *data);
+void *vm_gc_thread(void *data);
+void vm_gc_start_threads(size_t threads, VM *vm);
+void vm_gc_stop_threads(VM *vm);
+void vm_gc_run(void *(*fn)(void *), GCParallel *parallel);
+void vm_gc_parallel(VM *vm);
 
 void vm_gc(VM *vm);
+void vm_gc_record(clock_t start, size_t *count, clock_t *longest);
+void vm_gc_safepoint(VM *vm);
+int vm_gc_pending(VM *vm);
 //< garbage collector
 
 //> helpers
@@ -132,6 +217,7 @@ char *vm_read_string(VM *vm);
 #define VM_FRAME_PTR(vm) (vm->frame_ptr)
 #define VM_FRAME_CURRENT(vm) (&(vm->frames[vm->frame_ptr]))
 
+int vm_fn_locals(Fn *fn);
 void vm_frame_setup(Frame *frame, Fn *fn, VM *vm);
 void vm_frame_up(Fn *fn, Object *instance, int is_constructor, VM *vm);
 void vm_frame_down(VM *vm);
@@ -177,6 +263,11 @@ void vm_execute_get_array_item(VM *vm);
 void vm_execute_set_array_item(VM *vm);
 void vm_execute_arithmetic(int type, VM *vm);
 void vm_execute_comparison(int type, VM *vm);
+void vm_rewrite_opcode(uint8_t opcode, VM *vm);
+int vm_are_operands_ii(VM *vm);
+void vm_quicken_binary(uint8_t opcode, VM *vm);
+void vm_execute_arithmetic_ii(int type, VM *vm);
+void vm_execute_comparison_ii(int type, VM *vm);
 void vm_execute_argjmp(int type, VM *vm);
 void vm_execute_logical(int type, VM *vm);
 void vm_execute_negation(int type, VM *vm);
@@ -193,6 +284,7 @@ void vm_execute_from(VM *vm);
 void vm_execute_this(VM *vm);
 void vm_execute_jmp(VM *vm);
 void vm_execute_jmpc(VM *vm);
+void vm_execute_forloop(VM *vm);
 void vm_execute_get_local(VM *vm);
 void vm_execute_set_local(VM *vm);
 void vm_execute_set_global(VM *vm);
@@ -262,6 +354,8 @@ void native_fn_ascii(DynArr *args, VM *vm)
     new_str->buffer = buffer;
     new_str->length = 1;
 
+    vm->size += new_str->length + 1;
+
     vm_stack_push_object(new_str_obj, vm);
 }
 
@@ -306,6 +400,8 @@ void native_fn_str_sub(DynArr *args, VM *vm)
     sub_str->buffer = sub_str_buff;
     sub_str->length = sub_str_buff_len;
 
+    vm->size += sub_str->length + 1;
+
     vm_stack_push_object(sub_str_obj, vm);
 }
 
@@ -347,6 +443,8 @@ void native_fn_str_lower(DynArr *args, VM *vm)
     new_str->buffer = new_str_buffer;
     new_str->length = str_len;
 
+    vm->size += new_str->length + 1;
+
     vm_stack_push_object(new_str_obj, vm);
 }
 
@@ -388,6 +486,8 @@ void native_fn_str_upper(DynArr *args, VM *vm)
     new_str->buffer = new_str_buffer;
     new_str->length = str_len;
 
+    vm->size += new_str->length + 1;
+
     vm_stack_push_object(new_str_obj, vm);
 }
 
@@ -432,6 +532,8 @@ void native_fn_str_title(DynArr *args, VM *vm)
     new_str->buffer = new_str_buffer;
     new_str->length = str_len;
 
+    vm->size += new_str->length + 1;
+
     vm_stack_push_object(new_str_obj, vm);
 }
 
@@ -603,6 +705,8 @@ void native_fn_int_to_str(DynArr *args, VM *vm)
     str->length = length;
     str->buffer = buffer;
 
+    vm->size += str->length + 1;
+
     vm_stack_push_object(str_obj, vm);
 }
 
@@ -653,6 +757,8 @@ static void native_fn_read_line(DynArr *args, VM *vm)
     str->buffer = buffer;
     str->length = ptr;
 
+    vm->size += str->length + 1;
+
     vm_stack_push_object(str_obj, vm);
 }
 
@@ -718,6 +824,7 @@ void native_fn_read_file(DynArr *args, VM *vm)
 
         value->type = INT_VTYPE;
         memcpy(&value->i64, container, sizeof(container));
+        vm_gc_write_barrier(buffer_value->entity.object, arr->items[counter], value_obj, vm);
         arr->items[counter] = value_obj;
 
         counter++;
@@ -1010,7 +1117,7 @@ void vm_garbage_instance(Object *object)
         LZHTableNode *prev_attr_node = last_attr_node->previous_table_node;
         Value *attr_value = (Value *)last_attr_node->value;
 
-        vm_memory_dealloc(attr_value);
+        vm_memory_destroy_value(attr_value);
 
         last_attr_node = prev_attr_node;
     }
@@ -1084,40 +1191,76 @@ void vm_garbage_objects(VM *vm)
     }
 }
 
-int vm_gc_sweep_object(Object *object)
+size_t vm_object_size(Object *object)
 {
-    if (object->marked)
+    size_t size = sizeof(Object);
+
+    switch (object->type)
     {
-        object->marked = 0;
+    case STR_OTYPE:
+        String *string = &object->value.string;
 
-        return 0;
+        if (!string->core)
+            size += string->length + 1;
+
+        break;
+
+    case ARR_OTYPE:
+        size += sizeof(Object *) * object->value.array.length;
+        break;
+
+    case INSTANCE_OTYPE:
+        LZHTable *attrs_table = object->value.instance.attributes;
+
+        if (attrs_table)
+            size += sizeof(LZHTable) + sizeof(LZHTableBucket) * attrs_table->m + (sizeof(LZHTableNode) + sizeof(Value)) * attrs_table->n;
+
+        break;
+
+    default:
+        break;
     }
 
-    vm_garbage_object(object);
+    return size;
+}
+
+// survivors keep their mark, it is what tells old objects apart
+int vm_gc_sweep_object(Object *object, VM *vm)
+{
+    if (VM_GC_MARKED(object, vm))
+        return 0;
+
+    // parallel collections free them afterwards, on every thread
+    if (gc_worker)
+        vm_gc_defer_garbage(object, gc_worker->parallel);
+    else
+        vm_garbage_object(object);
 
     return 1;
 }
 
-void vm_gc_sweep_objects(VM *vm)
+// Sweeps up to 'budget' objects after vm->gc_sweep, the last one kept,
+// or from the first one when it is NULL. Returns 1 once none is left
+int vm_gc_sweep_objects(size_t *budget, VM *vm)
 {
     size_t count = 0;
+    size_t freed = 0;
 
-    Object *before = NULL;
-    Object *object = vm->head_object;
+    Object *before = vm->gc_sweep;
+    Object *object = before ? before->next : vm->head_object;
 
-    while (object)
+    while (object && *budget > 0)
     {
         Object *next = object->next;
 
         char is_head = object == vm->head_object;
         char is_tail = object == vm->tail_object;
+        size_t size = vm_object_size(object);
 
-        char flag = vm_gc_sweep_object(object);
+        char flag = vm_gc_sweep_object(object, vm);
 
         if (flag)
         {
-            vm->size -= sizeof(Object);
-
             if (is_head)
                 vm->head_object = next;
 
@@ -1127,211 +1270,930 @@ void vm_gc_sweep_objects(VM *vm)
             if (before)
                 before->next = next;
 
+            freed += size;
             count++;
         }
         else
+        {
+            vm->gc_live += size;
             before = object;
+        }
 
         object = next;
+        (*budget)--;
     }
 
-    vm->size -= sizeof(Object) * count;
+    vm->gc_sweep = before;
+    vm->size = vm->size > freed ? vm->size - freed : 0;
 
     vm_garbage_report("%ld objects collected", count);
+
+    return object == NULL;
 }
 
-int vm_gc_mark_object_array(Object *object)
+int vm_gc_mark_array_items(Gray *gray, size_t *budget, VM *vm)
 {
-    object->marked = 1;
-
     size_t count = 0;
 
-    Array *arr = &object->value.array;
+    Object **items = (Object **)gray->references;
+    size_t length = gray->length < *budget ? gray->length : *budget;
 
-    for (size_t i = 0; i < arr->length; i++)
+    for (size_t i = 0; i < length; i++)
     {
-        Object *item = arr->items[i];
+        // headers are read to be marked, so the ones further on get fetched meanwhile
+        if (i + VM_GC_PREFETCH_DISTANCE < length)
+            __builtin_prefetch(items[i + VM_GC_PREFETCH_DISTANCE]);
+
+        Object *item = items[i];
 
         if (!item)
             continue;
 
-        count += vm_gc_mark_object(item);
+        count += vm_gc_mark_object(item, vm);
     }
 
-    return count + 1;
+    *budget -= length;
+
+    // the rest waits for the next step
+    if (length < gray->length)
+        vm_gc_push_gray(gray->length - length, (void *)(items + length), vm);
+
+    return count;
 }
 
-int vm_gc_mark_instance(Object *object)
+int vm_gc_mark_attributes(Gray *gray, size_t *budget, VM *vm)
 {
-    object->marked = 1;
+    size_t count = 0;
 
-    Instance *instance = &object->value.instance;
+    LZHTableNode *attr_node = (LZHTableNode *)gray->references;
 
-    LZHTable *attrs_table = instance->attributes;
-    LZHTableNode *attr_node = attrs_table->nodes;
-
-    while (attr_node)
+    while (attr_node && *budget > 0)
     {
         LZHTableNode *prev_attr_node = attr_node->previous_table_node;
 
+        if (prev_attr_node)
+            __builtin_prefetch(prev_attr_node->value);
+
         Value *attr_value = (Value *)attr_node->value;
 
         if (attr_value->type == OBJECT_HTYPE)
-        {
-            Object *attr_obj = attr_value->entity.object;
-
-            vm_gc_mark_object(attr_obj);
-        }
+            count += vm_gc_mark_object(attr_value->entity.object, vm);
 
         attr_node = prev_attr_node;
+        (*budget)--;
     }
 
-    return 1;
+    if (attr_node)
+        vm_gc_push_gray(0, (void *)attr_node, vm);
+
+    return count;
 }
 
-int vm_gc_mark_object(Object *object)
+void vm_gc_push_gray(size_t length, void *references, VM *vm)
 {
-    if (object->marked)
-        return 0;
+    // parallel markers keep worklists of their own
+    if (gc_worker)
+    {
+        vm_gc_worker_push(length, references, gc_worker);
+        return;
+    }
 
-    vm_garbage_report("Object %p, marked", object);
+    if (vm->gray_used == vm->gray_count)
+    {
+        size_t count = vm->gray_count == 0 ? VM_GC_GRAY_LENGTH : vm->gray_count * 2;
+
+        vm->gray = (Gray *)vm_memory_realloc(sizeof(Gray) * count, vm->gray);
+        vm->gray_count = count;
+    }
+
+    Gray *gray = &vm->gray[vm->gray_used++];
 
+    gray->length = length;
+    gray->references = references;
+}
+
+// Leaves what 'object' references in the gray worklist, scanned by
+// vm_gc_mark_gray, so marking never recurses deeper than a method to
+// its instance. Returns the objects marked meanwhile
+int vm_gc_push_references(Object *object, VM *vm)
+{
     switch (object->type)
     {
     case VALUE_OTYPE:
-        object->marked = 1;
-        return 1;
-
     case STR_OTYPE:
-        object->marked = 1;
-        return 1;
+    case FN_OTYPE:
+    case NATIVE_FN_OTYPE:
+    case CLASS_OTYPE:
+        return 0;
 
     case ARR_OTYPE:
-        return vm_gc_mark_object_array(object);
+        Array *arr = &object->value.array;
 
-    case FN_OTYPE:
-        object->marked = 1;
-        return 1;
-
-    case METHOD_OTYPE:
-        object->marked = 1;
+        if (arr->length > 0)
+            vm_gc_push_gray(arr->length, (void *)arr->items, vm);
 
-        Method *method = &object->value.method;
+        return 0;
 
-        vm_gc_mark_object((Object *)method->instance);
+    case INSTANCE_OTYPE:
+        LZHTableNode *attr_node = object->value.instance.attributes->nodes;
 
-        return 1;
+        if (attr_node)
+            vm_gc_push_gray(0, (void *)attr_node, vm);
 
-    case NATIVE_FN_OTYPE:
-        object->marked = 1;
-        return 1;
+        return 0;
 
-    case CLASS_OTYPE:
-        object->marked = 1;
-        return 1;
+    case METHOD_OTYPE:
+        Method *method = &object->value.method;
 
-    case INSTANCE_OTYPE:
-        return vm_gc_mark_instance(object);
+        return vm_gc_mark_object((Object *)method->instance, vm);
 
     default:
         assert(0 && "Illegal ObjectType value");
     }
 }
 
-int vm_gc_mark_frame_values(Value *values)
+// Old objects are still marked from their collection, so minor
+// collections stop at them and only walk the young ones
+int vm_gc_mark_object(Object *object, VM *vm)
+{
+    if (VM_GC_MARKED(object, vm))
+        return 0;
+
+    // only the marker that changes it goes on with the object
+    if (__atomic_exchange_n(&object->marked, vm->gc_mark, __ATOMIC_RELAXED) == vm->gc_mark)
+        return 0;
+
+    vm_garbage_report("Object %p, marked", object);
+
+    return 1 + vm_gc_push_references(object, vm);
+}
+
+int vm_gc_mark_entry(Gray *gray, size_t *budget, VM *vm)
+{
+    if (gray->length > 0)
+        return vm_gc_mark_array_items(gray, budget, vm);
+
+    return vm_gc_mark_attributes(gray, budget, vm);
+}
+
+// Scans the gray worklist until it is empty or 'budget' references got
+// scanned. Entries hold the references themselves, so the ones further
+// down get prefetched without touching objects
+int vm_gc_mark_gray(size_t *budget, VM *vm)
 {
     size_t count = 0;
 
-    size_t values_len = FRAME_VALUES_LENGTH;
+    while (vm->gray_used > 0 && *budget > 0)
+    {
+        // marking pushes more entries and can move the worklist
+        Gray gray = vm->gray[--vm->gray_used];
+
+        if (vm->gray_used >= VM_GC_PREFETCH_DISTANCE)
+        {
+            Gray *ahead = &vm->gray[vm->gray_used - VM_GC_PREFETCH_DISTANCE];
 
-    for (size_t i = 0; i < values_len; i++)
+            // attributes are reached through their node
+            __builtin_prefetch(ahead->references);
+        }
+
+        count += vm_gc_mark_entry(&gray, budget, vm);
+    }
+
+    return count;
+}
+
+int vm_gc_mark_frame_values(Value *values, size_t length, VM *vm)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < length; i++)
     {
         Value *value = &values[i];
 
         if (value->type != OBJECT_HTYPE)
             continue;
 
-        count += vm_gc_mark_object(value->entity.object);
-    }
+        count += vm_gc_mark_object(value->entity.object, vm);
+    }
+
+    return count;
+}
+
+int vm_gc_mark_frames(VM *vm)
+{
+    size_t count = 0;
+
+    for (int i = vm->frame_ptr; i >= 0; i--)
+    {
+        Frame *frame = &vm->frames[i];
+        Object *instance_obj = frame->instance;
+
+        if (instance_obj)
+            vm_gc_mark_object(instance_obj, vm);
+
+        // slots past the ones its function uses are never written, nor cleared
+        Fn *fn = frame->fn;
+        size_t length = fn && fn->locals >= 0 ? (size_t)fn->locals : FRAME_VALUES_LENGTH;
+
+        count += vm_gc_mark_frame_values(frame->locals, length, vm);
+    }
+
+    return count;
+}
+
+int vm_gc_mark_stack(VM *vm)
+{
+    size_t count = 0;
+
+    for (int i = 0; i < vm->stack_ptr; i++)
+    {
+        Value *value = &vm->stack[i];
+
+        if (value->type != OBJECT_HTYPE)
+            continue;
+
+        count += vm_gc_mark_object(value->entity.object, vm);
+    }
+
+    return count;
+}
+
+int vm_gc_mark_globals(VM *vm)
+{
+    size_t count = 0;
+
+    LZHTableNode *node = vm->globals->nodes;
+
+    while (node)
+    {
+        LZHTableNode *previous = node->previous_table_node;
+
+        Value *value = (Value *)node->value;
+
+        if (value->type == OBJECT_HTYPE)
+        {
+            Object *object = value->entity.object;
+
+            count += vm_gc_mark_object(object, vm);
+        }
+
+        node = previous;
+    }
+
+    return count;
+}
+
+// Remembered objects are old, so they are marked already,
+// but what was written to them since the last collection is not
+int vm_gc_mark_remembered(VM *vm)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < vm->remembered_used; i++)
+    {
+        Object *object = vm->remembered[i];
+
+        object->remembered = 0;
+        count += vm_gc_push_references(object, vm);
+    }
+
+    vm->remembered_used = 0;
+
+    return count;
+}
+
+// the roots only get shaded, what they reference is left in the worklist
+int vm_gc_mark_roots(VM *vm)
+{
+    size_t count = 0;
+
+    count += vm_gc_mark_frames(vm);
+    count += vm_gc_mark_stack(vm);
+    count += vm_gc_mark_globals(vm);
+
+    return count;
+}
+
+void vm_gc_remember(Object *object, VM *vm)
+{
+    if (vm->remembered_used == vm->remembered_count)
+    {
+        size_t count = vm->remembered_count == 0 ? VM_GC_REMEMBERED_LENGTH : vm->remembered_count * 2;
+
+        vm->remembered = (Object **)vm_memory_realloc(sizeof(Object *) * count, vm->remembered);
+        vm->remembered_count = count;
+    }
+
+    object->remembered = 1;
+    vm->remembered[vm->remembered_used++] = object;
+}
+
+// Called before 'object' replaces 'previous' in 'container', either can be
+// NULL. Frames, the stack and the globals are roots, they need no barrier
+void vm_gc_write_barrier(Object *container, Object *previous, Object *object, VM *vm)
+{
+    switch (vm->gc_phase)
+    {
+    case IDLE_GCPHASE:
+        // minor collections don't walk old objects, so an old
+        // container holding a young object is remembered
+        if (object && VM_GC_MARKED(container, vm) && !container->remembered && !VM_GC_MARKED(object, vm))
+            vm_gc_remember(container, vm);
+
+        break;
+
+    case MARK_GCPHASE:
+        // what was reachable when marking started stays marked,
+        // even when the only reference to it gets overwritten
+        if (previous)
+            vm_gc_mark_object(previous, vm);
+
+        break;
+
+    case SWEEP_GCPHASE:
+        break;
+
+    default:
+        assert(0 && "Illegal GCPhase value");
+    }
+}
+
+void vm_gc_forget(VM *vm)
+{
+    for (size_t i = 0; i < vm->remembered_used; i++)
+        vm->remembered[i]->remembered = 0;
+
+    vm->remembered_used = 0;
+}
+
+// Collects the young objects only, the ones that survive become old
+void vm_gc_minor(VM *vm)
+{
+    size_t budget = SIZE_MAX;
+    size_t count = 0;
+
+    count += vm_gc_mark_roots(vm);
+    count += vm_gc_mark_remembered(vm);
+    count += vm_gc_mark_gray(&budget, vm);
+
+    vm_garbage_report("%ld objects marked", count);
+
+    vm->gc_sweep = vm->old_object;
+    vm_gc_sweep_objects(&budget, vm);
+
+    vm->old_object = vm->tail_object;
+    vm->gc_young_base = vm->size;
+
+    vm_garbage_report("%ld bytes after a minor collection", vm->size);
+}
+
+// Starts a full collection. Flipping the mark unmarks every old object at
+// once, young ones never had it. Objects allocated from now until the sweep
+// ends get the new mark, so they survive
+void vm_gc_start(VM *vm)
+{
+    vm_gc_forget(vm);
+
+    vm->gc_mark = vm->gc_mark == 1 ? 2 : 1;
+    vm->gc_phase = MARK_GCPHASE;
+    vm->gc_paced = vm->size;
+    vm->gc_debt = 0;
+    // the sweep can free it, minor collections wait until the end anyway
+    vm->old_object = NULL;
+
+    size_t count = vm_gc_mark_roots(vm);
+
+    vm_garbage_report("%ld roots marked", count);
+}
+
+void vm_gc_end(VM *vm)
+{
+    vm->gc_phase = IDLE_GCPHASE;
+
+    // every object got swept, so errors in the accounting don't pile up
+    vm->size = vm->gc_live;
+    vm_memory_release_arenas();
+
+    vm->old_object = vm->tail_object;
+    vm->gc_young_base = vm->size;
+
+    size_t threshold = (size_t)((double)vm->size * vm->gc_growth);
+
+    if (threshold < vm->gc_min)
+        threshold = vm->gc_min;
+
+    // near the heap limit the next collection comes sooner, so growth doesn't exhaust it
+    size_t limit = vm_memory_limit();
+    size_t used = vm_memory_used_space();
+    size_t room = limit > used ? (limit - used) / 2 : 0;
+
+    if (threshold > vm->size + room)
+        threshold = vm->size + room;
+
+    vm->gc_threshold = threshold;
+
+    vm_garbage_report("%ld bytes live, next collection at %ld", vm->size, vm->gc_threshold);
+}
+
+// Does up to 'budget' units of the full collection in progress,
+// a unit being a reference scanned or an object swept
+void vm_gc_work(size_t budget, VM *vm)
+{
+    if (vm->gc_phase == MARK_GCPHASE)
+    {
+        size_t count = vm_gc_mark_gray(&budget, vm);
+
+        vm_garbage_report("%ld objects marked", count);
+
+        if (vm->gray_used > 0)
+            return;
+
+        vm->gc_phase = SWEEP_GCPHASE;
+        vm->gc_sweep = NULL;
+        vm->gc_live = 0;
+    }
+
+    if (vm_gc_sweep_objects(&budget, vm))
+        vm_gc_end(vm);
+}
+
+// Paces the full collection in progress with the bytes allocated since the
+// previous step, and stops once the step takes the longest pause allowed.
+// Returns 0 when too little got allocated to take one
+int vm_gc_step(VM *vm)
+{
+    // only steps free objects, so what the size grew by meanwhile got allocated
+    size_t allocated = vm->size > vm->gc_paced ? vm->size - vm->gc_paced : 0;
+
+    if (allocated < VM_GC_STEP_BYTES)
+        return 0;
+
+    // too far behind, the heap already grew past what a collection allows
+    if (vm->size >= (size_t)((double)vm->gc_threshold * vm->gc_growth))
+    {
+        vm_gc_work(SIZE_MAX, vm);
+        return 1;
+    }
+
+    size_t budget = vm->gc_debt + allocated / VM_GC_UNIT_BYTES;
+    clock_t start = clock();
+
+    while (vm->gc_phase != IDLE_GCPHASE && budget > 0)
+    {
+        size_t units = budget < VM_GC_CLOCK_UNITS ? budget : VM_GC_CLOCK_UNITS;
+
+        budget -= units;
+        vm_gc_work(units, vm);
+
+        if (clock() - start >= vm->gc_max_pause)
+            break;
+    }
+
+    // what the pause left undone is owed to the next step
+    vm->gc_debt = vm->gc_phase == IDLE_GCPHASE ? 0 : budget;
+    vm->gc_paced = vm->size;
+
+    return 1;
+}
+
+void vm_gc_worker_push(size_t length, void *references, GCWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->used == worker->count)
+    {
+        // what got stolen from the bottom leaves room to reuse first
+        if (worker->bottom > 0)
+        {
+            memmove(worker->gray, worker->gray + worker->bottom, sizeof(Gray) * (worker->used - worker->bottom));
+
+            worker->used -= worker->bottom;
+            worker->bottom = 0;
+        }
+        else
+        {
+            size_t count = worker->count == 0 ? VM_GC_GRAY_LENGTH : worker->count * 2;
+
+            worker->gray = (Gray *)vm_memory_realloc(sizeof(Gray) * count, worker->gray);
+            worker->count = count;
+        }
+    }
+
+    Gray *gray = &worker->gray[worker->used++];
+
+    gray->length = length;
+    gray->references = references;
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+int vm_gc_worker_pop(GCWorker *worker, Gray *out_gray)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->used > worker->bottom)
+    {
+        *out_gray = worker->gray[--worker->used];
+        found = 1;
+    }
+
+    if (worker->used == worker->bottom)
+    {
+        worker->used = 0;
+        worker->bottom = 0;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+
+    return found;
+}
+
+// takes the oldest entry of another worker, the one most likely to lead to more
+int vm_gc_worker_steal(GCWorker *worker, Gray *out_gray)
+{
+    GCParallel *parallel = worker->parallel;
+    size_t index = (size_t)(worker - parallel->workers);
+
+    for (size_t i = 1; i < parallel->length; i++)
+    {
+        GCWorker *victim = &parallel->workers[(index + i) % parallel->length];
+        int found = 0;
+
+        pthread_mutex_lock(&victim->lock);
+
+        if (victim->used > victim->bottom)
+        {
+            *out_gray = victim->gray[victim->bottom++];
+            found = 1;
+        }
+
+        pthread_mutex_unlock(&victim->lock);
+
+        if (found)
+            return 1;
+    }
+
+    return 0;
+}
+
+int vm_gc_workers_have_gray(GCParallel *parallel)
+{
+    int found = 0;
+
+    for (size_t i = 0; i < parallel->length && !found; i++)
+    {
+        GCWorker *worker = &parallel->workers[i];
+
+        pthread_mutex_lock(&worker->lock);
+        found = worker->used > worker->bottom;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    return found;
+}
+
+void *vm_gc_mark_worker(void *data)
+{
+    GCWorker *worker = (GCWorker *)data;
+    GCParallel *parallel = worker->parallel;
+    VM *vm = parallel->vm;
+    Gray gray;
+
+    gc_worker = worker;
+
+    while (1)
+    {
+        if (vm_gc_worker_pop(worker, &gray) || vm_gc_worker_steal(worker, &gray))
+        {
+            // the rest of a large array goes back where the others can steal it
+            size_t budget = VM_GC_SPLIT_UNITS;
+
+            worker->marked += vm_gc_mark_entry(&gray, &budget, vm);
+
+            continue;
+        }
+
+        // only busy workers push, and to their own worklist,
+        // so once every worker is idle there is nothing left
+        __atomic_add_fetch(&parallel->idle, 1, __ATOMIC_SEQ_CST);
+
+        while (!vm_gc_workers_have_gray(parallel))
+        {
+            if (__atomic_load_n(&parallel->idle, __ATOMIC_SEQ_CST) == parallel->length)
+            {
+                gc_worker = NULL;
+                return NULL;
+            }
+
+            sched_yield();
+        }
+
+        __atomic_sub_fetch(&parallel->idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// chains 'object' to the dead ones, in segments the sweepers free one at a time
+void vm_gc_defer_garbage(Object *object, GCParallel *parallel)
+{
+    if (parallel->segment_length == 0)
+    {
+        if (parallel->segments_used == parallel->segments_count)
+        {
+            size_t count = parallel->segments_count == 0 ? VM_GC_SEGMENTS_LENGTH : parallel->segments_count * 2;
+
+            parallel->segments = (Object **)vm_memory_realloc(sizeof(Object *) * count, parallel->segments);
+            parallel->segments_count = count;
+        }
+
+        parallel->segments[parallel->segments_used++] = NULL;
+    }
+
+    Object **segment = &parallel->segments[parallel->segments_used - 1];
+
+    object->next = *segment;
+    *segment = object;
+
+    parallel->segment_length = (parallel->segment_length + 1) % VM_GC_SEGMENT_OBJECTS;
+}
+
+void *vm_gc_sweep_worker(void *data)
+{
+    GCWorker *worker = (GCWorker *)data;
+    GCParallel *parallel = worker->parallel;
+    size_t index = 0;
+
+    while ((index = __atomic_fetch_add(&parallel->next_segment, 1, __ATOMIC_RELAXED)) < parallel->segments_used)
+    {
+        Object *object = parallel->segments[index];
+
+        while (object)
+        {
+            Object *next = object->next;
+
+            vm_garbage_object(object);
+
+            object = next;
+        }
+    }
+
+    return NULL;
+}
+
+// sleeps until a job gets posted, runs it and sleeps again until told to stop
+void *vm_gc_thread(void *data)
+{
+    GCWorker *worker = (GCWorker *)data;
+    GCParallel *parallel = worker->parallel;
+    size_t job = 0;
+
+    pthread_mutex_lock(&parallel->gate);
+
+    while (1)
+    {
+        while (!parallel->stop && parallel->job == job)
+            pthread_cond_wait(&parallel->opened, &parallel->gate);
+
+        if (parallel->stop)
+            break;
+
+        job = parallel->job;
+
+        pthread_mutex_unlock(&parallel->gate);
+
+        parallel->fn(worker);
+
+        // sweepers only free, so their magazines fill up. Giving them back here
+        // leaves the heap as the VM thread would after sweeping on its own
+        vm_memory_flush_thread();
+
+        pthread_mutex_lock(&parallel->gate);
+
+        if (--parallel->pending == 0)
+            pthread_cond_signal(&parallel->finished);
+    }
+
+    pthread_mutex_unlock(&parallel->gate);
+
+    return NULL;
+}
+
+// Starts the threads besides the VM one that full collections mark and sweep on.
+// The ones that couldn't be created are left out
+void vm_gc_start_threads(size_t threads, VM *vm)
+{
+    vm->gc_parallel = NULL;
+
+    if (threads <= 1)
+        return;
+
+    GCParallel *parallel = (GCParallel *)vm_memory_calloc(sizeof(GCParallel));
+    size_t created = 0;
+
+    parallel->vm = vm;
+    parallel->workers = (GCWorker *)vm_memory_calloc(sizeof(GCWorker) * threads);
+
+    pthread_mutex_init(&parallel->gate, NULL);
+    pthread_cond_init(&parallel->opened, NULL);
+    pthread_cond_init(&parallel->finished, NULL);
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        parallel->workers[i].parallel = parallel;
+        pthread_mutex_init(&parallel->workers[i].lock, NULL);
+    }
+
+    for (size_t i = 1; i < threads; i++)
+    {
+        if (pthread_create(&parallel->workers[i].thread, NULL, vm_gc_thread, &parallel->workers[i]) != 0)
+            break;
+
+        created++;
+    }
+
+    // workers only look at it once the first job got posted
+    parallel->length = created + 1;
+    vm->gc_parallel = parallel;
+}
+
+void vm_gc_stop_threads(VM *vm)
+{
+    GCParallel *parallel = vm->gc_parallel;
+
+    if (!parallel)
+        return;
+
+    pthread_mutex_lock(&parallel->gate);
+
+    parallel->stop = 1;
+
+    pthread_cond_broadcast(&parallel->opened);
+    pthread_mutex_unlock(&parallel->gate);
+
+    for (size_t i = 1; i < parallel->length; i++)
+        pthread_join(parallel->workers[i].thread, NULL);
+
+    for (size_t i = 0; i < vm->gc_threads; i++)
+    {
+        pthread_mutex_destroy(&parallel->workers[i].lock);
+        vm_memory_dealloc(parallel->workers[i].gray);
+    }
+
+    pthread_cond_destroy(&parallel->finished);
+    pthread_cond_destroy(&parallel->opened);
+    pthread_mutex_destroy(&parallel->gate);
+    vm_memory_dealloc(parallel->segments);
+    vm_memory_dealloc(parallel->workers);
+    vm_memory_dealloc(parallel);
+
+    vm->gc_parallel = NULL;
+}
+
+// Runs 'fn' on every worker, the first one on the VM thread, and waits for the others
+void vm_gc_run(void *(*fn)(void *), GCParallel *parallel)
+{
+    pthread_mutex_lock(&parallel->gate);
+
+    parallel->fn = fn;
+    parallel->idle = 0;
+    parallel->pending = parallel->length - 1;
+    parallel->job++;
+
+    pthread_cond_broadcast(&parallel->opened);
+    pthread_mutex_unlock(&parallel->gate);
+
+    fn(&parallel->workers[0]);
+
+    pthread_mutex_lock(&parallel->gate);
+
+    while (parallel->pending > 0)
+        pthread_cond_wait(&parallel->finished, &parallel->gate);
 
-    return count;
+    pthread_mutex_unlock(&parallel->gate);
 }
 
-int vm_gc_mark_frames(VM *vm)
+// Marks and sweeps the full collection vm_gc_start began on the collector threads.
+// The dead get unlinked on the VM thread, so survivors keep their order and the
+// sizes add up as they do collecting on it alone. Freeing them is what gets shared
+void vm_gc_parallel(VM *vm)
 {
-    size_t count = 0;
+    GCParallel *parallel = vm->gc_parallel;
+    size_t threads = parallel->length;
 
-    for (int i = vm->frame_ptr; i >= 0; i--)
+    for (size_t i = 0; i < threads; i++)
     {
-        Frame *frame = &vm->frames[i];
-        Object *instance_obj = frame->instance;
+        // the previous collection left every worklist empty
+        parallel->workers[i].bottom = 0;
+        parallel->workers[i].used = 0;
+        parallel->workers[i].marked = 0;
+    }
 
-        if (instance_obj)
-            vm_gc_mark_object(instance_obj);
+    parallel->segments_used = 0;
+    parallel->segment_length = 0;
+    parallel->next_segment = 0;
 
-        count += vm_gc_mark_frame_values(frame->locals);
-    }
+    // the roots are shaded already, the others steal their references from the first worker
+    for (size_t i = 0; i < vm->gray_used; i++)
+        vm_gc_worker_push(vm->gray[i].length, vm->gray[i].references, &parallel->workers[0]);
 
-    return count;
-}
+    vm->gray_used = 0;
+
+    vm_gc_run(vm_gc_mark_worker, parallel);
 
-int vm_gc_mark_stack(VM *vm)
-{
     size_t count = 0;
 
-    for (int i = 0; i < vm->stack_ptr; i++)
-    {
-        Value *value = &vm->stack[i];
+    for (size_t i = 0; i < threads; i++)
+        count += parallel->workers[i].marked;
 
-        if (value->type != OBJECT_HTYPE)
-            continue;
+    vm_garbage_report("%ld objects marked", count);
 
-        count += vm_gc_mark_object(value->entity.object);
-    }
+    size_t budget = SIZE_MAX;
 
-    return count;
+    vm->gc_phase = SWEEP_GCPHASE;
+    vm->gc_sweep = NULL;
+    vm->gc_live = 0;
+
+    gc_worker = &parallel->workers[0];
+    vm_gc_sweep_objects(&budget, vm);
+    gc_worker = NULL;
+
+    vm_gc_run(vm_gc_sweep_worker, parallel);
+
+    vm_gc_end(vm);
 }
 
-int vm_gc_mark_globals(VM *vm)
+// Collects every object that can't be reached, at once
+void vm_gc(VM *vm)
 {
-    size_t count = 0;
+    // the collection in progress keeps what was reachable when it started
+    if (vm->gc_phase != IDLE_GCPHASE)
+        vm_gc_work(SIZE_MAX, vm);
 
-    LZHTableNode *node = vm->globals->nodes;
+    vm_gc_start(vm);
 
-    while (node)
-    {
-        LZHTableNode *previous = node->previous_table_node;
+    if (vm->gc_parallel)
+        vm_gc_parallel(vm);
+    else
+        vm_gc_work(SIZE_MAX, vm);
+}
 
-        Value *value = (Value *)node->value;
+// Called where every object is reachable from the frames, the stack or the
+// globals: before an instruction runs and when a loop jumps back
+void vm_gc_record(clock_t start, size_t *count, clock_t *longest)
+{
+    clock_t pause = clock() - start;
 
-        if (value->type == OBJECT_HTYPE)
+    (*count)++;
+
+    if (pause > *longest)
+        *longest = pause;
+}
+
+void vm_gc_safepoint(VM *vm)
+{
+    GCPauses *pauses = &vm->gc_pauses;
+    clock_t start = pauses->recording ? clock() : 0;
+
+    if (vm->gc_phase != IDLE_GCPHASE)
+    {
+        if (vm_gc_step(vm) && pauses->recording)
+            vm_gc_record(start, &pauses->steps, &pauses->longest_step);
+    }
+    else if (vm->size >= vm->gc_threshold)
+    {
+        if (vm->gc_max_pause > 0)
         {
-            Object *object = value->entity.object;
+            vm_gc_start(vm);
 
-            count += vm_gc_mark_object(object);
+            if (pauses->recording)
+                vm_gc_record(start, &pauses->steps, &pauses->longest_step);
         }
+        else
+        {
+            vm_gc(vm);
 
-        node = previous;
+            if (pauses->recording)
+                vm_gc_record(start, &pauses->full, &pauses->longest_full);
+        }
     }
+    else if (vm->gc_nursery > 0 && vm->size >= vm->gc_young_base + vm->gc_nursery)
+    {
+        vm_gc_minor(vm);
 
-    return count;
+        if (pauses->recording)
+            vm_gc_record(start, &pauses->minor, &pauses->longest_minor);
+    }
 }
 
-void vm_gc_mark_objects(VM *vm)
+// whether the next safepoint has work, for code that allocates between them
+int vm_gc_pending(VM *vm)
 {
-    size_t count = 0;
-
-    count += vm_gc_mark_frames(vm);
-    count += vm_gc_mark_stack(vm);
-    count += vm_gc_mark_globals(vm);
-
-    vm_garbage_report("%ld objects marked", count);
-}
+    if (vm->gc_phase != IDLE_GCPHASE)
+        return vm->size > vm->gc_paced && vm->size - vm->gc_paced >= VM_GC_STEP_BYTES;
 
-void vm_gc(VM *vm)
-{
-    vm_gc_mark_objects(vm);
-    vm_gc_sweep_objects(vm);
+    return vm->size >= vm->gc_threshold ||
+           (vm->gc_nursery > 0 && vm->size >= vm->gc_young_base + vm->gc_nursery);
 }
 
 int vm_is_value_nil(Value *value)
@@ -1507,7 +2369,8 @@ void vm_descompose_i32(int32_t value, uint8_t *bytes)
 
 int32_t vm_compose_i32(uint8_t *bytes)
 {
-    return ((int32_t)bytes[3] << 24) | ((int32_t)bytes[2] << 16) | ((int32_t)bytes[1] << 8) | ((int32_t)bytes[0]);
+    // shifting into the sign bit of an int32_t is undefined
+    return (int32_t)(((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[0]));
 }
 
 int32_t vm_read_i32(VM *vm)
@@ -1522,11 +2385,14 @@ int32_t vm_read_i32(VM *vm)
 
 Object *vm_create_object(ObjectType type, VM *vm)
 {
-    // if (vm->size >= 1024)
-    // vm_gc(vm);
-
+    // collecting here would miss the objects instructions hold in C locals,
+    // so it waits for the next safepoint
     Object *obj = vm_memory_create_object(type, vm);
 
+    // the full collection in progress already took what it keeps
+    if (vm->gc_phase != IDLE_GCPHASE)
+        obj->marked = vm->gc_mark;
+
     return obj;
 }
 
@@ -1549,6 +2415,9 @@ void vm_jmp(int32_t jmp_value, int32_t from, VM *vm)
             vm_err("Failed to execute jmp. current ip %ld, plus jmp value %d, less than 0", current_ip, jmp_value);
 
         frame->ip = current_ip + jmp_value;
+        jit_backedge(frame);
+
+        vm_gc_safepoint(vm);
     }
     else
     {
@@ -1688,6 +2557,36 @@ char *vm_read_string(VM *vm)
     return (char *)DYNARR_PTR_GET((size_t)index, vm->strings);
 }
 
+int vm_fn_locals(Fn *fn)
+{
+    DynArr *chunks = fn->chunks;
+    size_t locals = fn->params == NULL ? 0 : fn->params->used;
+    int operands = 0;
+
+    for (size_t pc = 0; pc < chunks->used; pc += 1 + operands)
+    {
+        uint8_t opcode = *(uint8_t *)dynarr_get(pc, chunks);
+        operands = jit_operands_length(opcode);
+
+        // chunks it can't walk could use any slot
+        if (operands < 0 || pc + 1 + operands > chunks->used)
+            return FRAME_VALUES_LENGTH;
+
+        // for loops name their counter and bound slots in the first two operands
+        int slots = opcode == FORLOOP_OPC ? 2 : opcode == LREAD_OPC || opcode == LSET_OPC ? 1 : 0;
+
+        for (int i = 1; i <= slots; i++)
+        {
+            size_t index = (size_t)*(uint8_t *)dynarr_get(pc + i, chunks);
+
+            if (index + 1 > locals)
+                locals = index + 1;
+        }
+    }
+
+    return locals > FRAME_VALUES_LENGTH ? FRAME_VALUES_LENGTH : (int)locals;
+}
+
 void vm_frame_setup(Frame *frame, Fn *fn, VM *vm)
 {
     DynArrPtr *params = fn->params;
@@ -1711,9 +2610,23 @@ void vm_frame_up(Fn *fn, Object *instance, int is_constructor, VM *vm)
 
     vm_frame_setup(frame, fn, vm);
 
+    if (fn->locals < 0)
+        fn->locals = vm_fn_locals(fn);
+
+    // earlier calls leave their objects behind the arguments
+    size_t args_count = fn->params == NULL ? 0 : fn->params->used;
+
+    if ((size_t)fn->locals > args_count)
+        memset(&frame->locals[args_count], 0, sizeof(Value) * ((size_t)fn->locals - args_count));
+
     frame->ip = 0;
+    frame->fn = fn;
     frame->chunks = fn->chunks;
     frame->instance = instance;
+
+    if (fn->hotness < JIT_HOT_THRESHOLD)
+        fn->hotness++;
+
     frame->is_constructor = is_constructor;
 }
 
@@ -1725,6 +2638,7 @@ void vm_frame_down(VM *vm)
     Frame *frame = VM_FRAME_CURRENT(vm);
 
     frame->ip = 0;
+    frame->fn = NULL;
     frame->chunks = NULL;
     frame->instance = NULL;
     frame->is_constructor = 0;
@@ -1923,7 +2837,7 @@ void vm_globals_write(char *identifier, Value *value, VM *vm)
 
     if (!global_value)
     {
-        global_value = vm_memory_alloc(sizeof(Value));
+        global_value = vm_memory_create_value();
         lzhtable_put((uint8_t *)identifier, strlen(identifier), (void *)global_value, vm->globals, NULL);
     }
 
@@ -1998,6 +2912,8 @@ void vm_execute_array(VM *vm)
         arr->items = is_empty ? vm_memory_calloc(sizeof(Object *) * len) : vm_memory_alloc(sizeof(Object *) * len);
     }
 
+    vm->size += sizeof(Object *) * arr->length;
+
     if (!is_empty)
     {
         for (int32_t i = len - 1; i >= 0; i--)
@@ -2089,8 +3005,12 @@ void vm_execute_set_array_item(VM *vm)
     if (index < 0 || (size_t)index >= array_obj->length)
         vm_err("Failed to assign value to array. Constraints: 0 < index (%d) < arr_len (%ld).", index, array_obj->length);
 
+    Object *container_obj = array_value->entity.object;
+    Object *previous_obj = array_obj->items[index];
+
     if (value_value->type == NIL_HTYPE)
     {
+        vm_gc_write_barrier(container_obj, previous_obj, NULL, vm);
         array_obj->items[index] = NULL;
         return;
     }
@@ -2105,11 +3025,13 @@ void vm_execute_set_array_item(VM *vm)
         raw_lvalue->type = raw_rvalue->type;
         raw_lvalue->i64 = raw_rvalue->i64;
 
+        vm_gc_write_barrier(container_obj, previous_obj, value_obj, vm);
         array_obj->items[index] = value_obj;
 
         return;
     }
 
+    vm_gc_write_barrier(container_obj, previous_obj, value_value->entity.object, vm);
     array_obj->items[index] = value_value->entity.object;
 }
 
@@ -2218,6 +3140,138 @@ void vm_execute_comparison(int type, VM *vm)
     }
 }
 
+void vm_rewrite_opcode(uint8_t opcode, VM *vm)
+{
+    Frame *frame = VM_FRAME_CURRENT(vm);
+
+    // the opcode is the byte right before the current ip
+    // as binary instructions do not have operands
+    dynarr_set((void *)&opcode, frame->ip - 1, frame->chunks);
+}
+
+int vm_are_operands_ii(VM *vm)
+{
+    if (VM_STACK_SIZE(vm) < 2)
+        return 0;
+
+    Value *right = &vm->stack[vm->stack_ptr - 1];
+    Value *left = &vm->stack[vm->stack_ptr - 2];
+
+    return left->type == VALUE_HTYPE &&
+           left->entity.primitive.type == INT_VTYPE &&
+           right->type == VALUE_HTYPE &&
+           right->entity.primitive.type == INT_VTYPE;
+}
+
+void vm_quicken_binary(uint8_t opcode, VM *vm)
+{
+    if (vm_are_operands_ii(vm))
+        vm_rewrite_opcode(opcode, vm);
+}
+
+void vm_execute_arithmetic_ii(int type, VM *vm)
+{
+    // guard: operands stopped being unboxed ints, go back to the generic form
+    if (!vm_are_operands_ii(vm))
+    {
+        vm_rewrite_opcode((uint8_t)(ADD_OPC + type - 1), vm);
+        vm_execute_arithmetic(type, vm);
+        return;
+    }
+
+    Primitive *rvalue = &vm->stack[vm->stack_ptr - 1].entity.primitive;
+    Primitive *lvalue = &vm->stack[vm->stack_ptr - 2].entity.primitive;
+
+    switch (type)
+    {
+    case 1:
+        lvalue->i64 += rvalue->i64;
+        break;
+
+    case 2:
+        lvalue->i64 -= rvalue->i64;
+        break;
+
+    case 3:
+        lvalue->i64 *= rvalue->i64;
+        break;
+
+    case 4:
+        if (rvalue->i64 == 0)
+            vm_err("Division by zero is undefined");
+
+        lvalue->i64 /= rvalue->i64;
+
+        break;
+
+    case 5:
+        if (rvalue->i64 == 0)
+            vm_err("Division by zero is undefined");
+
+        lvalue->i64 %= rvalue->i64;
+
+        break;
+
+    default:
+        assert(0 && "Illegal arithmetic operation type value");
+    }
+
+    // result stays in the left operand slot
+    vm->stack_ptr--;
+}
+
+void vm_execute_comparison_ii(int type, VM *vm)
+{
+    // guard: operands stopped being unboxed ints, go back to the generic form
+    if (!vm_are_operands_ii(vm))
+    {
+        vm_rewrite_opcode((uint8_t)(LT_OPC + type - 1), vm);
+        vm_execute_comparison(type, vm);
+        return;
+    }
+
+    Primitive *rvalue = &vm->stack[vm->stack_ptr - 1].entity.primitive;
+    Primitive *lvalue = &vm->stack[vm->stack_ptr - 2].entity.primitive;
+
+    int64_t result = 0;
+
+    switch (type)
+    {
+    case 1:
+        result = lvalue->i64 < rvalue->i64;
+        break;
+
+    case 2:
+        result = lvalue->i64 > rvalue->i64;
+        break;
+
+    case 3:
+        result = lvalue->i64 <= rvalue->i64;
+        break;
+
+    case 4:
+        result = lvalue->i64 >= rvalue->i64;
+        break;
+
+    case 5:
+        result = lvalue->i64 == rvalue->i64;
+        break;
+
+    case 6:
+        result = lvalue->i64 != rvalue->i64;
+        break;
+
+    default:
+        assert(0 && "Illegal comparison operation type value");
+    }
+
+    // result stays in the left operand slot
+    lvalue->type = BOOL_VTYPE;
+    lvalue->i64 = result;
+
+    vm->stack_ptr--;
+}
+
 void vm_execute_argjmp(int type, VM *vm)
 {
     Value *value = vm_stack_pop(vm);
@@ -2423,6 +3477,8 @@ void vm_execute_concat(VM *vm)
     nstr->buffer = buff;
     nstr->length = nstr_len;
 
+    vm->size += nstr->length + 1;
+
     vm_stack_push_object(str_obj, vm);
 }
 
@@ -2468,6 +3524,8 @@ void vm_execute_str_itm(VM *vm)
     new_str->core = 0;
     new_str->length = 1;
 
+    vm->size += new_str->length + 1;
+
     vm_stack_push_object(str_obj, vm);
 }
 
@@ -2531,8 +3589,16 @@ void vm_execute_set_property(VM *vm)
     Instance *instance = instance = &instance_obj->value.instance;
     Value *value = lzhtable_get((uint8_t *)key, key_size, instance->attributes);
 
+    Object *previous_obj = value && value->type == OBJECT_HTYPE ? value->entity.object : NULL;
+    Object *input_obj = input_value->type == OBJECT_HTYPE ? input_value->entity.object : NULL;
+
     if (!value)
-        value = (Value *)vm_memory_calloc(sizeof(Value));
+    {
+        value = vm_memory_create_value();
+        vm->size += sizeof(LZHTableNode) + sizeof(Value);
+    }
+
+    vm_gc_write_barrier(instance_obj, previous_obj, input_obj, vm);
 
     memcpy(value, input_value, sizeof(Value));
 
@@ -2633,6 +3699,7 @@ void vm_execute_jmp(VM *vm)
             vm_err("Failed to execute jmp. Current ip %ld, plus jmp value %d, less than 0", current_ip, jmp_value);
 
         frame->ip = current_ip + jmp_value;
+        jit_backedge(frame);
     }
     else
     {
@@ -2665,6 +3732,60 @@ void vm_execute_jmpc(VM *vm)
         frame->ip = current_ip + jmpc_value;
 }
 
+void vm_execute_forloop(VM *vm)
+{
+    Frame *frame = VM_FRAME_CURRENT(vm);
+    size_t from = frame->ip - 1;
+
+    uint8_t counter_index = vm_advance(vm);
+    uint8_t bound_index = vm_advance(vm);
+    uint8_t up = vm_advance(vm);
+    int32_t jmp_value = vm_read_i32(vm);
+
+    if (counter_index >= FRAME_VALUES_LENGTH || bound_index >= FRAME_VALUES_LENGTH)
+        vm_err("Failed to execute for loop. Illegal local index: %d or %d.", counter_index, bound_index);
+
+    Value *counter_value = &frame->locals[counter_index];
+    Value *bound_value = &frame->locals[bound_index];
+
+    int64_t counter = 0;
+    int64_t bound = 0;
+
+    // Fast path: both locals hold unboxed ints, which is always
+    // the case unless the body assigned something else to the counter
+    if (counter_value->type == VALUE_HTYPE &&
+        counter_value->entity.primitive.type == INT_VTYPE &&
+        bound_value->type == VALUE_HTYPE &&
+        bound_value->entity.primitive.type == INT_VTYPE)
+    {
+        counter = counter_value->entity.primitive.i64;
+        bound = bound_value->entity.primitive.i64;
+    }
+    else
+    {
+        Primitive *counter_primitive = NULL;
+        Primitive *bound_primitive = NULL;
+
+        if (!vm_is_value_int(counter_value, &counter_primitive))
+            vm_err("Failed to execute for loop. Counter is not int type.");
+
+        if (!vm_is_value_int(bound_value, &bound_primitive))
+            vm_err("Failed to execute for loop. Bound is not int type.");
+
+        counter = counter_primitive->i64;
+        bound = bound_primitive->i64;
+    }
+
+    counter = up ? counter + 1 : counter - 1;
+
+    counter_value->type = VALUE_HTYPE;
+    counter_value->entity.primitive.type = INT_VTYPE;
+    counter_value->entity.primitive.i64 = counter;
+
+    if (up ? counter < bound : counter >= bound)
+        vm_jmp(jmp_value, from, vm);
+}
+
 void vm_execute_get_local(VM *vm)
 {
     int32_t index = (int32_t)vm_advance(vm);
@@ -2800,6 +3921,8 @@ void vm_execute_call(VM *vm)
         instance->attributes = vm_memory_create_lzhtable(21);
         instance->klass = klass;
 
+        vm->size += sizeof(LZHTable) + sizeof(LZHTableBucket) * instance->attributes->m;
+
         if (constructor)
         {
             callable = klass->constructor;
@@ -2850,6 +3973,8 @@ void vm_execute_return(VM *vm)
 
 void vm_execute_instruction(VM *vm)
 {
+    vm_gc_safepoint(vm);
+
     uint8_t opcode = vm_advance(vm);
 
     switch (opcode)
@@ -2922,60 +4047,127 @@ void vm_execute_instruction(VM *vm)
     // arithmetic
     case ADD_OPC:
         // do not require to validate op
+        vm_quicken_binary(ADD_II_OPC, vm);
         vm_execute_arithmetic(1, vm);
         break;
 
     case SUB_OPC:
         // do not require to validate op
+        vm_quicken_binary(SUB_II_OPC, vm);
         vm_execute_arithmetic(2, vm);
         break;
 
     case MUL_OPC:
         // do not require to validate op
+        vm_quicken_binary(MUL_II_OPC, vm);
         vm_execute_arithmetic(3, vm);
         break;
 
     case DIV_OPC:
         // do not require to validate op
+        vm_quicken_binary(DIV_II_OPC, vm);
         vm_execute_arithmetic(4, vm);
         break;
 
     case MOD_OPC:
         // do not require to validate op
+        vm_quicken_binary(MOD_II_OPC, vm);
         vm_execute_arithmetic(5, vm);
         break;
 
     // comparison
     case LT_OPC:
         // do not require to validate op
+        vm_quicken_binary(LT_II_OPC, vm);
         vm_execute_comparison(1, vm);
         break;
 
     case GT_OPC:
         // do not require to validate op
+        vm_quicken_binary(GT_II_OPC, vm);
         vm_execute_comparison(2, vm);
         break;
 
     case LE_OPC:
         // do not require to validate op
+        vm_quicken_binary(LE_II_OPC, vm);
         vm_execute_comparison(3, vm);
         break;
 
     case GE_OPC:
         // do not require to validate op
+        vm_quicken_binary(GE_II_OPC, vm);
         vm_execute_comparison(4, vm);
         break;
 
     case EQ_OPC:
         // do not require to validate op
+        vm_quicken_binary(EQ_II_OPC, vm);
         vm_execute_comparison(5, vm);
         break;
 
     case NE_OPC:
         // do not require to validate op
+        vm_quicken_binary(NE_II_OPC, vm);
         vm_execute_comparison(6, vm);
         break;
 
+    // quickened
+    case ADD_II_OPC:
+        // do not require to validate op
+        vm_execute_arithmetic_ii(1, vm);
+        break;
+
+    case SUB_II_OPC:
+        // do not require to validate op
+        vm_execute_arithmetic_ii(2, vm);
+        break;
+
+    case MUL_II_OPC:
+        // do not require to validate op
+        vm_execute_arithmetic_ii(3, vm);
+        break;
+
+    case DIV_II_OPC:
+        // do not require to validate op
+        vm_execute_arithmetic_ii(4, vm);
+        break;
+
+    case MOD_II_OPC:
+        // do not require to validate op
+        vm_execute_arithmetic_ii(5, vm);
+        break;
+
+    case LT_II_OPC:
+        // do not require to validate op
+        vm_execute_comparison_ii(1, vm);
+        break;
+
+    case GT_II_OPC:
+        // do not require to validate op
+        vm_execute_comparison_ii(2, vm);
+        break;
+
+    case LE_II_OPC:
+        // do not require to validate op
+        vm_execute_comparison_ii(3, vm);
+        break;
+
+    case GE_II_OPC:
+        // do not require to validate op
+        vm_execute_comparison_ii(4, vm);
+        break;
+
+    case EQ_II_OPC:
+        // do not require to validate op
+        vm_execute_comparison_ii(5, vm);
+        break;
+
+    case NE_II_OPC:
+        // do not require to validate op
+        vm_execute_comparison_ii(6, vm);
+        break;
+
     // logical
     case OR_OPC:
         // do not require to validate op
@@ -3043,6 +4235,11 @@ void vm_execute_instruction(VM *vm)
         vm_execute_argjmp(2, vm);
         break;
 
+    case FORLOOP_OPC:
+        vm_validate_opcode("FORLOOP", 7, vm);
+        vm_execute_forloop(vm);
+        break;
+
     case CONCAT_OPC:
         // do not require to validate op
         vm_execute_concat(vm);
@@ -3149,17 +4346,41 @@ VM *vm_create()
     vm->klass = NULL;
 
     vm->size = 0;
+    vm->gray = NULL;
+    vm->gray_used = 0;
+    vm->gray_count = 0;
+    vm->remembered = NULL;
+    vm->remembered_used = 0;
+    vm->remembered_count = 0;
+    vm->gc_threshold = VM_GC_MIN_BYTES;
+    vm->gc_min = VM_GC_MIN_BYTES;
+    vm->gc_growth = VM_GC_GROWTH;
+    vm->gc_young_base = 0;
+    vm->gc_nursery = VM_GC_NURSERY_BYTES;
+    vm->gc_phase = IDLE_GCPHASE;
+    vm->gc_mark = 1;
+    vm->gc_sweep = NULL;
+    vm->gc_live = 0;
+    vm->gc_paced = 0;
+    vm->gc_debt = 0;
+    vm->gc_max_pause = 0;
+    vm->gc_threads = VM_GC_THREADS;
+    vm_gc_start_threads(vm->gc_threads, vm);
+    memset(&vm->gc_pauses, 0, sizeof(GCPauses));
     vm->head_object = NULL;
     vm->tail_object = NULL;
+    vm->old_object = NULL;
 
-    DynArr *default_chunks = vm_memory_create_dynarr(sizeof(uint8_t));
+    // top level code lives in its own function so the jit can treat it like any other
+    Fn *main_fn = vm_memory_create_fn("main");
 
-    lzstack_push((void *)default_chunks, vm->blocks_stack, NULL);
+    lzstack_push((void *)main_fn->chunks, vm->blocks_stack, NULL);
 
     Frame *frame = &vm->frames[0];
 
     frame->ip = 0;
-    frame->chunks = default_chunks;
+    frame->fn = main_fn;
+    frame->chunks = main_fn->chunks;
 
     //> adding natives
     vm_add_native("ascii", 1, native_fn_ascii, vm);
@@ -3192,9 +4413,11 @@ void vm_destroy(VM *vm)
     if (!vm)
         return;
 
+    vm_gc_stop_threads(vm);
+
     //> cleaning up frame
     Frame *frame = &vm->frames[0];
-    vm_memory_destroy_dynarr(frame->chunks);
+    vm_memory_destroy_fn(frame->fn);
     //< cleaning up frames
 
     //> cleaning up int constants
@@ -3246,7 +4469,7 @@ void vm_destroy(VM *vm)
         LZHTableNode *previous = node->previous_table_node;
 
         Value *value = (Value *)node->value;
-        vm_memory_dealloc(value);
+        vm_memory_destroy_value(value);
 
         node = previous;
     }
@@ -3257,6 +4480,8 @@ void vm_destroy(VM *vm)
     //> cleaning up helpers
     vm_memory_destroy_lzstack(vm->blocks_stack);
     vm_memory_destroy_lzstack(vm->fn_def_stack);
+    vm_memory_dealloc(vm->gray);
+    vm_memory_dealloc(vm->remembered);
     //< cleaning up helpers
 
     //> cleaning up objects
@@ -3280,12 +4505,60 @@ void vm_destroy(VM *vm)
     vm->klass = NULL;
 
     vm->size = 0;
+    vm->gray = NULL;
+    vm->gray_used = 0;
+    vm->gray_count = 0;
+    vm->remembered = NULL;
+    vm->remembered_used = 0;
+    vm->remembered_count = 0;
+    vm->gc_phase = IDLE_GCPHASE;
+    vm->gc_sweep = NULL;
     vm->head_object = NULL;
     vm->tail_object = NULL;
+    vm->old_object = NULL;
 
     vm_memory_dealloc(vm);
 }
 
+void vm_gc_tune(double growth, size_t min_bytes, size_t nursery_bytes, size_t max_pause_us, size_t threads, VM *vm)
+{
+    assert(growth > 1.0 && "Illegal growth value. Collections would never stop");
+    assert(threads >= 1 && threads <= VM_GC_MAX_THREADS && "Illegal threads value");
+
+    vm->gc_growth = growth;
+    vm->gc_min = min_bytes;
+    vm->gc_threshold = min_bytes;
+    vm->gc_nursery = nursery_bytes;
+
+    // a pause shorter than the clock can tell still gets one tick
+    clock_t max_pause = (clock_t)((double)max_pause_us * CLOCKS_PER_SEC / 1000000.0);
+
+    vm->gc_max_pause = max_pause_us > 0 && max_pause == 0 ? 1 : max_pause;
+
+    if (threads != vm->gc_threads)
+    {
+        vm_gc_stop_threads(vm);
+
+        vm->gc_threads = threads;
+        vm_gc_start_threads(threads, vm);
+    }
+}
+
+void vm_gc_record_pauses(VM *vm)
+{
+    vm->gc_pauses.recording = 1;
+}
+
+void vm_gc_report_pauses(VM *vm)
+{
+    GCPauses *pauses = &vm->gc_pauses;
+
+    // microseconds of process time, what the pause bound is measured with
+    fprintf(stderr, "gc steps: %zu, longest: %lld us\n", pauses->steps, (long long)pauses->longest_step * 1000000 / CLOCKS_PER_SEC);
+    fprintf(stderr, "gc full: %zu, longest: %lld us\n", pauses->full, (long long)pauses->longest_full * 1000000 / CLOCKS_PER_SEC);
+    fprintf(stderr, "gc minor: %zu, longest: %lld us\n", pauses->minor, (long long)pauses->longest_minor * 1000000 / CLOCKS_PER_SEC);
+}
+
 size_t vm_block_length(VM *vm)
 {
     return ((DynArr *)lzstack_peek(vm->blocks_stack, NULL))->used;
@@ -3452,7 +4725,10 @@ size_t vm_write_str_const(char *value, VM *vm)
 int vm_execute(VM *vm)
 {
     while (!vm_is_at_end(vm))
-        vm_execute_instruction(vm);
+    {
+        if (!aot_execute(vm) && !jit_execute(vm))
+            vm_execute_instruction(vm);
+    }
 
     if (!vm->halt && !vm->stop && vm->frame_ptr != 0)
         vm_err("Illegal virtual machine end state. The virtual machine must end its execution in the main frame.");
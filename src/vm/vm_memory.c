@@ -1,43 +1,472 @@
+#define _DEFAULT_SOURCE
 #include "vm_memory.h"
+#include "jit.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the address space of the whole heap is reserved at once and split in slots,
+// arenas are mapped over one slot or, for bigger requests, over consecutive ones
+#define ARENA_SHIFT 23
+#define ARENA_BYTES ((size_t)1 << ARENA_SHIFT)
+#define DEFAULT_LIMIT ((size_t)1024 * 1024 * 1024)
+// small allocations are slots of slab pages, each page is a buddy block of this size.
+// Pages sit at multiples of their size from the arena start, so the one holding
+// a slot is found by rounding the slot offset down
+#define SLAB_PAGE_BYTES ((size_t)64 * 1024)
+#define SLAB_TAG 1
+#define SLAB_CLASSES 12
+#define SLAB_MAX_BYTES 256
+// objects and values, the records the VM creates and collects the most, have pools of their own
+#define RECORD_SLOTS 1024
+// every thread caches slab slots and records in magazines, one per kind, taken from
+// and given back to the shared heap in batches. Threads only meet at the heap lock once a batch
+#define OBJECT_KIND SLAB_CLASSES
+#define VALUE_KIND (SLAB_CLASSES + 1)
+#define KINDS (SLAB_CLASSES + 2)
+#define MAGAZINE_SLOTS 64
+#define MAGAZINE_BATCH 32
+
+typedef struct _magazine_
+{
+    size_t count;
+    void *slots[MAGAZINE_SLOTS];
+} Magazine;
 
 static int initialized = 0;
-static LZAllocator *allocator = NULL;
+// guards everything shared below, but the reservation and its slots
+// which only change for arenas no live pointer can be in
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *reserved = NULL;
+static size_t reserved_slots = 0;
+static LZAllocator **slots = NULL; // arena mapped over each slot
+static LZAllocator **arenas = NULL;
+static size_t arenas_used = 0;
+static size_t arenas_count = 0;
+static size_t arenas_bytes = 0;
+static size_t current_arena = 0; // where the last allocation succeeded
+static size_t heap_limit = DEFAULT_LIMIT;
 static DynArrAllocator dynarr_allocator = {0};
 static LZStackAllocator lzstack_allocator = {0};
 static LZHTableAllocator lzhtable_allocator = {0};
+static LZSlabAllocator slab_allocator = {0};
+static LZSlab slabs[SLAB_CLASSES];
+static LZAreaAllocator records_allocator = {0};
+static LZArea *records = NULL;
+static pthread_key_t magazines_key;
+static __thread Magazine magazines[KINDS];
+static __thread int magazines_registered = 0;
+
+static LZAllocator *arena_of(void *ptr);
+static LZAllocator *add_arena(size_t bytes);
+static void remove_arena(size_t index);
+static void *arenas_alloc(size_t bytes);
+static void no_space();
+
+static size_t slab_class(size_t bytes);
+static LZSlabPage *slab_page_of(void *ptr, LZAllocator *arena);
+static void *slab_page_alloc(size_t bytes);
+static void slab_page_dealloc(void *ptr);
+
+// heap lock held
+static void *heap_alloc(size_t bytes);
+static void *heap_realloc(void *ptr, size_t bytes);
+static void heap_dealloc(void *ptr);
+static void *kind_alloc(size_t kind);
+static void kind_dealloc(size_t kind, void *ptr);
+
+static void magazines_register();
+static void *magazine_pop(size_t kind);
+static void magazine_push(size_t kind, void *ptr);
+static void magazines_flush(void *data);
+
+LZAllocator *arena_of(void *ptr)
+{
+    unsigned char *byte_ptr = (unsigned char *)ptr;
+
+    if (byte_ptr < reserved || byte_ptr >= reserved + reserved_slots * ARENA_BYTES)
+        return NULL;
+
+    return slots[(size_t)(byte_ptr - reserved) >> ARENA_SHIFT];
+}
+
+LZAllocator *add_arena(size_t bytes)
+{
+    // the block 'bytes' needs, which may be bigger than a regular arena
+    size_t order = lzallocator_order(bytes);
+
+    if (order >= LZALLOCATOR_ORDERS - 1)
+        return NULL;
+
+    size_t size = (size_t)1 << order;
+
+    if (size < ARENA_BYTES)
+        size = ARENA_BYTES;
+
+    size_t count = size / ARENA_BYTES;
+    size_t from = 0;
+    size_t free_slots = 0;
+
+    for (size_t i = 0; i < reserved_slots && free_slots < count; i++)
+    {
+        if (slots[i])
+        {
+            free_slots = 0;
+            continue;
+        }
+
+        if (free_slots++ == 0)
+            from = i;
+    }
+
+    if (free_slots < count)
+        return NULL;
+
+    if (arenas_used == arenas_count)
+    {
+        size_t new_count = arenas_count == 0 ? 8 : arenas_count * 2;
+        LZAllocator **new_arenas = (LZAllocator **)realloc(arenas, sizeof(LZAllocator *) * new_count);
+
+        if (!new_arenas)
+            return NULL;
+
+        arenas = new_arenas;
+        arenas_count = new_count;
+    }
+
+    unsigned char *area = reserved + from * ARENA_BYTES;
+    LZAllocator *arena = (LZAllocator *)malloc(sizeof(LZAllocator));
+
+    if (!arena || mprotect(area, size, PROT_READ | PROT_WRITE))
+    {
+        free(arena);
+        return NULL;
+    }
+
+    lzallocator_init(area, size, arena);
+
+    for (size_t i = 0; i < count; i++)
+        slots[from + i] = arena;
+
+    current_arena = arenas_used;
+    arenas[arenas_used++] = arena;
+    arenas_bytes += size;
+
+    return arena;
+}
+
+void remove_arena(size_t index)
+{
+    LZAllocator *arena = arenas[index];
+    unsigned char *area = (unsigned char *)arena->blocks;
+    size_t from = (size_t)(area - reserved) >> ARENA_SHIFT;
+
+    for (size_t i = 0; i < arena->bytes / ARENA_BYTES; i++)
+        slots[from + i] = NULL;
+
+    // mapped again as reserved, which drops its pages
+    mmap(area, arena->bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+    arenas_bytes -= arena->bytes;
+    free(arena);
+
+    arenas[index] = arenas[--arenas_used];
+    current_arena = 0;
+}
+
+void *arenas_alloc(size_t bytes)
+{
+    void *ptr = lzallocator_alloc(bytes, arenas[current_arena], NULL);
+
+    if (ptr)
+        return ptr;
+
+    for (size_t i = 0; i < arenas_used; i++)
+    {
+        if (i == current_arena)
+            continue;
+
+        ptr = lzallocator_alloc(bytes, arenas[i], NULL);
+
+        if (ptr)
+        {
+            current_arena = i;
+            return ptr;
+        }
+    }
+
+    LZAllocator *arena = add_arena(bytes);
+
+    return arena ? lzallocator_alloc(bytes, arena, NULL) : NULL;
+}
+
+void no_space()
+{
+    fprintf(stderr, "VM heap exhausted at %zu MiB, raise the limit with --max-heap or PIKO_MAX_HEAP\n", heap_limit / (1024 * 1024));
+    vm_memory_deinit();
+}
+
+size_t slab_class(size_t bytes)
+{
+    // 16 bytes apart up to 128, 32 bytes apart up to 256
+    if (bytes <= 128)
+        return bytes == 0 ? 0 : (bytes - 1) / 16;
+
+    return 8 + (bytes - 129) / 32;
+}
+
+LZSlabPage *slab_page_of(void *ptr, LZAllocator *arena)
+{
+    size_t offset = (size_t)((unsigned char *)ptr - (unsigned char *)arena->blocks);
+    // a block smaller than a page shares it with its buddies, whose first header
+    // sits at the page start too, so there is always a valid header there.
+    // Read without the heap lock: no other thread can turn it into a slab page header
+    // while 'ptr' is alive, nor change the one of a slab page with slots in use
+    LZAllocatorHeader *header = (LZAllocatorHeader *)((unsigned char *)arena->blocks + (offset & ~(SLAB_PAGE_BYTES - 1)));
+
+    if (header->free || header->tag != SLAB_TAG || header->size != SLAB_PAGE_BYTES)
+        return NULL;
+
+    return (LZSlabPage *)((unsigned char *)header + LZALLOCATOR_HEADER_SIZE);
+}
+
+void *slab_page_alloc(size_t bytes)
+{
+    void *ptr = arenas_alloc(bytes);
+
+    if (ptr)
+        lzallocator_get_header(ptr)->tag = SLAB_TAG;
+
+    return ptr;
+}
+
+void slab_page_dealloc(void *ptr)
+{
+    lzallocator_dealloc(ptr, arena_of(ptr));
+}
+
+void *heap_alloc(size_t bytes)
+{
+    return bytes <= SLAB_MAX_BYTES ? lzslab_alloc(&slabs[slab_class(bytes)]) : arenas_alloc(bytes);
+}
+
+void *heap_realloc(void *ptr, size_t bytes)
+{
+    if (!ptr)
+        return heap_alloc(bytes);
+
+    LZAllocator *arena = arena_of(ptr);
+
+    assert(arena && "Pointer doesn't belong to the VM heap");
+
+    LZSlabPage *page = slab_page_of(ptr, arena);
+    size_t old_bytes = 0;
+
+    if (page)
+    {
+        old_bytes = page->slab->slot_size;
+
+        if (bytes <= old_bytes)
+            return ptr;
+    }
+    else
+    {
+        // grows inside its own arena when possible
+        void *new_ptr = lzallocator_realloc(bytes, ptr, arena, NULL);
+
+        if (new_ptr)
+            return new_ptr;
+
+        old_bytes = LZALLOCATOR_CALC_BLOCK_SIZE(lzallocator_get_header(ptr)->size);
+    }
+
+    void *new_ptr = heap_alloc(bytes);
+
+    if (!new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_bytes < bytes ? old_bytes : bytes);
+    heap_dealloc(ptr);
+
+    return new_ptr;
+}
+
+void heap_dealloc(void *ptr)
+{
+    LZAllocator *arena = arena_of(ptr);
+
+    if (!arena)
+        return;
+
+    LZSlabPage *page = slab_page_of(ptr, arena);
+
+    if (page)
+        lzslab_dealloc(ptr, page);
+    else
+        lzallocator_dealloc(ptr, arena);
+}
+
+void *kind_alloc(size_t kind)
+{
+    switch (kind)
+    {
+    case OBJECT_KIND:
+        return lzarea_alloc(sizeof(struct _object_), RECORD_SLOTS, records);
+
+    case VALUE_KIND:
+        return lzarea_alloc(sizeof(Value), RECORD_SLOTS, records);
+
+    default:
+        return lzslab_alloc(&slabs[kind]);
+    }
+}
+
+void kind_dealloc(size_t kind, void *ptr)
+{
+    if (kind == OBJECT_KIND || kind == VALUE_KIND)
+        lzarea_dealloc(ptr, records);
+    else
+        lzslab_dealloc(ptr, slab_page_of(ptr, arena_of(ptr)));
+}
+
+// lets the thread give its magazines back when it exits. Threads that only
+// free fill them too, so both ends register
+void magazines_register()
+{
+    if (magazines_registered)
+        return;
+
+    pthread_setspecific(magazines_key, magazines);
+    magazines_registered = 1;
+}
+
+void *magazine_pop(size_t kind)
+{
+    Magazine *magazine = &magazines[kind];
+
+    if (magazine->count == 0)
+    {
+        magazines_register();
+
+        pthread_mutex_lock(&heap_lock);
+
+        while (magazine->count < MAGAZINE_BATCH)
+        {
+            void *ptr = kind_alloc(kind);
+
+            if (!ptr)
+                break;
+
+            magazine->slots[magazine->count++] = ptr;
+        }
+
+        pthread_mutex_unlock(&heap_lock);
+    }
+
+    return magazine->count ? magazine->slots[--magazine->count] : NULL;
+}
+
+void magazine_push(size_t kind, void *ptr)
+{
+    Magazine *magazine = &magazines[kind];
+
+    magazines_register();
+
+    if (magazine->count == MAGAZINE_SLOTS)
+    {
+        pthread_mutex_lock(&heap_lock);
+
+        while (magazine->count > MAGAZINE_SLOTS - MAGAZINE_BATCH)
+            kind_dealloc(kind, magazine->slots[--magazine->count]);
+
+        pthread_mutex_unlock(&heap_lock);
+    }
+
+    magazine->slots[magazine->count++] = ptr;
+}
+
+void magazines_flush(void *data)
+{
+    Magazine *thread_magazines = (Magazine *)data;
+
+    if (!initialized)
+        return;
+
+    pthread_mutex_lock(&heap_lock);
+
+    for (size_t kind = 0; kind < KINDS; kind++)
+    {
+        Magazine *magazine = &thread_magazines[kind];
+
+        while (magazine->count > 0)
+            kind_dealloc(kind, magazine->slots[--magazine->count]);
+    }
+
+    pthread_mutex_unlock(&heap_lock);
+}
 
 size_t vm_memory_all_space()
 {
     assert(initialized && "You need to call vm_memory_init");
 
-    return allocator->bytes;
+    pthread_mutex_lock(&heap_lock);
+    size_t bytes = arenas_bytes;
+    pthread_mutex_unlock(&heap_lock);
+
+    return bytes;
 }
 
 size_t vm_memory_used_space()
 {
     assert(initialized && "You need to call vm_memory_init");
 
-    size_t available = lzallocator_available_space(allocator);
+    size_t available = 0;
+
+    pthread_mutex_lock(&heap_lock);
 
-    return allocator->bytes - available;
+    for (size_t i = 0; i < arenas_used; i++)
+        available += lzallocator_available_space(arenas[i]);
+
+    size_t bytes = arenas_bytes;
+
+    pthread_mutex_unlock(&heap_lock);
+
+    return bytes - available;
 }
 
 void vm_memory_print_blocks()
 {
-    LZAllocatorHeader *header = allocator->blocks;
+    pthread_mutex_lock(&heap_lock);
 
-    while (header)
+    for (size_t i = 0; i < arenas_used; i++)
     {
-        LZAllocatorHeader *next = header->next;
+        LZAllocator *arena = arenas[i];
+        // blocks are contiguous, each one starts where the previous ends
+        unsigned char *start = (unsigned char *)arena->blocks;
+        unsigned char *end = start + arena->bytes;
+        LZAllocatorHeader *header = arena->blocks;
+
+        printf("arena %zu: %zu bytes\n\n", i, arena->bytes);
 
-        printf("free: %d\n", header->free);
-        printf("size: %ld\n", header->size);
+        while (header)
+        {
+            unsigned char *next = (unsigned char *)header + header->size;
 
-        header = next;
+            printf("free: %d\n", header->free);
+            printf("size: %ld\n", header->size);
 
-        if (header)
+            header = next < end ? (LZAllocatorHeader *)next : NULL;
+
+            if (header)
+                printf("\n");
+        }
+
+        if (i + 1 < arenas_used)
             printf("\n");
     }
+
+    pthread_mutex_unlock(&heap_lock);
 }
 
 void vm_memory_report_space()
@@ -48,6 +477,64 @@ void vm_memory_report_space()
     printf("%ld/%ld bytes\n", used, all);
 }
 
+void vm_memory_set_limit(size_t bytes)
+{
+    assert(!initialized && "The heap limit is fixed by vm_memory_init");
+
+    // the first arena is always mapped
+    heap_limit = bytes < ARENA_BYTES ? ARENA_BYTES : bytes;
+}
+
+size_t vm_memory_limit()
+{
+    return heap_limit;
+}
+
+void vm_memory_flush_thread()
+{
+    magazines_flush(magazines);
+}
+
+void vm_memory_release_arenas()
+{
+    assert(initialized && "You need to call vm_memory_init");
+
+    pthread_mutex_lock(&heap_lock);
+
+    // one empty arena stays mapped, so a program that frees everything
+    // and allocates again doesn't map and unmap each collection
+    int kept = 0;
+
+    for (size_t i = 0; i < arenas_used;)
+    {
+        LZAllocator *arena = arenas[i];
+
+        if (lzallocator_available_space(arena) != arena->bytes)
+        {
+            i++;
+            continue;
+        }
+
+        if (kept || arena->bytes != ARENA_BYTES)
+        {
+            if (arenas_used > 1)
+            {
+                remove_arena(i);
+                continue;
+            }
+        }
+
+        // its pages go back to the OS too, only the first one holds the free block header
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        madvise((unsigned char *)arena->blocks + page, arena->bytes - page, MADV_DONTNEED);
+
+        kept = 1;
+        i++;
+    }
+
+    pthread_mutex_unlock(&heap_lock);
+}
+
 int vm_memory_init()
 {
     if (initialized)
@@ -64,9 +551,40 @@ int vm_memory_init()
     lzhtable_allocator.realloc = _realloc_;
     lzhtable_allocator.dealloc = _dealloc_;
 
-    allocator = lzallocator_create(lzallocator_mib(8));
+    reserved_slots = (heap_limit + ARENA_BYTES - 1) / ARENA_BYTES;
+    reserved = (unsigned char *)mmap(NULL, reserved_slots * ARENA_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    slots = (LZAllocator **)calloc(reserved_slots, sizeof(LZAllocator *));
+
+    if (reserved == MAP_FAILED || !slots || !add_arena(0))
+    {
+        if (reserved != MAP_FAILED)
+            munmap(reserved, reserved_slots * ARENA_BYTES);
+
+        free(slots);
 
-    if (!allocator)
+        reserved = NULL;
+        slots = NULL;
+
+        return 1;
+    }
+
+    slab_allocator.alloc = slab_page_alloc;
+    slab_allocator.dealloc = slab_page_dealloc;
+
+    for (size_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        size_t slot_size = i < 8 ? (i + 1) * 16 : 128 + (i - 7) * 32;
+        lzslab_init(slot_size, SLAB_PAGE_BYTES - LZALLOCATOR_HEADER_SIZE, &slab_allocator, &slabs[i]);
+    }
+
+    // the pool allocates while the heap lock is held
+    records_allocator.alloc = heap_alloc;
+    records_allocator.realloc = heap_realloc;
+    records_allocator.dealloc = heap_dealloc;
+
+    records = lzarea_create(&records_allocator);
+
+    if (!records || pthread_key_create(&magazines_key, magazines_flush))
         return 1;
 
     initialized = 1;
@@ -79,7 +597,31 @@ void vm_memory_deinit()
     if (!initialized)
         return;
 
-    lzallocator_destroy(allocator);
+    // other threads must be gone, the magazines of this one
+    // point to slots that go away with the arenas
+    memset(magazines, 0, sizeof(magazines));
+    magazines_registered = 0;
+    pthread_key_delete(magazines_key);
+
+    // slab pages and records go away with their arenas
+    memset(slabs, 0, sizeof(slabs));
+    records = NULL;
+
+    for (size_t i = 0; i < arenas_used; i++)
+        free(arenas[i]);
+
+    munmap(reserved, reserved_slots * ARENA_BYTES);
+    free(arenas);
+    free(slots);
+
+    reserved = NULL;
+    reserved_slots = 0;
+    slots = NULL;
+    arenas = NULL;
+    arenas_used = 0;
+    arenas_count = 0;
+    arenas_bytes = 0;
+    current_arena = 0;
 
     initialized = 0;
 }
@@ -88,10 +630,19 @@ void *vm_memory_alloc(size_t bytes)
 {
     assert(initialized && "You need to call vm_memory_init");
 
-    void *ptr = lzallocator_alloc(bytes, allocator, NULL);
+    void *ptr = NULL;
+
+    if (bytes <= SLAB_MAX_BYTES)
+        ptr = magazine_pop(slab_class(bytes));
+    else
+    {
+        pthread_mutex_lock(&heap_lock);
+        ptr = arenas_alloc(bytes);
+        pthread_mutex_unlock(&heap_lock);
+    }
 
     if (!ptr)
-        vm_memory_deinit();
+        no_space();
 
     assert(ptr && "No space to allocate");
 
@@ -100,14 +651,9 @@ void *vm_memory_alloc(size_t bytes)
 
 void *vm_memory_calloc(size_t bytes)
 {
-    assert(initialized && "You need to call vm_memory_init");
-
-    void *ptr = lzallocator_calloc(bytes, allocator, NULL);
+    void *ptr = vm_memory_alloc(bytes);
 
-    if (!ptr)
-        vm_memory_deinit();
-
-    assert(ptr && "No space to allocate");
+    memset(ptr, 0, bytes);
 
     return ptr;
 }
@@ -116,10 +662,37 @@ void *vm_memory_realloc(size_t bytes, void *ptr)
 {
     assert(initialized && "You need to call vm_memory_init");
 
-    void *new_ptr = lzallocator_realloc(bytes, ptr, allocator, NULL);
+    if (!ptr)
+        return vm_memory_alloc(bytes);
+
+    LZAllocator *arena = arena_of(ptr);
+
+    assert(arena && "Pointer doesn't belong to the VM heap");
+
+    LZSlabPage *page = slab_page_of(ptr, arena);
+
+    // slab slots move through the magazines
+    if (page)
+    {
+        size_t slot_size = page->slab->slot_size;
+
+        if (bytes <= slot_size)
+            return ptr;
+
+        void *new_ptr = vm_memory_alloc(bytes);
+
+        memcpy(new_ptr, ptr, slot_size);
+        vm_memory_dealloc(ptr);
+
+        return new_ptr;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    void *new_ptr = heap_realloc(ptr, bytes);
+    pthread_mutex_unlock(&heap_lock);
 
     if (!new_ptr)
-        vm_memory_deinit();
+        no_space();
 
     assert(new_ptr && "No space to allocate");
 
@@ -133,7 +706,22 @@ void vm_memory_dealloc(void *ptr)
 
     assert(initialized && "You need to call vm_memory_init");
 
-    lzallocator_dealloc(ptr, allocator);
+    LZAllocator *arena = arena_of(ptr);
+
+    if (!arena)
+        return;
+
+    LZSlabPage *page = slab_page_of(ptr, arena);
+
+    if (page)
+    {
+        magazine_push((size_t)(page->slab - slabs), ptr);
+        return;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    lzallocator_dealloc(ptr, arena);
+    pthread_mutex_unlock(&heap_lock);
 }
 
 void *_alloc_(size_t size)
@@ -169,6 +757,10 @@ Fn *vm_memory_create_fn(char *name)
     fn->name = vm_memory_clone_string(name);
     fn->params = vm_memory_create_dynarr_ptr();
     fn->chunks = vm_memory_create_dynarr(sizeof(uint8_t));
+    fn->hotness = 0;
+    fn->locals = -1;
+    fn->jit = NULL;
+    fn->aot = NULL;
 
     return fn;
 }
@@ -184,6 +776,8 @@ void vm_memory_destroy_fn(Fn *fn)
     for (size_t i = 0; i < strs_len; i++)
         vm_memory_dealloc(DYNARR_PTR_GET(i, strs));
 
+    jit_destroy_code(fn->jit);
+
     vm_memory_dealloc(fn->name);
     vm_memory_destroy_dynarr_ptr(fn->params);
     vm_memory_destroy_dynarr(fn->chunks);
@@ -191,6 +785,8 @@ void vm_memory_destroy_fn(Fn *fn)
     fn->name = NULL;
     fn->params = NULL;
     fn->chunks = NULL;
+    fn->jit = NULL;
+    fn->aot = NULL;
 
     vm_memory_dealloc(fn);
 }
@@ -308,7 +904,12 @@ void vm_memory_destroy_instance(Instance *instance)
 
 Object *vm_memory_create_object(ObjectType type, VM *vm)
 {
-    Object *object = (Object *)vm_memory_alloc(sizeof(struct _object_));
+    Object *object = (Object *)magazine_pop(OBJECT_KIND);
+
+    if (!object)
+        no_space();
+
+    assert(object && "No space to allocate");
 
     memset((void *)object, 0, sizeof(struct _object_));
 
@@ -331,5 +932,33 @@ void vm_memory_destroy_object(Object *object)
     if (!object)
         return;
 
-    vm_memory_dealloc(object);
+    magazine_push(OBJECT_KIND, object);
+}
+
+Value *vm_memory_create_value()
+{
+    Value *value = (Value *)magazine_pop(VALUE_KIND);
+
+    if (!value)
+        no_space();
+
+    assert(value && "No space to allocate");
+
+    return value;
+}
+
+void vm_memory_destroy_value(Value *value)
+{
+    if (!value)
+        return;
+
+    magazine_push(VALUE_KIND, value);
+}
+
+void vm_memory_records_stats(LZAreaStats *stats)
+{
+    // records cached by magazines count as used
+    pthread_mutex_lock(&heap_lock);
+    lzarea_stats(records, stats);
+    pthread_mutex_unlock(&heap_lock);
 }
\ No newline at end of file
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Checks that full collections run in steps keep to PIKO_GC_MAX_PAUSE on a
+# large heap, which stopping the world to collect takes far longer than.
+# Steps look at the clock every VM_GC_CLOCK_UNITS units, so they may overrun it by
+# one slice of them, which takes up to about 80 us when it frees the large arrays
+# gc_pause.pk allocates. Without the cap those steps take over 1000 us. Process
+# time also counts the interrupts the machine takes, so a step only has to keep
+# to the bound in one of RUNS runs.
+# usage: tests/gc_pause.sh [piko binary]
+PIKO=${1:-./bin/piko}
+DIR=$(dirname "$0")
+MAX_PAUSE=200
+SLICE=150
+RUNS=3
+EXPECTED="31249875000
+100000"
+
+# prints the count and the longest pause of the kind given
+longest() {
+    sed -n "s/^gc $1: \([0-9]*\), longest: \([0-9]*\) us$/\1 \2/p"
+}
+
+AT_ONCE=$(PIKO_GC_STATS=1 PIKO_GC_NURSERY=0 "$PIKO" --no-cache "$DIR/gc_pause.pk" 2>&1)
+
+set -- $(echo "$AT_ONCE" | longest full)
+
+if [ "${1:-0}" -eq 0 ]; then
+    echo "gc_pause: no collections ran"
+    exit 1
+fi
+
+if [ "$2" -le $((MAX_PAUSE + SLICE)) ]; then
+    echo "gc_pause: the heap is too small, collecting at once took $2 us"
+    exit 1
+fi
+
+RUN=1
+
+while true; do
+    STEPPED=$(PIKO_GC_STATS=1 PIKO_GC_NURSERY=0 PIKO_GC_MAX_PAUSE=$MAX_PAUSE "$PIKO" --no-cache "$DIR/gc_pause.pk" 2>&1)
+
+    set -- $(echo "$STEPPED" | longest steps)
+
+    if [ "$(echo "$STEPPED" | grep -v '^gc ')" != "$EXPECTED" ]; then
+        echo "gc_pause: unexpected output"
+        exit 1
+    fi
+
+    if [ "${1:-0}" -eq 0 ]; then
+        echo "gc_pause: no steps ran"
+        exit 1
+    fi
+
+    if [ "$2" -le $((MAX_PAUSE + SLICE)) ]; then
+        break
+    fi
+
+    if [ $RUN -eq $RUNS ]; then
+        echo "gc_pause: longest step took $2 us, the bound is $MAX_PAUSE us plus $SLICE us"
+        exit 1
+    fi
+
+    RUN=$((RUN + 1))
+done
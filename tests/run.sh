@@ -0,0 +1,54 @@
+#!/bin/sh
+# Runs every tests/*.pk in each execution mode (interpreter, jit, aot, no
+# streaming compiler, parallel collector) and compares what it prints
+# with tests/*.out, twice through the bytecode cache, the first run writing
+# it and the second loading it, then every tests/*.sh, which check on their own.
+# usage: tests/run.sh [piko binary], from the repository root
+PIKO=${1:-./bin/piko}
+DIR=$(dirname "$0")
+FAILED=0
+
+for source in "$DIR"/*.pk; do
+    expected="${source%.pk}.out"
+
+    [ -f "$expected" ] || continue
+
+    # a mode is either a flag or an environment setting for the collector
+    for mode in --no-jit --jit-all --aot --no-stream PIKO_GC_THREADS=4 ""; do
+        case $mode in
+            -*) flag=$mode vars= ;;
+            *) flag= vars=$mode ;;
+        esac
+
+        if ! env $vars "$PIKO" --no-cache $flag "$source" 2>&1 | cmp -s - "$expected"; then
+            echo "FAIL $source $mode"
+            FAILED=1
+        fi
+    done
+
+    rm -f "$source.aot.c" "$source.aot.so"
+
+    rm -f "$source.pkc"
+
+    for run in saving loading; do
+        if ! "$PIKO" "$source" 2>&1 | cmp -s - "$expected"; then
+            echo "FAIL $source cache $run"
+            FAILED=1
+        fi
+    done
+
+    rm -f "$source.pkc"
+done
+
+for script in "$DIR"/*.sh; do
+    [ "$(basename "$script")" = run.sh ] && continue
+
+    if ! sh "$script" "$PIKO"; then
+        echo "FAIL $script"
+        FAILED=1
+    fi
+done
+
+[ $FAILED -eq 0 ] && echo "All tests passed"
+
+exit $FAILED